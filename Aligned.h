@@ -24,6 +24,65 @@
 
 namespace neo
 {
+    // Alignment that keeps two objects from ever sharing a cache line, and the size data can have to
+    // surely fit in one. Both have to be known at compile time to be used in alignas, so they are per
+    // architecture rather than read from SystemInfo; tests/cache_line.cpp checks them against the line size
+    // the machine reports. x86-64 and AArch64 use 128: Intel's spatial prefetcher pulls in lines in pairs,
+    // and Apple's cores have 128 byte lines.
+#if defined(__x86_64__) || defined(__aarch64__) || defined(__powerpc64__)
+    static constexpr size_t hardware_destructive_interference_size = 128;
+#else
+    static constexpr size_t hardware_destructive_interference_size = 64;
+#endif
+    static constexpr size_t hardware_constructive_interference_size = 64;
+
+    // A T alone on its cache line(s): nothing before or after it in memory shares a line with it. For
+    // data written by one thread next to data read or written by others.
+    template<typename T>
+    class alignas(hardware_destructive_interference_size) CacheLinePadded
+    {
+    public:
+        template<typename... Args>
+        requires(!(sizeof...(Args) == 1 && (IsSame<RemoveCV<RemoveReference<Args>>, CacheLinePadded> && ...)))
+            constexpr CacheLinePadded(Args&&... args) :
+            m_value(forward<Args>(args)...)
+        {
+        }
+
+        constexpr T& get()
+        {
+            return m_value;
+        }
+
+        constexpr T const& get() const
+        {
+            return m_value;
+        }
+
+        constexpr T& operator*()
+        {
+            return m_value;
+        }
+
+        constexpr T const& operator*() const
+        {
+            return m_value;
+        }
+
+        constexpr T* operator->()
+        {
+            return &m_value;
+        }
+
+        constexpr T const* operator->() const
+        {
+            return &m_value;
+        }
+
+    private:
+        T m_value;
+    };
+
     template<typename T, size_t Alignment>
     requires(Alignment > 0) class Aligned
     {
@@ -75,3 +134,4 @@ namespace neo
     };
 }
 using neo::Aligned;
+using neo::CacheLinePadded;
@@ -17,6 +17,13 @@
 #pragma once
 #include "Util.h"
 #include "Concepts.h"
+#include "NumericLimits.h"
+#include "Types.h"
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 namespace neo
 {
@@ -120,22 +127,22 @@ namespace neo
 
         constexpr T and_fetch(T const& value, MemoryOrder order)
         {
-            return __atomic_fetch_add(&m_value, value, order);
+            return __atomic_and_fetch(&m_value, value, order);
         }
 
         constexpr T xor_fetch(T const& value, MemoryOrder order)
         {
-            return __atomic_fetch_add(&m_value, value, order);
+            return __atomic_xor_fetch(&m_value, value, order);
         }
 
         constexpr T or_fetch(T const& value, MemoryOrder order)
         {
-            return __atomic_fetch_add(&m_value, value, order);
+            return __atomic_or_fetch(&m_value, value, order);
         }
 
         constexpr T nand_fetch(T const& value, MemoryOrder order)
         {
-            return __atomic_fetch_add(&m_value, value, order);
+            return __atomic_nand_fetch(&m_value, value, order);
         }
 
         constexpr T test_and_set(MemoryOrder order) requires(sizeof(T) == 1)
@@ -143,9 +150,33 @@ namespace neo
             return __atomic_test_and_set(&m_value, order);
         }
 
-        constexpr T clear(MemoryOrder order) requires(sizeof(T) == 1)
+        constexpr void clear(MemoryOrder order) requires(sizeof(T) == 1)
+        {
+            __atomic_clear(&m_value, order);
+        }
+
+        // Sleeps until notified while the value still equals expected. May return spuriously, so callers loop and
+        // recheck; the check and the sleep are atomic with respect to notify_*().
+        void wait(T const& expected) const requires(sizeof(T) == 4)
+        {
+            ::syscall(SYS_futex, &m_value, FUTEX_WAIT_PRIVATE, __builtin_bit_cast(u32, expected), nullptr);
+        }
+
+        // Same, giving up after timeout. Returns false once it timed out.
+        bool wait(T const& expected, timespec const& timeout) const requires(sizeof(T) == 4)
         {
-            return __atomic_clear(&m_value, order);
+            auto result = ::syscall(SYS_futex, &m_value, FUTEX_WAIT_PRIVATE, __builtin_bit_cast(u32, expected), &timeout);
+            return result == 0 || errno != ETIMEDOUT;
+        }
+
+        void notify_one() requires(sizeof(T) == 4)
+        {
+            ::syscall(SYS_futex, &m_value, FUTEX_WAKE_PRIVATE, 1);
+        }
+
+        void notify_all() requires(sizeof(T) == 4)
+        {
+            ::syscall(SYS_futex, &m_value, FUTEX_WAKE_PRIVATE, NumericLimits<int>::max());
         }
 
         constexpr T* ptr() __attribute__((always_inline))
@@ -157,6 +188,11 @@ namespace neo
 
         T m_value {};
     };
+
+    inline void atomic_thread_fence(MemoryOrder order)
+    {
+        __atomic_thread_fence(order);
+    }
 }
 using neo::Atomic;
 using neo::MemoryOrder;
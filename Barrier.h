@@ -15,78 +15,293 @@
  */
 
 #pragma once
+#include "Aligned.h"
+#include "Assert.h"
 #include "Atomic.h"
+#include "Mutex.h"
 #include "NumericLimits.h"
-#include <syscall.h>
-#include <linux/futex.h>
-#include <unistd.h>
+#include "Types.h"
+#include "Util.h"
 
 namespace neo
 {
+    namespace detail
+    {
+        // Spins on word while it holds phase, then sleeps on it. sleepers counts the threads that went to sleep, so
+        // whoever changes word only makes a syscall when somebody did.
+        inline void wait_for_phase_change(Atomic<u32> const& word, u32 phase, Atomic<u32>& sleepers, u32 spin_rounds)
+        {
+            SpinBackoff backoff(spin_rounds);
+            while (word.load(Acquire) == phase)
+            {
+                if (backoff.spin())
+                    continue;
+
+                sleepers.add_fetch(1, SequentiallyConsistent);
+                while (word.load(SequentiallyConsistent) == phase)
+                    word.wait(phase);
+                sleepers.sub_fetch(1, Relaxed);
+                return;
+            }
+        }
+
+        inline void advance_phase(Atomic<u32>& word, Atomic<u32> const& sleepers)
+        {
+            word.add_fetch(1, SequentiallyConsistent);
+            if (sleepers.load(SequentiallyConsistent) != 0)
+                word.notify_all();
+        }
+    }
+
+    // Centralized barrier with sense reversal: threads count down one word and wait for a phase number to change,
+    // and the last one to arrive resets the count before bumping the phase. A fast thread re-entering for the next
+    // phase therefore can't be confused with a slow one still leaving this one. Waiters spin for spin_rounds
+    // rounds of backoff before sleeping on a futex. Every arrival touches the same line, so for many threads
+    // prefer TreeBarrier or DisseminationBarrier.
     class Barrier
     {
     public:
-        explicit Barrier(u32 expected) :
-            m_control(expected), m_expected(expected)
+        static constexpr u32 default_spin_rounds = 16;
+
+        Barrier(Barrier const&) = delete;
+        Barrier& operator=(Barrier const&) = delete;
+
+        explicit Barrier(u32 expected, u32 spin_rounds = default_spin_rounds) :
+            m_control(expected), m_expected(expected), m_spin_rounds(spin_rounds)
         {
+            VERIFY(expected > 0);
         }
 
         void arrive_and_wait()
         {
-            auto count = m_control.sub_fetch(1, AcquireRelease);
-            if (count == 0)
-            {
-
-                m_control.store(m_expected, Relaxed);
-                syscall(SYS_futex, m_control.ptr(), FUTEX_WAKE_PRIVATE, NumericLimits<int>::max());
-            }
-            else
-                wait();
+            wait(arrive());
         }
 
-        void wait()
+        // Arrives without waiting; the result is the phase to hand to wait().
+        u32 arrive()
         {
-            auto count = m_control.load(MemoryOrder::Acquire);
-            while (count != 0)
-            {
-                auto result = syscall(SYS_futex, m_control.ptr(), FUTEX_WAIT_PRIVATE, count, nullptr);
-                if (result == 0)
-                    break;
-                count = m_control.load(MemoryOrder::Acquire);
-            }
+            // Can't change before we arrive, the phase only ends once everyone did.
+            auto phase = m_phase.load(Acquire);
+            if (m_control.sub_fetch(1, AcquireRelease) == 0)
+                complete_phase();
+            return phase;
         }
 
-        void arrive()
+        // Returns once the given phase is over.
+        void wait(u32 phase) const
         {
-            m_control.sub_fetch(1, AcquireRelease);
+            detail::wait_for_phase_change(m_phase, phase, m_sleepers, m_spin_rounds);
         }
 
+        // Arrives and leaves the barrier for good: later phases expect one thread less.
         void arrive_and_drop()
         {
             m_expected.sub_fetch(1, AcquireRelease);
-            auto count = m_control.sub_fetch(1, AcquireRelease);
-            if (count == 0)
-            {
-                m_control.store(m_expected, Release);
-                syscall(SYS_futex, m_control.ptr(), FUTEX_WAKE_PRIVATE, (int)NumericLimits<int>::max());
-            }
-            else
-                wait();
+            if (m_control.sub_fetch(1, AcquireRelease) == 0)
+                complete_phase();
         }
 
         u32 waiting() const
         {
-            return m_expected - m_control.load(Acquire);
+            return m_expected.load(Acquire) - m_control.load(Acquire);
         }
 
+        // Threads still to arrive in the current phase.
         u32 size() const
         {
             return m_control.load(Acquire);
         }
 
     private:
-        Atomic<u32> m_control;
+        void complete_phase()
+        {
+            m_control.store(m_expected.load(Acquire), Relaxed);
+            detail::advance_phase(m_phase, m_sleepers);
+        }
+
+        alignas(hardware_destructive_interference_size) Atomic<u32> m_control;
         Atomic<u32> m_expected;
+        u32 m_spin_rounds;
+        // Waiters poll these, keep them away from the line every arrival writes.
+        alignas(hardware_destructive_interference_size) Atomic<u32> m_phase { 0 };
+        mutable Atomic<u32> m_sleepers { 0 };
+    };
+
+    // Combining tree barrier. Participants arrive at a leaf shared with at most fan_in - 1 others; the last to
+    // reach a node carries on to its parent, and the last at the root releases everyone through one phase word.
+    // Each node sits on its own cache line, so no line sees more than fan_in arrivals per phase.
+    class TreeBarrier
+    {
+    public:
+        static constexpr u32 fan_in = 4;
+
+        TreeBarrier(TreeBarrier const&) = delete;
+        TreeBarrier& operator=(TreeBarrier const&) = delete;
+
+        explicit TreeBarrier(u32 participants, u32 spin_rounds = Barrier::default_spin_rounds) :
+            m_participants(participants), m_spin_rounds(spin_rounds)
+        {
+            VERIFY(participants > 0);
+
+            u32 count = 0;
+            for (u32 width = participants; width > 1; width = (width + fan_in - 1) / fan_in)
+                count += (width + fan_in - 1) / fan_in;
+            m_node_count = count == 0 ? 1 : count;
+            m_nodes = new Node[m_node_count];
+
+            // Levels are stored leaves first; a node's parent is in the level after its own.
+            u32 level_start = 0;
+            u32 width = participants;
+            do
+            {
+                u32 level_width = (width + fan_in - 1) / fan_in;
+                for (u32 i = 0; i < level_width; i++)
+                {
+                    auto& node = m_nodes[level_start + i];
+                    node.expected = min(fan_in, width - i * fan_in);
+                    node.remaining.store(node.expected, Relaxed);
+                    node.parent = level_width == 1 ? root : level_start + level_width + i / fan_in;
+                }
+                level_start += level_width;
+                width = level_width;
+            } while (width > 1);
+        }
+
+        ~TreeBarrier()
+        {
+            delete[] m_nodes;
+            m_nodes = nullptr;
+        }
+
+        // participant is this thread's index, below the participant count and unique among the waiting threads.
+        void arrive_and_wait(u32 participant)
+        {
+            VERIFY(participant < m_participants);
+            auto phase = m_phase.load(Acquire);
+
+            u32 index = participant / fan_in;
+            while (true)
+            {
+                auto& node = m_nodes[index];
+                if (node.remaining.sub_fetch(1, AcquireRelease) != 0)
+                {
+                    detail::wait_for_phase_change(m_phase, phase, m_sleepers, m_spin_rounds);
+                    return;
+                }
+                // Nobody arrives here again before the phase ends.
+                node.remaining.store(node.expected, Relaxed);
+                if (node.parent == root)
+                    break;
+                index = node.parent;
+            }
+            detail::advance_phase(m_phase, m_sleepers);
+        }
+
+        u32 participants() const
+        {
+            return m_participants;
+        }
+
+    private:
+        static constexpr u32 root = NumericLimits<u32>::max();
+
+        struct alignas(hardware_destructive_interference_size) Node
+        {
+            Atomic<u32> remaining;
+            u32 expected;
+            u32 parent;
+        };
+
+        u32 m_participants;
+        u32 m_spin_rounds;
+        u32 m_node_count;
+        Node* m_nodes;
+        alignas(hardware_destructive_interference_size) Atomic<u32> m_phase { 0 };
+        Atomic<u32> m_sleepers { 0 };
+    };
+
+    // Dissemination barrier: in round r of ceil(log2(n)), participant i signals participant i + 2^r and waits for
+    // the signal of participant i - 2^r (mod n). No word is shared by more than two threads and there is no
+    // release broadcast, at the price of log2(n) signals per participant and phase.
+    class DisseminationBarrier
+    {
+    public:
+        DisseminationBarrier(DisseminationBarrier const&) = delete;
+        DisseminationBarrier& operator=(DisseminationBarrier const&) = delete;
+
+        explicit DisseminationBarrier(u32 participants, u32 spin_rounds = Barrier::default_spin_rounds) :
+            m_participants(participants), m_spin_rounds(spin_rounds)
+        {
+            VERIFY(participants > 0);
+            while (((u32)1 << m_rounds) < participants)
+                m_rounds++;
+            m_slots = new Slot[participants] {};
+        }
+
+        ~DisseminationBarrier()
+        {
+            delete[] m_slots;
+            m_slots = nullptr;
+        }
+
+        // participant is this thread's index, below the participant count and unique among the waiting threads.
+        void arrive_and_wait(u32 participant)
+        {
+            VERIFY(participant < m_participants);
+            auto& self = m_slots[participant];
+            // Signals carry the phase number, so a partner already a phase ahead just leaves a larger one.
+            auto phase = ++self.phase;
+
+            for (u32 round = 0; round < m_rounds; round++)
+            {
+                auto& partner = m_slots[(participant + ((u32)1 << round)) % m_participants];
+                partner.signals[round].store(phase, SequentiallyConsistent);
+                if (partner.sleeping.load(SequentiallyConsistent) != 0)
+                    partner.signals[round].notify_all();
+
+                wait_for_signal(self, self.signals[round], phase);
+            }
+        }
+
+        u32 participants() const
+        {
+            return m_participants;
+        }
+
+    private:
+        static constexpr u32 max_rounds = 32;
+
+        struct alignas(hardware_destructive_interference_size) Slot
+        {
+            // Owner only.
+            u32 phase { 0 };
+            Atomic<u32> sleeping { 0 };
+            Atomic<u32> signals[max_rounds];
+        };
+
+        void wait_for_signal(Slot& self, Atomic<u32> const& signal, u32 phase)
+        {
+            detail::SpinBackoff backoff(m_spin_rounds);
+            while ((i32)(signal.load(Acquire) - phase) < 0)
+            {
+                if (backoff.spin())
+                    continue;
+
+                self.sleeping.store(1, SequentiallyConsistent);
+                u32 seen;
+                while ((i32)((seen = signal.load(SequentiallyConsistent)) - phase) < 0)
+                    signal.wait(seen);
+                self.sleeping.store(0, Relaxed);
+                return;
+            }
+        }
+
+        u32 m_participants;
+        u32 m_spin_rounds;
+        u32 m_rounds { 0 };
+        Slot* m_slots;
     };
 }
 using neo::Barrier;
+using neo::DisseminationBarrier;
+using neo::TreeBarrier;
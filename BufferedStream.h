@@ -15,35 +15,105 @@
  */
 
 #pragma once
-#include "Types.h"
+#include "Buffer.h"
+#include "Optional.h"
 #include "Stream.h"
-#include "Vector.h"
+#include "StringView.h"
+#include "Types.h"
+#if defined(__SSE2__)
+    #include <immintrin.h>
+#endif
 
 namespace neo
 {
-    class BufferedStream final : public OutputStream
+    namespace detail
     {
-        explicit BufferedStream(OutputStream& base, size_t buffer_size) :
-            m_base(base), m_buffer(Vector<u8>::create_with_capacity(buffer_size))
+        // First occurrence of byte, 32 or 16 bytes per compare.
+        inline u8* find_byte(u8* data, size_t size, u8 byte)
+        {
+#if defined(__AVX2__)
+            auto needle32 = _mm256_set1_epi8((char)byte);
+            for (; size >= 32; data += 32, size -= 32)
+            {
+                auto mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const*)data), needle32));
+                if (mask != 0)
+                    return data + __builtin_ctz(mask);
+            }
+#endif
+#if defined(__SSE2__)
+            auto needle16 = _mm_set1_epi8((char)byte);
+            for (; size >= 16; data += 16, size -= 16)
+            {
+                auto mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const*)data), needle16));
+                if (mask != 0)
+                    return data + __builtin_ctz(mask);
+            }
+#endif
+            for (; size > 0; data++, size--)
+            {
+                if (*data == byte)
+                    return data;
+            }
+            return nullptr;
+        }
+
+        inline Buffer<u8> create_stream_buffer(size_t size)
         {
-            m_buffer.change_size(buffer_size);
+            VERIFY(size != 0);
+            auto buffer = Buffer<u8>::create_uninitialized(size);
+            VERIFY(buffer.has_value());
+            return buffer.release_value();
+        }
+    }
+
+    // Collects small writes and hands them to base in buffer_size pieces. Writes at least as large as the buffer go
+    // straight through after what is buffered.
+    class BufferedOutputStream final : public OutputStream
+    {
+    public:
+        static constexpr size_t default_buffer_size = 64 * KiB;
+
+        explicit BufferedOutputStream(OutputStream& base, size_t buffer_size = default_buffer_size) :
+            m_base(base), m_buffer(detail::create_stream_buffer(buffer_size))
+        {
+        }
+
+        BufferedOutputStream(BufferedOutputStream const&) = delete;
+        BufferedOutputStream& operator=(BufferedOutputStream const&) = delete;
+
+        ~BufferedOutputStream()
+        {
+            flush_buffer();
         }
 
         virtual void write(Span<u8> const& from) override
         {
-            if (m_buffer.size() + from.size() > m_buffer.capacity())
-                flush();
+            if (m_size + from.size() <= m_buffer.size())
+            {
+                UntypedCopy(from.size(), from.data(), m_buffer.data() + m_size);
+                m_size += from.size();
+                return;
+            }
+
+            flush_buffer();
+            if (from.size() >= m_buffer.size())
+            {
+                m_base.write(from);
+                return;
+            }
             UntypedCopy(from.size(), from.data(), m_buffer.data());
+            m_size = from.size();
         }
 
         virtual void flush() override
         {
-            m_base.write(m_buffer.span());
-            m_buffer.clear();
+            flush_buffer();
+            m_base.flush();
         }
 
         virtual void close() override
         {
+            flush_buffer();
             m_base.close();
         }
 
@@ -52,9 +122,218 @@ namespace neo
             return m_base.has_error();
         }
 
+        // Native transfers write to base directly, so what is buffered has to go first.
+        virtual Optional<NativeHandle> native_handle() override
+        {
+            flush_buffer();
+            return m_base.native_handle();
+        }
+
+        virtual void native_advance(size_t bytes) override
+        {
+            m_base.native_advance(bytes);
+        }
+
+        size_t buffered_size() const
+        {
+            return m_size;
+        }
+
     private:
+        void flush_buffer()
+        {
+            if (m_size == 0)
+                return;
+            m_base.write(Span<u8>(m_buffer.data(), m_size));
+            m_size = 0;
+        }
+
         OutputStream& m_base;
-        Vector<u8> m_buffer;
+        Buffer<u8> m_buffer;
+        size_t m_size { 0 };
+    };
+
+    // Reads base in buffer_size pieces so small reads are a copy out of the buffer rather than a call into base.
+    // Spans and views returned by peek(), read_until() and read_line() point into the buffer and stay valid until
+    // the next call on the stream.
+    class BufferedInputStream final : public InputStream
+    {
+    public:
+        static constexpr size_t default_buffer_size = 64 * KiB;
+
+        explicit BufferedInputStream(InputStream& base, size_t buffer_size = default_buffer_size) :
+            m_base(base), m_buffer(detail::create_stream_buffer(buffer_size))
+        {
+        }
+
+        BufferedInputStream(BufferedInputStream const&) = delete;
+        BufferedInputStream& operator=(BufferedInputStream const&) = delete;
+
+        // Fills to unless base runs out first, so fixed size fields never come back split.
+        virtual size_t read(Span<u8>& to) override
+        {
+            if (to.size() <= buffered_size())
+            {
+                UntypedCopy(to.size(), m_buffer.data() + m_begin, to.data());
+                m_begin += to.size();
+                return to.size();
+            }
+            return read_slow(to);
+        }
+
+        virtual bool end() const override
+        {
+            return m_begin == m_end && m_base.end();
+        }
+
+        virtual void close() override
+        {
+            m_base.close();
+        }
+
+        virtual bool has_error() const override
+        {
+            return m_base.has_error();
+        }
+
+        // The next up to size bytes without consuming them, shorter only at the end of the input.
+        Span<u8> peek(size_t size)
+        {
+            if (size > m_buffer.size())
+                grow(size);
+            while (buffered_size() < size)
+            {
+                if (refill() == 0)
+                    break;
+            }
+            return Span<u8>(m_buffer.data() + m_begin, min(size, buffered_size()));
+        }
+
+        void skip(size_t size)
+        {
+            while (size > 0)
+            {
+                if (buffered_size() == 0 && refill() == 0)
+                    return;
+                auto skipped = min(size, buffered_size());
+                m_begin += skipped;
+                size -= skipped;
+            }
+        }
+
+        // Everything up to and including the next delimiter. At the end of the input whatever is left comes back
+        // without one, and once nothing is left, no value. The buffer grows for runs longer than it.
+        Optional<Span<u8>> read_until(u8 delimiter)
+        {
+            size_t scanned = 0;
+            while (true)
+            {
+                auto* start = m_buffer.data() + m_begin;
+                auto* found = detail::find_byte(start + scanned, buffered_size() - scanned, delimiter);
+                if (found != nullptr)
+                {
+                    auto length = (size_t)(found - start) + 1;
+                    m_begin += length;
+                    return Span<u8>(start, length);
+                }
+
+                scanned = buffered_size();
+                if (m_end == m_buffer.size() && m_begin == 0)
+                    grow(m_buffer.size() * 2);
+                if (refill() == 0)
+                {
+                    if (buffered_size() == 0)
+                        return {};
+                    Span<u8> rest(m_buffer.data() + m_begin, buffered_size());
+                    m_begin = m_end;
+                    return rest;
+                }
+            }
+        }
+
+        // The next line without its \n or \r\n.
+        Optional<StringView> read_line()
+        {
+            auto line = read_until('\n');
+            if (!line.has_value())
+                return {};
+
+            auto size = line.value().size();
+            if (size > 0 && line.value()[size - 1] == '\n')
+                size--;
+            if (size > 0 && line.value()[size - 1] == '\r')
+                size--;
+            return StringView((char const*)line.value().data(), size);
+        }
+
+        size_t buffered_size() const
+        {
+            return m_end - m_begin;
+        }
+
+    private:
+        size_t read_slow(Span<u8>& to)
+        {
+            auto copied = buffered_size();
+            UntypedCopy(copied, m_buffer.data() + m_begin, to.data());
+            m_begin = m_end = 0;
+
+            while (copied < to.size())
+            {
+                auto remaining = to.size() - copied;
+                // Large reads skip the buffer.
+                if (remaining >= m_buffer.size())
+                {
+                    Span<u8> rest(to.data() + copied, remaining);
+                    auto bytes_read = m_base.read(rest);
+                    if (bytes_read == 0)
+                        break;
+                    copied += bytes_read;
+                    continue;
+                }
+
+                if (refill() == 0)
+                    break;
+                auto taken = min(remaining, buffered_size());
+                UntypedCopy(taken, m_buffer.data() + m_begin, to.data() + copied);
+                m_begin += taken;
+                copied += taken;
+            }
+            return copied;
+        }
+
+        // Moves what is buffered to the front and reads once into the free space.
+        size_t refill()
+        {
+            if (m_begin != 0)
+            {
+                __builtin_memmove(m_buffer.data(), m_buffer.data() + m_begin, buffered_size());
+                m_end -= m_begin;
+                m_begin = 0;
+            }
+            if (m_end == m_buffer.size())
+                return 0;
+
+            Span<u8> free(m_buffer.data() + m_end, m_buffer.size() - m_end);
+            auto bytes_read = m_base.read(free);
+            m_end += bytes_read;
+            return bytes_read;
+        }
+
+        void grow(size_t size)
+        {
+            auto bigger = detail::create_stream_buffer(size);
+            UntypedCopy(buffered_size(), m_buffer.data() + m_begin, bigger.data());
+            m_end -= m_begin;
+            m_begin = 0;
+            m_buffer = std::move(bigger);
+        }
+
+        InputStream& m_base;
+        Buffer<u8> m_buffer;
+        size_t m_begin { 0 };
+        size_t m_end { 0 };
     };
 }
-using neo::BufferedStream;
+using neo::BufferedInputStream;
+using neo::BufferedOutputStream;
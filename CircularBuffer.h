@@ -15,56 +15,94 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #pragma once
-#include "Vector.h"
+#include "Assert.h"
+#include "New.h"
 #include "Optional.h"
+#include "TypeTraits.h"
+#include "Types.h"
 
 namespace neo
 {
+    // FIFO over one ring of storage that doubles when full. Single threaded, see ConcurrentQueue.h for queues
+    // between threads.
     template<typename T>
     class CircularBuffer
     {
     public:
-        explicit CircularBuffer(size_t capacity) :
-            m_buffer(Vector<T>::create_with_capacity(capacity))
+        explicit CircularBuffer(size_t capacity)
         {
+            grow(capacity == 0 ? 1 : capacity);
+        }
+
+        CircularBuffer(CircularBuffer const&) = delete;
+        CircularBuffer& operator=(CircularBuffer const&) = delete;
+
+        ~CircularBuffer()
+        {
+            while (m_size > 0)
+                dequeue();
+            __builtin_free(m_storage);
         }
 
         void enqueue(T const& value)
         {
-            if (m_write_index == m_buffer.capacity() && m_read_index == 0)
-                m_buffer.resize(m_buffer.size() * 2);
-            m_buffer[m_write_index++] = value;
+            if (m_size == m_capacity)
+                grow(m_capacity * 2);
+            new (&m_storage[(m_read_index + m_size) % m_capacity]) T(value);
+            m_size++;
         }
 
         void enqueue(T&& value)
         {
-            if (m_write_index == m_buffer.capacity() && m_read_index == 0)
-                m_buffer.change_size(m_buffer.size() * 2);
-            m_buffer[m_write_index++] = std::move(value);
+            if (m_size == m_capacity)
+                grow(m_capacity * 2);
+            new (&m_storage[(m_read_index + m_size) % m_capacity]) T(std::move(value));
+            m_size++;
         }
 
         Optional<T> dequeue()
         {
-            if (m_read_index == m_write_index)
+            if (m_size == 0)
                 return {};
-            size_t previous = m_read_index++;
-            if (m_read_index == m_buffer.capacity())
-                m_read_index = 0;
-            return { std::move(m_buffer[previous]) };
+            Optional<T> value(std::move(m_storage[m_read_index]));
+            m_storage[m_read_index].~T();
+            m_read_index = m_read_index + 1 == m_capacity ? 0 : m_read_index + 1;
+            m_size--;
+            return value;
         }
-        
+
         size_t size() const
         {
-            if (m_write_index > m_read_index)
-                return m_write_index - m_read_index;
-            else
-                return m_buffer.size() - m_read_index + m_write_index;
+            return m_size;
+        }
+
+        size_t capacity() const
+        {
+            return m_capacity;
         }
 
     private:
-        Vector<T> m_buffer;
-        size_t m_read_index {};
-        size_t m_write_index {};
+        // Moves the elements to the start of a new ring, unwrapping them.
+        void grow(size_t capacity)
+        {
+            auto* storage = (T*)__builtin_malloc(sizeof(T) * capacity);
+            VERIFY(storage != nullptr);
+            for (size_t i = 0; i < m_size; i++)
+            {
+                auto& element = m_storage[(m_read_index + i) % m_capacity];
+                new (&storage[i]) T(std::move(element));
+                element.~T();
+            }
+            __builtin_free(m_storage);
+            m_storage = storage;
+            m_capacity = capacity;
+            m_read_index = 0;
+        }
+
+        T* m_storage { nullptr };
+        size_t m_capacity { 0 };
+        size_t m_read_index { 0 };
+        size_t m_size { 0 };
     };
 }
 using neo::CircularBuffer;
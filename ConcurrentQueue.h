@@ -0,0 +1,316 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Aligned.h"
+#include "Atomic.h"
+#include "Assert.h"
+#include "New.h"
+#include "Optional.h"
+#include "Span.h"
+#include "TypeTraits.h"
+#include "Types.h"
+
+extern "C"
+{
+    extern void* aligned_alloc(size_t __alignment, size_t __size);
+}
+
+namespace neo
+{
+    namespace detail
+    {
+        inline size_t queue_capacity(size_t requested)
+        {
+            VERIFY(requested > 0);
+            return requested <= 2 ? 2 : (size_t)1 << (64 - __builtin_clzll(requested - 1));
+        }
+
+        template<typename T>
+        T* allocate_queue_storage(size_t count)
+        {
+            constexpr auto line = hardware_destructive_interference_size;
+            auto bytes = (sizeof(T) * count + line - 1) & ~(line - 1);
+            auto* storage = (T*)aligned_alloc(max<size_t>(alignof(T), line), bytes);
+            VERIFY(storage != nullptr);
+            return storage;
+        }
+    }
+
+    // Bounded queue between exactly one producer thread and one consumer thread. The capacity is rounded up to a
+    // power of two. Each side keeps its index on its own cache line next to a cached copy of the other side's, so
+    // the shared lines are only touched when the cached copy says the queue looks full or empty.
+    template<typename T>
+    class SPSCRingBuffer
+    {
+    public:
+        explicit SPSCRingBuffer(size_t capacity) :
+            m_capacity(detail::queue_capacity(capacity)), m_storage(detail::allocate_queue_storage<T>(m_capacity))
+        {
+        }
+
+        SPSCRingBuffer(SPSCRingBuffer const&) = delete;
+        SPSCRingBuffer& operator=(SPSCRingBuffer const&) = delete;
+
+        ~SPSCRingBuffer()
+        {
+            if constexpr (!IsTriviallyDestructible<T>)
+            {
+                auto tail = m_tail.load(Relaxed);
+                for (auto head = m_head.load(Relaxed); head != tail; head++)
+                    slot(head).~T();
+            }
+            __builtin_free(m_storage);
+        }
+
+        // Producer only. false if the buffer is full.
+        bool try_push(T const& value)
+        {
+            return emplace(value);
+        }
+
+        bool try_push(T&& value)
+        {
+            return emplace(std::move(value));
+        }
+
+        // Producer only. Moves as many of values as fit, in order, and returns how many that was.
+        size_t push_batch(Span<T> const& values)
+        {
+            auto tail = m_tail.load(Relaxed);
+            auto free = m_capacity - (tail - m_cached_head);
+            if (free < values.size())
+            {
+                m_cached_head = m_head.load(Acquire);
+                free = m_capacity - (tail - m_cached_head);
+            }
+
+            auto count = min(free, values.size());
+            for (size_t i = 0; i < count; i++)
+                new (&slot(tail + i)) T(std::move(values.data()[i]));
+            m_tail.store(tail + count, Release);
+            return count;
+        }
+
+        // Consumer only.
+        Optional<T> try_pop()
+        {
+            auto head = m_head.load(Relaxed);
+            if (head == m_cached_tail)
+            {
+                m_cached_tail = m_tail.load(Acquire);
+                if (head == m_cached_tail)
+                    return {};
+            }
+
+            Optional<T> value(std::move(slot(head)));
+            slot(head).~T();
+            m_head.store(head + 1, Release);
+            return value;
+        }
+
+        // Consumer only. Moves up to to.size() elements into to and returns how many.
+        size_t pop_batch(Span<T>& to)
+        {
+            auto head = m_head.load(Relaxed);
+            auto available = m_cached_tail - head;
+            if (available < to.size())
+            {
+                m_cached_tail = m_tail.load(Acquire);
+                available = m_cached_tail - head;
+            }
+
+            auto count = min(available, to.size());
+            for (size_t i = 0; i < count; i++)
+            {
+                to.data()[i] = std::move(slot(head + i));
+                slot(head + i).~T();
+            }
+            m_head.store(head + count, Release);
+            return count;
+        }
+
+        // Exact only when called from one of the two sides with the other idle.
+        [[nodiscard]] size_t size_approx() const
+        {
+            return m_tail.load(Acquire) - m_head.load(Acquire);
+        }
+
+        [[nodiscard]] size_t capacity() const
+        {
+            return m_capacity;
+        }
+
+    private:
+        T& slot(size_t index)
+        {
+            return m_storage[index & (m_capacity - 1)];
+        }
+
+        template<typename TValue>
+        bool emplace(TValue&& value)
+        {
+            auto tail = m_tail.load(Relaxed);
+            if (tail - m_cached_head == m_capacity)
+            {
+                m_cached_head = m_head.load(Acquire);
+                if (tail - m_cached_head == m_capacity)
+                    return false;
+            }
+
+            new (&slot(tail)) T(forward<TValue>(value));
+            m_tail.store(tail + 1, Release);
+            return true;
+        }
+
+        size_t const m_capacity;
+        T* const m_storage;
+
+        alignas(hardware_destructive_interference_size) Atomic<size_t> m_head { 0 };
+        size_t m_cached_tail { 0 };
+
+        alignas(hardware_destructive_interference_size) Atomic<size_t> m_tail { 0 };
+        size_t m_cached_head { 0 };
+    };
+
+    // Bounded queue any number of threads push to and pop from, after Dmitry Vyukov's bounded MPMC queue. Every
+    // cell carries a sequence number saying whose turn it is: a producer may fill cell i when it reads i, a
+    // consumer may empty it when it reads i + 1. A push or pop is one compare-exchange on the shared position and no
+    // locks, though a thread preempted between claiming a cell and publishing it holds up the ones that follow.
+    template<typename T>
+    class MPMCQueue
+    {
+    public:
+        explicit MPMCQueue(size_t capacity) :
+            m_capacity(detail::queue_capacity(capacity)), m_cells(detail::allocate_queue_storage<Cell>(m_capacity))
+        {
+            for (size_t i = 0; i < m_capacity; i++)
+                new (&m_cells[i].sequence) Atomic<size_t>(i);
+        }
+
+        MPMCQueue(MPMCQueue const&) = delete;
+        MPMCQueue& operator=(MPMCQueue const&) = delete;
+
+        ~MPMCQueue()
+        {
+            if constexpr (!IsTriviallyDestructible<T>)
+            {
+                while (try_pop().has_value())
+                    ;
+            }
+            __builtin_free(m_cells);
+        }
+
+        // false if the queue is full
+        bool try_push(T const& value)
+        {
+            return emplace(value);
+        }
+
+        bool try_push(T&& value)
+        {
+            return emplace(std::move(value));
+        }
+
+        Optional<T> try_pop()
+        {
+            auto position = m_dequeue_position.load(Relaxed);
+            Cell* cell;
+            while (true)
+            {
+                cell = &m_cells[position & (m_capacity - 1)];
+                auto sequence = cell->sequence.load(Acquire);
+                auto difference = (i64)sequence - (i64)(position + 1);
+                if (difference == 0)
+                {
+                    if (m_dequeue_position.compare_exchange_weak(position, position + 1, Relaxed, Relaxed))
+                        break;
+                }
+                else if (difference < 0)
+                {
+                    return {};
+                }
+                else
+                {
+                    position = m_dequeue_position.load(Relaxed);
+                }
+            }
+
+            auto* value = (T*)cell->storage;
+            Optional<T> result(std::move(*value));
+            value->~T();
+            cell->sequence.store(position + m_capacity, Release);
+            return result;
+        }
+
+        [[nodiscard]] size_t size_approx() const
+        {
+            auto enqueued = m_enqueue_position.load(Acquire);
+            auto dequeued = m_dequeue_position.load(Acquire);
+            return enqueued > dequeued ? enqueued - dequeued : 0;
+        }
+
+        [[nodiscard]] size_t capacity() const
+        {
+            return m_capacity;
+        }
+
+    private:
+        struct Cell
+        {
+            Atomic<size_t> sequence;
+            alignas(T) u8 storage[sizeof(T)];
+        };
+
+        template<typename TValue>
+        bool emplace(TValue&& value)
+        {
+            auto position = m_enqueue_position.load(Relaxed);
+            Cell* cell;
+            while (true)
+            {
+                cell = &m_cells[position & (m_capacity - 1)];
+                auto sequence = cell->sequence.load(Acquire);
+                auto difference = (i64)sequence - (i64)position;
+                if (difference == 0)
+                {
+                    if (m_enqueue_position.compare_exchange_weak(position, position + 1, Relaxed, Relaxed))
+                        break;
+                }
+                else if (difference < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    position = m_enqueue_position.load(Relaxed);
+                }
+            }
+
+            new (cell->storage) T(forward<TValue>(value));
+            cell->sequence.store(position + 1, Release);
+            return true;
+        }
+
+        size_t const m_capacity;
+        Cell* const m_cells;
+
+        alignas(hardware_destructive_interference_size) Atomic<size_t> m_enqueue_position { 0 };
+        alignas(hardware_destructive_interference_size) Atomic<size_t> m_dequeue_position { 0 };
+    };
+}
+using neo::MPMCQueue;
+using neo::SPSCRingBuffer;
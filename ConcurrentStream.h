@@ -15,9 +15,18 @@
  */
 
 #pragma once
+#include "Aligned.h"
 #include "Types.h"
 #include "Stream.h"
 #include "Mutex.h"
+#include "Buffer.h"
+#include "NumericLimits.h"
+#include "OSError.h"
+#include "PerThread.h"
+#include "ResultOrError.h"
+#include "SmartPtr.h"
+#include "Thread.h"
+#include "Time.h"
 
 namespace neo
 {
@@ -145,6 +154,470 @@ namespace neo
         OutputStream& m_base;
         mutable Mutex m_mutex;
     };
+
+    enum class BackpressurePolicy
+    {
+        // A producer whose buffer is full waits for the writer thread to make room.
+        Block,
+        // A producer whose buffer is full drops the write and counts it in dropped_writes().
+        Drop
+    };
+
+    struct MultiProducerOptions
+    {
+        // Bytes each producer thread may have queued, rounded up to a power of two. Writes larger than a quarter of
+        // it skip the queue and go to the base stream directly once the producer's earlier writes are out.
+        size_t producer_buffer_size { 64 * KiB };
+        // Threads past this many share one extra buffer behind a lock.
+        size_t max_producers { 64 };
+        BackpressurePolicy backpressure { BackpressurePolicy::Block };
+    };
+
+    namespace detail
+    {
+        struct alignas(hardware_destructive_interference_size) ProducerSlot
+        {
+            Atomic<u64> owner { 0 };
+            Atomic<u8*> data { nullptr };
+            // Producer side: the publish position and the last consumer position it saw.
+            Atomic<u64> head { 0 };
+            u64 cached_tail { 0 };
+            // Consumer side, on its own line so publishing doesn't bounce it.
+            alignas(hardware_destructive_interference_size) Atomic<u64> tail { 0 };
+        };
+
+        // Each write is a 16 byte header and the bytes, padded to 16. A header with skip set fills the end of the
+        // ring when the next record doesn't fit there.
+        struct RecordHeader
+        {
+            u64 timestamp;
+            u32 size;
+            u32 skip;
+        };
+
+        struct DrainCursor
+        {
+            ProducerSlot* slot;
+            u8* data;
+            u64 position;
+            u64 end;
+        };
+
+        struct ProducerCache
+        {
+            u64 stream_id { 0 };
+            ProducerSlot* slot { nullptr };
+        };
+    }
+
+    // An OutputStream many threads write at once without sharing a lock. Each producer thread appends timestamped
+    // records to a buffer of its own, and one writer thread drains all of them in timestamp order, in batches, to
+    // base. Memory is bounded by producer_buffer_size per producer; what happens when a producer's buffer is full is
+    // the backpressure policy. flush() returns once everything written before it reached base and base was flushed.
+    // Destruction drains and flushes; close() also closes base. Writes racing with either may be dropped.
+    class MultiProducerOutputStream final : public OutputStream
+    {
+    public:
+        static constexpr size_t batch_size = 256 * KiB;
+
+        MultiProducerOutputStream(MultiProducerOutputStream const&) = delete;
+        MultiProducerOutputStream& operator=(MultiProducerOutputStream const&) = delete;
+
+        static ResultOrError<OwnPtr<MultiProducerOutputStream>, OSError> create(OutputStream& base, MultiProducerOptions const& options = {})
+        {
+            VERIFY(options.max_producers > 0);
+            OwnPtr<MultiProducerOutputStream> stream(new MultiProducerOutputStream(base, options));
+            auto* stream_ptr = stream.operator->();
+            auto thread = Thread::create([stream_ptr]
+                { stream_ptr->run_writer(); });
+            if (thread.has_error())
+                return thread.error();
+            stream->m_writer = thread.result();
+            return stream;
+        }
+
+        ~MultiProducerOutputStream()
+        {
+            shut_down();
+            for (size_t i = 0; i <= m_max_producers; i++)
+                __builtin_free(m_slots[i].data.load(Relaxed));
+            delete[] m_slots;
+            delete[] m_cursors;
+        }
+
+        void write(Span<u8> const& from) override
+        {
+            if (from.size() == 0)
+                return;
+            if (m_stopping.load(Relaxed))
+            {
+                m_dropped_writes.fetch_add(1, Relaxed);
+                return;
+            }
+
+            auto* slot = producer_slot();
+            if (slot != nullptr)
+            {
+                write_to_slot(*slot, from);
+                return;
+            }
+
+            auto* shared = &m_slots[m_max_producers];
+            m_shared_lock.lock();
+            write_to_slot(*shared, from);
+            m_shared_lock.unlock();
+        }
+
+        void flush() override
+        {
+            if (m_stopping.load(Acquire))
+                return;
+
+            auto ticket = m_flush_requested.add_fetch(1, SequentiallyConsistent);
+            wake_writer();
+            while (true)
+            {
+                auto completed = m_flush_completed.load(Acquire);
+                if ((i32)(completed - ticket) >= 0 || m_stopped.load(SequentiallyConsistent))
+                    return;
+                m_flush_completed.wait(completed);
+            }
+        }
+
+        bool has_error() const override
+        {
+            return m_has_error.load(Acquire);
+        }
+
+        void close() override
+        {
+            shut_down();
+            m_base.close();
+        }
+
+        [[nodiscard]] u64 dropped_writes() const
+        {
+            return m_dropped_writes.load(Relaxed);
+        }
+
+    private:
+        static constexpr size_t header_size = sizeof(detail::RecordHeader);
+
+        MultiProducerOutputStream(OutputStream& base, MultiProducerOptions const& options) :
+            m_base(base),
+            m_max_producers(options.max_producers),
+            m_capacity(max<size_t>(1024, round_up_to_power_of_two(options.producer_buffer_size))),
+            m_policy(options.backpressure),
+            m_id(s_next_id.fetch_add(1, Relaxed)),
+            m_slots(new detail::ProducerSlot[options.max_producers + 1]),
+            m_batch(Buffer<u8>::create_uninitialized(batch_size).release_value()),
+            m_cursors(new detail::DrainCursor[options.max_producers + 1])
+        {
+            auto* shared = (u8*)__builtin_malloc(m_capacity);
+            VERIFY(shared != nullptr);
+            m_slots[m_max_producers].data.store(shared, Relaxed);
+        }
+
+        static size_t round_up_to_power_of_two(size_t value)
+        {
+            return value <= 1 ? 1 : (size_t)1 << (64 - __builtin_clzll(value - 1));
+        }
+
+        static size_t record_size(size_t payload)
+        {
+            return (header_size + payload + 15) & ~(size_t)15;
+        }
+
+        // The calling thread's slot, claimed on its first write: a free one, or one whose thread has exited.
+        // nullptr when all of them belong to live threads.
+        detail::ProducerSlot* producer_slot()
+        {
+            if (s_cache.stream_id == m_id)
+                return s_cache.slot;
+
+            auto* found = detail::claim_thread_owned(m_slots, m_max_producers);
+            if (found == nullptr)
+                return nullptr;
+
+            if (found->data.load(Relaxed) == nullptr)
+            {
+                auto* data = (u8*)__builtin_malloc(m_capacity);
+                VERIFY(data != nullptr);
+                found->data.store(data, Release);
+            }
+            s_cache = { m_id, found };
+            return found;
+        }
+
+        void write_to_slot(detail::ProducerSlot& slot, Span<u8> const& from)
+        {
+            if (from.size() > m_capacity / 4)
+            {
+                write_directly(slot, from);
+                return;
+            }
+
+            auto* data = slot.data.load(Relaxed);
+            auto total = record_size(from.size());
+            auto head = slot.head.load(Acquire);
+            auto index = head & (m_capacity - 1);
+            auto contiguous = m_capacity - index;
+            auto needed = contiguous < total ? contiguous + total : total;
+
+            if (head + needed - slot.cached_tail > m_capacity)
+            {
+                if (!wait_for_space(slot, head + needed - m_capacity))
+                    return;
+            }
+
+            if (contiguous < total)
+            {
+                auto* skip = (detail::RecordHeader*)(data + index);
+                skip->skip = 1;
+                head += contiguous;
+                index = 0;
+            }
+
+            auto* header = (detail::RecordHeader*)(data + index);
+            header->timestamp = Timer::now().to_nanoseconds();
+            header->size = (u32)from.size();
+            header->skip = 0;
+            __builtin_memcpy(data + index + header_size, from.data(), from.size());
+            slot.head.store(head + total, Release);
+
+            atomic_thread_fence(SequentiallyConsistent);
+            if (m_writer_sleeping.load(Relaxed) == 1)
+                wake_writer();
+        }
+
+        // Waits until the writer has consumed up to tail, or under Drop counts the write and gives up.
+        bool wait_for_space(detail::ProducerSlot& slot, u64 tail)
+        {
+            while (true)
+            {
+                slot.cached_tail = slot.tail.load(Acquire);
+                if (slot.cached_tail >= tail)
+                    return true;
+                if (m_policy == BackpressurePolicy::Drop || m_stopped.load(Acquire))
+                {
+                    m_dropped_writes.fetch_add(1, Relaxed);
+                    return false;
+                }
+
+                auto generation = m_space_generation.load(Acquire);
+                m_space_waiters.fetch_add(1, SequentiallyConsistent);
+                wake_writer();
+                if (slot.tail.load(SequentiallyConsistent) < tail)
+                    m_space_generation.wait(generation);
+                m_space_waiters.fetch_sub(1, Relaxed);
+            }
+        }
+
+        // A write too big for the ring waits for this producer's queued records to go out so its order holds,
+        // then goes to base between two of the writer's batches.
+        void write_directly(detail::ProducerSlot& slot, Span<u8> const& from)
+        {
+            if (!wait_for_space(slot, slot.head.load(Relaxed)))
+                return;
+
+            m_base_lock.lock();
+            m_base.write(from);
+            m_has_error.store(m_base.has_error(), Release);
+            m_base_lock.unlock();
+        }
+
+        void wake_writer()
+        {
+            if (m_writer_sleeping.exchange(0, SequentiallyConsistent) == 1)
+                m_writer_sleeping.notify_one();
+        }
+
+        bool has_pending() const
+        {
+            for (size_t i = 0; i <= m_max_producers; i++)
+            {
+                if (m_slots[i].head.load(Acquire) != m_slots[i].tail.load(Relaxed))
+                    return true;
+            }
+            return false;
+        }
+
+        void run_writer()
+        {
+            while (true)
+            {
+                auto stopping = m_stopping.load(Acquire);
+                auto flush_requested = m_flush_requested.load(Acquire);
+                auto drained = drain();
+                if (flush_requested != m_flush_completed.load(Relaxed))
+                {
+                    m_base_lock.lock();
+                    m_base.flush();
+                    m_has_error.store(m_base.has_error(), Release);
+                    m_base_lock.unlock();
+                    m_flush_completed.store(flush_requested, Release);
+                    m_flush_completed.notify_all();
+                }
+                if (stopping)
+                    return;
+                if (drained)
+                    continue;
+
+                m_writer_sleeping.store(1, SequentiallyConsistent);
+                atomic_thread_fence(SequentiallyConsistent);
+                if (has_pending() || m_stopping.load(Acquire) || m_flush_requested.load(Acquire) != flush_requested)
+                {
+                    m_writer_sleeping.store(0, Relaxed);
+                    continue;
+                }
+                // The timeout only guards against a missed wake up.
+                timespec timeout { 0, 100 * 1000 * 1000 };
+                m_writer_sleeping.wait(1, timeout);
+                m_writer_sleeping.store(0, Relaxed);
+            }
+        }
+
+        // Merges what every producer had published when the pass started by timestamp, copying it into the batch
+        // buffer and handing that to base whenever it fills. Returns whether there was anything.
+        bool drain()
+        {
+            size_t active = 0;
+            for (size_t i = 0; i <= m_max_producers; i++)
+            {
+                auto& slot = m_slots[i];
+                auto head = slot.head.load(Acquire);
+                auto tail = slot.tail.load(Relaxed);
+                VERIFY(head - tail <= m_capacity);
+                if (head != tail)
+                    m_cursors[active++] = { &slot, slot.data.load(Acquire), tail, head };
+            }
+            if (active == 0)
+                return false;
+
+            auto header_at = [this](detail::DrainCursor& cursor) -> detail::RecordHeader*
+            {
+                auto* header = (detail::RecordHeader*)(cursor.data + (cursor.position & (m_capacity - 1)));
+                if (header->skip)
+                {
+                    cursor.position += m_capacity - (cursor.position & (m_capacity - 1));
+                    header = (detail::RecordHeader*)cursor.data;
+                }
+                return header;
+            };
+
+            size_t batched = 0;
+            auto release = [this, active]
+            {
+                for (size_t i = 0; i < active; i++)
+                    m_cursors[i].slot->tail.store(m_cursors[i].position, Release);
+                if (m_space_waiters.load(SequentiallyConsistent) > 0)
+                {
+                    m_space_generation.fetch_add(1, Release);
+                    m_space_generation.notify_all();
+                }
+            };
+
+            size_t remaining = active;
+            while (remaining > 0)
+            {
+                detail::DrainCursor* earliest = nullptr;
+                detail::RecordHeader* earliest_header = nullptr;
+                for (size_t i = 0; i < active; i++)
+                {
+                    auto& cursor = m_cursors[i];
+                    if (cursor.position == cursor.end)
+                        continue;
+                    auto* header = header_at(cursor);
+                    if (earliest == nullptr || header->timestamp < earliest_header->timestamp)
+                    {
+                        earliest = &cursor;
+                        earliest_header = header;
+                    }
+                }
+
+                VERIFY(earliest_header->size <= m_capacity / 4);
+                if (batched + earliest_header->size > batch_size)
+                {
+                    write_batch(batched);
+                    batched = 0;
+                    release();
+                }
+                __builtin_memcpy(m_batch.data() + batched, earliest_header + 1, earliest_header->size);
+                batched += earliest_header->size;
+                earliest->position += record_size(earliest_header->size);
+                if (earliest->position == earliest->end)
+                    remaining--;
+            }
+
+            write_batch(batched);
+            release();
+            return true;
+        }
+
+        void write_batch(size_t size)
+        {
+            if (size == 0)
+                return;
+            m_base_lock.lock();
+            m_base.write(Span<u8>(m_batch.data(), size));
+            m_has_error.store(m_base.has_error(), Release);
+            m_base_lock.unlock();
+        }
+
+        // Stops the writer after a last drain and flush. Anything published after that pass is drained here.
+        void shut_down()
+        {
+            if (m_stopped.load(Acquire))
+                return;
+            m_stopping.store(true, SequentiallyConsistent);
+            wake_writer();
+            if (m_writer.has_value())
+                [[maybe_unused]] auto exit = m_writer.value()->wait_for_thread_exit();
+            if (drain())
+            {
+                m_base.flush();
+                m_has_error.store(m_base.has_error(), Release);
+            }
+
+            // Changing the words makes a waiter that missed m_stopped come back and see it.
+            m_stopped.store(true, SequentiallyConsistent);
+            m_flush_completed.fetch_add(1, Release);
+            m_flush_completed.notify_all();
+            m_space_generation.fetch_add(1, Release);
+            m_space_generation.notify_all();
+        }
+
+        static inline Atomic<u64> s_next_id { 1 };
+        static inline thread_local detail::ProducerCache s_cache {};
+
+        OutputStream& m_base;
+        size_t m_max_producers;
+        size_t m_capacity;
+        BackpressurePolicy m_policy;
+        u64 m_id;
+        // max_producers slots and the shared one after them.
+        detail::ProducerSlot* m_slots;
+        SpinlockMutex m_shared_lock;
+        SpinlockMutex m_base_lock;
+        Optional<RefPtr<Thread>> m_writer;
+
+        alignas(hardware_destructive_interference_size) Atomic<u32> m_writer_sleeping { 0 };
+        Atomic<bool> m_stopping { false };
+        Atomic<bool> m_stopped { false };
+        Atomic<u32> m_flush_requested { 0 };
+        Atomic<u32> m_flush_completed { 0 };
+        Atomic<u32> m_space_generation { 0 };
+        Atomic<u32> m_space_waiters { 0 };
+        Atomic<bool> m_has_error { false };
+        Atomic<u64> m_dropped_writes { 0 };
+
+        // Writer thread only.
+        alignas(hardware_destructive_interference_size) Buffer<u8> m_batch;
+        detail::DrainCursor* m_cursors;
+    };
 }
+using neo::BackpressurePolicy;
 using neo::ConcurrentInputStream;
 using neo::ConcurrentOutputStream;
+using neo::MultiProducerOptions;
+using neo::MultiProducerOutputStream;
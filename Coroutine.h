@@ -0,0 +1,157 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Preprocessor.h"
+#include "Types.h"
+
+#ifdef NEO_DO_NOT_DEFINE_STD
+    #include <coroutine>
+#else
+// The compiler looks up coroutine_traits and coroutine_handle in std when lowering a coroutine, these are the minimal
+// definitions it needs, built on the same builtins libstdc++ and libc++ use.
+
+namespace std
+{
+    template<typename TReturn, typename... TArgs>
+    struct coroutine_traits
+    {
+        using promise_type = typename TReturn::promise_type;
+    };
+
+    template<typename TPromise = void>
+    struct coroutine_handle;
+
+    template<>
+    struct coroutine_handle<void>
+    {
+        constexpr coroutine_handle() noexcept = default;
+        constexpr coroutine_handle(nullptr_t) noexcept { }
+
+        constexpr static coroutine_handle from_address(void* address) noexcept
+        {
+            coroutine_handle handle;
+            handle.m_frame = address;
+            return handle;
+        }
+
+        constexpr void* address() const noexcept { return m_frame; }
+        constexpr explicit operator bool() const noexcept { return m_frame != nullptr; }
+        constexpr bool operator==(coroutine_handle const& other) const noexcept { return m_frame == other.m_frame; }
+
+        bool done() const { return __builtin_coro_done(m_frame); }
+        void operator()() const { resume(); }
+        void resume() const { __builtin_coro_resume(m_frame); }
+        void destroy() const { __builtin_coro_destroy(m_frame); }
+
+    protected:
+        void* m_frame { nullptr };
+    };
+
+    template<typename TPromise>
+    struct coroutine_handle : coroutine_handle<void>
+    {
+        constexpr coroutine_handle() noexcept = default;
+        constexpr coroutine_handle(nullptr_t) noexcept { }
+
+        constexpr static coroutine_handle from_address(void* address) noexcept
+        {
+            coroutine_handle handle;
+            handle.m_frame = address;
+            return handle;
+        }
+
+        static coroutine_handle from_promise(TPromise& promise)
+        {
+            coroutine_handle handle;
+            handle.m_frame = __builtin_coro_promise((char*)&promise, __alignof(TPromise), true);
+            return handle;
+        }
+
+        TPromise& promise() const
+        {
+            return *static_cast<TPromise*>(__builtin_coro_promise(m_frame, __alignof(TPromise), false));
+        }
+    };
+
+    struct noop_coroutine_promise
+    {
+    };
+
+    // Mirrors the frame layout the compiler expects (resume and destroy pointers first), so resuming it through
+    // symmetric transfer lands on a function that does nothing.
+    template<>
+    struct coroutine_handle<noop_coroutine_promise> : coroutine_handle<void>
+    {
+        constexpr bool done() const noexcept { return false; }
+        void operator()() const noexcept { }
+        void resume() const noexcept { }
+        void destroy() const noexcept { }
+
+    private:
+        friend coroutine_handle noop_coroutine() noexcept;
+
+        struct Frame
+        {
+            static void resume_or_destroy() { }
+            void (*resume)() { resume_or_destroy };
+            void (*destroy)() { resume_or_destroy };
+            noop_coroutine_promise promise;
+        };
+        static Frame s_frame;
+
+        coroutine_handle() noexcept
+        {
+            m_frame = &s_frame;
+        }
+    };
+
+    using noop_coroutine_handle = coroutine_handle<noop_coroutine_promise>;
+
+    inline noop_coroutine_handle::Frame noop_coroutine_handle::s_frame {};
+
+    inline noop_coroutine_handle noop_coroutine() noexcept
+    {
+        return noop_coroutine_handle();
+    }
+
+    struct suspend_always
+    {
+        constexpr bool await_ready() const noexcept { return false; }
+        constexpr void await_suspend(coroutine_handle<>) const noexcept { }
+        constexpr void await_resume() const noexcept { }
+    };
+
+    struct suspend_never
+    {
+        constexpr bool await_ready() const noexcept { return true; }
+        constexpr void await_suspend(coroutine_handle<>) const noexcept { }
+        constexpr void await_resume() const noexcept { }
+    };
+}
+#endif
+
+namespace neo
+{
+    template<typename TPromise = void>
+    using CoroutineHandle = std::coroutine_handle<TPromise>;
+    using SuspendAlways = std::suspend_always;
+    using SuspendNever = std::suspend_never;
+}
+
+using neo::CoroutineHandle;
+using neo::SuspendAlways;
+using neo::SuspendNever;
@@ -0,0 +1,261 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Assert.h"
+#include "IterableUtil.h"
+#include "Iterator.h"
+#include "Memory.h"
+#include "New.h"
+#include "TypeTraits.h"
+#include "Types.h"
+#include "Util.h"
+
+namespace neo
+{
+    // Double ended queue over one growable ring of storage. Pushing or popping at either end is amortized O(1) and
+    // never allocates per element; elements are reachable by index. The capacity is a power of two, so indices wrap
+    // with a mask. Growing moves the elements and invalidates references to them.
+    template<typename T>
+    class Deque : public IterableExtensions<Deque<T>, T>
+    {
+    public:
+        using type = T;
+        using iterator = Iterator<Deque>;
+        using const_iterator = Iterator<const Deque>;
+        static constexpr size_t default_capacity { 16 };
+
+        Deque() = default;
+
+        Deque(Deque const& other)
+        {
+            ensure_capacity(other.m_size);
+            for (size_t i = 0; i < other.m_size; i++)
+                new (&m_storage[i]) T(other[i]);
+            m_size = other.m_size;
+        }
+
+        Deque(Deque&& other) :
+            m_storage(other.m_storage), m_capacity(other.m_capacity), m_head(other.m_head), m_size(other.m_size)
+        {
+            other.m_storage = nullptr;
+            other.m_capacity = 0;
+            other.m_head = 0;
+            other.m_size = 0;
+        }
+
+        Deque& operator=(Deque const& other)
+        {
+            if (this == &other)
+                return *this;
+
+            this->~Deque();
+            new (this) Deque(other);
+            return *this;
+        }
+
+        Deque& operator=(Deque&& other)
+        {
+            if (this == &other)
+                return *this;
+
+            this->~Deque();
+            new (this) Deque(std::move(other));
+            return *this;
+        }
+
+        ~Deque()
+        {
+            clear();
+            MallocAllocator::deallocate(m_storage);
+            m_storage = nullptr;
+            m_capacity = 0;
+        }
+
+        void add_back(T const& element)
+        {
+            if (m_size == m_capacity)
+                grow(m_capacity == 0 ? default_capacity : m_capacity * 2);
+            new (&slot(m_head + m_size)) T(element);
+            m_size++;
+        }
+
+        void add_back(T&& element)
+        {
+            if (m_size == m_capacity)
+                grow(m_capacity == 0 ? default_capacity : m_capacity * 2);
+            new (&slot(m_head + m_size)) T(std::move(element));
+            m_size++;
+        }
+
+        void add_front(T const& element)
+        {
+            if (m_size == m_capacity)
+                grow(m_capacity == 0 ? default_capacity : m_capacity * 2);
+            m_head = (m_head - 1) & (m_capacity - 1);
+            new (&slot(m_head)) T(element);
+            m_size++;
+        }
+
+        void add_front(T&& element)
+        {
+            if (m_size == m_capacity)
+                grow(m_capacity == 0 ? default_capacity : m_capacity * 2);
+            m_head = (m_head - 1) & (m_capacity - 1);
+            new (&slot(m_head)) T(std::move(element));
+            m_size++;
+        }
+
+        T pop_back()
+        {
+            VERIFY(m_size > 0);
+            auto& element = slot(m_head + m_size - 1);
+            T value = std::move(element);
+            element.~T();
+            m_size--;
+            return value;
+        }
+
+        T pop_front()
+        {
+            VERIFY(m_size > 0);
+            auto& element = slot(m_head);
+            T value = std::move(element);
+            element.~T();
+            m_head = (m_head + 1) & (m_capacity - 1);
+            m_size--;
+            return value;
+        }
+
+        [[nodiscard]] T& peek_back()
+        {
+            VERIFY(m_size > 0);
+            return slot(m_head + m_size - 1);
+        }
+
+        [[nodiscard]] T const& peek_back() const
+        {
+            VERIFY(m_size > 0);
+            return slot(m_head + m_size - 1);
+        }
+
+        [[nodiscard]] T& peek_front()
+        {
+            VERIFY(m_size > 0);
+            return slot(m_head);
+        }
+
+        [[nodiscard]] T const& peek_front() const
+        {
+            VERIFY(m_size > 0);
+            return slot(m_head);
+        }
+
+        // index 0 is the front
+        T& operator[](size_t index)
+        {
+            VERIFY(index < m_size);
+            return slot(m_head + index);
+        }
+
+        T const& operator[](size_t index) const
+        {
+            VERIFY(index < m_size);
+            return slot(m_head + index);
+        }
+
+        void clear()
+        {
+            if constexpr (!IsTriviallyDestructible<T>)
+            {
+                for (size_t i = 0; i < m_size; i++)
+                    slot(m_head + i).~T();
+            }
+            m_head = 0;
+            m_size = 0;
+        }
+
+        void ensure_capacity(size_t capacity)
+        {
+            if (capacity > m_capacity)
+                grow(capacity <= default_capacity ? default_capacity : (size_t)1 << (64 - __builtin_clzll(capacity - 1)));
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return m_size;
+        }
+
+        [[nodiscard]] bool is_empty() const
+        {
+            return m_size == 0;
+        }
+
+        [[nodiscard]] size_t capacity() const
+        {
+            return m_capacity;
+        }
+
+        auto begin()
+        {
+            return iterator { *this };
+        }
+
+        auto end()
+        {
+            return iterator { *this, m_size };
+        }
+
+        auto begin() const
+        {
+            return const_iterator { *this };
+        }
+
+        auto end() const
+        {
+            return const_iterator { *this, m_size };
+        }
+
+    private:
+        T& slot(size_t index) const
+        {
+            return m_storage[index & (m_capacity - 1)];
+        }
+
+        // Moves the elements to the start of the new storage, so the front is at 0 again.
+        void grow(size_t capacity)
+        {
+            auto* storage = (T*)MallocAllocator::allocate(capacity * sizeof(T));
+            ENSURE(storage != nullptr);
+            for (size_t i = 0; i < m_size; i++)
+            {
+                auto& element = slot(m_head + i);
+                new (&storage[i]) T(std::move(element));
+                element.~T();
+            }
+            MallocAllocator::deallocate(m_storage);
+            m_storage = storage;
+            m_capacity = capacity;
+            m_head = 0;
+        }
+
+        T* m_storage { nullptr };
+        size_t m_capacity { 0 };
+        size_t m_head { 0 };
+        size_t m_size { 0 };
+    };
+}
+using neo::Deque;
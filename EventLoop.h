@@ -0,0 +1,683 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Assert.h"
+#include "Atomic.h"
+#include "Concepts.h"
+#include "OSError.h"
+#include "ResultOrError.h"
+#include "SmartPtr.h"
+#include "Socket.h"
+#include "Task.h"
+#include "ThreadPool.h"
+#include "Time.h"
+#include "Vector.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace neo
+{
+    namespace detail
+    {
+        struct EventCallback
+        {
+            virtual ~EventCallback() = default;
+            virtual void run(u32 events) = 0;
+        };
+
+        template<typename TFunc>
+        struct EventCallbackStorage final : public EventCallback
+        {
+            template<typename TArg>
+            explicit EventCallbackStorage(TArg&& f) :
+                func(forward<TArg>(f))
+            {
+            }
+
+            void run(u32 events) override
+            {
+                func(events);
+            }
+
+            TFunc func;
+        };
+
+        // Everything the loop knows about one registered fd. Readiness that arrives while nobody waits is kept
+        // in readable/writable, edge-triggered epoll won't report it again.
+        struct FdWatch
+        {
+            int fd { -1 };
+            EventCallback* callback { nullptr };
+            CoroutineHandle<> reader {};
+            CoroutineHandle<> writer {};
+            bool readable { false };
+            bool writable { false };
+        };
+
+        struct LoopTimer
+        {
+            u64 deadline;
+            u64 interval;
+            u64 id;
+            PoolTask* task;
+        };
+    }
+
+    // Single threaded reactor over edge-triggered epoll. Everything except execute() and stop() must be called
+    // from the thread running the loop.
+    class EventLoop
+    {
+    public:
+        enum Event : u32
+        {
+            Readable = EPOLLIN,
+            Writable = EPOLLOUT,
+            PeerClosed = EPOLLRDHUP,
+            Hangup = EPOLLHUP,
+            Error = EPOLLERR
+        };
+
+        using TimerId = u64;
+
+        static constexpr int max_events_per_wait = 256;
+
+        EventLoop(EventLoop const&) = delete;
+        EventLoop& operator=(EventLoop const&) = delete;
+
+        static ResultOrError<OwnPtr<EventLoop>, OSError> create()
+        {
+            auto epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+            if (epoll_fd == -1)
+                return OSError(errno);
+
+            auto wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            auto timer_fd = wake_fd == -1 ? -1 : ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if (timer_fd == -1)
+            {
+                auto error = errno;
+                if (wake_fd != -1)
+                    ::close(wake_fd);
+                ::close(epoll_fd);
+                return OSError(error);
+            }
+
+            OwnPtr<EventLoop> loop(new EventLoop(epoll_fd, wake_fd, timer_fd));
+            epoll_event wake_event { EPOLLIN, { .ptr = &loop->m_wake_watch } };
+            epoll_event timer_event { EPOLLIN, { .ptr = &loop->m_timer_watch } };
+            if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake_event) == -1
+                || ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &timer_event) == -1)
+                return OSError(errno);
+
+            return loop;
+        }
+
+        ~EventLoop()
+        {
+            while (auto* task = m_posted.pop())
+                delete task;
+            for (size_t i = 0; i < m_timers.size(); i++)
+                delete m_timers[i].task;
+            for (size_t i = 0; i < m_watches.size(); i++)
+                destroy_watch(m_watches[i]);
+            free_retired_watches();
+            ::close(m_timer_watch.fd);
+            ::close(m_wake_watch.fd);
+            ::close(m_epoll_fd);
+        }
+
+        // Calls on_events(u32 events) with the Event bits every time the fd changes readiness. Being
+        // edge-triggered, the callback has to read or write until EAGAIN or it won't hear about the fd again.
+        template<typename TFunc>
+        requires Callable<TFunc, u32>
+        Optional<OSError> watch(int fd, TFunc&& on_events)
+        {
+            auto watch_or_error = watch_for(fd);
+            if (watch_or_error.has_error())
+                return watch_or_error.error();
+
+            auto* watch = watch_or_error.result();
+            VERIFY(watch->callback == nullptr);
+            watch->callback = new detail::EventCallbackStorage<RemoveCV<RemoveReference<TFunc>>>(forward<TFunc>(on_events));
+            return {};
+        }
+
+        // Forgets about the fd, which must happen before it is closed: the kernel drops closed fds from epoll on
+        // its own, a new fd reusing the number would otherwise never be registered. Coroutines waiting on the
+        // fd are resumed and get ECANCELED.
+        void unwatch(int fd)
+        {
+            if (auto* watch = forget_watch(fd))
+                resume_cancelled(watch);
+        }
+
+        // Same as unwatch() followed by closing the socket. The socket is closed before the waiters resume,
+        // they may well destroy it.
+        template<typename TSocket>
+        Optional<SocketError> close(TSocket& socket)
+        {
+            auto* watch = forget_watch(socket.fd());
+            auto error = socket.close();
+            if (watch != nullptr)
+                resume_cancelled(watch);
+            return error;
+        }
+
+        template<VoidCallable TFunc>
+        TimerId add_timer(Time const& delay, TFunc&& func)
+        {
+            return add_timer(delay.to_nanoseconds(), 0, forward<TFunc>(func));
+        }
+
+        template<VoidCallable TFunc>
+        TimerId add_repeating_timer(Time const& interval, TFunc&& func)
+        {
+            VERIFY(interval.to_nanoseconds() != 0);
+            return add_timer(interval.to_nanoseconds(), interval.to_nanoseconds(), forward<TFunc>(func));
+        }
+
+        // false if the timer already fired or was cancelled
+        bool cancel_timer(TimerId id)
+        {
+            if (id == m_running_timer)
+            {
+                m_running_timer_cancelled = true;
+                return true;
+            }
+
+            for (size_t i = 0; i < m_timers.size(); i++)
+            {
+                if (m_timers[i].id != id)
+                    continue;
+
+                delete m_timers[i].task;
+                remove_timer_at(i);
+                arm_timer_fd();
+                return true;
+            }
+            return false;
+        }
+
+        // Runs func on the loop thread. Safe to call from any thread, which makes the loop an Executor as well.
+        template<VoidCallable TFunc>
+        void execute(TFunc&& func)
+        {
+            m_posted.push(new detail::PoolTaskStorage<RemoveCV<RemoveReference<TFunc>>>(forward<TFunc>(func)));
+            wake();
+        }
+
+        // Processes events until stop() is called.
+        void run()
+        {
+            while (!m_stop_requested.exchange(false, AcquireRelease))
+                run_once();
+        }
+
+        // Makes run() return after the current batch of events. Safe to call from any thread.
+        void stop()
+        {
+            m_stop_requested.store(true, Release);
+            wake();
+        }
+
+        // Waits for one batch of events, timers or posted functions and handles them.
+        void run_once()
+        {
+            epoll_event events[max_events_per_wait];
+            auto count = ::epoll_wait(m_epoll_fd, events, max_events_per_wait, -1);
+            if (count == -1)
+            {
+                VERIFY(errno == EINTR);
+                return;
+            }
+
+            bool timers_due = false;
+            for (int i = 0; i < count; i++)
+            {
+                auto* watch = static_cast<detail::FdWatch*>(events[i].data.ptr);
+                if (watch == &m_wake_watch)
+                {
+                    drain_fd(m_wake_watch.fd);
+                    continue;
+                }
+                if (watch == &m_timer_watch)
+                {
+                    drain_fd(m_timer_watch.fd);
+                    timers_due = true;
+                    continue;
+                }
+                dispatch(watch, events[i].events);
+            }
+
+            run_posted();
+            if (timers_due)
+                run_due_timers();
+            free_retired_watches();
+        }
+
+        // co_await loop.readable(fd) suspends until fd has something to read, or returns right away if readiness
+        // arrived since the last wait. Yields the error registering the fd failed with, if any.
+        auto readable(int fd)
+        {
+            return ReadinessAwaiter { *this, fd, true };
+        }
+
+        auto writable(int fd)
+        {
+            return ReadinessAwaiter { *this, fd, false };
+        }
+
+        // co_await loop.sleep(delay) resumes the coroutine on the loop thread once the delay passed.
+        auto sleep(Time const& delay)
+        {
+            struct Awaiter
+            {
+                bool await_ready() const noexcept { return false; }
+
+                void await_suspend(CoroutineHandle<> handle)
+                {
+                    loop.add_timer(delay, [handle]
+                        { handle.resume(); });
+                }
+
+                void await_resume() const noexcept { }
+
+                EventLoop& loop;
+                Time delay;
+            };
+
+            return Awaiter { *this, delay };
+        }
+
+        // The sockets used by the coroutine helpers below must be in non-blocking mode.
+
+        Task<ResultOrError<TCPSocket, SocketError>> accept(TCPListener& listener)
+        {
+            while (true)
+            {
+                auto result = listener.accept();
+                if (!result.has_error() || !would_block(result.error()))
+                    co_return result;
+
+                auto error = co_await readable(listener.fd());
+                if (error.has_value())
+                    co_return SocketError((int)error.value());
+            }
+        }
+
+        Task<ResultOrError<TCPSocket, SocketError>> connect(Ipv4SocketAddress address)
+        {
+            auto result = TCPSocket::connect(address, SocketMode::NonBlocking);
+            if (result.has_error())
+                co_return result;
+
+            auto error = co_await writable(result.result().fd());
+            if (error.has_value())
+            {
+                unwatch(result.result().fd());
+                co_return SocketError((int)error.value());
+            }
+
+            auto connect_error = result.result().pending_error();
+            if (connect_error != 0)
+            {
+                unwatch(result.result().fd());
+                co_return connect_error;
+            }
+            co_return result;
+        }
+
+        // \return The number of bytes read, 0 once the peer closed the connection
+        Task<ResultOrError<size_t, SocketError>> receive(TCPSocket& socket, Span<u8>& buffer)
+        {
+            while (true)
+            {
+                auto result = socket.receive(buffer);
+                if (!result.has_error() || !would_block(result.error()))
+                    co_return result;
+
+                auto error = co_await readable(socket.fd());
+                if (error.has_value())
+                    co_return SocketError((int)error.value());
+            }
+        }
+
+        // Sends all of data.
+        Task<Optional<SocketError>> send(TCPSocket& socket, Span<u8> const& data)
+        {
+            size_t sent = 0;
+            while (sent < data.size())
+            {
+                auto result = socket.send_some(Span<u8>(data.data() + sent, data.size() - sent));
+                if (!result.has_error())
+                {
+                    sent += result.result();
+                    continue;
+                }
+                if (!would_block(result.error()))
+                    co_return result.error();
+
+                auto error = co_await writable(socket.fd());
+                if (error.has_value())
+                    co_return SocketError((int)error.value());
+            }
+            co_return {};
+        }
+
+    private:
+        struct ReadinessAwaiter
+        {
+            bool await_ready()
+            {
+                auto watch_or_error = loop.watch_for(fd);
+                if (watch_or_error.has_error())
+                {
+                    error = watch_or_error.error();
+                    return true;
+                }
+
+                watch = watch_or_error.result();
+                bool& ready = for_read ? watch->readable : watch->writable;
+                if (!ready)
+                    return false;
+                ready = false;
+                return true;
+            }
+
+            void await_suspend(CoroutineHandle<> handle)
+            {
+                auto& waiter = for_read ? watch->reader : watch->writer;
+                VERIFY(!waiter);
+                waiter = handle;
+            }
+
+            Optional<OSError> await_resume() const
+            {
+                // Resumed by unwatch(), waiting again would register the fd right before it gets closed.
+                if (watch != nullptr && watch->fd == -1)
+                    return OSError(ECANCELED);
+                return error;
+            }
+
+            EventLoop& loop;
+            int fd;
+            bool for_read;
+            detail::FdWatch* watch { nullptr };
+            Optional<OSError> error {};
+        };
+
+        EventLoop(int epoll_fd, int wake_fd, int timer_fd) :
+            m_epoll_fd(epoll_fd)
+        {
+            m_wake_watch.fd = wake_fd;
+            m_timer_watch.fd = timer_fd;
+        }
+
+        static bool would_block(SocketError error)
+        {
+            return error == EAGAIN || error == EWOULDBLOCK;
+        }
+
+        static CoroutineHandle<> take_handle(CoroutineHandle<>& handle)
+        {
+            auto taken = handle;
+            handle = nullptr;
+            return taken;
+        }
+
+        static void drain_fd(int fd)
+        {
+            u64 value;
+            while (::read(fd, &value, sizeof(value)) == sizeof(value))
+            {
+            }
+        }
+
+        ResultOrError<detail::FdWatch*, OSError> watch_for(int fd)
+        {
+            VERIFY(fd >= 0);
+            while (m_watches.size() <= (size_t)fd)
+                m_watches.append(nullptr);
+            if (m_watches[fd] != nullptr)
+                return m_watches[fd];
+
+            auto* watch = new detail::FdWatch;
+            watch->fd = fd;
+            epoll_event event { EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, { .ptr = watch } };
+            if (::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+            {
+                delete watch;
+                return OSError(errno);
+            }
+            m_watches[fd] = watch;
+            return watch;
+        }
+
+        detail::FdWatch* forget_watch(int fd)
+        {
+            if (fd < 0 || (size_t)fd >= m_watches.size() || m_watches[fd] == nullptr)
+                return nullptr;
+
+            auto* watch = m_watches[fd];
+            m_watches[fd] = nullptr;
+            ::epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+
+            // The watch may still be referenced by events of the current batch, it is freed once that's done.
+            watch->fd = -1;
+            delete watch->callback;
+            watch->callback = nullptr;
+            m_retired_watches.append(watch);
+            return watch;
+        }
+
+        void resume_cancelled(detail::FdWatch* watch)
+        {
+            if (auto reader = take_handle(watch->reader))
+                reader.resume();
+            if (auto writer = take_handle(watch->writer))
+                writer.resume();
+        }
+
+        void dispatch(detail::FdWatch* watch, u32 events)
+        {
+            if (watch->fd == -1)
+                return;
+
+            if (watch->callback != nullptr)
+                watch->callback->run(events);
+
+            // The callback may have unwatched the fd.
+            if (watch->fd == -1)
+                return;
+
+            if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                if (auto reader = take_handle(watch->reader))
+                    reader.resume();
+                else
+                    watch->readable = true;
+            }
+
+            if (watch->fd == -1)
+                return;
+
+            if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            {
+                if (auto writer = take_handle(watch->writer))
+                    writer.resume();
+                else
+                    watch->writable = true;
+            }
+        }
+
+        void destroy_watch(detail::FdWatch* watch)
+        {
+            if (watch == nullptr)
+                return;
+            delete watch->callback;
+            delete watch;
+        }
+
+        void free_retired_watches()
+        {
+            while (!m_retired_watches.is_empty())
+                destroy_watch(m_retired_watches.take_last());
+        }
+
+        void wake()
+        {
+            if (m_wake_pending.exchange(true, AcquireRelease))
+                return;
+            u64 one = 1;
+            [[maybe_unused]] auto written = ::write(m_wake_watch.fd, &one, sizeof(one));
+        }
+
+        void run_posted()
+        {
+            // Pairs with the exchange in wake(): anything pushed before a skipped wakeup is visible below.
+            m_wake_pending.exchange(false, AcquireRelease);
+            while (auto* task = m_posted.pop())
+            {
+                task->run();
+                delete task;
+            }
+        }
+
+        template<VoidCallable TFunc>
+        TimerId add_timer(u64 delay, u64 interval, TFunc&& func)
+        {
+            auto id = ++m_last_timer_id;
+            auto* task = new detail::PoolTaskStorage<RemoveCV<RemoveReference<TFunc>>>(forward<TFunc>(func));
+            push_timer({ Timer::now().to_nanoseconds() + delay, interval, id, task });
+            if (m_timers[0].id == id)
+                arm_timer_fd();
+            return id;
+        }
+
+        void run_due_timers()
+        {
+            auto now = Timer::now().to_nanoseconds();
+            while (!m_timers.is_empty() && m_timers[0].deadline <= now)
+            {
+                auto timer = m_timers[0];
+                remove_timer_at(0);
+
+                m_running_timer = timer.id;
+                m_running_timer_cancelled = false;
+                timer.task->run();
+                m_running_timer = 0;
+
+                if (timer.interval == 0 || m_running_timer_cancelled)
+                {
+                    delete timer.task;
+                    continue;
+                }
+
+                // A repeating timer that fell behind skips the missed runs instead of firing back to back.
+                timer.deadline += timer.interval;
+                if (timer.deadline <= now)
+                    timer.deadline = now + timer.interval;
+                push_timer(timer);
+            }
+            arm_timer_fd();
+        }
+
+        void arm_timer_fd()
+        {
+            itimerspec spec {};
+            if (!m_timers.is_empty())
+            {
+                auto now = Timer::now().to_nanoseconds();
+                // A zero it_value disarms the timer, expired deadlines still need a wakeup.
+                auto remaining = m_timers[0].deadline > now ? m_timers[0].deadline - now : 1;
+                spec.it_value = { (time_t)(remaining / 1000000000), (long)(remaining % 1000000000) };
+            }
+            ::timerfd_settime(m_timer_watch.fd, 0, &spec, nullptr);
+        }
+
+        // m_timers is a binary min-heap on the deadline.
+
+        void push_timer(detail::LoopTimer const& timer)
+        {
+            m_timers.append(timer);
+            sift_up(m_timers.size() - 1);
+        }
+
+        void remove_timer_at(size_t index)
+        {
+            auto last = m_timers.take_last();
+            if (index == m_timers.size())
+                return;
+            m_timers[index] = last;
+            sift_down(index);
+            sift_up(index);
+        }
+
+        void sift_up(size_t index)
+        {
+            while (index > 0)
+            {
+                auto parent = (index - 1) / 2;
+                if (m_timers[parent].deadline <= m_timers[index].deadline)
+                    return;
+                swap_timers(parent, index);
+                index = parent;
+            }
+        }
+
+        void sift_down(size_t index)
+        {
+            while (true)
+            {
+                auto smallest = index;
+                auto left = index * 2 + 1;
+                auto right = left + 1;
+                if (left < m_timers.size() && m_timers[left].deadline < m_timers[smallest].deadline)
+                    smallest = left;
+                if (right < m_timers.size() && m_timers[right].deadline < m_timers[smallest].deadline)
+                    smallest = right;
+                if (smallest == index)
+                    return;
+                swap_timers(smallest, index);
+                index = smallest;
+            }
+        }
+
+        void swap_timers(size_t a, size_t b)
+        {
+            auto temp = m_timers[a];
+            m_timers[a] = m_timers[b];
+            m_timers[b] = temp;
+        }
+
+        int m_epoll_fd;
+        detail::FdWatch m_wake_watch;
+        detail::FdWatch m_timer_watch;
+        Vector<detail::FdWatch*> m_watches;
+        Vector<detail::FdWatch*> m_retired_watches;
+        Vector<detail::LoopTimer> m_timers;
+        TimerId m_last_timer_id { 0 };
+        TimerId m_running_timer { 0 };
+        bool m_running_timer_cancelled { false };
+        detail::TaskList m_posted;
+        Atomic<bool> m_wake_pending { false };
+        Atomic<bool> m_stop_requested { false };
+    };
+}
+
+using neo::EventLoop;
@@ -15,13 +15,18 @@
  */
 
 #pragma once
+#include "Atomic.h"
 #include "OSError.h"
 #include "Optional.h"
 #include "ResultOrError.h"
 #include "Span.h"
 #include "String.h"
 #include "Buffer.h"
+#include "Mutex.h"
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #ifdef _WIN32
     #include <io.h>
 #else
@@ -37,21 +42,38 @@ namespace neo
         End = SEEK_END
     };
 
-    // TODO: Implement reporting of errors
+    struct FileOptions
+    {
+        // O_DIRECT: reads and writes bypass the page cache. Buffers, offsets and sizes must then be multiples of
+        // direct_io_alignment(), e.g. a Buffer<u8>::create_uninitialized(size, file.direct_io_alignment()).
+        bool direct { false };
+        // Permissions of a newly created file, before the umask.
+        mode_t permissions { 0666 };
+    };
+
+    // A file descriptor. Sequential read()/read_byte() go through a small read-ahead buffer like stdio did, which
+    // write(), seek() and flush() hand back to the file. read_at()/write_at() and the vectored variants are
+    // unbuffered and don't touch the file position, so any number of threads may use them on one File at once.
     class File
     {
     public:
+        static constexpr size_t read_buffer_size = 4096;
+
         ~File()
         {
             if (m_is_open)
-                fclose(m_handle);
+                ::close(m_fd);
+            delete[] m_read_buffer;
         }
 
         File(File&& other) :
-            m_handle(other.m_handle), m_is_open(other.m_is_open)
+            m_fd(other.m_fd), m_is_open(other.m_is_open), m_is_direct(other.m_is_direct), m_direct_io_alignment(other.m_direct_io_alignment), m_eof(other.m_eof), m_has_error(other.m_has_error),
+            m_read_buffer(other.m_read_buffer), m_read_start(other.m_read_start), m_read_end(other.m_read_end)
         {
-            other.m_handle = nullptr;
+            other.m_fd = -1;
             other.m_is_open = false;
+            other.m_read_buffer = nullptr;
+            other.m_read_start = other.m_read_end = 0;
         }
 
         File& operator=(File&& other)
@@ -59,6 +81,7 @@ namespace neo
             if (this == &other)
                 return *this;
 
+            this->~File();
             new (this) File(std::move(other));
 
             return *this;
@@ -89,14 +112,22 @@ namespace neo
                 return (OSError)errno;
         }
 
-        [[nodiscard]] static ResultOrError<File, OSError> open(const String& path, const char* posix_open_mode)
+        // posix_open_mode is an fopen() mode: "r", "w", "a", each optionally with "+", plus "x" for exclusive creation.
+        // "b" is accepted and ignored.
+        [[nodiscard]] static ResultOrError<File, OSError> open(const String& path, const char* posix_open_mode, FileOptions options = {})
         {
             VERIFY(!path.is_empty());
 
-            FILE* file = fopen(path.null_terminated_characters(), posix_open_mode);
-            if (file == nullptr)
+            auto flags = open_flags(posix_open_mode);
+            if (flags == -1)
+                return OSError::InvalidArgument;
+            if (options.direct)
+                flags |= O_DIRECT;
+
+            auto fd = ::open(path.null_terminated_characters(), flags | O_CLOEXEC, options.permissions);
+            if (fd == -1)
                 return (OSError)errno;
-            return File(file);
+            return File(fd, options.direct);
         }
 
         [[nodiscard]] static ResultOrError<Tuple<Buffer<u8>, size_t>, OSError> read_to_buffer(const String& path, size_t max_bytes_to_read)
@@ -133,7 +164,7 @@ namespace neo
             if (!maybe_buffer.has_value())
                 return OSError::OutOfMemory;
             auto buffer = maybe_buffer.release_value();
-            auto bytes_read_or_error = file_or_error.result().read(buffer.span(), buffer.size());
+            auto bytes_read_or_error = file_or_error.result().read_at(buffer.span(), 0);
             returnerr(bytes_read_or_error);
             return buffer;
         }
@@ -143,27 +174,56 @@ namespace neo
             if (!m_is_open)
                 return OSError::BadFileNumber;
 
-            auto byte_read = fgetc(m_handle);
-            if (byte_read == EOF)
-                return OSError::EndOfFile;
-            return (u8)byte_read;
+            if (m_read_start == m_read_end)
+            {
+                auto result = fill_read_buffer();
+                if (result == -1)
+                {
+                    m_has_error = true;
+                    return (OSError)errno;
+                }
+                if (result == 0)
+                {
+                    m_eof = true;
+                    return OSError::EndOfFile;
+                }
+            }
+            return m_read_buffer[m_read_start++];
         }
 
+        // Reads until max_bytes arrived or the file ends, EndOfFile if it already had.
         [[nodiscard]] ResultOrError<size_t, OSError> read(Span<u8> to, size_t max_bytes)
         {
-            VERIFY(to.size() <= max_bytes);
+            VERIFY(max_bytes <= to.size());
             if (!m_is_open)
                 return OSError::BadFileNumber;
 
-            size_t bytes_read = fread(to.data(), 1, max_bytes, m_handle);
-
-            if (bytes_read == 0)
+            size_t bytes_read = take_buffered(to.data(), max_bytes);
+            while (bytes_read < max_bytes)
             {
-                if (feof(m_handle))
-                    return OSError::EndOfFile;
-                else
-                    return (OSError)errno;
+                // Small reads go through the read-ahead buffer, big ones straight into to.
+                auto wanted = max_bytes - bytes_read;
+                bool buffered = wanted < read_buffer_size && !m_is_direct;
+                auto result = buffered ? fill_read_buffer() : ::read(m_fd, to.data() + bytes_read, wanted);
+                if (result == -1 && errno == EINTR)
+                    continue;
+                if (result == -1)
+                {
+                    m_has_error = true;
+                    if (bytes_read == 0)
+                        return (OSError)errno;
+                    break;
+                }
+                if (result == 0)
+                {
+                    m_eof = true;
+                    break;
+                }
+                bytes_read += buffered ? take_buffered(to.data() + bytes_read, wanted) : (size_t)result;
             }
+
+            if (bytes_read == 0 && max_bytes != 0)
+                return OSError::EndOfFile;
             return bytes_read;
         }
 
@@ -172,90 +232,407 @@ namespace neo
             VERIFY(bytes_to_write <= from.size());
             if (!m_is_open)
                 return OSError::BadFileNumber;
+            if (auto error = drop_read_buffer(); error.has_value())
+                return error.release_value();
 
-            size_t bytes_written = fwrite(from.data(), 1, bytes_to_write, m_handle);
+            size_t bytes_written = 0;
+            while (bytes_written < bytes_to_write)
+            {
+                auto result = ::write(m_fd, from.data() + bytes_written, bytes_to_write - bytes_written);
+                if (result == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    m_has_error = true;
+                    return (OSError)errno;
+                }
+                bytes_written += (size_t)result;
+            }
+            return bytes_written;
+        }
+
+        // pread until to is full or the file ends, a short count means the end was reached.
+        [[nodiscard]] ResultOrError<size_t, OSError> read_at(Span<u8> to, u64 offset) const
+        {
+            verify_direct_io(to.data(), to.size(), offset);
+            size_t bytes_read = 0;
+            while (bytes_read < to.size())
+            {
+                auto result = ::pread(m_fd, to.data() + bytes_read, to.size() - bytes_read, (off_t)(offset + bytes_read));
+                if (result == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return (OSError)errno;
+                }
+                if (result == 0)
+                    break;
+                bytes_read += (size_t)result;
+            }
+            return bytes_read;
+        }
+
+        [[nodiscard]] ResultOrError<size_t, OSError> write_at(Span<u8> const& from, u64 offset)
+        {
+            verify_direct_io(from.data(), from.size(), offset);
+            size_t bytes_written = 0;
+            while (bytes_written < from.size())
+            {
+                auto result = ::pwrite(m_fd, from.data() + bytes_written, from.size() - bytes_written, (off_t)(offset + bytes_written));
+                if (result == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return (OSError)errno;
+                }
+                bytes_written += (size_t)result;
+            }
             return bytes_written;
         }
 
+        // Scatter read: fills buffers one after the other from offset with preadv, as few syscalls as possible.
+        // A short count means the file ended.
+        [[nodiscard]] ResultOrError<size_t, OSError> read_vectored_at(Span<Span<u8>> buffers, u64 offset) const
+        {
+            return vectored_at(buffers, offset, false);
+        }
+
+        // Gather write of every buffer in order from offset with pwritev.
+        [[nodiscard]] ResultOrError<size_t, OSError> write_vectored_at(Span<Span<u8>> buffers, u64 offset)
+        {
+            return vectored_at(buffers, offset, true);
+        }
+
+        // Reserves disk space for [offset, offset + length) so later writes there can't fail with ENOSPC and the
+        // file's blocks stay contiguous. keep_size reserves past the end without growing the file.
+        [[nodiscard]] Optional<OSError> allocate(u64 offset, u64 length, bool keep_size = false)
+        {
+            if (::fallocate(m_fd, keep_size ? FALLOC_FL_KEEP_SIZE : 0, (off_t)offset, (off_t)length) == 0)
+                return {};
+            if (errno != EOPNOTSUPP || keep_size)
+                return (OSError)errno;
+            // The filesystem can't reserve blocks, posix_fallocate writes zeros instead.
+            auto error = ::posix_fallocate(m_fd, (off_t)offset, (off_t)length);
+            if (error != 0)
+                return (OSError)error;
+            return {};
+        }
+
+        // Makes written data durable, skipping metadata that isn't needed to read it back. See DataSyncBatcher for
+        // many writers.
+        [[nodiscard]] Optional<OSError> sync_data()
+        {
+            if (::fdatasync(m_fd) == -1)
+                return (OSError)errno;
+            return {};
+        }
+
+        [[nodiscard]] Optional<OSError> sync()
+        {
+            if (::fsync(m_fd) == -1)
+                return (OSError)errno;
+            return {};
+        }
+
+        // Alignment O_DIRECT needs for buffers, offsets and sizes on this file. Looked up once at open for files
+        // opened with direct.
+        [[nodiscard]] size_t direct_io_alignment() const
+        {
+            if (m_direct_io_alignment != 0)
+                return m_direct_io_alignment;
+            return query_direct_io_alignment();
+        }
+
         [[nodiscard]] Optional<OSError> seek(SeekMode relative_to, long offset)
         {
-            auto result = fseek(m_handle, offset, (int)relative_to);
+            if (auto error = drop_read_buffer(); error.has_value())
+                return error;
+            auto result = ::lseek(m_fd, offset, (int)relative_to);
             if (result == -1)
                 return (OSError)errno;
+            m_eof = false;
             return {};
         }
 
+        // Writes aren't buffered. Hands back whatever was read ahead, so the descriptor's position is getpos() again.
+        [[nodiscard]] Optional<OSError> flush()
+        {
+            if (!m_is_open)
+                return OSError::BadFileNumber;
+            return drop_read_buffer();
+        }
+
         [[nodiscard]] Optional<OSError> close()
         {
-            if (fclose(m_handle) == EOF)
-                return (OSError)errno;
+            if (!m_is_open)
+                return OSError::BadFileNumber;
             m_is_open = false;
+            m_read_start = m_read_end = 0;
+            if (::close(m_fd) == -1)
+                return (OSError)errno;
             return {};
         }
 
         [[nodiscard]] ResultOrError<long, OSError> getpos() const
         {
-            auto result = ftell(m_handle);
+            auto result = ::lseek(m_fd, 0, SEEK_CUR);
             if (result == -1)
                 return (OSError)errno;
-            return result;
+            return result - (long)(m_read_end - m_read_start);
         }
 
+        // True once a read ran into the end of the file, until the next seek.
         [[nodiscard]] bool eof() const
         {
-            return feof(m_handle);
+            return m_eof;
         }
 
         [[nodiscard]] bool has_error() const
         {
-            return ferror(m_handle);
+            return m_has_error;
+        }
+
+        [[nodiscard]] int fd() const
+        {
+            return m_fd;
         }
 
         [[nodiscard]] static ResultOrError<long, OSError> size(const String& path)
         {
-            auto* handle = fopen(path.null_terminated_characters(), "r");
-            auto result = fseek(handle, 0, SEEK_END);
-            if (result == -1)
+            struct stat info;
+            if (::stat(path.null_terminated_characters(), &info) == -1)
+                return (OSError)errno;
+            return (long)info.st_size;
+        }
+
+        [[nodiscard]] ResultOrError<long, OSError> size() const
+        {
+            struct stat info;
+            if (::fstat(m_fd, &info) == -1)
+                return (OSError)errno;
+            return (long)info.st_size;
+        }
+
+    private:
+        explicit File(int fd, bool direct) :
+            m_fd(fd), m_is_open(true), m_is_direct(direct)
+        {
+            if (direct)
+                m_direct_io_alignment = query_direct_io_alignment();
+        }
+
+        size_t query_direct_io_alignment() const
+        {
+#ifdef STATX_DIOALIGN
+            struct statx info {};
+            if (::statx(m_fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &info) == 0 && (info.stx_mask & STATX_DIOALIGN) && info.stx_dio_offset_align != 0)
+                return max((size_t)info.stx_dio_mem_align, (size_t)info.stx_dio_offset_align);
+#endif
+            return 4096;
+        }
+
+        // Only called with nothing left in the buffer. The result of read().
+        ssize_t fill_read_buffer()
+        {
+            if (m_read_buffer == nullptr)
+                m_read_buffer = new u8[read_buffer_size];
+            m_read_start = m_read_end = 0;
+            while (true)
             {
-                fclose(handle);
+                auto result = ::read(m_fd, m_read_buffer, read_buffer_size);
+                if (result == -1 && errno == EINTR)
+                    continue;
+                if (result > 0)
+                    m_read_end = (size_t)result;
+                return result;
+            }
+        }
+
+        size_t take_buffered(u8* to, size_t max_bytes)
+        {
+            auto count = min(max_bytes, m_read_end - m_read_start);
+            if (count != 0)
+                __builtin_memcpy(to, m_read_buffer + m_read_start, count);
+            m_read_start += count;
+            return count;
+        }
+
+        // Moves the descriptor back over the bytes read ahead but not consumed.
+        Optional<OSError> drop_read_buffer()
+        {
+            auto unread = m_read_end - m_read_start;
+            m_read_start = m_read_end = 0;
+            if (unread != 0 && ::lseek(m_fd, -(off_t)unread, SEEK_CUR) == -1)
                 return (OSError)errno;
+            return {};
+        }
+
+        static int open_flags(char const* mode)
+        {
+            int flags;
+            switch (*mode++)
+            {
+            case 'r':
+                flags = O_RDONLY;
+                break;
+            case 'w':
+                flags = O_WRONLY | O_CREAT | O_TRUNC;
+                break;
+            case 'a':
+                flags = O_WRONLY | O_CREAT | O_APPEND;
+                break;
+            default:
+                return -1;
             }
-            auto size = ftell(handle);
-            if (size == -1)
+
+            for (; *mode != 0; mode++)
             {
-                fclose(handle);
-                return (OSError)errno;
+                if (*mode == '+')
+                    flags = (flags & ~O_ACCMODE) | O_RDWR;
+                else if (*mode == 'x')
+                    flags |= O_EXCL;
+                else if (*mode != 'b' && *mode != 'e')
+                    return -1;
             }
-            fclose(handle);
-            return size;
+            return flags;
         }
 
-        [[nodiscard]] ResultOrError<long, OSError> size() const
+        void verify_direct_io([[maybe_unused]] void const* data, [[maybe_unused]] size_t size, [[maybe_unused]] u64 offset) const
         {
-            auto current_pos = ftell(m_handle);
-            if (current_pos == -1)
-                return (OSError)errno;
-            auto result = fseek(m_handle, 0, SEEK_END);
-            if (result == -1)
-                return (OSError)errno;
-            auto size = ftell(m_handle);
-            if (size == -1)
-                return (OSError)errno;
-            result = fseek(m_handle, current_pos, SEEK_SET);
-            if (result == -1)
-                return (OSError)errno;
-            return size;
+            if (m_is_direct)
+            {
+                VERIFY((ptr_t)data % m_direct_io_alignment == 0);
+                VERIFY(size % m_direct_io_alignment == 0);
+                VERIFY(offset % m_direct_io_alignment == 0);
+            }
         }
 
-    private:
-        explicit File(_IO_FILE* handle) :
-            m_handle(handle), m_is_open(true)
+        ResultOrError<size_t, OSError> vectored_at(Span<Span<u8>> buffers, u64 offset, bool write) const
         {
+            static constexpr size_t batch_size = 64;
+            iovec iovecs[batch_size];
+            size_t done = 0;
+            size_t index = 0;
+            size_t skip = 0;
+            while (index < buffers.size())
+            {
+                size_t count = 0;
+                size_t wanted = 0;
+                for (size_t i = index; i < buffers.size() && count < batch_size; i++, count++)
+                {
+                    auto first = i == index ? skip : 0;
+                    verify_direct_io(buffers[i].data() + first, buffers[i].size() - first, offset + done + wanted);
+                    iovecs[count] = { buffers[i].data() + first, buffers[i].size() - first };
+                    wanted += buffers[i].size() - first;
+                }
+
+                auto result = write ? ::pwritev(m_fd, iovecs, (int)count, (off_t)(offset + done))
+                                    : ::preadv(m_fd, iovecs, (int)count, (off_t)(offset + done));
+                if (result == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    if (done == 0)
+                        return (OSError)errno;
+                    break;
+                }
+                if (result == 0 && wanted != 0)
+                    break;
+
+                done += (size_t)result;
+                // Step over the buffers this call filled, a partial one is resumed where it stopped.
+                auto advanced = (size_t)result + skip;
+                skip = 0;
+                while (index < buffers.size() && advanced >= buffers[index].size())
+                {
+                    advanced -= buffers[index].size();
+                    index++;
+                }
+                skip = advanced;
+            }
+            return done;
         }
 
-        _IO_FILE* m_handle { nullptr };
+        int m_fd { -1 };
         bool m_is_open { false };
+        bool m_is_direct { false };
+        size_t m_direct_io_alignment { 0 };
+        bool m_eof { false };
+        bool m_has_error { false };
+        u8* m_read_buffer { nullptr };
+        size_t m_read_start { 0 };
+        size_t m_read_end { 0 };
+    };
+
+    // Group commit for fdatasync: every thread calling sync() returns once a sync that started after its call
+    // finished, and threads arriving while one runs share the next. N concurrent writers cost about two syncs
+    // instead of N.
+    class DataSyncBatcher
+    {
+    public:
+        explicit DataSyncBatcher(File& file) :
+            m_file(file)
+        {
+        }
+
+        DataSyncBatcher(DataSyncBatcher const&) = delete;
+        DataSyncBatcher& operator=(DataSyncBatcher const&) = delete;
+
+        [[nodiscard]] Optional<OSError> sync()
+        {
+            m_lock.lock();
+            // A sync already running may have started before this caller's writes, so it needs the next one.
+            auto target = m_started + 1;
+            while (true)
+            {
+                auto completed = m_completed.load(Acquire);
+                if ((i32)(completed - target) >= 0)
+                {
+                    auto error = m_last_error;
+                    m_lock.unlock();
+                    return error;
+                }
+
+                if (!m_in_progress)
+                {
+                    m_in_progress = true;
+                    auto generation = ++m_started;
+                    m_lock.unlock();
+
+                    auto error = m_file.sync_data();
+
+                    m_lock.lock();
+                    m_last_error = error;
+                    m_in_progress = false;
+                    m_completed.store(generation, Release);
+                    m_lock.unlock();
+                    m_completed.notify_all();
+                    m_lock.lock();
+                    continue;
+                }
+
+                m_lock.unlock();
+                m_completed.wait(completed);
+                m_lock.lock();
+            }
+        }
+
+        // How many fdatasync calls ran, for seeing how well writes batch.
+        [[nodiscard]] u32 syncs() const
+        {
+            return m_completed.load(Relaxed);
+        }
+
+    private:
+        File& m_file;
+        SpinlockMutex m_lock;
+        u32 m_started { 0 };
+        bool m_in_progress { false };
+        Optional<OSError> m_last_error;
+        Atomic<u32> m_completed { 0 };
     };
 }
+using neo::DataSyncBatcher;
 using neo::File;
+using neo::FileOptions;
 using neo::SeekMode;
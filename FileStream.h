@@ -89,6 +89,22 @@ namespace neo
             return;
         }
 
+        Optional<NativeHandle> native_handle() override
+        {
+            auto position = m_file.getpos();
+            if (position.has_error() || m_file.flush().has_value())
+                return {};
+            return NativeHandle { m_file.fd(), position.result() };
+        }
+
+        void native_advance(size_t bytes) override
+        {
+            // The transfer used explicit offsets and left the descriptor position where native_handle() found it.
+            auto maybe_error = m_file.seek(SeekMode::Current, (long)bytes);
+            if (maybe_error.has_value())
+                m_last_error = maybe_error.value();
+        }
+
         File& file()
         {
             return m_file;
@@ -18,226 +18,255 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "Concepts.h"
 #include "TypeTraits.h"
 #include "Assert.h"
+#include "New.h"
+#include "Types.h"
+#include <stddef.h>
 
 namespace neo
 {
-    template<typename TReturn, typename... TArgs>
-    class Function
+    namespace detail
     {
-        struct CallableStorageView
+        enum class FunctionOperation
         {
-            virtual TReturn operator()(TArgs...) = 0;
-            virtual ~CallableStorageView() = default;
-            virtual CallableStorageView* clone() = 0;
+            Copy,
+            // Move constructs into the destination and destroys the source.
+            Move,
+            Destroy
         };
 
-        template<typename TCallable>
-        struct CallableStorage : public CallableStorageView
+        // Type erased callable with InlineSize bytes of storage inside the object. A callable that fits there is
+        // stored in place; a larger one goes on the heap and the buffer holds the pointer. Calls go through one
+        // function pointer kept in the object, copies/moves/destruction through a second one, so there is no
+        // virtual dispatch and no allocation for small captures.
+        template<size_t InlineSize, bool Copyable, typename TReturn, typename... TArgs>
+        class BasicFunction
         {
-            CallableStorage(TCallable callable) :
-                m_callable(callable) { }
-            ~CallableStorage() = default;
+            static_assert(InlineSize >= sizeof(void*), "the inline buffer has to hold at least a pointer");
+
+            template<typename TCallable>
+            using Stored = RemoveCV<RemoveReference<TCallable>>;
+
+        public:
+            static constexpr size_t inline_size = InlineSize;
 
-            TCallable m_callable;
+            BasicFunction() = default;
 
-            virtual TReturn operator()(TArgs... args) override
+            BasicFunction(BasicFunction const& other) requires(Copyable) :
+                m_invoke(other.m_invoke), m_manage(other.m_manage)
             {
-                if constexpr (IsSame<TReturn, void>)
-                    m_callable(forward<TArgs>(args)...);
-                else
-                    return m_callable(forward<TArgs>(args)...);
+                if (m_manage != nullptr)
+                    m_manage(FunctionOperation::Copy, const_cast<u8*>(other.m_storage), m_storage);
             }
 
-            virtual CallableStorage* clone() override
+            BasicFunction(BasicFunction&& other) :
+                m_invoke(other.m_invoke), m_manage(other.m_manage)
             {
-                return new CallableStorage(m_callable);
+                if (m_manage != nullptr)
+                    m_manage(FunctionOperation::Move, other.m_storage, m_storage);
+                other.m_invoke = nullptr;
+                other.m_manage = nullptr;
             }
-        };
-
-    public:
-
-        Function()
-        {
-        }
-
-        Function(Function const& other)
-        {
-            if (m_callable_ptr != nullptr)
-                delete m_callable_ptr;
-
-            m_callable_ptr = other.m_callable_ptr->clone();
-        }
 
-        Function(Function&& other)
-        {
-            if (m_callable_ptr != nullptr)
-                delete m_callable_ptr;
+            template<typename TCallable>
+            requires(!IsSame<Stored<TCallable>, BasicFunction> && CallableWithReturnType<Stored<TCallable>&, TReturn, TArgs...> && (!Copyable || CopyConstructable<Stored<TCallable>>))
+            BasicFunction(TCallable&& callable)
+            {
+                emplace(forward<TCallable>(callable));
+            }
 
-            m_callable_ptr = other.m_callable_ptr;
-            other.m_callable_ptr = m_callable_ptr;
-        }
+            ~BasicFunction()
+            {
+                reset();
+            }
 
-        Function& operator=(Function const& other)
-        {
-            if (this == &other)
+            BasicFunction& operator=(BasicFunction const& other) requires(Copyable)
+            {
+                if (this == &other)
+                    return *this;
+                this->~BasicFunction();
+                new (this) BasicFunction(other);
                 return *this;
-            new (this) Function(other);
-            return *this;
-        }
+            }
 
-        Function& operator=(Function&& other)
-        {
-            if (this == &other)
+            BasicFunction& operator=(BasicFunction&& other)
+            {
+                if (this == &other)
+                    return *this;
+                this->~BasicFunction();
+                new (this) BasicFunction(std::move(other));
                 return *this;
-            new (this) Function(std::move(other));
-            return *this;
-        }
-
-        template<CallableWithReturnType<TReturn, TArgs...> Callable>
-        Function(Callable const& callable) :
-            m_callable_ptr(new CallableStorage<Callable> { callable })
-        {
-        }
-
-        template<CallableWithReturnType<TReturn, TArgs...> Callable>
-        Function& operator=(Callable callable)
-        {
-            if (m_callable_ptr != nullptr)
-                delete m_callable_ptr;
-            m_callable_ptr = new CallableStorage<Callable> { callable };
+            }
 
-            return *this;
-        }
+            template<typename TCallable>
+            requires(!IsSame<Stored<TCallable>, BasicFunction> && CallableWithReturnType<Stored<TCallable>&, TReturn, TArgs...> && (!Copyable || CopyConstructable<Stored<TCallable>>))
+            BasicFunction& operator=(TCallable&& callable)
+            {
+                reset();
+                emplace(forward<TCallable>(callable));
+                return *this;
+            }
 
-        TReturn operator()(TArgs... args) const requires(PackSize<TArgs...> > 0)
-        {
-            VERIFY(m_callable_ptr != nullptr);
-            if constexpr (IsSame<TReturn, void>)
-                m_callable_ptr->operator()(forward<TArgs>(args)...);
-            else
-                return m_callable_ptr->operator()(forward<TArgs>(args)...);
-        }
-
-        TReturn operator()() const requires(PackSize<TArgs...> == 0)
-        {
-            VERIFY(m_callable_ptr != nullptr);
-            if constexpr (IsSame<TReturn, void>)
-                m_callable_ptr->operator()();
-            else
-                return m_callable_ptr->operator()();
-        }
-
-        bool is_valid()
-        {
-            return m_callable_ptr != nullptr;
-        }
+            TReturn operator()(TArgs... args) const
+            {
+                VERIFY(m_invoke != nullptr);
+                return m_invoke(const_cast<u8*>(m_storage), forward<TArgs>(args)...);
+            }
 
-    private:
-        CallableStorageView* m_callable_ptr { nullptr };
-    };
+            bool is_valid() const
+            {
+                return m_invoke != nullptr;
+            }
 
-    template<typename TReturn>
-    class Function<TReturn, void>
-    {
-        struct CallableStorageView
-        {
-            virtual TReturn operator()() = 0;
-            virtual ~CallableStorageView() = default;
-            virtual CallableStorageView* clone() = 0;
-        };
+            explicit operator bool() const
+            {
+                return m_invoke != nullptr;
+            }
 
-        template<typename TCallable>
-        struct CallableStorage : public CallableStorageView
-        {
-            CallableStorage(TCallable callable) :
-                m_callable(callable) { }
-            ~CallableStorage() = default;
+            void reset()
+            {
+                if (m_manage != nullptr)
+                    m_manage(FunctionOperation::Destroy, m_storage, nullptr);
+                m_invoke = nullptr;
+                m_manage = nullptr;
+            }
 
-            TCallable m_callable;
+            // Whether TCallable would be stored without allocating.
+            template<typename TCallable>
+            static constexpr bool stores_inline = sizeof(TCallable) <= InlineSize && alignof(TCallable) <= alignof(max_align_t);
 
-            virtual TReturn operator()() override
+        private:
+            template<typename TCallable>
+            void emplace(TCallable&& callable)
             {
-                if constexpr (IsSame<TReturn, void>)
-                    m_callable();
+                using T = Stored<TCallable>;
+                if constexpr (stores_inline<T>)
+                {
+                    new (m_storage) T(forward<TCallable>(callable));
+                    m_invoke = [](u8* storage, TArgs&&... args) -> TReturn
+                    { return (*(T*)storage)(forward<TArgs>(args)...); };
+                    m_manage = &manage_inline<T>;
+                }
                 else
-                    return m_callable();
+                {
+                    *(T**)m_storage = new T(forward<TCallable>(callable));
+                    m_invoke = [](u8* storage, TArgs&&... args) -> TReturn
+                    { return (**(T**)storage)(forward<TArgs>(args)...); };
+                    m_manage = &manage_heap<T>;
+                }
             }
 
-            virtual CallableStorage* clone() override
+            template<typename T>
+            static void manage_inline(FunctionOperation operation, u8* from, u8* to)
             {
-                return new CallableStorage(m_callable);
+                auto* callable = (T*)from;
+                if constexpr (Copyable)
+                {
+                    if (operation == FunctionOperation::Copy)
+                    {
+                        new (to) T(*callable);
+                        return;
+                    }
+                }
+                if (operation == FunctionOperation::Move)
+                    new (to) T(std::move(*callable));
+                callable->~T();
             }
+
+            template<typename T>
+            static void manage_heap(FunctionOperation operation, u8* from, u8* to)
+            {
+                auto* callable = *(T**)from;
+                if constexpr (Copyable)
+                {
+                    if (operation == FunctionOperation::Copy)
+                    {
+                        *(T**)to = new T(*callable);
+                        return;
+                    }
+                }
+                if (operation == FunctionOperation::Move)
+                    *(T**)to = callable;
+                else
+                    delete callable;
+            }
+
+            alignas(max_align_t) u8 m_storage[InlineSize];
+            TReturn (*m_invoke)(u8*, TArgs&&...) { nullptr };
+            void (*m_manage)(FunctionOperation, u8*, u8*) { nullptr };
         };
 
-    public:
+        // Function<void, void> means no arguments, as it always has.
+        template<size_t InlineSize, bool Copyable, typename TReturn, typename... TArgs>
+        struct SelectFunction
+        {
+            using type = BasicFunction<InlineSize, Copyable, TReturn, TArgs...>;
+        };
 
-        Function()
+        template<size_t InlineSize, bool Copyable, typename TReturn>
+        struct SelectFunction<InlineSize, Copyable, TReturn, void>
         {
-        }
+            using type = BasicFunction<InlineSize, Copyable, TReturn>;
+        };
 
-        Function(Function const& other)
+        // A pointer to someone else's callable and a function that calls it, nothing to allocate or destroy.
+        template<typename TReturn, typename... TArgs>
+        class BasicFunctionRef
         {
-            delete m_callable_ptr;
+        public:
+            template<typename TCallable>
+            requires(!IsSame<RemoveCV<RemoveReference<TCallable>>, BasicFunctionRef> && CallableWithReturnType<RemoveReference<TCallable>&, TReturn, TArgs...>)
+            BasicFunctionRef(TCallable&& callable) :
+                m_callable((void*)__builtin_addressof(callable)),
+                m_invoke([](void* callable, TArgs&&... args) -> TReturn
+                    { return (*(RemoveReference<TCallable>*)callable)(forward<TArgs>(args)...); })
+            {
+            }
 
-            m_callable_ptr = other.m_callable_ptr->clone();
-        }
+            BasicFunctionRef(BasicFunctionRef const&) = default;
+            BasicFunctionRef& operator=(BasicFunctionRef const&) = default;
 
-        Function(Function&& other)
-        {
-            delete m_callable_ptr;
+            TReturn operator()(TArgs... args) const
+            {
+                return m_invoke(m_callable, forward<TArgs>(args)...);
+            }
 
-            m_callable_ptr = other.m_callable_ptr;
-            other.m_callable_ptr = m_callable_ptr;
-        }
+        private:
+            void* m_callable;
+            TReturn (*m_invoke)(void*, TArgs&&...);
+        };
 
-        Function& operator=(Function const& other)
+        template<typename TReturn, typename... TArgs>
+        struct SelectFunctionRef
         {
-            if (this == &other)
-                return *this;
-            new (this) Function(other);
-            return *this;
-        }
+            using type = BasicFunctionRef<TReturn, TArgs...>;
+        };
 
-        Function& operator=(Function&& other)
+        template<typename TReturn>
+        struct SelectFunctionRef<TReturn, void>
         {
-            if (this == &other)
-                return *this;
-            new (this) Function(std::move(other));
-            return *this;
-        }
+            using type = BasicFunctionRef<TReturn>;
+        };
+    }
 
-        template<CallableWithReturnType<TReturn> Callable>
-        Function(Callable const& callable) :
-            m_callable_ptr(new CallableStorage<Callable> { callable })
-        {
-        }
+    // Enough for a lambda capturing four pointers or references.
+    static constexpr size_t function_inline_size = 4 * sizeof(void*);
 
-        template<CallableWithReturnType<TReturn> Callable>
-        Function& operator=(Callable callable)
-        {
-            if (m_callable_ptr != nullptr)
-                delete m_callable_ptr;
-            m_callable_ptr = new CallableStorage<Callable> { callable };
+    // A copyable callable that stores captures up to InlineSize bytes without allocating.
+    template<size_t InlineSize, typename TReturn, typename... TArgs>
+    using InlineFunction = typename detail::SelectFunction<InlineSize, true, TReturn, TArgs...>::type;
 
-            return *this;
-        }
+    template<typename TReturn, typename... TArgs>
+    using Function = InlineFunction<function_inline_size, TReturn, TArgs...>;
 
-        TReturn operator()() const
-        {
-            VERIFY(m_callable_ptr != nullptr);
-            if constexpr (IsSame<TReturn, void>)
-                m_callable_ptr->operator()();
-            else
-                return m_callable_ptr->operator()();
-        }
-
-        bool is_valid()
-        {
-            return m_callable_ptr != nullptr;
-        }
+    // Move only, so it can hold move only captures such as an OwnPtr.
+    template<typename TReturn, typename... TArgs>
+    using UniqueFunction = typename detail::SelectFunction<function_inline_size, false, TReturn, TArgs...>::type;
 
-    private:
-        CallableStorageView* m_callable_ptr { nullptr };
-    };
+    // For callback parameters: refers to a callable that must outlive it, copies as two pointers.
+    template<typename TReturn, typename... TArgs>
+    using FunctionRef = typename detail::SelectFunctionRef<TReturn, TArgs...>::type;
 }
 using neo::Function;
+using neo::FunctionRef;
+using neo::InlineFunction;
+using neo::UniqueFunction;
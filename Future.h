@@ -15,43 +15,98 @@
  */
 #pragma once
 
+#include "Atomic.h"
+#include "Concepts.h"
+#include "Mutex.h"
 #include "SmartPtr.h"
 #include "Optional.h"
 #include "Memory.h"
+#include "Span.h"
+#include "Time.h"
+#include "TypeTraits.h"
+#include <time.h>
 
 namespace neo
 {
     namespace detail
     {
+        struct FutureContinuation
+        {
+            virtual ~FutureContinuation() = default;
+            virtual void run() = 0;
+
+            FutureContinuation* next { nullptr };
+        };
+
+        template<typename TFunc>
+        struct FutureContinuationStorage final : public FutureContinuation
+        {
+            template<typename TArg>
+            explicit FutureContinuationStorage(TArg&& f) :
+                func(forward<TArg>(f))
+            {
+            }
+
+            void run() override
+            {
+                func();
+            }
+
+            TFunc func;
+        };
+
         template<typename T>
-        class FutureState
+        class FutureState : public RefCounted<FutureState<T>>
         {
         public:
+            enum Status : u32
+            {
+                Pending,
+                Ready,
+                Broken
+            };
+
             FutureState() = default;
 
+            ~FutureState()
+            {
+                // Only reachable if the state was never completed, which Promise doesn't allow.
+                while (m_continuations != nullptr)
+                    delete exchange_continuations(m_continuations->next);
+            }
+
             void set_value(T const& value)
             {
+                VERIFY(m_status.load(Acquire) == Pending);
                 m_object = value;
+                complete(Ready);
             }
 
             void set_value(T&& value)
             {
+                VERIFY(m_status.load(Acquire) == Pending);
                 m_object = std::move(value);
+                complete(Ready);
             }
 
             void break_promise()
             {
-                m_broken = true;
+                complete(Broken);
             }
 
             [[nodiscard]] bool has_value() const
             {
-                return m_object.has_value();
+                return m_status.load(Acquire) == Ready;
             }
 
             [[nodiscard]] bool is_broken() const
             {
-                return m_broken;
+                return m_status.load(Acquire) == Broken;
+            }
+
+            [[nodiscard]] bool is_completed() const
+            {
+                return m_status.load(Acquire) != Pending;
             }
 
             [[nodiscard]] T& value()
@@ -61,12 +116,109 @@ namespace neo
 
             [[nodiscard]] T release_value()
             {
-                return m_object.release_value();
+                return std::move(m_object.value());
+            }
+
+            void wait() const
+            {
+                auto status = m_status.load(Acquire);
+                if (status != Pending)
+                    return;
+
+                m_waiters.add_fetch(1, SequentiallyConsistent);
+                while (status == Pending)
+                {
+                    m_status.wait(Pending);
+                    status = m_status.load(Acquire);
+                }
+                m_waiters.sub_fetch(1, Relaxed);
+            }
+
+            // false if the timeout expired first
+            [[nodiscard]] bool wait_for(Time const& timeout) const
+            {
+                auto status = m_status.load(Acquire);
+                if (status != Pending)
+                    return true;
+
+                auto deadline = Timer::now().to_nanoseconds() + timeout.to_nanoseconds();
+                m_waiters.add_fetch(1, SequentiallyConsistent);
+                while (status == Pending)
+                {
+                    auto now = Timer::now().to_nanoseconds();
+                    if (now >= deadline)
+                        break;
+                    auto remaining = deadline - now;
+                    timespec relative_timeout { (time_t)(remaining / 1000000000), (long)(remaining % 1000000000) };
+                    m_status.wait(Pending, relative_timeout);
+                    status = m_status.load(Acquire);
+                }
+                m_waiters.sub_fetch(1, Relaxed);
+                return status != Pending;
+            }
+
+            // Runs func once the state is ready or broken: right away if it already is, otherwise on the thread
+            // that completes it.
+            template<VoidCallable TFunc>
+            void on_completion(TFunc&& func)
+            {
+                auto* continuation = new FutureContinuationStorage<RemoveCV<RemoveReference<TFunc>>>(forward<TFunc>(func));
+                {
+                    ScopedLock lock(m_continuations_lock);
+                    if (m_status.load(Acquire) == Pending)
+                    {
+                        continuation->next = m_continuations;
+                        m_continuations = continuation;
+                        return;
+                    }
+                }
+                continuation->run();
+                delete continuation;
             }
 
         private:
+            FutureContinuation* exchange_continuations(FutureContinuation* new_list)
+            {
+                auto* old = m_continuations;
+                m_continuations = new_list;
+                return old;
+            }
+
+            void complete(Status status)
+            {
+                FutureContinuation* continuations;
+                {
+                    ScopedLock lock(m_continuations_lock);
+                    m_status.store(status, SequentiallyConsistent);
+                    continuations = exchange_continuations(nullptr);
+                }
+
+                if (m_waiters.load(SequentiallyConsistent) != 0)
+                    m_status.notify_all();
+
+                // The list is newest first, run in registration order.
+                FutureContinuation* ordered = nullptr;
+                while (continuations != nullptr)
+                {
+                    auto* next = continuations->next;
+                    continuations->next = ordered;
+                    ordered = continuations;
+                    continuations = next;
+                }
+                while (ordered != nullptr)
+                {
+                    auto* next = ordered->next;
+                    ordered->run();
+                    delete ordered;
+                    ordered = next;
+                }
+            }
+
+            mutable Atomic<u32> m_status { Pending };
+            mutable Atomic<u32> m_waiters { 0 };
             Optional<T> m_object {};
-            bool m_broken { false };
+            SpinlockMutex m_continuations_lock;
+            FutureContinuation* m_continuations { nullptr };
         };
     }
 
@@ -80,7 +232,7 @@ namespace neo
 
     public:
         Promise() :
-            m_state(create_refcounted<typename state::type>().release_nonnull())
+            m_state(new detail::FutureState<T>())
         {
         }
 
@@ -88,7 +240,7 @@ namespace neo
         {
             if (m_state.is_valid())
             {
-                if (!m_state->has_value())
+                if (!m_state->is_completed())
                     m_state->break_promise();
             }
         }
@@ -104,6 +256,7 @@ namespace neo
             if (this == &other)
                 return *this;
 
+            this->~Promise();
             new (this) Promise(std::move(other));
 
             return *this;
@@ -121,24 +274,21 @@ namespace neo
 
         [[nodiscard]] bool is_valid() const
         {
-            return !m_state.is_valid();
+            return m_state.is_valid();
         }
 
         void set_value(T const& value)
         {
-            VERIFY(!m_state->has_value());
             m_state->set_value(value);
         }
 
         void set_value(T&& value)
         {
-            VERIFY(!m_state->has_value());
             m_state->set_value(std::move(value));
         }
 
         Promise& operator=(T const& value)
         {
-            VERIFY(!m_state->has_value());
             m_state->set_value(value);
 
             return *this;
@@ -146,7 +296,6 @@ namespace neo
 
         Promise& operator=(T&& value)
         {
-            VERIFY(!m_state->has_value());
             m_state->set_value(std::move(value));
 
             return *this;
@@ -163,6 +312,8 @@ namespace neo
         using state = RefPtr<detail::FutureState<T>>;
 
     public:
+        using type = T;
+
         Future() = delete;
         Future(Future const& other) :
             m_state(other.m_state)
@@ -179,6 +330,7 @@ namespace neo
             if (this == &other)
                 return *this;
 
+            this->~Future();
             new (this) Future(other);
 
             return *this;
@@ -189,6 +341,7 @@ namespace neo
             if (this == &other)
                 return *this;
 
+            this->~Future();
             new (this) Future(std::move(other));
 
             return *this;
@@ -212,31 +365,99 @@ namespace neo
             return m_state->is_broken();
         }
 
+        // Either has a value or is broken.
+        [[nodiscard]] bool is_ready() const
+        {
+            VERIFY(m_state.is_valid());
+            return m_state->is_completed();
+        }
+
         [[nodiscard]] T& value()
         {
             wait();
+            VERIFY(!m_state->is_broken());
             return m_state->value();
         }
 
         [[nodiscard]] T const& value() const
         {
             wait();
+            VERIFY(!m_state->is_broken());
             return static_cast<T const&>(m_state->value());
         }
 
         [[nodiscard]] T release_value()
         {
             wait();
-            auto value = std::move(m_state->release_value());
-            m_state.clear();
-            return value;
+            VERIFY(!m_state->is_broken());
+            return m_state->release_value();
         }
 
+        // Blocks until the future is ready or broken.
         void wait() const
         {
             VERIFY(m_state.is_valid());
-            while (!m_state->has_value())
-                ;
+            m_state->wait();
+        }
+
+        // Same as wait(), false if the timeout expired first.
+        [[nodiscard]] bool wait_for(Time const& timeout) const
+        {
+            VERIFY(m_state.is_valid());
+            return m_state->wait_for(timeout);
+        }
+
+        // Calls func() once the future is ready or broken, on the thread that completes it, or right away if it
+        // already is.
+        template<VoidCallable TFunc>
+        void on_completion(TFunc&& func)
+        {
+            VERIFY(m_state.is_valid());
+            m_state->on_completion(forward<TFunc>(func));
+        }
+
+        // Calls func(value) once the value is set, on the thread that sets it, or right away if it already is.
+        // Returns a future for func's result, which is broken if this one is. If func returns void nothing is
+        // returned.
+        template<Callable<T&> TFunc>
+        auto then(TFunc&& func)
+        {
+            VERIFY(m_state.is_valid());
+            using TResult = ReturnType<TFunc, T&>;
+            auto* state = &m_state.leak_ref();
+            if constexpr (IsSame<TResult, void>)
+            {
+                m_state->on_completion([state, func = forward<TFunc>(func)]() mutable
+                    {
+                        if (state->has_value())
+                            func(state->value()); });
+            }
+            else
+            {
+                Promise<TResult> promise;
+                auto future = promise.get_future();
+                m_state->on_completion([state, promise = std::move(promise), func = forward<TFunc>(func)]() mutable
+                    {
+                        if (state->has_value())
+                            promise.set_value(func(state->value())); });
+                return future;
+            }
+        }
+
+        // Same as then(func), but func runs as a task on executor (e.g. a ThreadPool) instead of inline.
+        template<Callable<T&> TFunc, typename TExecutor>
+        requires(!IsSame<ReturnType<TFunc, T&>, void>) Future<ReturnType<TFunc, T&>> then(TFunc&& func, TExecutor& executor)
+        {
+            VERIFY(m_state.is_valid());
+            Promise<ReturnType<TFunc, T&>> promise;
+            auto future = promise.get_future();
+            m_state->on_completion([state = m_state, &executor, promise = std::move(promise), func = forward<TFunc>(func)]() mutable
+                {
+                    if (!state->has_value())
+                        return;
+                    executor.execute([state, promise = std::move(promise), func = std::move(func)]() mutable
+                        { promise.set_value(func(state->value())); }); });
+            return future;
         }
 
     private:
@@ -247,6 +468,58 @@ namespace neo
 
         state m_state;
     };
+
+    // Ready, with the number of futures, once every future in the span is ready or broken.
+    template<typename T>
+    [[nodiscard]] Future<size_t> when_all(Span<Future<T>> futures)
+    {
+        struct Join
+        {
+            Atomic<size_t> remaining;
+            Promise<size_t> promise;
+        };
+
+        RefPtr<Join> join = create_refcounted<Join>(futures.size(), Promise<size_t> {}).release_nonnull();
+        auto all = join->promise.get_future();
+        if (futures.size() == 0)
+        {
+            join->promise.set_value(0);
+            return all;
+        }
+
+        for (size_t i = 0; i < futures.size(); i++)
+        {
+            futures[i].on_completion([join, count = futures.size()]() mutable
+                {
+                    if (join->remaining.sub_fetch(1, AcquireRelease) == 0)
+                        join->promise.set_value(count); });
+        }
+        return all;
+    }
+
+    // Ready, with the index of the first future in the span that became ready or broken. Broken if the span is empty.
+    template<typename T>
+    [[nodiscard]] Future<size_t> when_any(Span<Future<T>> futures)
+    {
+        struct Race
+        {
+            Atomic<bool> finished;
+            Promise<size_t> promise;
+        };
+
+        RefPtr<Race> race = create_refcounted<Race>(false, Promise<size_t> {}).release_nonnull();
+        auto any = race->promise.get_future();
+        for (size_t i = 0; i < futures.size(); i++)
+        {
+            futures[i].on_completion([race, i]() mutable
+                {
+                    if (!race->finished.exchange(true, AcquireRelease))
+                        race->promise.set_value(i); });
+        }
+        return any;
+    }
 }
 using neo::Future;
 using neo::Promise;
+using neo::when_all;
+using neo::when_any;
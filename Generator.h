@@ -14,20 +14,23 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#pragma once
 #include "Concepts.h"
 #include "Assert.h"
+#include "Coroutine.h"
+#include "New.h"
 #include "NumericLimits.h"
 
 namespace neo
 {
     template<typename T, typename TState, typename TPump, typename TRewindFunc, typename TValueExtractor>
-    class GeneratorIterator
+    class FunctorGeneratorIterator
     {
     public:
         using type = T;
-        using iterator_type = GeneratorIterator;
-        using underlying_container_type = GeneratorIterator;
-        constexpr GeneratorIterator(TPump pump, TRewindFunc rewind, TValueExtractor extractor, TState initial_state, bool exhausted = false) :
+        using iterator_type = FunctorGeneratorIterator;
+        using underlying_container_type = FunctorGeneratorIterator;
+        constexpr FunctorGeneratorIterator(TPump pump, TRewindFunc rewind, TValueExtractor extractor, TState initial_state, bool exhausted = false) :
             m_pump(pump), m_rewind(rewind), m_value_extractor(extractor), m_state(initial_state), m_exhausted(exhausted) { }
 
         constexpr T operator*()
@@ -35,26 +38,26 @@ namespace neo
             return m_value_extractor(m_state);
         }
 
-        constexpr GeneratorIterator& operator++()
+        constexpr FunctorGeneratorIterator& operator++()
         {
             m_pump(m_state, m_exhausted);
             return *this;
         }
 
-        constexpr GeneratorIterator operator++(int)
+        constexpr FunctorGeneratorIterator operator++(int)
         {
             auto prev = *this;
             m_pump(m_state, m_exhausted);
             return prev;
         }
 
-        constexpr GeneratorIterator& operator--()
+        constexpr FunctorGeneratorIterator& operator--()
         {
             m_rewind(m_state, m_exhausted);
             return *this;
         }
 
-        constexpr GeneratorIterator operator--(int)
+        constexpr FunctorGeneratorIterator operator--(int)
         {
             auto current = *this;
             m_rewind(m_state, m_exhausted);
@@ -66,7 +69,7 @@ namespace neo
             return m_exhausted;
         }
 
-        constexpr bool operator==(GeneratorIterator const& right) const
+        constexpr bool operator==(FunctorGeneratorIterator const& right) const
         {
             if (m_state == right.m_state)
                 return true;
@@ -84,20 +87,21 @@ namespace neo
     template<typename T, typename TState = T>
     struct GeneratorUtil;
 
+    // Generator driven by pump, rewind and extractor functors over an explicit state, see Generators below.
     template<typename T, typename TState, typename TPump, typename TRewindFunc, typename TValueExtractor>
-    class Generator
+    class FunctorGenerator
     {
         friend GeneratorUtil<T, TState>;
 
     public:
         constexpr auto begin() const
         {
-            return GeneratorIterator<T, TState, TPump, TRewindFunc, TValueExtractor>(m_pump, m_rewind, m_value_extractor, m_initial_state, false);
+            return FunctorGeneratorIterator<T, TState, TPump, TRewindFunc, TValueExtractor>(m_pump, m_rewind, m_value_extractor, m_initial_state, false);
         }
 
         constexpr auto end() const
         {
-            return GeneratorIterator<T, TState, TPump, TRewindFunc, TValueExtractor>(m_pump, m_rewind, m_value_extractor, m_end_state, true);
+            return FunctorGeneratorIterator<T, TState, TPump, TRewindFunc, TValueExtractor>(m_pump, m_rewind, m_value_extractor, m_end_state, true);
         }
 
         constexpr size_t generate_into(auto range_start, auto range_end)
@@ -114,7 +118,7 @@ namespace neo
         }
 
     private:
-        explicit constexpr Generator(
+        explicit constexpr FunctorGenerator(
             TPump pump, TRewindFunc rewind, TValueExtractor extractor,
             TState initial_state,
             TState end_state) :
@@ -134,10 +138,130 @@ namespace neo
     {
         static constexpr auto create_generator(auto pump, auto rewind, auto extractor, TState initial_state, TState end_state)
         {
-            return Generator<T, TState, decltype(pump), decltype(rewind), decltype(extractor)>(pump, rewind, extractor, initial_state, end_state);
+            return FunctorGenerator<T, TState, decltype(pump), decltype(rewind), decltype(extractor)>(pump, rewind, extractor, initial_state, end_state);
         }
     };
 
+    // Coroutine generator: each co_yield hands one value to the consumer and suspends until the next one is
+    // asked for. Values are referenced in place, nothing is copied out of the coroutine frame.
+    template<typename T>
+    class [[nodiscard]] Generator
+    {
+    public:
+        struct promise_type
+        {
+            Generator get_return_object()
+            {
+                return Generator(CoroutineHandle<promise_type>::from_promise(*this));
+            }
+
+            SuspendAlways initial_suspend() const noexcept { return {}; }
+            SuspendAlways final_suspend() const noexcept { return {}; }
+            void return_void() const noexcept { }
+            void unhandled_exception() { VERIFY_NOT_REACHED(); }
+
+            SuspendAlways yield_value(T& value) noexcept
+            {
+                current = &value;
+                return {};
+            }
+
+            SuspendAlways yield_value(T&& value) noexcept
+            {
+                current = &value;
+                return {};
+            }
+
+            T* current { nullptr };
+        };
+
+        class Iterator
+        {
+        public:
+            using type = T;
+
+            Iterator() = default;
+
+            T& operator*() const
+            {
+                return *m_handle.promise().current;
+            }
+
+            Iterator& operator++()
+            {
+                m_handle.resume();
+                return *this;
+            }
+
+            bool is_end() const
+            {
+                return !m_handle || m_handle.done();
+            }
+
+            bool operator==(Iterator const& other) const
+            {
+                return is_end() == other.is_end();
+            }
+
+        private:
+            friend Generator;
+
+            explicit Iterator(CoroutineHandle<promise_type> handle) :
+                m_handle(handle)
+            {
+            }
+
+            CoroutineHandle<promise_type> m_handle {};
+        };
+
+        Generator(Generator const&) = delete;
+        Generator& operator=(Generator const&) = delete;
+
+        Generator(Generator&& other) :
+            m_handle(other.m_handle)
+        {
+            other.m_handle = nullptr;
+        }
+
+        Generator& operator=(Generator&& other)
+        {
+            if (this == &other)
+                return *this;
+
+            this->~Generator();
+            new (this) Generator(std::move(other));
+
+            return *this;
+        }
+
+        ~Generator()
+        {
+            if (m_handle)
+                m_handle.destroy();
+        }
+
+        // Starts the coroutine, a generator can only be iterated once.
+        Iterator begin()
+        {
+            VERIFY(m_handle);
+            m_handle.resume();
+            return Iterator(m_handle);
+        }
+
+        Iterator end()
+        {
+            return Iterator();
+        }
+
+    private:
+        explicit Generator(CoroutineHandle<promise_type> handle) :
+            m_handle(handle)
+        {
+        }
+
+        CoroutineHandle<promise_type> m_handle {};
+    };
+
     // Default generators
 
     namespace Generators
@@ -159,6 +283,7 @@ namespace neo
 
     }
 }
+using neo::FunctorGenerator;
+using neo::FunctorGeneratorIterator;
 using neo::Generator;
-using neo::GeneratorIterator;
 using neo::GeneratorUtil;
@@ -110,10 +110,11 @@ namespace neo
                 { return a.priority < b.priority; });
         }
 
-        [[nodiscard]] Vector<GenericLexerToken> tokenize(String const& source)
+        // Tokens copy what they match, the source itself is only viewed, so it can be e.g. a MappedFile.
+        [[nodiscard]] Vector<GenericLexerToken> tokenize(StringView const& source)
         {
             Vector<GenericLexerToken> tokens;
-            MultilineStringIterator current = source.to_view().begin(), end = source.to_view().end(), tmp = source.to_view().begin();
+            MultilineStringIterator current = source.begin(), end = source.end(), tmp = source.begin();
             String chunk;
 
             while (current != end)
@@ -0,0 +1,861 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Assert.h"
+#include "Atomic.h"
+#include "File.h"
+#include "Future.h"
+#include "OSError.h"
+#include "ResultOrError.h"
+#include "SmartPtr.h"
+#include "Socket.h"
+#include "Span.h"
+#include "Vector.h"
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace neo
+{
+    // Bytes transferred, or the accepted fd for accept().
+    using IOResult = ResultOrError<size_t, OSError>;
+
+    enum class IOBackend
+    {
+        Auto,
+        IoUring,
+        Fallback
+    };
+
+    enum class IOFlags : u8
+    {
+        None = 0,
+        // The next operation only starts once this one succeeded, and is cancelled if it fails.
+        Link = 1
+    };
+
+    // Index into the files registered with IOEngine::register_files().
+    struct FixedFile
+    {
+        u32 index;
+    };
+
+    class IOTarget
+    {
+    public:
+        IOTarget(int fd) :
+            m_value(fd), m_is_fixed(false)
+        {
+        }
+
+        IOTarget(FixedFile file) :
+            m_value((int)file.index), m_is_fixed(true)
+        {
+        }
+
+        IOTarget(File const& file) :
+            IOTarget(file.fd())
+        {
+        }
+
+        IOTarget(TCPSocket const& socket) :
+            IOTarget(socket.fd())
+        {
+        }
+
+        IOTarget(TCPListener const& listener) :
+            IOTarget(listener.fd())
+        {
+        }
+
+        int value() const
+        {
+            return m_value;
+        }
+
+        bool is_fixed() const
+        {
+            return m_is_fixed;
+        }
+
+    private:
+        int m_value;
+        bool m_is_fixed;
+    };
+
+    namespace detail
+    {
+        struct IOOperation
+        {
+            enum Kind : u8
+            {
+                Read,
+                Write,
+                ReadFixed,
+                WriteFixed,
+                Receive,
+                Send,
+                Accept
+            };
+
+            Kind kind;
+            IOTarget target;
+            u8* data;
+            size_t length;
+            u64 offset;
+            u16 buffer_index;
+            bool link;
+            Promise<IOResult> promise {};
+
+            // io_uring: neighbours in the engine's list of operations in flight. Fallback: next in the queued or
+            // completed list, the operation linked after this one, and the result waiting to be delivered.
+            IOOperation* next { nullptr };
+            IOOperation* previous { nullptr };
+            IOOperation* linked_next { nullptr };
+            i64 result { 0 };
+        };
+
+        // Raw submission and completion rings of an io_uring instance.
+        class IORing
+        {
+        public:
+            IORing() = default;
+            IORing(IORing const&) = delete;
+            IORing& operator=(IORing const&) = delete;
+
+            ~IORing()
+            {
+                if (m_fd == -1)
+                    return;
+                ::munmap(m_sqes, m_sq_entries * sizeof(io_uring_sqe));
+                if (m_cq_ring != m_sq_ring)
+                    ::munmap(m_cq_ring, m_cq_ring_size);
+                ::munmap(m_sq_ring, m_sq_ring_size);
+                ::close(m_fd);
+            }
+
+            // Fails if the kernel has no io_uring or lacks one of the operations IOEngine uses.
+            Optional<OSError> setup(u32 entries)
+            {
+                io_uring_params params {};
+                params.flags = IORING_SETUP_CLAMP;
+                auto fd = (int)::syscall(__NR_io_uring_setup, entries, &params);
+                if (fd == -1)
+                    return (OSError)errno;
+                m_fd = fd;
+
+                if (!supports_required_operations())
+                {
+                    errno = ENOSYS;
+                    return fail_setup();
+                }
+
+                m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+                m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+                if (single_mmap)
+                    m_sq_ring_size = m_cq_ring_size = max(m_sq_ring_size, m_cq_ring_size);
+
+                auto* sq_ring = ::mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+                if (sq_ring == MAP_FAILED)
+                    return fail_setup();
+                m_sq_ring = (u8*)sq_ring;
+
+                if (single_mmap)
+                {
+                    m_cq_ring = m_sq_ring;
+                }
+                else
+                {
+                    auto* cq_ring = ::mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                    if (cq_ring == MAP_FAILED)
+                        return fail_setup();
+                    m_cq_ring = (u8*)cq_ring;
+                }
+
+                auto* sqes = ::mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+                if (sqes == MAP_FAILED)
+                    return fail_setup();
+                m_sqes = (io_uring_sqe*)sqes;
+
+                // The ring indices are shared with the kernel, Atomic<u32> has the same layout as u32.
+                m_sq_head = (Atomic<u32>*)(m_sq_ring + params.sq_off.head);
+                m_sq_tail = (Atomic<u32>*)(m_sq_ring + params.sq_off.tail);
+                m_sq_array = (u32*)(m_sq_ring + params.sq_off.array);
+                m_sq_mask = *(u32*)(m_sq_ring + params.sq_off.ring_mask);
+                m_sq_entries = params.sq_entries;
+                m_cq_head = (Atomic<u32>*)(m_cq_ring + params.cq_off.head);
+                m_cq_tail = (Atomic<u32>*)(m_cq_ring + params.cq_off.tail);
+                m_cqes = (io_uring_cqe*)(m_cq_ring + params.cq_off.cqes);
+                m_cq_mask = *(u32*)(m_cq_ring + params.cq_off.ring_mask);
+                m_cq_entries = params.cq_entries;
+                m_local_tail = m_sq_tail->load(Relaxed);
+                m_submitted_tail = m_local_tail;
+                return {};
+            }
+
+            // A zeroed entry to fill, nullptr if the submission ring is full until the next submit().
+            io_uring_sqe* next_sqe()
+            {
+                if (m_local_tail - m_sq_head->load(Acquire) == m_sq_entries)
+                    return nullptr;
+
+                auto index = m_local_tail & m_sq_mask;
+                auto* sqe = &m_sqes[index];
+                __builtin_memset(sqe, 0, sizeof(io_uring_sqe));
+                m_sq_array[index] = index;
+                m_local_tail++;
+                return sqe;
+            }
+
+            // Hands every queued entry to the kernel in one io_uring_enter, optionally waiting for completions.
+            Optional<OSError> submit(u32 wait_for)
+            {
+                m_sq_tail->store(m_local_tail, Release);
+                while (true)
+                {
+                    auto to_submit = m_local_tail - m_submitted_tail;
+                    if (to_submit == 0 && wait_for == 0)
+                        return {};
+
+                    auto flags = wait_for != 0 ? IORING_ENTER_GETEVENTS : 0;
+                    auto submitted = ::syscall(__NR_io_uring_enter, m_fd, to_submit, wait_for, flags, nullptr, 0);
+                    if (submitted == -1)
+                    {
+                        if (errno == EINTR)
+                            continue;
+                        return (OSError)errno;
+                    }
+                    m_submitted_tail += (u32)submitted;
+                    return {};
+                }
+            }
+
+            bool has_unsubmitted() const
+            {
+                return m_local_tail != m_submitted_tail;
+            }
+
+            // Calls on_completion(user_data, result) for every completion posted so far.
+            template<typename TFunc>
+            size_t reap(TFunc&& on_completion)
+            {
+                auto head = m_cq_head->load(Relaxed);
+                auto tail = m_cq_tail->load(Acquire);
+                size_t count = 0;
+                while (head != tail)
+                {
+                    auto& cqe = m_cqes[head & m_cq_mask];
+                    auto user_data = cqe.user_data;
+                    auto result = cqe.res;
+                    head++;
+                    // Give the slot back before running the completion, which may queue more work.
+                    m_cq_head->store(head, Release);
+                    on_completion(user_data, result);
+                    count++;
+                    tail = m_cq_tail->load(Acquire);
+                }
+                return count;
+            }
+
+            Optional<OSError> register_resource(unsigned opcode, void* resources, u32 count)
+            {
+                if (::syscall(__NR_io_uring_register, m_fd, opcode, resources, count) == -1)
+                    return (OSError)errno;
+                return {};
+            }
+
+            u32 completion_capacity() const
+            {
+                return m_cq_entries;
+            }
+
+        private:
+            bool supports_required_operations()
+            {
+                constexpr u32 probe_ops = 256;
+                alignas(io_uring_probe) u8 storage[sizeof(io_uring_probe) + probe_ops * sizeof(io_uring_probe_op)] {};
+                auto* probe = (io_uring_probe*)storage;
+                if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, probe_ops) == -1)
+                    return false;
+
+                u8 required[] { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ACCEPT };
+                for (auto op : required)
+                {
+                    if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                        return false;
+                }
+                return true;
+            }
+
+            OSError fail_setup()
+            {
+                auto error = (OSError)errno;
+                if (m_cq_ring != nullptr && m_cq_ring != m_sq_ring)
+                    ::munmap(m_cq_ring, m_cq_ring_size);
+                if (m_sq_ring != nullptr)
+                    ::munmap(m_sq_ring, m_sq_ring_size);
+                ::close(m_fd);
+                m_fd = -1;
+                return error;
+            }
+
+            int m_fd { -1 };
+            u8* m_sq_ring { nullptr };
+            u8* m_cq_ring { nullptr };
+            size_t m_sq_ring_size { 0 };
+            size_t m_cq_ring_size { 0 };
+            io_uring_sqe* m_sqes { nullptr };
+            Atomic<u32>* m_sq_head { nullptr };
+            Atomic<u32>* m_sq_tail { nullptr };
+            u32* m_sq_array { nullptr };
+            u32 m_sq_mask { 0 };
+            u32 m_sq_entries { 0 };
+            Atomic<u32>* m_cq_head { nullptr };
+            Atomic<u32>* m_cq_tail { nullptr };
+            io_uring_cqe* m_cqes { nullptr };
+            u32 m_cq_mask { 0 };
+            u32 m_cq_entries { 0 };
+            u32 m_local_tail { 0 };
+            u32 m_submitted_tail { 0 };
+        };
+    }
+
+    // Asynchronous file and socket I/O. Operations are queued and handed to the kernel in batches by submit(),
+    // their futures complete inside poll() and wait() on the calling thread, so an engine belongs to one thread.
+    // Runs on io_uring when the kernel supports it, otherwise on pread/pwrite and non-blocking socket calls with
+    // poll() for readiness.
+    class IOEngine
+    {
+    public:
+        IOEngine(IOEngine const&) = delete;
+        IOEngine& operator=(IOEngine const&) = delete;
+
+        static ResultOrError<OwnPtr<IOEngine>, OSError> create(u32 queue_depth = 256, IOBackend backend = IOBackend::Auto)
+        {
+            VERIFY(queue_depth != 0);
+            OwnPtr<IOEngine> engine(new IOEngine());
+            if (backend != IOBackend::Fallback)
+            {
+                auto error = engine->m_ring.setup(queue_depth);
+                if (!error.has_value())
+                {
+                    engine->m_backend = IOBackend::IoUring;
+                    return engine;
+                }
+                if (backend == IOBackend::IoUring)
+                    return error.value();
+            }
+            engine->m_backend = IOBackend::Fallback;
+            return engine;
+        }
+
+        ~IOEngine()
+        {
+            // Outstanding operations reference caller buffers, so they have to end before the ring goes away. A
+            // receive or accept nobody answers never would on its own.
+            cancel_all();
+            while (m_in_flight != 0)
+                wait(1);
+        }
+
+        IOBackend backend() const
+        {
+            return m_backend;
+        }
+
+        size_t in_flight() const
+        {
+            return m_in_flight;
+        }
+
+        // Pins the buffers for read_fixed_at()/write_fixed_at(), replacing any registered before.
+        Optional<OSError> register_buffers(Span<Span<u8>> buffers)
+        {
+            if (m_backend == IOBackend::IoUring)
+            {
+                if (!m_buffers.is_empty())
+                    m_ring.register_resource(IORING_UNREGISTER_BUFFERS, nullptr, 0);
+                Vector<iovec> iovecs;
+                for (size_t i = 0; i < buffers.size(); i++)
+                    iovecs.append(iovec { buffers[i].data(), buffers[i].size() });
+                auto error = m_ring.register_resource(IORING_REGISTER_BUFFERS, iovecs.data(), (u32)iovecs.size());
+                if (error.has_value())
+                    return error;
+            }
+
+            m_buffers.change_size(0);
+            for (size_t i = 0; i < buffers.size(); i++)
+                m_buffers.append(buffers[i]);
+            return {};
+        }
+
+        // Registers fds to be used as FixedFile { index }, which skips the per-operation fd lookup.
+        Optional<OSError> register_files(Span<int> fds)
+        {
+            if (m_backend == IOBackend::IoUring)
+            {
+                if (!m_files.is_empty())
+                    m_ring.register_resource(IORING_UNREGISTER_FILES, nullptr, 0);
+                auto error = m_ring.register_resource(IORING_REGISTER_FILES, fds.data(), (u32)fds.size());
+                if (error.has_value())
+                    return error;
+            }
+
+            m_files.change_size(0);
+            for (size_t i = 0; i < fds.size(); i++)
+                m_files.append(fds[i]);
+            return {};
+        }
+
+        // Reaching the end of the file completes with 0 bytes.
+        Future<IOResult> read_at(IOTarget file, Span<u8> into, u64 offset, IOFlags flags = IOFlags::None)
+        {
+            return queue(detail::IOOperation::Read, file, into.data(), into.size(), offset, 0, flags);
+        }
+
+        Future<IOResult> write_at(IOTarget file, Span<u8> const& from, u64 offset, IOFlags flags = IOFlags::None)
+        {
+            return queue(detail::IOOperation::Write, file, (u8*)from.data(), from.size(), offset, 0, flags);
+        }
+
+        // into must lie inside the buffer registered at buffer_index.
+        Future<IOResult> read_fixed_at(IOTarget file, u16 buffer_index, Span<u8> into, u64 offset, IOFlags flags = IOFlags::None)
+        {
+            verify_inside_buffer(buffer_index, into);
+            return queue(detail::IOOperation::ReadFixed, file, into.data(), into.size(), offset, buffer_index, flags);
+        }
+
+        Future<IOResult> write_fixed_at(IOTarget file, u16 buffer_index, Span<u8> const& from, u64 offset, IOFlags flags = IOFlags::None)
+        {
+            verify_inside_buffer(buffer_index, from);
+            return queue(detail::IOOperation::WriteFixed, file, (u8*)from.data(), from.size(), offset, buffer_index, flags);
+        }
+
+        // Completes with 0 bytes once the peer closed the connection.
+        Future<IOResult> receive(IOTarget socket, Span<u8> into, IOFlags flags = IOFlags::None)
+        {
+            return queue(detail::IOOperation::Receive, socket, into.data(), into.size(), 0, 0, flags);
+        }
+
+        Future<IOResult> send(IOTarget socket, Span<u8> const& from, IOFlags flags = IOFlags::None)
+        {
+            return queue(detail::IOOperation::Send, socket, (u8*)from.data(), from.size(), 0, 0, flags);
+        }
+
+        // Completes with the accepted fd, see TCPSocket::adopt().
+        Future<IOResult> accept(IOTarget listener, IOFlags flags = IOFlags::None)
+        {
+            return queue(detail::IOOperation::Accept, listener, nullptr, 0, 0, 0, flags);
+        }
+
+        // Hands every queued operation to the kernel at once.
+        Optional<OSError> submit()
+        {
+            if (m_backend == IOBackend::IoUring)
+                return m_ring.submit(0);
+
+            fallback_start_queued();
+            return {};
+        }
+
+        // Submits and completes whatever already finished, without blocking.
+        // \return The number of completed operations
+        size_t poll()
+        {
+            if (m_backend == IOBackend::IoUring)
+            {
+                m_ring.submit(0);
+                return reap();
+            }
+
+            fallback_start_queued();
+            if (!m_parked.is_empty())
+                fallback_poll_parked(0);
+            return fallback_deliver();
+        }
+
+        // Submits and blocks until at least min_completions operations completed, or none are left in flight.
+        // \return The number of completed operations
+        size_t wait(size_t min_completions = 1)
+        {
+            size_t completed = 0;
+            if (m_backend == IOBackend::IoUring)
+            {
+                while (true)
+                {
+                    completed += reap();
+                    if (completed >= min_completions || m_in_flight == 0)
+                        return completed;
+                    auto wait_for = (u32)min(min_completions - completed, m_in_flight);
+                    auto error = m_ring.submit(wait_for);
+                    VERIFY(!error.has_value() || error.value() == OSError::TryAgain || error.value() == OSError::DeviceOrResourceBusy);
+                }
+            }
+
+            fallback_start_queued();
+            while (true)
+            {
+                completed += fallback_deliver();
+                if (completed >= min_completions || m_in_flight == 0)
+                    return completed;
+                fallback_poll_parked(-1);
+            }
+        }
+
+        // Cancels every operation queued or in flight. Their futures complete in a later poll() or wait(): with
+        // OSError(ECANCELED), or with their own result if they finished first or can't be interrupted, like a read
+        // of a regular file already under way.
+        void cancel_all()
+        {
+            if (m_backend == IOBackend::IoUring)
+            {
+                for (auto* operation = m_in_flight_head; operation != nullptr; operation = operation->next)
+                {
+                    auto* sqe = m_ring.next_sqe();
+                    if (sqe == nullptr)
+                    {
+                        m_ring.submit(0);
+                        sqe = m_ring.next_sqe();
+                        VERIFY(sqe != nullptr);
+                    }
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->addr = (u64)operation;
+                    sqe->user_data = cancel_user_data;
+                }
+                m_ring.submit(0);
+                return;
+            }
+
+            auto* queued = m_queued_head;
+            m_queued_head = m_queued_tail = nullptr;
+            while (queued != nullptr)
+            {
+                auto* next = queued->next;
+                queued->next = nullptr;
+                fallback_complete(queued, -ECANCELED);
+                queued = next;
+            }
+            for (size_t i = 0; i < m_parked.size(); i++)
+                fallback_complete(m_parked[i], -ECANCELED);
+            m_parked.change_size(0);
+        }
+
+    private:
+        // Completions of IORING_OP_ASYNC_CANCEL, which belong to no operation.
+        static constexpr u64 cancel_user_data = 0;
+
+        IOEngine() = default;
+
+        void verify_inside_buffer([[maybe_unused]] u16 buffer_index, [[maybe_unused]] Span<u8> const& span) const
+        {
+            VERIFY(buffer_index < m_buffers.size());
+            [[maybe_unused]] auto const& buffer = m_buffers[buffer_index];
+            VERIFY(span.data() >= buffer.data() && span.data() + span.size() <= buffer.data() + buffer.size());
+        }
+
+        int fd_of(IOTarget target) const
+        {
+            if (!target.is_fixed())
+                return target.value();
+            VERIFY((size_t)target.value() < m_files.size());
+            return m_files[target.value()];
+        }
+
+        Future<IOResult> queue(detail::IOOperation::Kind kind, IOTarget target, u8* data, size_t length, u64 offset, u16 buffer_index, IOFlags flags)
+        {
+            auto* operation = new detail::IOOperation { kind, target, data, length, offset, buffer_index, flags == IOFlags::Link };
+            auto future = operation->promise.get_future();
+            m_in_flight++;
+
+            if (m_backend == IOBackend::IoUring)
+            {
+                operation->next = m_in_flight_head;
+                if (m_in_flight_head != nullptr)
+                    m_in_flight_head->previous = operation;
+                m_in_flight_head = operation;
+                queue_sqe(operation);
+            }
+            else
+            {
+                fallback_queue(operation);
+            }
+            return future;
+        }
+
+        void queue_sqe(detail::IOOperation* operation)
+        {
+            // More operations in flight than completion slots could overflow the completion ring.
+            while (m_in_flight > m_ring.completion_capacity())
+                wait(1);
+
+            auto* sqe = m_ring.next_sqe();
+            if (sqe == nullptr)
+            {
+                m_ring.submit(0);
+                sqe = m_ring.next_sqe();
+                VERIFY(sqe != nullptr);
+            }
+
+            sqe->fd = operation->target.value();
+            if (operation->target.is_fixed())
+                sqe->flags |= IOSQE_FIXED_FILE;
+            if (operation->link)
+                sqe->flags |= IOSQE_IO_LINK;
+            sqe->addr = (u64)operation->data;
+            sqe->len = (u32)operation->length;
+            sqe->off = operation->offset;
+            sqe->user_data = (u64)operation;
+
+            switch (operation->kind)
+            {
+            case detail::IOOperation::Read:
+                sqe->opcode = IORING_OP_READ;
+                break;
+            case detail::IOOperation::Write:
+                sqe->opcode = IORING_OP_WRITE;
+                break;
+            case detail::IOOperation::ReadFixed:
+                sqe->opcode = IORING_OP_READ_FIXED;
+                sqe->buf_index = operation->buffer_index;
+                break;
+            case detail::IOOperation::WriteFixed:
+                sqe->opcode = IORING_OP_WRITE_FIXED;
+                sqe->buf_index = operation->buffer_index;
+                break;
+            case detail::IOOperation::Receive:
+                sqe->opcode = IORING_OP_RECV;
+                break;
+            case detail::IOOperation::Send:
+                sqe->opcode = IORING_OP_SEND;
+                sqe->msg_flags = MSG_NOSIGNAL;
+                break;
+            case detail::IOOperation::Accept:
+                sqe->opcode = IORING_OP_ACCEPT;
+                sqe->accept_flags = SOCK_CLOEXEC;
+                break;
+            }
+        }
+
+        size_t reap()
+        {
+            size_t finished = 0;
+            m_ring.reap([&](u64 user_data, i32 result)
+                {
+                    if (user_data == cancel_user_data)
+                        return;
+                    finish((detail::IOOperation*)user_data, result);
+                    finished++; });
+            return finished;
+        }
+
+        void finish(detail::IOOperation* operation, i64 result)
+        {
+            m_in_flight--;
+            if (m_backend == IOBackend::IoUring)
+            {
+                if (operation->previous != nullptr)
+                    operation->previous->next = operation->next;
+                else
+                    m_in_flight_head = operation->next;
+                if (operation->next != nullptr)
+                    operation->next->previous = operation->previous;
+            }
+            if (result < 0)
+                operation->promise.set_value(IOResult((OSError)-result));
+            else
+                operation->promise.set_value(IOResult((size_t)result));
+            delete operation;
+        }
+
+        // Fallback: operations queue up until submit(), then each chain of linked operations runs in order. Socket
+        // operations that would block are parked until poll() reports the fd ready, finished ones wait in
+        // m_completed to be delivered by poll() or wait().
+
+        void fallback_queue(detail::IOOperation* operation)
+        {
+            if (m_queued_tail == nullptr)
+                m_queued_head = operation;
+            else
+                m_queued_tail->next = operation;
+            m_queued_tail = operation;
+        }
+
+        void fallback_start_queued()
+        {
+            auto* operation = m_queued_head;
+            if (operation == nullptr)
+                return;
+            m_queued_head = m_queued_tail = nullptr;
+
+            // Chains are linked up before anything starts, a chain's head may finish right away.
+            Vector<detail::IOOperation*> chain_heads;
+            detail::IOOperation* link_from = nullptr;
+            while (operation != nullptr)
+            {
+                auto* next = operation->next;
+                operation->next = nullptr;
+                if (link_from != nullptr)
+                    link_from->linked_next = operation;
+                else
+                    chain_heads.append(operation);
+                link_from = operation->link ? operation : nullptr;
+                operation = next;
+            }
+
+            for (size_t i = 0; i < chain_heads.size(); i++)
+                fallback_start(chain_heads[i]);
+        }
+
+        static bool would_block(i64 result)
+        {
+            return result == -EAGAIN || result == -EWOULDBLOCK;
+        }
+
+        i64 fallback_attempt(detail::IOOperation* operation)
+        {
+            auto fd = fd_of(operation->target);
+            ssize_t result = 0;
+            switch (operation->kind)
+            {
+            case detail::IOOperation::Read:
+            case detail::IOOperation::ReadFixed:
+                result = ::pread(fd, operation->data, operation->length, (off_t)operation->offset);
+                break;
+            case detail::IOOperation::Write:
+            case detail::IOOperation::WriteFixed:
+                result = ::pwrite(fd, operation->data, operation->length, (off_t)operation->offset);
+                break;
+            case detail::IOOperation::Receive:
+                result = ::recv(fd, operation->data, operation->length, MSG_DONTWAIT);
+                break;
+            case detail::IOOperation::Send:
+                result = ::send(fd, operation->data, operation->length, MSG_DONTWAIT | MSG_NOSIGNAL);
+                break;
+            case detail::IOOperation::Accept:
+            {
+                // A blocking listener would block accept4 itself, check readiness first.
+                pollfd ready { fd, POLLIN, 0 };
+                if (::poll(&ready, 1, 0) == 0)
+                    return -EAGAIN;
+                result = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+                break;
+            }
+            }
+            return result == -1 ? -errno : result;
+        }
+
+        void fallback_start(detail::IOOperation* operation)
+        {
+            auto result = fallback_attempt(operation);
+            if (would_block(result))
+                m_parked.append(operation);
+            else
+                fallback_complete(operation, result);
+        }
+
+        void fallback_complete(detail::IOOperation* operation, i64 result)
+        {
+            while (operation != nullptr)
+            {
+                operation->result = result;
+                if (m_completed_tail == nullptr)
+                    m_completed_head = operation;
+                else
+                    m_completed_tail->next = operation;
+                m_completed_tail = operation;
+
+                auto* linked = operation->linked_next;
+                if (linked == nullptr)
+                    return;
+                if (result >= 0)
+                {
+                    fallback_start(linked);
+                    return;
+                }
+                // A failed link cancels the rest of the chain.
+                operation = linked;
+                result = -ECANCELED;
+            }
+        }
+
+        void fallback_poll_parked(int timeout_ms)
+        {
+            Vector<pollfd> fds;
+            for (size_t i = 0; i < m_parked.size(); i++)
+            {
+                auto kind = m_parked[i]->kind;
+                short events = kind == detail::IOOperation::Send ? POLLOUT : POLLIN;
+                fds.append(pollfd { fd_of(m_parked[i]->target), events, 0 });
+            }
+
+            if (::poll(fds.data(), fds.size(), timeout_ms) <= 0)
+                return;
+
+            Vector<detail::IOOperation*> ready;
+            size_t still_parked = 0;
+            for (size_t i = 0; i < m_parked.size(); i++)
+            {
+                if (fds[i].revents != 0)
+                    ready.append(m_parked[i]);
+                else
+                    m_parked[still_parked++] = m_parked[i];
+            }
+            m_parked.change_size(still_parked);
+            for (size_t i = 0; i < ready.size(); i++)
+                fallback_start(ready[i]);
+        }
+
+        size_t fallback_deliver()
+        {
+            size_t count = 0;
+            while (m_completed_head != nullptr)
+            {
+                auto* operation = m_completed_head;
+                m_completed_head = operation->next;
+                if (m_completed_head == nullptr)
+                    m_completed_tail = nullptr;
+                finish(operation, operation->result);
+                count++;
+            }
+            return count;
+        }
+
+        IOBackend m_backend { IOBackend::Fallback };
+        size_t m_in_flight { 0 };
+        detail::IORing m_ring;
+        detail::IOOperation* m_in_flight_head { nullptr };
+        Vector<Span<u8>> m_buffers;
+        Vector<int> m_files;
+
+        detail::IOOperation* m_queued_head { nullptr };
+        detail::IOOperation* m_queued_tail { nullptr };
+        detail::IOOperation* m_completed_head { nullptr };
+        detail::IOOperation* m_completed_tail { nullptr };
+        Vector<detail::IOOperation*> m_parked;
+    };
+}
+
+using neo::FixedFile;
+using neo::IOBackend;
+using neo::IOEngine;
+using neo::IOFlags;
+using neo::IOResult;
+using neo::IOTarget;
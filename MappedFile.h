@@ -0,0 +1,366 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+#pragma once
+#include "OSError.h"
+#include "Optional.h"
+#include "ResultOrError.h"
+#include "Span.h"
+#include "Stream.h"
+#include "String.h"
+#include "StringView.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace neo
+{
+    enum class MapAccess
+    {
+        ReadOnly,
+        ReadWrite
+    };
+
+    enum class MapAdvice
+    {
+        Normal = MADV_NORMAL,
+        Sequential = MADV_SEQUENTIAL,
+        Random = MADV_RANDOM,
+        WillNeed = MADV_WILLNEED,
+        DontNeed = MADV_DONTNEED,
+        HugePage = MADV_HUGEPAGE
+    };
+
+    struct MapOptions
+    {
+        MapAccess access { MapAccess::ReadOnly };
+        // Faults every page in up front instead of on first touch.
+        bool populate { false };
+        // Most of the file to keep mapped at once, 0 maps all of it. Larger files are viewed a window at a time, see
+        // slide_to().
+        size_t window_size { 0 };
+    };
+
+    // A file mapped into memory, read through span() or view() without copying into a buffer first. Writes through a
+    // ReadWrite mapping go to the file, the file's size is fixed while mapped.
+    class MappedFile
+    {
+    public:
+        MappedFile(MappedFile const&) = delete;
+        MappedFile& operator=(MappedFile const&) = delete;
+
+        MappedFile(MappedFile&& other) :
+            m_fd(other.m_fd),
+            m_file_size(other.m_file_size),
+            m_options(other.m_options),
+            m_window(other.m_window),
+            m_window_offset(other.m_window_offset),
+            m_window_size(other.m_window_size)
+        {
+            other.m_fd = -1;
+            other.m_window = nullptr;
+        }
+
+        MappedFile& operator=(MappedFile&& other)
+        {
+            if (this == &other)
+                return *this;
+
+            this->~MappedFile();
+            new (this) MappedFile(std::move(other));
+            return *this;
+        }
+
+        ~MappedFile()
+        {
+            unmap();
+            if (m_fd != -1)
+                ::close(m_fd);
+        }
+
+        [[nodiscard]] static ResultOrError<MappedFile, OSError> map(String const& path, MapOptions options = {})
+        {
+            VERIFY(!path.is_empty());
+            auto flags = (options.access == MapAccess::ReadWrite ? O_RDWR : O_RDONLY) | O_CLOEXEC;
+            auto fd = ::open(path.null_terminated_characters(), flags);
+            if (fd == -1)
+                return (OSError)errno;
+
+            struct stat info;
+            if (::fstat(fd, &info) == -1)
+            {
+                auto error = errno;
+                ::close(fd);
+                return (OSError)error;
+            }
+
+            if (options.window_size != 0)
+                options.window_size = align_up_to_page(options.window_size);
+
+            MappedFile file(fd, (size_t)info.st_size, options);
+            auto maybe_error = file.slide_to(0);
+            if (maybe_error.has_value())
+                return maybe_error.value();
+            return file;
+        }
+
+        // The mapped window, which is the whole file unless the file is larger than the window size.
+        [[nodiscard]] Span<u8> span() const
+        {
+            return Span<u8>(m_window, m_window_size);
+        }
+
+        [[nodiscard]] StringView view() const
+        {
+            return StringView((char const*)m_window, m_window_size);
+        }
+
+        // Where span() starts in the file.
+        [[nodiscard]] size_t window_offset() const
+        {
+            return m_window_offset;
+        }
+
+        [[nodiscard]] size_t file_size() const
+        {
+            return m_file_size;
+        }
+
+        [[nodiscard]] bool is_windowed() const
+        {
+            return m_options.window_size != 0 && m_options.window_size < m_file_size;
+        }
+
+        [[nodiscard]] int fd() const
+        {
+            return m_fd;
+        }
+
+        // Maps the window holding offset, starting at the page offset falls in. offset may be the file's size, which
+        // leaves an empty window.
+        [[nodiscard]] Optional<OSError> slide_to(size_t offset)
+        {
+            VERIFY(offset <= m_file_size);
+            auto window_offset = offset & ~(page_size() - 1);
+            auto window_size = m_file_size - window_offset;
+            if (m_options.window_size != 0)
+                window_size = min(window_size, m_options.window_size);
+
+            if (m_window != nullptr && window_offset == m_window_offset && window_size == m_window_size)
+                return {};
+
+            unmap();
+            m_window_offset = window_offset;
+            if (window_size == 0)
+                return {};
+
+            auto protection = PROT_READ | (m_options.access == MapAccess::ReadWrite ? PROT_WRITE : 0);
+            auto flags = MAP_SHARED | (m_options.populate ? MAP_POPULATE : 0);
+            auto* address = ::mmap(nullptr, window_size, protection, flags, m_fd, (off_t)window_offset);
+            if (address == MAP_FAILED)
+                return (OSError)errno;
+
+            m_window = (u8*)address;
+            m_window_size = window_size;
+            return {};
+        }
+
+        // Hints how the window will be used. offset is relative to the window, length 0 means to its end. HugePage
+        // only takes on filesystems that can back files with huge pages.
+        [[nodiscard]] Optional<OSError> advise(MapAdvice advice, size_t offset = 0, size_t length = 0)
+        {
+            VERIFY(offset <= m_window_size);
+            if (m_window == nullptr)
+                return {};
+
+            // madvise wants a page aligned start.
+            auto start = offset & ~(page_size() - 1);
+            auto end = length == 0 ? m_window_size : min(offset + length, m_window_size);
+            if (::madvise(m_window + start, end - start, (int)advice) == -1)
+                return (OSError)errno;
+            return {};
+        }
+
+        // Writes the window's dirty pages back to the file and waits for it.
+        [[nodiscard]] Optional<OSError> sync()
+        {
+            if (m_window == nullptr)
+                return {};
+            if (::msync(m_window, m_window_size, MS_SYNC) == -1)
+                return (OSError)errno;
+            return {};
+        }
+
+        [[nodiscard]] static size_t page_size()
+        {
+            static size_t const size = (size_t)::sysconf(_SC_PAGESIZE);
+            return size;
+        }
+
+    private:
+        MappedFile(int fd, size_t file_size, MapOptions options) :
+            m_fd(fd),
+            m_file_size(file_size),
+            m_options(options)
+        {
+        }
+
+        static size_t align_up_to_page(size_t size)
+        {
+            return (size + page_size() - 1) & ~(page_size() - 1);
+        }
+
+        void unmap()
+        {
+            if (m_window != nullptr)
+                ::munmap(m_window, m_window_size);
+            m_window = nullptr;
+            m_window_size = 0;
+        }
+
+        int m_fd { -1 };
+        size_t m_file_size { 0 };
+        MapOptions m_options;
+        u8* m_window { nullptr };
+        size_t m_window_offset { 0 };
+        size_t m_window_size { 0 };
+    };
+
+    // Reads a MappedFile front to back, sliding its window as needed and asking the kernel to read ahead of the
+    // position so page faults rarely wait on the disk. Mirrors MemoryStream's reading interface.
+    class MappedFileStream final : public InputStream
+    {
+    public:
+        static constexpr size_t default_prefetch_distance = 2 * MiB;
+
+        explicit MappedFileStream(MappedFile& file, size_t prefetch_distance = default_prefetch_distance) :
+            m_file(file),
+            m_prefetch_distance(prefetch_distance)
+        {
+            [[maybe_unused]] auto maybe_error = m_file.advise(MapAdvice::Sequential);
+            prefetch();
+        }
+
+        virtual size_t read(Span<u8>& to) override
+        {
+            size_t copied = 0;
+            while (copied < to.size() && !end())
+            {
+                auto available = next(to.size() - copied);
+                if (available.size() == 0)
+                    break;
+                UntypedCopy(available.size(), available.data(), to.data() + copied);
+                copied += available.size();
+            }
+            return copied;
+        }
+
+        // The next up to max_bytes as a view into the mapping, no copy. Stops at the end of the current window, so
+        // it can return less than is left in the file.
+        Span<u8> next(size_t max_bytes)
+        {
+            if (end())
+                return Span<u8>(nullptr, 0);
+            if (m_position >= m_file.window_offset() + m_file.span().size() || m_position < m_file.window_offset())
+            {
+                auto maybe_error = m_file.slide_to(m_position);
+                if (maybe_error.has_value())
+                {
+                    m_last_error = maybe_error.value();
+                    return Span<u8>(nullptr, 0);
+                }
+                [[maybe_unused]] auto advise_error = m_file.advise(MapAdvice::Sequential);
+                m_prefetched_until = m_position;
+            }
+
+            auto window_position = m_position - m_file.window_offset();
+            auto size = min(max_bytes, m_file.span().size() - window_position);
+            auto* data = m_file.span().data() + window_position;
+            m_position += size;
+            if (m_position + m_prefetch_distance / 2 > m_prefetched_until)
+                prefetch();
+            return Span<u8>(data, size);
+        }
+
+        virtual bool end() const override
+        {
+            return m_position == m_file.file_size();
+        }
+
+        virtual void close() override
+        {
+        }
+
+        virtual bool has_error() const override
+        {
+            return m_last_error != OSError::Success;
+        }
+
+        virtual Optional<NativeHandle> native_handle() override
+        {
+            return NativeHandle { m_file.fd(), (i64)m_position };
+        }
+
+        virtual void native_advance(size_t bytes) override
+        {
+            seek(m_position + bytes);
+        }
+
+        void seek(size_t position)
+        {
+            VERIFY(position <= m_file.file_size());
+            m_position = position;
+            m_prefetched_until = position;
+        }
+
+        size_t size() const
+        {
+            return m_file.file_size();
+        }
+
+        size_t unread_bytes() const
+        {
+            return m_file.file_size() - m_position;
+        }
+
+    private:
+        // WILLNEED on the next prefetch_distance bytes of the window starts their reads without blocking.
+        void prefetch()
+        {
+            if (m_prefetch_distance == 0)
+                return;
+            auto window_end = m_file.window_offset() + m_file.span().size();
+            auto from = max(m_prefetched_until, m_position);
+            if (from >= window_end || from < m_file.window_offset())
+                return;
+            auto length = min(m_prefetch_distance, window_end - from);
+            [[maybe_unused]] auto maybe_error = m_file.advise(MapAdvice::WillNeed, from - m_file.window_offset(), length);
+            m_prefetched_until = from + length;
+        }
+
+        MappedFile& m_file;
+        size_t m_prefetch_distance;
+        size_t m_position { 0 };
+        size_t m_prefetched_until { 0 };
+        OSError m_last_error { OSError::Success };
+    };
+}
+using neo::MapAccess;
+using neo::MapAdvice;
+using neo::MapOptions;
+using neo::MappedFile;
+using neo::MappedFileStream;
@@ -18,6 +18,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "Types.h"
 #include "SmartPtr.h"
+#include "TypeTraits.h"
+#include <stddef.h>
 
 namespace neo
 {
@@ -50,10 +52,29 @@ namespace neo
         return NullableOwnPtr<TObject>(static_cast<TObject*>(storage));
     }
 
+    // Allocates the control block and the object together, so creating one costs a single allocation and the
+    // count sits next to the data. Intrusively counted objects delete themselves and are always created with new.
     template<typename TObject, typename TAllocator = MallocAllocator, typename... TArgs>
     NullableRefPtr<TObject> create_refcounted(TArgs&&... args)
     {
-        return NullableRefPtr<TObject>(create<TObject, TAllocator, TArgs...>(forward<TArgs>(args)...).release());
+        if constexpr (IntrusivelyRefCounted<TObject>)
+        {
+            static_assert(IsSame<TAllocator, MallocAllocator>, "intrusively counted objects are freed with delete");
+            return NullableRefPtr<TObject>(new TObject { forward<TArgs>(args)... });
+        }
+        else
+        {
+            using Block = detail::RefPtrInlineBlock<TObject, TAllocator>;
+            static_assert(alignof(Block) <= alignof(max_align_t));
+
+            void* storage = TAllocator::allocate(sizeof(Block));
+            if (storage == nullptr)
+                return NullableRefPtr<TObject>(nullptr);
+
+            auto* block = new (storage) Block();
+            new (block->object()) TObject { forward<TArgs>(args)... };
+            return detail::RefPtrAdopter::adopt<TObject, true>(block->object(), block);
+        }
     }
 
     template<typename TObject, typename TAllocator = MallocAllocator>
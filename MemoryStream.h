@@ -34,7 +34,7 @@ namespace neo
         virtual size_t read(Span<u8>& to) override
         {
             size_t to_read = min(to.size(), m_backing.size() - m_read_pos);
-            UntypedCopy(to_read, m_backing.data(), to.data());
+            UntypedCopy(to_read, m_backing.data() + m_read_pos, to.data());
             m_read_pos += to_read;
             return to_read;
         }
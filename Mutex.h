@@ -16,16 +16,131 @@
 
 #pragma once
 #include "Atomic.h"
+#include "NumericLimits.h"
 #include "Optional.h"
 #include <Concepts.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 #include <syscall.h>
-#include <linux/futex.h>
 #include <errno.h>
+#include <sched.h>
 
 namespace neo
 {
+    namespace detail
+    {
+        inline void cpu_relax()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield");
+#endif
+        }
+
+        // Exponential backoff for spin loops: 1, 2, 4 ... 64 pauses per round. spin() returns false once the
+        // rounds are used up, which is where futex based locks go to sleep.
+        class SpinBackoff
+        {
+        public:
+            explicit SpinBackoff(u32 rounds) :
+                m_rounds(rounds)
+            {
+            }
+
+            bool spin()
+            {
+                if (m_round >= m_rounds)
+                    return false;
+                auto pauses = 1u << (m_round < 6 ? m_round : 6);
+                for (u32 i = 0; i < pauses; i++)
+                    cpu_relax();
+                m_round++;
+                return true;
+            }
+
+        private:
+            u32 m_rounds;
+            u32 m_round { 0 };
+        };
+
+        // The three state futex mutex from Drepper's "Futexes Are Tricky": 0 unlocked, 1 locked, 2 locked with
+        // possible sleepers. unlock() only makes a syscall in state 2. Before sleeping, lock() spins for SpinRounds
+        // rounds of backoff in case the holder is about to release.
+        template<u32 SpinRounds>
+        class FutexMutex
+        {
+        public:
+            FutexMutex() = default;
+            FutexMutex& operator=(FutexMutex&) = delete;
+            FutexMutex& operator=(FutexMutex&&) = delete;
+
+            ~FutexMutex()
+            {
+                VERIFY(m_control.load(Relaxed) == 0);
+            }
+
+            void lock()
+            {
+                u32 state = 0;
+                if (m_control.compare_exchange_strong(state, 1, Acquire, Relaxed)) [[likely]]
+                    return;
+                lock_slow(state);
+            }
+
+            // true if the lock was acquired
+            bool try_lock()
+            {
+                u32 expected = 0;
+                return m_control.compare_exchange_strong(expected, 1, Acquire, Relaxed);
+            }
+
+            void unlock()
+            {
+                if (m_control.exchange(0, Release) == 2)
+                    m_control.notify_one();
+            }
+
+            bool is_locked() const
+            {
+                return m_control.load(Acquire) != 0;
+            }
+
+            // How many lock() calls found the mutex held.
+            [[nodiscard]] u32 contended_acquisitions() const
+            {
+                return m_contended.load(Relaxed);
+            }
+
+        private:
+            void lock_slow(u32 state)
+            {
+                m_contended.fetch_add(1, Relaxed);
+
+                SpinBackoff backoff(SpinRounds);
+                while (state == 1 && backoff.spin())
+                {
+                    state = 0;
+                    if (m_control.compare_exchange_strong(state, 1, Acquire, Relaxed))
+                        return;
+                }
+
+                // Taking it as 2 is conservative: the unlock after ours then wakes someone who may not exist.
+                if (state != 2)
+                    state = m_control.exchange(2, Acquire);
+                while (state != 0)
+                {
+                    m_control.wait(2);
+                    state = m_control.exchange(2, Acquire);
+                }
+            }
+
+            Atomic<u32> m_control { 0 };
+            Atomic<u32> m_contended { 0 };
+        };
+    }
+
+    // For very short critical sections. Spins with backoff, yielding the CPU once the backoff is at its longest.
     class SpinlockMutex
     {
     public:
@@ -40,22 +155,27 @@ namespace neo
 
         void lock()
         {
-            u32 expected = 0;
-            while (!m_control.compare_exchange_strong(expected, 1, AcquireRelease, Acquire))
-                ;
+            detail::SpinBackoff backoff(7);
+            while (!try_lock())
+            {
+                // Wait on a plain load so the line stays shared until the holder lets go.
+                while (m_control.load(Relaxed) != 0)
+                {
+                    if (!backoff.spin())
+                        sched_yield();
+                }
+            }
         }
 
         bool try_lock()
         {
             u32 expected = 0;
-            return m_control.compare_exchange_strong(expected, 1, AcquireRelease, Acquire);
+            return m_control.compare_exchange_strong(expected, 1, Acquire, Relaxed);
         }
 
         bool unlock()
         {
-            u32 expected = 1;
-            bool result = m_control.compare_exchange_strong(expected, 0, AcquireRelease, Acquire);
-            return result;
+            return m_control.exchange(0, Release) == 1;
         }
 
         bool is_locked() const
@@ -67,105 +187,229 @@ namespace neo
         Atomic<u32> m_control { 0 };
     };
 
-    class Mutex
+    // Spins briefly, then sleeps on a futex.
+    using Mutex = detail::FutexMutex<4>;
+    // Spins about as long as a futex round trip before sleeping, for locks that are often held only briefly.
+    using HybridMutex = detail::FutexMutex<10>;
+
+    // First come, first served: each lock() takes a ticket and waits for it to be called. Waiters spin with backoff
+    // proportional to their place in line, then sleep until the ticket being served changes.
+    class TicketLock
     {
     public:
-        Mutex() = default;
-        Mutex& operator=(Mutex&) = delete;
-        Mutex& operator=(Mutex&&) = delete;
+        TicketLock() = default;
+        TicketLock& operator=(TicketLock&) = delete;
+        TicketLock& operator=(TicketLock&&) = delete;
 
-        ~Mutex()
+        ~TicketLock()
         {
-            VERIFY(m_control.load(Relaxed) == 0);
+            VERIFY(m_next_ticket.load(Relaxed) == m_now_serving.load(Relaxed));
         }
 
         void lock()
         {
-            u32 expected = 0;
-            while (!m_control.compare_exchange_strong(expected, 1, AcquireRelease, Acquire))
+            auto ticket = m_next_ticket.fetch_add(1, Relaxed);
+            auto serving = m_now_serving.load(Acquire);
+            if (serving == ticket) [[likely]]
+                return;
+
+            m_contended.fetch_add(1, Relaxed);
+            u32 rounds = 0;
+            while (serving != ticket)
             {
-                [[maybe_unused]] auto result = syscall(SYS_futex, m_control.ptr(), FUTEX_WAIT_PRIVATE, expected, nullptr);
-                VERIFY(result != -1);
-                expected = 0;
+                if (rounds++ < 64)
+                {
+                    for (u32 i = 0; i < (ticket - serving) * 16; i++)
+                        detail::cpu_relax();
+                }
+                else
+                {
+                    m_sleepers.fetch_add(1, SequentiallyConsistent);
+                    if (m_now_serving.load(SequentiallyConsistent) == serving)
+                        m_now_serving.wait(serving);
+                    m_sleepers.fetch_sub(1, Relaxed);
+                }
+                serving = m_now_serving.load(Acquire);
             }
         }
 
-        // true if the lock was acquired
         bool try_lock()
         {
-            u32 expected = 0;
-            return m_control.compare_exchange_strong(expected, 1, AcquireRelease, Acquire) == true;
+            auto serving = m_now_serving.load(Acquire);
+            auto ticket = serving;
+            return m_next_ticket.compare_exchange_strong(ticket, serving + 1, Acquire, Relaxed);
         }
 
         void unlock()
         {
-            u32 expected = 1;
-            [[maybe_unused]] auto success = m_control.compare_exchange_strong(expected, 0, AcquireRelease, Acquire);
-            VERIFY(success)
-            success = syscall(SYS_futex, m_control.ptr(), FUTEX_WAKE_PRIVATE, 1) != -1;
-            VERIFY(success);
+            m_now_serving.add_fetch(1, SequentiallyConsistent);
+            // Every sleeper wakes because only the one holding the next ticket may go, and the kernel can't tell
+            // which that is.
+            if (m_sleepers.load(SequentiallyConsistent) > 0)
+                m_now_serving.notify_all();
         }
 
         bool is_locked() const
         {
-            return m_control.load(Acquire) == 1;
+            return m_next_ticket.load(Acquire) != m_now_serving.load(Acquire);
+        }
+
+        [[nodiscard]] u32 contended_acquisitions() const
+        {
+            return m_contended.load(Relaxed);
         }
 
     private:
-        Atomic<u32> m_control alignas(4);
+        Atomic<u32> m_next_ticket { 0 };
+        Atomic<u32> m_now_serving { 0 };
+        Atomic<u32> m_sleepers { 0 };
+        Atomic<u32> m_contended { 0 };
     };
 
-    class HybridMutex
+    // Many readers or one writer. Writers are preferred: once one is waiting, new readers wait behind it, so a
+    // steady stream of readers can't starve writers. Both sides spin with backoff before sleeping on a futex.
+    class RWLock
     {
     public:
-        HybridMutex() = default;
-        HybridMutex& operator=(HybridMutex&) = delete;
-        HybridMutex& operator=(HybridMutex&&) = delete;
+        RWLock() = default;
+        RWLock& operator=(RWLock&) = delete;
+        RWLock& operator=(RWLock&&) = delete;
 
-        ~HybridMutex()
+        ~RWLock()
         {
-            VERIFY(m_control.load(Relaxed) == 0);
+            VERIFY(m_state.load(Relaxed) == 0);
+        }
+
+        void lock_shared()
+        {
+            if (try_lock_shared()) [[likely]]
+                return;
+
+            m_contended_reads.fetch_add(1, Relaxed);
+            detail::SpinBackoff backoff(6);
+            while (!try_lock_shared())
+            {
+                if (backoff.spin())
+                    continue;
+
+                auto sequence = m_read_sequence.load(Acquire);
+                m_sleeping_readers.fetch_add(1, SequentiallyConsistent);
+                if (!readers_may_enter(m_state.load(SequentiallyConsistent)))
+                    m_read_sequence.wait(sequence);
+                m_sleeping_readers.fetch_sub(1, Relaxed);
+            }
+        }
+
+        bool try_lock_shared()
+        {
+            auto state = m_state.load(Relaxed);
+            while (readers_may_enter(state))
+            {
+                if (m_state.compare_exchange_weak(state, state + 1, Acquire, Relaxed))
+                    return true;
+            }
+            return false;
+        }
+
+        void unlock_shared()
+        {
+            auto state = m_state.sub_fetch(1, SequentiallyConsistent);
+            if ((state & reader_mask) == 0 && m_sleeping_writers.load(SequentiallyConsistent) > 0)
+                wake_writer();
         }
 
         void lock()
         {
+            if (try_lock()) [[likely]]
+                return;
 
-            u8 iterations = 0;
-            u32 expected = 0;
-            while (!m_control.compare_exchange_strong(expected, 1, AcquireRelease, Acquire))
+            m_contended_writes.fetch_add(1, Relaxed);
+            m_state.fetch_add(writer_waiting, SequentiallyConsistent);
+            detail::SpinBackoff backoff(6);
+            while (true)
             {
-                if (++iterations > 60)
+                auto state = m_state.load(Relaxed);
+                if ((state & (writer_bit | reader_mask)) == 0)
                 {
-                    [[maybe_unused]] auto result = syscall(SYS_futex, m_control.ptr(), FUTEX_WAIT_PRIVATE, 1, nullptr);
-                    VERIFY(result != -1);
-                    expected = 0;
+                    // Trading one waiting count for the writer bit.
+                    if (m_state.compare_exchange_weak(state, state - writer_waiting + writer_bit, Acquire, Relaxed))
+                        return;
+                    continue;
                 }
+                if (backoff.spin())
+                    continue;
+
+                auto sequence = m_write_sequence.load(Acquire);
+                m_sleeping_writers.fetch_add(1, SequentiallyConsistent);
+                if ((m_state.load(SequentiallyConsistent) & (writer_bit | reader_mask)) != 0)
+                    m_write_sequence.wait(sequence);
+                m_sleeping_writers.fetch_sub(1, Relaxed);
             }
         }
 
-        // true if the lock was acquired
         bool try_lock()
         {
-            u32 expected = 0;
-            return m_control.compare_exchange_strong(expected, 1, AcquireRelease, Acquire) == true;
+            auto state = m_state.load(Relaxed);
+            return (state & (writer_bit | reader_mask)) == 0
+                && m_state.compare_exchange_strong(state, state | writer_bit, Acquire, Relaxed);
         }
 
         void unlock()
         {
-            u32 expected = 1;
-            [[maybe_unused]] auto success = m_control.compare_exchange_strong(expected, 0, AcquireRelease, Acquire);
-            VERIFY(success)
-            success = syscall(SYS_futex, m_control.ptr(), FUTEX_WAKE_PRIVATE, 1) != -1;
-            VERIFY(success);
+            m_state.fetch_and(~writer_bit, SequentiallyConsistent);
+            if (m_sleeping_writers.load(SequentiallyConsistent) > 0)
+                wake_writer();
+            if (m_sleeping_readers.load(SequentiallyConsistent) > 0)
+            {
+                m_read_sequence.add_fetch(1, Release);
+                m_read_sequence.notify_all();
+            }
         }
 
         bool is_locked() const
         {
-            return m_control.load(Acquire) == 1;
+            return (m_state.load(Acquire) & writer_bit) != 0;
+        }
+
+        [[nodiscard]] u32 readers() const
+        {
+            return m_state.load(Acquire) & reader_mask;
+        }
+
+        [[nodiscard]] u32 contended_reads() const
+        {
+            return m_contended_reads.load(Relaxed);
+        }
+
+        [[nodiscard]] u32 contended_writes() const
+        {
+            return m_contended_writes.load(Relaxed);
         }
 
     private:
-        Atomic<u32> m_control { 0 };
+        // The writer bit, then a count of waiting writers, then a count of readers inside.
+        static constexpr u32 writer_bit = 1u << 31;
+        static constexpr u32 writer_waiting = 1u << 20;
+        static constexpr u32 reader_mask = writer_waiting - 1;
+
+        static bool readers_may_enter(u32 state)
+        {
+            return (state & ~reader_mask) == 0;
+        }
+
+        void wake_writer()
+        {
+            m_write_sequence.add_fetch(1, Release);
+            m_write_sequence.notify_one();
+        }
+
+        Atomic<u32> m_state { 0 };
+        Atomic<u32> m_read_sequence { 0 };
+        Atomic<u32> m_write_sequence { 0 };
+        Atomic<u32> m_sleeping_readers { 0 };
+        Atomic<u32> m_sleeping_writers { 0 };
+        Atomic<u32> m_contended_reads { 0 };
+        Atomic<u32> m_contended_writes { 0 };
     };
 
     class RecursiveMutex
@@ -177,77 +421,57 @@ namespace neo
 
         ~RecursiveMutex()
         {
-            VERIFY(m_control.load(Relaxed) == 0);
+            VERIFY(m_count == 0);
         }
 
         u32 lock()
         {
-            auto tid = syscall(__NR_gettid);
-            if (m_tid == tid)
-            {
-                return m_control.add_fetch(1, Relaxed);
-            }
-            else
-            {
-                u32 expected = 0;
-                while (!m_control.compare_exchange_strong(expected, 1, AcquireRelease, Acquire))
-                {
-                    [[maybe_unused]] auto result = syscall(SYS_futex, m_control.ptr(), FUTEX_WAIT_PRIVATE, expected, nullptr);
-                    VERIFY(result != -1);
-                    expected = 0;
-                }
-                m_tid = tid;
-                return 1;
-            }
+            auto tid = (long)syscall(__NR_gettid);
+            if (m_tid.load(Relaxed) == tid)
+                return ++m_count;
+
+            m_mutex.lock();
+            m_tid.store(tid, Relaxed);
+            m_count = 1;
+            return 1;
         }
 
+        // The new recursion depth, 0 if another thread holds the mutex.
         ssize_t try_lock()
         {
-            auto tid = syscall(__NR_gettid);
-            if (m_tid == tid)
-            {
-                return m_control.add_fetch(1, Relaxed);
-            }
-            else
-            {
-                size_t expected = 0;
-                bool success = syscall(SYS_futex, m_control.ptr(), FUTEX_WAIT_PRIVATE, expected, nullptr) == 0;
-                if (success)
-                {
-                    m_control.store(1, MemoryOrder::AcquireRelease);
-                    m_tid = tid;
-                }
-                return success;
-            }
+            auto tid = (long)syscall(__NR_gettid);
+            if (m_tid.load(Relaxed) == tid)
+                return ++m_count;
+
+            if (!m_mutex.try_lock())
+                return 0;
+            m_tid.store(tid, Relaxed);
+            m_count = 1;
+            return 1;
         }
 
         u32 unlock()
         {
-            auto tid = syscall(__NR_gettid);
-            VERIFY(m_tid == tid);
-            if (m_tid == tid) [[likely]]
+            VERIFY(m_tid.load(Relaxed) == (long)syscall(__NR_gettid));
+            auto remaining = --m_count;
+            if (remaining == 0)
             {
-                bool will_unlock = m_control.load(Relaxed) == 1;
-                if (will_unlock)
-                {
-                    m_tid = 0;
-                }
-                auto result = m_control.sub_fetch(1, AcquireRelease);
-                syscall(SYS_futex, m_control.ptr(), FUTEX_WAKE_PRIVATE, 1, nullptr);
-                return result;
+                m_tid.store(0, Relaxed);
+                m_mutex.unlock();
             }
-
-            __builtin_abort();
+            return remaining;
         }
 
         bool is_locked() const
         {
-            return m_control.load(Acquire) != 0;
+            return m_mutex.is_locked();
         }
 
     private:
-        Atomic<u32> m_control alignas(4) { 0 };
-        long m_tid { 0 };
+        Mutex m_mutex;
+        // Only ever equal to the caller's tid if the caller holds the mutex, so a relaxed read is enough.
+        Atomic<long> m_tid { 0 };
+        u32 m_count { 0 };
     };
 
     template<MutexLike T>
@@ -272,8 +496,35 @@ namespace neo
     private:
         T& m_mutex;
     };
+
+    template<typename T>
+    class [[nodiscard]] ScopedSharedLock
+    {
+    public:
+        ScopedSharedLock() = delete;
+        ScopedSharedLock& operator=(ScopedSharedLock const&) = delete;
+        ScopedSharedLock& operator=(ScopedSharedLock&&) = delete;
+
+        ScopedSharedLock(T& lock) :
+            m_lock(lock)
+        {
+            lock.lock_shared();
+        }
+
+        ~ScopedSharedLock()
+        {
+            m_lock.unlock_shared();
+        }
+
+    private:
+        T& m_lock;
+    };
 }
 using neo::HybridMutex;
 using neo::Mutex;
 using neo::RecursiveMutex;
+using neo::RWLock;
 using neo::ScopedLock;
+using neo::ScopedSharedLock;
+using neo::SpinlockMutex;
+using neo::TicketLock;
@@ -16,14 +16,21 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include "File.h"
 #include "Socket.h"
 #include "Stream.h"
+#include <sys/sendfile.h>
 
 namespace neo
 {
     class NetworkStream final : public InputStream, public OutputStream
     {
     public:
+        explicit NetworkStream(TCPSocket&& socket) :
+            m_socket(new TCPSocket(std::move(socket)))
+        {
+        }
+
         virtual size_t read(Span<u8>& to) override
         {
             auto result = m_socket->receive(to);
@@ -33,18 +40,25 @@ namespace neo
                 return 0;
             }
             m_last_error = 0;
+            if (result.result() == 0)
+                m_peer_closed = true;
             return result.result();
         }
 
+        // True once a read saw the peer close the connection, this doesn't touch the socket.
         virtual bool end() const override
         {
-            // Check if the socket can read
-            return m_socket->data_available().result_or(0) == 0;
-            return false;
+            return m_peer_closed;
         }
 
         virtual void write(Span<u8> const& from) override
         {
+            if (m_zero_copy_threshold != 0 && from.size() >= m_zero_copy_threshold)
+            {
+                write_zero_copy(from);
+                return;
+            }
+
             auto error = m_socket->send(from);
             if (error.has_value())
             {
@@ -74,9 +88,70 @@ namespace neo
             return m_last_error != 0;
         }
 
+        virtual Optional<NativeHandle> native_handle() override
+        {
+            return NativeHandle { m_socket->fd(), -1 };
+        }
+
+        // Sends length bytes of file from offset straight out of the page cache, leaving the file's position alone.
+        // Returns the bytes sent, fewer than length if the file is shorter or an error stopped it.
+        size_t send_file(File& file, size_t offset, size_t length)
+        {
+            auto flush_error = file.flush();
+            if (flush_error.has_value())
+            {
+                m_last_error = (SocketError)flush_error.value();
+                return 0;
+            }
+
+            size_t sent = 0;
+            while (sent < length)
+            {
+                off_t position = (off_t)(offset + sent);
+                auto result = ::sendfile(m_socket->fd(), file.fd(), &position, length - sent);
+                if (result == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    m_last_error = errno;
+                    return sent;
+                }
+                if (result == 0)
+                    break;
+                sent += (size_t)result;
+            }
+            m_last_error = 0;
+            return sent;
+        }
+
+        // Writes of at least threshold bytes go out with MSG_ZEROCOPY. write() still waits for the kernel to release
+        // the buffer, which takes until the peer acknowledged the data, so this only pays off for large writes.
+        Optional<SocketError> enable_zero_copy(size_t threshold = 256 * KiB)
+        {
+            auto error = m_socket->enable_zero_copy();
+            if (error.has_value())
+                return error;
+            m_zero_copy_threshold = threshold;
+            return {};
+        }
+
     private:
-        mutable OwnPtr<TCPSocket> m_socket;
+        void write_zero_copy(Span<u8> const& from)
+        {
+            auto sequence = m_socket->send_zero_copy(from);
+            if (sequence.has_error())
+            {
+                m_last_error = sequence.error();
+                return;
+            }
+            auto error = m_socket->wait_for_zero_copy(sequence.result());
+            m_last_error = error.has_value() ? error.value() : 0;
+        }
+
+        OwnPtr<TCPSocket> m_socket;
         SocketError m_last_error { 0 };
+        size_t m_zero_copy_threshold { 0 };
+        bool m_peer_closed { false };
     };
 
 }
@@ -62,7 +62,8 @@ namespace neo
         {
             if (other.has_value())
             {
-                new (this) Optional(other.release_value());
+                new (m_storage) T(std::move(other.value()));
+                other.value().~T();
                 other.m_has_value = false;
             }
         }
@@ -136,7 +137,7 @@ namespace neo
         [[nodiscard]] constexpr T release_value()
         {
             VERIFY(has_value());
-            return *reinterpret_cast<T*>(&m_storage);
+            return std::move(*reinterpret_cast<T*>(&m_storage));
         }
 
         [[nodiscard]] T& value_or(T& fallback)
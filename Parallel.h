@@ -0,0 +1,324 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Atomic.h"
+#include "Concepts.h"
+#include "Memory.h"
+#include "Span.h"
+#include "Synchronization.h"
+#include "SmartPtr.h"
+#include "SystemInfo.h"
+#include "ThreadPool.h"
+#include "Util.h"
+#include "Vector.h"
+
+namespace neo
+{
+    namespace detail
+    {
+        // Elements handed to a worker at once. A chunk always spans whole cache lines so two workers
+        // never write to the same line, is big enough to amortize the hand-off, and small enough that
+        // every worker gets a few chunks to balance uneven work. Large inputs are also cut so a chunk
+        // and a scratch copy of it (parallel_sort) fit in the worker's L2.
+        template<typename T>
+        size_t parallel_grain_size(size_t count)
+        {
+            auto line_size = l1_cache_line_size();
+            size_t elements_per_line = max<size_t>((line_size > 0 ? (size_t)line_size : 64) / sizeof(T), 1);
+            size_t grain = elements_per_line * 64;
+            size_t balanced = count / ((size_t)cpu_thread_count() * 4);
+            if (auto l2_size = l2_cache_size(); l2_size != 0)
+                balanced = min<size_t>(balanced, l2_size / 2 / sizeof(T));
+            if (balanced > grain)
+                grain = (balanced + elements_per_line - 1) / elements_per_line * elements_per_line;
+            return grain;
+        }
+
+        struct ParallelJob
+        {
+            explicit ParallelJob(size_t chunks) :
+                chunk_count(chunks), remaining_chunks((u32)chunks)
+            {
+            }
+
+            size_t chunk_count;
+            Atomic<size_t> next_chunk { 0 };
+            Latch remaining_chunks;
+        };
+
+        // Calls func(begin, end, chunk_index) for every grain-sized chunk of [0, count). Chunks are handed out
+        // dynamically to the calling thread and to the workers of the global ThreadPool, and this returns once
+        // every chunk is done. The caller never waits on a helper that hasn't started, so this is safe to call
+        // from inside a pool task.
+        template<typename TFunc>
+        void parallel_chunks(size_t count, size_t grain, TFunc const& func)
+        {
+            if (count == 0)
+                return;
+
+            VERIFY(grain > 0);
+            size_t chunk_count = (count + grain - 1) / grain;
+            VERIFY(chunk_count < NumericLimits<u32>::max());
+
+            RefPtr<ParallelJob> job = create_refcounted<ParallelJob>(chunk_count).release_nonnull();
+            // Late helpers only touch the job, which they keep alive, and find no chunk left to claim.
+            auto work = [job, &func, count, grain]() mutable
+            {
+                auto& state = *job;
+                while (true)
+                {
+                    auto chunk = state.next_chunk.fetch_add(1, Relaxed);
+                    if (chunk >= state.chunk_count)
+                        return;
+                    auto begin = chunk * grain;
+                    func(begin, min(begin + grain, count), chunk);
+                    state.remaining_chunks.count_down();
+                }
+            };
+
+            auto& pool = ThreadPool::global();
+            size_t helper_count = min(pool.worker_count(), chunk_count - 1);
+            for (size_t i = 0; i < helper_count; i++)
+                pool.execute(work);
+
+            work();
+
+            job->remaining_chunks.wait();
+        }
+
+        template<typename T, typename TComparer>
+        void merge_runs(T* left, size_t left_size, T* right, size_t right_size, T* to, TComparer const& comparer)
+        {
+            size_t i = 0, j = 0, k = 0;
+            while (i < left_size && j < right_size)
+            {
+                if (comparer(right[j], left[i]))
+                    to[k++] = std::move(right[j++]);
+                else
+                    to[k++] = std::move(left[i++]);
+            }
+            while (i < left_size)
+                to[k++] = std::move(left[i++]);
+            while (j < right_size)
+                to[k++] = std::move(right[j++]);
+        }
+
+        // Stable bottom-up merge sort of data[0, size), using scratch[0, size) as the merge buffer.
+        template<typename T, typename TComparer>
+        void sequential_merge_sort(T* data, T* scratch, size_t size, TComparer const& comparer)
+        {
+            constexpr size_t insertion_run = 16;
+            for (size_t run = 0; run < size; run += insertion_run)
+            {
+                size_t run_end = min(run + insertion_run, size);
+                for (size_t i = run + 1; i < run_end; i++)
+                {
+                    T value = std::move(data[i]);
+                    size_t j = i;
+                    for (; j > run && comparer(value, data[j - 1]); j--)
+                        data[j] = std::move(data[j - 1]);
+                    data[j] = std::move(value);
+                }
+            }
+
+            T* from = data;
+            T* to = scratch;
+            for (size_t width = insertion_run; width < size; width *= 2)
+            {
+                for (size_t left = 0; left < size; left += 2 * width)
+                {
+                    size_t middle = min(left + width, size);
+                    size_t right = min(left + 2 * width, size);
+                    merge_runs(from + left, middle - left, from + middle, right - middle, to + left, comparer);
+                }
+                swap(from, to);
+            }
+
+            if (from != data)
+            {
+                for (size_t i = 0; i < size; i++)
+                    data[i] = std::move(from[i]);
+            }
+        }
+    }
+
+    // Calls func(element) for every element of the span.
+    template<typename T, Callable<T&> TFunc>
+    void parallel_for(Span<T> span, TFunc const& func)
+    {
+        detail::parallel_chunks(span.size(), detail::parallel_grain_size<T>(span.size()), [&](size_t begin, size_t end, size_t)
+            {
+                for (size_t i = begin; i < end; i++)
+                    func(span.data()[i]); });
+    }
+
+    // Calls func(index) for every index in [begin, end).
+    template<Callable<size_t> TFunc>
+    void parallel_for(size_t begin, size_t end, TFunc const& func)
+    {
+        VERIFY(begin <= end);
+        detail::parallel_chunks(end - begin, detail::parallel_grain_size<size_t>(end - begin), [&](size_t chunk_begin, size_t chunk_end, size_t)
+            {
+                for (size_t i = chunk_begin; i < chunk_end; i++)
+                    func(begin + i); });
+    }
+
+    // Same contract as aggregate(): aggregator(TAggregate&, element) folds one element in. Every chunk starts
+    // from a value-initialized TAggregate and the partial results are folded into initial_value, in order,
+    // with combiner(TAggregate&, TAggregate const&). TAggregate {} must be the identity of combiner.
+    template<typename T, typename TAggregate, Callable<TAggregate&, T&> TAggregatorFunc, Callable<TAggregate&, TAggregate const&> TCombinerFunc>
+    TAggregate parallel_reduce(Span<T> span, TAggregate initial_value, TAggregatorFunc const& aggregator, TCombinerFunc const& combiner)
+    {
+        auto grain = detail::parallel_grain_size<T>(span.size());
+        auto chunk_count = (span.size() + grain - 1) / grain;
+        if (chunk_count == 0)
+            return initial_value;
+
+        auto* partials = new TAggregate[chunk_count] {};
+        detail::parallel_chunks(span.size(), grain, [&](size_t begin, size_t end, size_t chunk)
+            {
+                TAggregate partial {};
+                for (size_t i = begin; i < end; i++)
+                    aggregator(partial, span.data()[i]);
+                partials[chunk] = std::move(partial); });
+
+        for (size_t i = 0; i < chunk_count; i++)
+            combiner(initial_value, partials[i]);
+        delete[] partials;
+
+        return initial_value;
+    }
+
+    // to[i] = func(from[i]). Both spans must have the same size.
+    template<typename TFrom, typename TTo, CallableWithReturnType<TTo, TFrom&> TFunc>
+    void parallel_transform(Span<TFrom> from, Span<TTo> to, TFunc const& func)
+    {
+        VERIFY(from.size() == to.size());
+        detail::parallel_chunks(from.size(), detail::parallel_grain_size<TTo>(from.size()), [&](size_t begin, size_t end, size_t)
+            {
+                for (size_t i = begin; i < end; i++)
+                    to.data()[i] = func(from.data()[i]); });
+    }
+
+    // Stable sort. Chunks are merge sorted in parallel and then merged pairwise, each round in parallel.
+    // T must be default constructible, it is used to build the merge buffer.
+    template<typename T, CallableWithReturnType<bool, T const&, T const&> TComparer = decltype(DefaultLessThanComparer<T>)>
+    void parallel_sort(Span<T> span, TComparer const& comparer = DefaultLessThanComparer<T>)
+    {
+        auto size = span.size();
+        if (size < 2)
+            return;
+
+        auto* data = span.data();
+        auto* scratch = new T[size];
+        auto grain = detail::parallel_grain_size<T>(size);
+        detail::parallel_chunks(size, grain, [&](size_t begin, size_t end, size_t)
+            { detail::sequential_merge_sort(data + begin, scratch + begin, end - begin, comparer); });
+
+        T* from = data;
+        T* to = scratch;
+        for (size_t width = grain; width < size; width *= 2)
+        {
+            auto pair_count = (size + 2 * width - 1) / (2 * width);
+            detail::parallel_chunks(pair_count, 1, [&](size_t pair, size_t, size_t)
+                {
+                    size_t left = pair * 2 * width;
+                    size_t middle = min(left + width, size);
+                    size_t right = min(left + 2 * width, size);
+                    detail::merge_runs(from + left, middle - left, from + middle, right - middle, to + left, comparer); });
+            swap(from, to);
+        }
+
+        if (from != data)
+        {
+            detail::parallel_chunks(size, grain, [&](size_t begin, size_t end, size_t)
+                {
+                    for (size_t i = begin; i < end; i++)
+                        data[i] = std::move(from[i]); });
+        }
+        delete[] scratch;
+    }
+
+    // In place inclusive scan: span[i] = op(span[0], ..., span[i]). op must be associative.
+    template<typename T, CallableWithReturnType<T, T const&, T const&> TOperation>
+    void parallel_scan(Span<T> span, TOperation const& op)
+    {
+        auto size = span.size();
+        if (size < 2)
+            return;
+
+        auto* data = span.data();
+        auto grain = detail::parallel_grain_size<T>(size);
+        auto chunk_count = (size + grain - 1) / grain;
+
+        detail::parallel_chunks(size, grain, [&](size_t begin, size_t end, size_t)
+            {
+                for (size_t i = begin + 1; i < end; i++)
+                    data[i] = op(data[i - 1], data[i]); });
+
+        if (chunk_count == 1)
+            return;
+
+        // Carry of every chunk is the running total of all the chunks before it.
+        auto* carries = new T[chunk_count];
+        carries[1] = data[grain - 1];
+        for (size_t chunk = 2; chunk < chunk_count; chunk++)
+            carries[chunk] = op(carries[chunk - 1], data[chunk * grain - 1]);
+
+        detail::parallel_chunks(size - grain, grain, [&](size_t begin, size_t end, size_t chunk)
+            {
+                auto const& carry = carries[chunk + 1];
+                for (size_t i = grain + begin; i < grain + end; i++)
+                    data[i] = op(carry, data[i]); });
+        delete[] carries;
+    }
+
+    template<typename T, Callable<T&> TFunc>
+    void parallel_for(Vector<T>& vector, TFunc const& func)
+    {
+        parallel_for(vector.span(), func);
+    }
+
+    template<typename T, typename TAggregate, Callable<TAggregate&, T&> TAggregatorFunc, Callable<TAggregate&, TAggregate const&> TCombinerFunc>
+    TAggregate parallel_reduce(Vector<T>& vector, TAggregate initial_value, TAggregatorFunc const& aggregator, TCombinerFunc const& combiner)
+    {
+        return parallel_reduce(vector.span(), move(initial_value), aggregator, combiner);
+    }
+
+    template<typename TFrom, typename TTo, CallableWithReturnType<TTo, TFrom&> TFunc>
+    void parallel_transform(Vector<TFrom>& from, Vector<TTo>& to, TFunc const& func)
+    {
+        parallel_transform(from.span(), to.span(), func);
+    }
+
+    template<typename T, CallableWithReturnType<bool, T const&, T const&> TComparer = decltype(DefaultLessThanComparer<T>)>
+    void parallel_sort(Vector<T>& vector, TComparer const& comparer = DefaultLessThanComparer<T>)
+    {
+        parallel_sort(vector.span(), comparer);
+    }
+
+    template<typename T, CallableWithReturnType<T, T const&, T const&> TOperation>
+    void parallel_scan(Vector<T>& vector, TOperation const& op)
+    {
+        parallel_scan(vector.span(), op);
+    }
+}
+using neo::parallel_for;
+using neo::parallel_reduce;
+using neo::parallel_scan;
+using neo::parallel_sort;
+using neo::parallel_transform;
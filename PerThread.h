@@ -0,0 +1,211 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Aligned.h"
+#include "Assert.h"
+#include "Atomic.h"
+#include "Concepts.h"
+#include "Types.h"
+
+namespace neo
+{
+    namespace detail
+    {
+        static constexpr u32 max_thread_slots = 4096;
+        static constexpr u32 no_thread_slot = ~(u32)0;
+
+        // Bitmap of the thread slots in use, and how many threads have held each. Constant initialized, so it
+        // outlives every thread_local holder.
+        class ThreadSlots
+        {
+        public:
+            // The slot and its new generation.
+            u64 acquire()
+            {
+                for (u32 word = 0; word < max_thread_slots / 64; word++)
+                {
+                    auto used = m_used[word].load(Relaxed);
+                    while (used != ~(u64)0)
+                    {
+                        auto bit = (u32)__builtin_ctzll(~used);
+                        if (m_used[word].compare_exchange_strong(used, used | ((u64)1 << bit), Acquire, Relaxed))
+                        {
+                            auto slot = word * 64 + bit;
+                            auto generation = m_generations[slot].add_fetch(1, AcquireRelease);
+                            return (u64)generation << 32 | slot;
+                        }
+                    }
+                }
+                // More live threads than slots.
+                ENSURE(false);
+                return no_thread_slot;
+            }
+
+            void release(u32 slot)
+            {
+                m_used[slot / 64].fetch_and(~((u64)1 << (slot % 64)), Release);
+            }
+
+            // May report a thread that just exited as alive, never the other way round.
+            bool is_alive(u64 token) const
+            {
+                auto slot = (u32)token;
+                if ((m_used[slot / 64].load(Acquire) & ((u64)1 << (slot % 64))) == 0)
+                    return false;
+                return m_generations[slot].load(Acquire) == (u32)(token >> 32);
+            }
+
+        private:
+            Atomic<u64> m_used[max_thread_slots / 64] {};
+            Atomic<u32> m_generations[max_thread_slots] {};
+        };
+
+        inline constinit ThreadSlots s_thread_slots;
+
+        struct ThreadSlotHolder
+        {
+            ~ThreadSlotHolder()
+            {
+                if (token != 0)
+                    s_thread_slots.release((u32)token);
+            }
+
+            u64 token { 0 };
+        };
+
+        inline thread_local ThreadSlotHolder s_thread_slot;
+    }
+
+    // Identifies the calling thread among every thread the process has run: its thread_slot() and how many
+    // threads held that slot before it. Never 0, and unlike thread ids never reused.
+    inline u64 thread_token()
+    {
+        auto& holder = detail::s_thread_slot;
+        if (holder.token == 0) [[unlikely]]
+            holder.token = detail::s_thread_slots.acquire();
+        return holder.token;
+    }
+
+    // Small dense index of the calling thread, below detail::max_thread_slots. A thread keeps its slot until
+    // it exits, after which a new thread may get the same one.
+    inline u32 thread_slot()
+    {
+        return (u32)thread_token();
+    }
+
+    namespace detail
+    {
+        // The record of records[0, count) owned by the calling thread: the one it already has, a free one, or
+        // one whose thread has exited, which comes with whatever that thread left in it. TRecord has an
+        // Atomic<u64> owner holding a thread_token(), 0 when free. nullptr when all belong to live threads.
+        template<typename TRecord>
+        TRecord* claim_thread_owned(TRecord* records, size_t count)
+        {
+            auto token = thread_token();
+            for (size_t i = 0; i < count; i++)
+            {
+                if (records[i].owner.load(Acquire) == token)
+                    return &records[i];
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                u64 expected = 0;
+                if (records[i].owner.compare_exchange_strong(expected, token, AcquireRelease, Acquire))
+                    return &records[i];
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                auto owner = records[i].owner.load(Acquire);
+                if (!s_thread_slots.is_alive(owner) && records[i].owner.compare_exchange_strong(owner, token, AcquireRelease, Acquire))
+                    return &records[i];
+            }
+            return nullptr;
+        }
+    }
+
+    // One value-initialized T per thread slot, each on its own cache line, so threads can update their own
+    // without bouncing lines between cores: counters and other state that is written often and combined
+    // rarely. Storage is allocated in chunks on first use by a thread in the chunk's slot range. A slot's
+    // value is left as is when its thread exits and the next thread to get the slot carries on with it.
+    template<typename T>
+    class PerThread
+    {
+    public:
+        static constexpr u32 chunk_size = 64;
+
+        PerThread() = default;
+        PerThread(PerThread const&) = delete;
+        PerThread& operator=(PerThread const&) = delete;
+
+        ~PerThread()
+        {
+            for (auto& chunk : m_chunks)
+                delete chunk.load(Acquire);
+        }
+
+        // The calling thread's value.
+        T& local()
+        {
+            return at(thread_slot());
+        }
+
+        T& at(u32 slot)
+        {
+            VERIFY(slot < detail::max_thread_slots);
+            auto* chunk = m_chunks[slot / chunk_size].load(Acquire);
+            if (chunk == nullptr) [[unlikely]]
+                chunk = allocate_chunk(slot / chunk_size);
+            return *chunk->values[slot % chunk_size];
+        }
+
+        // Calls func(T&) on the value of every slot allocated so far, including ones other threads may be
+        // updating: T must tolerate that, e.g. by being Atomic.
+        template<Callable<T&> TFunc>
+        void for_each(TFunc&& func)
+        {
+            for (auto& chunk_pointer : m_chunks)
+            {
+                auto* chunk = chunk_pointer.load(Acquire);
+                if (chunk == nullptr)
+                    continue;
+                for (auto& value : chunk->values)
+                    func(*value);
+            }
+        }
+
+    private:
+        struct Chunk
+        {
+            CacheLinePadded<T> values[chunk_size] {};
+        };
+
+        Chunk* allocate_chunk(u32 index)
+        {
+            auto* chunk = new Chunk;
+            Chunk* expected = nullptr;
+            if (m_chunks[index].compare_exchange_strong(expected, chunk, AcquireRelease, Acquire))
+                return chunk;
+            delete chunk;
+            return expected;
+        }
+
+        Atomic<Chunk*> m_chunks[detail::max_thread_slots / chunk_size] {};
+    };
+}
+using neo::PerThread;
+using neo::thread_slot;
+using neo::thread_token;
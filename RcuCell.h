@@ -0,0 +1,148 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Atomic.h"
+#include "Memory.h"
+#include "Mutex.h"
+#include "Reclamation.h"
+#include "SmartPtr.h"
+#include "TypeTraits.h"
+
+namespace neo
+{
+    // An immutable version of an RcuCell's value, kept alive for as long as the handle is.
+    template<typename T>
+    using Snapshot = RefPtr<T const>;
+
+    namespace detail
+    {
+        template<typename T>
+        struct RcuVersion
+        {
+            Snapshot<T> value;
+        };
+    }
+
+    // Read-copy-update cell for read-mostly data such as configuration or routing tables. Readers never block and
+    // never write shared memory beyond their own epoch record: read() runs a function on the current version, and
+    // snapshot() hands out a reference counted handle to it. Writers build a new version and publish it with one
+    // atomic exchange; each version is freed once the cell and the last snapshot of it have let go and no reader is
+    // still inside read(). Writers are serialized with each other.
+    template<typename T>
+    class RcuCell
+    {
+    public:
+        RcuCell(RcuCell const&) = delete;
+        RcuCell& operator=(RcuCell const&) = delete;
+
+        explicit RcuCell(Snapshot<T> initial, EpochDomain& domain = EpochDomain::global()) :
+            m_domain(domain), m_current(new detail::RcuVersion<T> { std::move(initial) })
+        {
+        }
+
+        explicit RcuCell(T&& initial, EpochDomain& domain = EpochDomain::global()) :
+            RcuCell(make_snapshot(std::move(initial)), domain)
+        {
+        }
+
+        explicit RcuCell(T const& initial, EpochDomain& domain = EpochDomain::global()) :
+            RcuCell(make_snapshot(initial), domain)
+        {
+        }
+
+        // Versions already replaced may outlive the cell until the domain frees them.
+        ~RcuCell()
+        {
+            delete m_current.load(Acquire);
+            m_current.store(nullptr, Relaxed);
+        }
+
+        // Calls func with the current version. The reference is only valid inside func, which must not publish
+        // to this cell; its result is returned, and must not point into the value either.
+        template<typename TFunc>
+        decltype(auto) read(TFunc&& func) const
+        {
+            auto guard = m_domain.pin();
+            return func(*m_current.load(Acquire)->value);
+        }
+
+        // The current version, valid for as long as the handle is held.
+        [[nodiscard]] Snapshot<T> snapshot() const
+        {
+            auto guard = m_domain.pin();
+            return m_current.load(Acquire)->value;
+        }
+
+        void publish(Snapshot<T> value)
+        {
+            ScopedLock lock(m_writer_lock);
+            replace(std::move(value));
+        }
+
+        void publish(T&& value)
+        {
+            publish(make_snapshot(std::move(value)));
+        }
+
+        void publish(T const& value)
+        {
+            publish(make_snapshot(value));
+        }
+
+        // Copies the current version, lets func modify the copy and publishes it. Concurrent updates apply one
+        // after the other, so none is lost.
+        template<typename TFunc>
+        void update(TFunc&& func)
+        {
+            ScopedLock lock(m_writer_lock);
+            T copy(*m_current.load(Acquire)->value);
+            func(copy);
+            replace(make_snapshot(std::move(copy)));
+        }
+
+        // Blocks until no reader can still see a version this thread replaced, and frees those versions.
+        // Must not be called from inside read().
+        void synchronize()
+        {
+            m_domain.synchronize();
+        }
+
+    private:
+        template<typename TValue>
+        static Snapshot<T> make_snapshot(TValue&& value)
+        {
+            RefPtr<T> created = create_refcounted<T>(forward<TValue>(value)).release_nonnull();
+            return created;
+        }
+
+        void replace(Snapshot<T>&& value)
+        {
+            auto* previous = m_current.exchange(new detail::RcuVersion<T> { std::move(value) }, AcquireRelease);
+            // Readers inside read() or snapshot() may still be looking at it. Writes are rare and versions can
+            // be big, so collect right away rather than letting a batch of old versions pile up: a writer
+            // thread keeps at most the two it replaced last, until its next write or synchronize().
+            m_domain.retire(previous);
+            m_domain.collect();
+        }
+
+        EpochDomain& m_domain;
+        Atomic<detail::RcuVersion<T>*> m_current;
+        Mutex m_writer_lock;
+    };
+}
+using neo::RcuCell;
+using neo::Snapshot;
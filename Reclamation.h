@@ -0,0 +1,530 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Aligned.h"
+#include "Assert.h"
+#include "Atomic.h"
+#include "Deque.h"
+#include "PerThread.h"
+#include "Types.h"
+#include <linux/membarrier.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace neo
+{
+    namespace detail
+    {
+        struct RetiredPointer
+        {
+            void* pointer;
+            void (*deleter)(void*);
+            u64 epoch;
+        };
+
+        template<typename T>
+        void delete_retired(void* pointer)
+        {
+            delete static_cast<T*>(pointer);
+        }
+
+        struct ReclamationCache
+        {
+            u64 domain_id { 0 };
+            void* record { nullptr };
+        };
+
+        inline Atomic<u64> s_next_reclamation_domain_id { 1 };
+        // One per record type, so a thread using an epoch and a hazard domain doesn't search on every call.
+        template<typename TRecord>
+        inline thread_local ReclamationCache s_reclamation_cache {};
+
+        // The calling thread's record, see claim_thread_owned(). Records are claimed for good, there is no release.
+        template<typename TRecord>
+        TRecord* claim_thread_record(u64 domain_id, TRecord* records, size_t count)
+        {
+            auto& cache = s_reclamation_cache<TRecord>;
+            if (cache.domain_id == domain_id)
+                return static_cast<TRecord*>(cache.record);
+
+            auto* found = claim_thread_owned(records, count);
+            VERIFY(found != nullptr && "more live threads than max_threads");
+
+            cache = { domain_id, found };
+            return found;
+        }
+
+        // With membarrier(), the side that runs rarely can force a full fence on every running thread of the
+        // process, so the frequent side only has to keep the compiler from reordering.
+        inline bool asymmetric_fences_available()
+        {
+            static bool available = []
+            {
+                auto commands = ::syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+                if (commands < 0 || (commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED) == 0)
+                    return false;
+                return ::syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+            }();
+            return available;
+        }
+
+        inline void heavy_fence()
+        {
+            if (asymmetric_fences_available())
+            {
+                ENSURE(::syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0) == 0);
+            }
+            else
+            {
+                atomic_thread_fence(SequentiallyConsistent);
+            }
+        }
+
+        struct alignas(hardware_destructive_interference_size) EpochRecord
+        {
+            Atomic<u64> owner { 0 };
+            // The global epoch the thread pinned, shifted left by one, with the low bit set while pinned.
+            Atomic<u64> state { 0 };
+            // Owner only.
+            u32 pin_depth { 0 };
+            u32 retired_since_collect { 0 };
+            Deque<RetiredPointer> limbo;
+        };
+
+        struct alignas(hardware_destructive_interference_size) HazardRecord
+        {
+            Atomic<u64> owner { 0 };
+            // Owner only.
+            u64 used_slots { 0 };
+            Deque<RetiredPointer> retired;
+            void** scratch { nullptr };
+        };
+    }
+
+    struct EpochDomainOptions
+    {
+        // Threads that may use the domain at the same time; records of exited threads are reused.
+        size_t max_threads { 128 };
+        // A thread tries to advance the epoch and free its garbage after this many retires.
+        size_t collect_threshold { 64 };
+    };
+
+    // Epoch based reclamation. Readers pin the domain around every access to shared nodes; a node unlinked and
+    // retired in epoch e is freed once the global epoch reaches e + 2, which it can only do after every thread
+    // pinned at the time has unpinned. Pinning is two stores and a fence, so it suits read-mostly structures, but
+    // a thread that stays pinned stalls reclamation for everyone: use HazardDomain when readers may block.
+    class EpochDomain
+    {
+    public:
+        EpochDomain(EpochDomain const&) = delete;
+        EpochDomain& operator=(EpochDomain const&) = delete;
+
+        explicit EpochDomain(EpochDomainOptions const& options = {}) :
+            m_max_threads(options.max_threads),
+            m_collect_threshold(options.collect_threshold),
+            m_id(detail::s_next_reclamation_domain_id.fetch_add(1, Relaxed)),
+            m_records(new detail::EpochRecord[options.max_threads]),
+            m_asymmetric_fences(detail::asymmetric_fences_available())
+        {
+            VERIFY(m_max_threads > 0);
+        }
+
+        // Frees everything still retired. No thread may be pinned or use the domain any more.
+        ~EpochDomain()
+        {
+            for (size_t i = 0; i < m_max_threads; i++)
+            {
+                auto& record = m_records[i];
+                VERIFY((record.state.load(Acquire) & 1) == 0);
+                while (!record.limbo.is_empty())
+                {
+                    auto retired = record.limbo.pop_front();
+                    retired.deleter(retired.pointer);
+                }
+            }
+            delete[] m_records;
+            m_records = nullptr;
+        }
+
+        // Domain shared by everything that doesn't need its own.
+        static EpochDomain& global()
+        {
+            static EpochDomain domain;
+            return domain;
+        }
+
+        class Guard
+        {
+        public:
+            Guard(Guard const&) = delete;
+            Guard& operator=(Guard const&) = delete;
+
+            ~Guard()
+            {
+                m_domain.unpin(m_record);
+            }
+
+        private:
+            friend EpochDomain;
+
+            Guard(EpochDomain& domain, detail::EpochRecord& record) :
+                m_domain(domain), m_record(record)
+            {
+            }
+
+            EpochDomain& m_domain;
+            detail::EpochRecord& m_record;
+        };
+
+        // Nodes reachable from shared pointers stay valid while the guard lives. Guards nest.
+        [[nodiscard]] Guard pin()
+        {
+            auto& record = *detail::claim_thread_record(m_id, m_records, m_max_threads);
+            if (record.pin_depth++ == 0)
+            {
+                // The announcement has to be ordered before every load made under the guard. try_advance() takes
+                // care of that with a heavy fence when it can, otherwise a sequentially consistent exchange does,
+                // which is cheaper than a store and a fence on x86.
+                auto state = (m_epoch.load(Relaxed) << 1) | 1;
+                if (m_asymmetric_fences)
+                {
+                    record.state.store(state, Relaxed);
+                    asm volatile(""
+                                 :
+                                 :
+                                 : "memory");
+                }
+                else
+                {
+                    record.state.exchange(state, SequentiallyConsistent);
+                }
+            }
+            return Guard(*this, record);
+        }
+
+        // Hands pointer, already unreachable for new readers, to deleter once no reader can still hold it.
+        void retire(void* pointer, void (*deleter)(void*))
+        {
+            auto& record = *detail::claim_thread_record(m_id, m_records, m_max_threads);
+            record.limbo.add_back({ pointer, deleter, m_epoch.load(Acquire) });
+            m_pending.fetch_add(1, Relaxed);
+
+            if (++record.retired_since_collect >= m_collect_threshold)
+                collect(record);
+        }
+
+        template<typename T>
+        void retire(T* pointer)
+        {
+            retire(pointer, detail::delete_retired<T>);
+        }
+
+        // Advances the epoch if every pinned thread has caught up and frees what the calling thread retired that
+        // is now unreachable. Returns how many pointers were freed.
+        size_t collect()
+        {
+            return collect(*detail::claim_thread_record(m_id, m_records, m_max_threads));
+        }
+
+        // Waits for readers pinned in older epochs to leave, then frees everything the calling thread retired.
+        // Must not be called under a guard of this domain.
+        void synchronize()
+        {
+            auto& record = *detail::claim_thread_record(m_id, m_records, m_max_threads);
+            VERIFY(record.pin_depth == 0);
+            collect(record);
+            while (!record.limbo.is_empty())
+            {
+                sched_yield();
+                collect(record);
+            }
+        }
+
+        // Retired pointers not freed yet, across all threads.
+        [[nodiscard]] size_t pending() const
+        {
+            return m_pending.load(Relaxed);
+        }
+
+        [[nodiscard]] u64 epoch() const
+        {
+            return m_epoch.load(Acquire);
+        }
+
+    private:
+        void unpin(detail::EpochRecord& record)
+        {
+            VERIFY(record.pin_depth > 0);
+            if (--record.pin_depth == 0)
+                record.state.store(record.state.load(Relaxed) & ~(u64)1, Release);
+        }
+
+        bool try_advance()
+        {
+            auto epoch = m_epoch.load(Acquire);
+            detail::heavy_fence();
+            for (size_t i = 0; i < m_max_threads; i++)
+            {
+                auto state = m_records[i].state.load(Acquire);
+                if ((state & 1) != 0 && (state >> 1) != epoch)
+                    return false;
+            }
+            return m_epoch.compare_exchange_strong(epoch, epoch + 1, AcquireRelease, Relaxed);
+        }
+
+        size_t collect(detail::EpochRecord& record)
+        {
+            record.retired_since_collect = 0;
+            try_advance();
+
+            auto epoch = m_epoch.load(Acquire);
+            size_t freed = 0;
+            // Retired in epoch order, so the freeable ones are a prefix.
+            while (!record.limbo.is_empty() && record.limbo.peek_front().epoch + 2 <= epoch)
+            {
+                auto retired = record.limbo.pop_front();
+                retired.deleter(retired.pointer);
+                freed++;
+            }
+            m_pending.fetch_sub(freed, Relaxed);
+            return freed;
+        }
+
+        size_t m_max_threads;
+        size_t m_collect_threshold;
+        u64 m_id;
+        detail::EpochRecord* m_records;
+        bool m_asymmetric_fences;
+        alignas(hardware_destructive_interference_size) Atomic<u64> m_epoch { 0 };
+        alignas(hardware_destructive_interference_size) Atomic<size_t> m_pending { 0 };
+    };
+
+    struct HazardDomainOptions
+    {
+        // Threads that may use the domain at the same time; records of exited threads are reused.
+        size_t max_threads { 128 };
+        // Hazard pointers each thread can hold at once, at most 64.
+        size_t hazards_per_thread { 4 };
+        // A thread scans the hazard pointers once it has this many retired pointers; 0 means twice the number of
+        // hazard pointers in the domain.
+        size_t scan_threshold { 0 };
+    };
+
+    // Hazard pointer reclamation. A reader publishes each pointer it is about to dereference, and a retired pointer
+    // is only freed when no hazard pointer holds it. Costs a fence per protected load, but a stalled reader only
+    // pins the nodes it protects: each thread keeps fewer than scan_threshold + max_threads * hazards_per_thread
+    // retired pointers, whatever the other threads do.
+    class HazardDomain
+    {
+    public:
+        HazardDomain(HazardDomain const&) = delete;
+        HazardDomain& operator=(HazardDomain const&) = delete;
+
+        explicit HazardDomain(HazardDomainOptions const& options = {}) :
+            m_max_threads(options.max_threads),
+            m_hazards_per_thread(options.hazards_per_thread),
+            // Each thread's hazard pointers start on a cache line of their own.
+            m_hazard_stride((options.hazards_per_thread + hazards_per_line - 1) & ~(hazards_per_line - 1)),
+            m_hazard_count(options.max_threads * m_hazard_stride),
+            m_scan_threshold(options.scan_threshold != 0 ? options.scan_threshold : 2 * options.max_threads * options.hazards_per_thread),
+            m_id(detail::s_next_reclamation_domain_id.fetch_add(1, Relaxed)),
+            m_records(new detail::HazardRecord[options.max_threads]),
+            m_hazards((Atomic<void*>*)aligned_alloc(hardware_destructive_interference_size, m_hazard_count * sizeof(Atomic<void*>)))
+        {
+            VERIFY(m_hazards != nullptr);
+            __builtin_memset((void*)m_hazards, 0, m_hazard_count * sizeof(Atomic<void*>));
+            VERIFY(m_max_threads > 0);
+            VERIFY(m_hazards_per_thread > 0 && m_hazards_per_thread <= 64);
+        }
+
+        // Frees everything still retired. No thread may hold a hazard pointer or use the domain any more.
+        ~HazardDomain()
+        {
+            for (size_t i = 0; i < m_max_threads; i++)
+            {
+                auto& record = m_records[i];
+                VERIFY(record.used_slots == 0);
+                while (!record.retired.is_empty())
+                {
+                    auto retired = record.retired.pop_front();
+                    retired.deleter(retired.pointer);
+                }
+                delete[] record.scratch;
+            }
+            delete[] m_records;
+            free(m_hazards);
+            m_records = nullptr;
+            m_hazards = nullptr;
+        }
+
+        // Domain shared by everything that doesn't need its own.
+        static HazardDomain& global()
+        {
+            static HazardDomain domain;
+            return domain;
+        }
+
+        // One of the calling thread's hazard pointers, released on destruction. Only the thread that made it may
+        // use it.
+        class HazardPointer
+        {
+        public:
+            HazardPointer(HazardPointer const&) = delete;
+            HazardPointer& operator=(HazardPointer const&) = delete;
+
+            ~HazardPointer()
+            {
+                reset();
+                m_record.used_slots &= ~((u64)1 << m_index);
+            }
+
+            // Loads source and keeps the result from being freed until reset, protect or destruction.
+            template<typename T>
+            T* protect(Atomic<T*> const& source)
+            {
+                T* pointer = source.load(Relaxed);
+                while (true)
+                {
+                    // The hazard must be visible before source is checked again; once it still matches, any
+                    // retire of it comes later and its scan sees the hazard.
+                    m_slot.exchange(pointer, SequentiallyConsistent);
+                    T* again = source.load(Acquire);
+                    if (again == pointer)
+                        return pointer;
+                    pointer = again;
+                }
+            }
+
+            void reset()
+            {
+                m_slot.store(nullptr, Release);
+            }
+
+        private:
+            friend HazardDomain;
+
+            HazardPointer(detail::HazardRecord& record, Atomic<void*>& slot, size_t index) :
+                m_record(record), m_slot(slot), m_index(index)
+            {
+            }
+
+            detail::HazardRecord& m_record;
+            Atomic<void*>& m_slot;
+            size_t m_index;
+        };
+
+        [[nodiscard]] HazardPointer make_hazard_pointer()
+        {
+            auto& record = *detail::claim_thread_record(m_id, m_records, m_max_threads);
+            auto free_slots = ~record.used_slots;
+            if (m_hazards_per_thread < 64)
+                free_slots &= ((u64)1 << m_hazards_per_thread) - 1;
+            VERIFY(free_slots != 0 && "more hazard pointers than hazards_per_thread");
+
+            size_t index = __builtin_ctzll(free_slots);
+            record.used_slots |= (u64)1 << index;
+            auto& slot = m_hazards[(size_t)(&record - m_records) * m_hazard_stride + index];
+            return HazardPointer(record, slot, index);
+        }
+
+        // Hands pointer, already unreachable for new readers, to deleter once no hazard pointer holds it.
+        void retire(void* pointer, void (*deleter)(void*))
+        {
+            auto& record = *detail::claim_thread_record(m_id, m_records, m_max_threads);
+            record.retired.add_back({ pointer, deleter, 0 });
+            m_pending.fetch_add(1, Relaxed);
+
+            if (record.retired.size() >= m_scan_threshold)
+                scan(record);
+        }
+
+        template<typename T>
+        void retire(T* pointer)
+        {
+            retire(pointer, detail::delete_retired<T>);
+        }
+
+        // Frees what the calling thread retired that no hazard pointer holds. Returns how many pointers were freed.
+        size_t collect()
+        {
+            return scan(*detail::claim_thread_record(m_id, m_records, m_max_threads));
+        }
+
+        // Retired pointers not freed yet, across all threads.
+        [[nodiscard]] size_t pending() const
+        {
+            return m_pending.load(Relaxed);
+        }
+
+    private:
+        size_t scan(detail::HazardRecord& record)
+        {
+            if (record.scratch == nullptr)
+                record.scratch = new void*[m_hazard_count];
+
+            // Pairs with the fence in protect(): a hazard set before our retire is seen here.
+            atomic_thread_fence(SequentiallyConsistent);
+            size_t hazards = 0;
+            for (size_t i = 0; i < m_hazard_count; i++)
+            {
+                auto* hazard = m_hazards[i].load(Acquire);
+                if (hazard != nullptr)
+                    record.scratch[hazards++] = hazard;
+            }
+
+            // Few hazard pointers are set at any time, so a linear search beats sorting them.
+            size_t freed = 0;
+            for (size_t count = record.retired.size(); count > 0; count--)
+            {
+                auto retired = record.retired.pop_front();
+                bool is_protected = false;
+                for (size_t i = 0; i < hazards && !is_protected; i++)
+                    is_protected = record.scratch[i] == retired.pointer;
+
+                if (is_protected)
+                {
+                    record.retired.add_back(retired);
+                }
+                else
+                {
+                    retired.deleter(retired.pointer);
+                    freed++;
+                }
+            }
+            m_pending.fetch_sub(freed, Relaxed);
+            return freed;
+        }
+
+        static constexpr size_t hazards_per_line = hardware_destructive_interference_size / sizeof(Atomic<void*>);
+
+        size_t m_max_threads;
+        size_t m_hazards_per_thread;
+        size_t m_hazard_stride;
+        size_t m_hazard_count;
+        size_t m_scan_threshold;
+        u64 m_id;
+        detail::HazardRecord* m_records;
+        Atomic<void*>* m_hazards;
+        alignas(hardware_destructive_interference_size) Atomic<size_t> m_pending { 0 };
+    };
+}
+using neo::EpochDomain;
+using neo::EpochDomainOptions;
+using neo::HazardDomain;
+using neo::HazardDomainOptions;
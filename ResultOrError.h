@@ -36,22 +36,23 @@ namespace neo
                 ((TResult*)m_storage)->~TResult();
         }
 
+        // The storage is raw, the held object has to be constructed in place rather than assigned to.
         constexpr ResultOrError(ResultOrError const& other) :
             m_has_error(other.m_has_error)
         {
             if (other.m_has_error)
-                Copy(1, (TError*)other.m_storage, (TError*)m_storage);
+                new (&m_storage) TError(*(TError const*)other.m_storage);
             else
-                Copy(1, (TResult*)other.m_storage, (TResult*)m_storage);
+                new (&m_storage) TResult(*(TResult const*)other.m_storage);
         }
 
         constexpr ResultOrError(ResultOrError&& other) :
             m_has_error(other.m_has_error)
         {
             if (other.m_has_error)
-                MoveOrCopy(1, (TError*)other.m_storage, (TError*)m_storage);
+                new (&m_storage) TError(std::move(*(TError*)other.m_storage));
             else
-                MoveOrCopy(1, (TResult*)other.m_storage, (TResult*)m_storage);
+                new (&m_storage) TResult(std::move(*(TResult*)other.m_storage));
         }
 
         constexpr ResultOrError& operator=(const ResultOrError& other)
@@ -59,7 +60,7 @@ namespace neo
             if (this == &other)
                 return *this;
 
-            ~ResultOrError();
+            this->~ResultOrError();
             new (this) ResultOrError(other);
 
             return *this;
@@ -70,7 +71,7 @@ namespace neo
             if (this == &other)
                 return *this;
 
-            ~ResultOrError();
+            this->~ResultOrError();
             new (this) ResultOrError(std::move(other));
 
             return *this;
@@ -167,13 +167,142 @@ namespace neo
 
     namespace detail
     {
+        // The strong references together hold one weak reference, so the block outlives the object until both
+        // counts drop to zero.
         struct RefPtrControlBlock
         {
-            Atomic<size_t> reference_count;
-            Atomic<size_t> weak_reference_count;
+            using Operation = void (*)(RefPtrControlBlock*);
+
+            RefPtrControlBlock(Operation destroy, Operation deallocate) :
+                destroy_object(destroy), deallocate_block(deallocate)
+            {
+            }
+
+            Atomic<size_t> reference_count { 1 };
+            Atomic<size_t> weak_reference_count { 1 };
+            Operation destroy_object;
+            Operation deallocate_block;
+        };
+
+        // Control block for an object allocated on its own, as in RefPtr(new T).
+        template<typename T>
+        struct RefPtrSeparateBlock final : public RefPtrControlBlock
+        {
+            explicit RefPtrSeparateBlock(T* obj) :
+                RefPtrControlBlock(
+                    [](RefPtrControlBlock* block) { delete static_cast<RefPtrSeparateBlock*>(block)->object; },
+                    [](RefPtrControlBlock* block) { delete static_cast<RefPtrSeparateBlock*>(block); }),
+                object(obj)
+            {
+            }
+
+            T* object;
         };
+
+        // Control block with the object stored right behind it, see create_refcounted().
+        template<typename T, typename TAllocator>
+        struct RefPtrInlineBlock final : public RefPtrControlBlock
+        {
+            RefPtrInlineBlock() :
+                RefPtrControlBlock(
+                    [](RefPtrControlBlock* block) { static_cast<RefPtrInlineBlock*>(block)->object()->~T(); },
+                    [](RefPtrControlBlock* block)
+                    {
+                        static_cast<RefPtrInlineBlock*>(block)->~RefPtrInlineBlock();
+                        TAllocator::deallocate(block);
+                    })
+            {
+            }
+
+            T* object()
+            {
+                return reinterpret_cast<T*>(storage);
+            }
+
+            alignas(T) u8 storage[sizeof(T)];
+        };
+
+        inline void release_weak_reference(RefPtrControlBlock* control)
+        {
+            if (control->weak_reference_count.sub_fetch(1, AcquireRelease) == 0)
+                control->deallocate_block(control);
+        }
+
+        inline void release_strong_reference(RefPtrControlBlock* control)
+        {
+            if (control->reference_count.sub_fetch(1, AcquireRelease) != 0)
+                return;
+
+            control->destroy_object(control);
+            // With no weak references left nobody can make new ones, so skip the second atomic decrement.
+            if (control->weak_reference_count.load(Acquire) == 1)
+                control->deallocate_block(control);
+            else
+                release_weak_reference(control);
+        }
+
+        struct IntrusiveRefCountTag
+        {
+        };
+
+        template<typename T, bool ThreadSafe>
+        class RefCountedBase : public IntrusiveRefCountTag
+        {
+        public:
+            RefCountedBase(RefCountedBase const&) = delete;
+            RefCountedBase& operator=(RefCountedBase const&) = delete;
+
+            void ref() const
+            {
+                if constexpr (ThreadSafe)
+                    m_ref_count.fetch_add(1, Relaxed);
+                else
+                    m_ref_count++;
+            }
+
+            void unref() const
+            {
+                u32 refs;
+                if constexpr (ThreadSafe)
+                    refs = m_ref_count.sub_fetch(1, AcquireRelease);
+                else
+                    refs = --m_ref_count;
+
+                if (refs == 0)
+                    delete static_cast<T const*>(this);
+            }
+
+            [[nodiscard]] size_t ref_count() const
+            {
+                if constexpr (ThreadSafe)
+                    return m_ref_count.load(Relaxed);
+                else
+                    return m_ref_count;
+            }
+
+        protected:
+            RefCountedBase() = default;
+            ~RefCountedBase() = default;
+
+        private:
+            mutable Conditional<ThreadSafe, Atomic<u32>, u32> m_ref_count { 1 };
+        };
+
+        struct RefPtrAdopter;
     }
 
+    // Intrusive reference counting: the count lives inside the object, which starts out with one reference that
+    // the first RefPtr adopts. Objects delete themselves through T's destructor, so a polymorphic T needs a
+    // virtual one. WeakPtr is not supported.
+    template<typename T>
+    using RefCounted = detail::RefCountedBase<T, true>;
+    // Same, with a plain counter for objects that never leave the thread that created them.
+    template<typename T>
+    using LocalRefCounted = detail::RefCountedBase<T, false>;
+
+    template<typename T>
+    concept IntrusivelyRefCounted = BaseOf<detail::IntrusiveRefCountTag, T>;
+
     template<typename T, bool Nullable>
     class RefPtrImpl
     {
@@ -181,25 +310,31 @@ namespace neo
 
         template<typename T_, bool B>
         friend class RefPtrImpl;
+        friend detail::RefPtrAdopter;
 
     public:
         using type = T;
         static constexpr bool nullable = Nullable;
 
+        // Takes over the reference obj was created with if T is intrusively counted, otherwise allocates a
+        // separate control block. Prefer create_refcounted(), which allocates both together.
         constexpr explicit RefPtrImpl(T* obj) :
             m_data(obj)
         {
             if constexpr (!Nullable)
                 ENSURE(obj != nullptr);
-            m_control = new detail::RefPtrControlBlock { 1, 0 };
+            if constexpr (!IntrusivelyRefCounted<T>)
+            {
+                if (obj != nullptr)
+                    m_control = new detail::RefPtrSeparateBlock<T>(obj);
+            }
         }
 
         constexpr RefPtrImpl(const RefPtrImpl& other) :
             m_data(other.m_data), m_control(other.m_control)
         {
             VERIFY(other.m_data != nullptr);
-            ENSURE(m_control != nullptr);
-            m_control->reference_count.add_fetch(1, MemoryOrder::Relaxed);
+            ref();
         }
 
         constexpr RefPtrImpl(RefPtrImpl&& other) :
@@ -221,7 +356,8 @@ namespace neo
         requires BaseOf<TBase, T>
         constexpr operator RefPtrImpl<TBase, Nullable>()
         {
-            m_control->reference_count.add_fetch(1, MemoryOrder::Relaxed);
+            static_assert(IntrusivelyRefCounted<TBase> == IntrusivelyRefCounted<T>);
+            ref();
 
             RefPtrImpl<TBase, Nullable> base;
             base.m_control = m_control;
@@ -234,11 +370,11 @@ namespace neo
             return release_nonnull();
         }
 
-        constexpr RefPtrImpl<T, false> release_nonnull()
+        constexpr RefPtrImpl<T, false> release_nonnull() &
         {
             ENSURE(m_data != nullptr);
 
-            m_control->reference_count.add_fetch(1, MemoryOrder::Relaxed);
+            ref();
 
             RefPtrImpl<T, false> copy;
             copy.m_data = m_data;
@@ -247,14 +383,28 @@ namespace neo
             return copy;
         }
 
+        // Hands our reference over instead of taking a new one.
+        constexpr RefPtrImpl<T, false> release_nonnull() &&
+        {
+            ENSURE(m_data != nullptr);
+
+            RefPtrImpl<T, false> moved;
+            moved.m_data = m_data;
+            moved.m_control = m_control;
+            m_data = nullptr;
+            m_control = nullptr;
+
+            return moved;
+        }
+
         template<typename TDerived>
         requires BaseOf<T, TDerived>
         constexpr RefPtrImpl(RefPtrImpl<TDerived, Nullable> const& other) :
             m_data(other.m_data), m_control(other.m_control)
         {
+            static_assert(IntrusivelyRefCounted<TDerived> == IntrusivelyRefCounted<T>);
             VERIFY(other.m_data != nullptr);
-            ENSURE(m_control != nullptr);
-            m_control->reference_count.add_fetch(1, MemoryOrder::Relaxed);
+            ref();
         }
 
         constexpr WeakPtr<T> make_weak() const
@@ -267,7 +417,7 @@ namespace neo
             if (this == &other)
                 return *this;
 
-            VERIFY(other.m_control != nullptr);
+            VERIFY(other.m_data != nullptr);
 
             this->~RefPtrImpl();
             new (this) RefPtrImpl(other);
@@ -288,7 +438,7 @@ namespace neo
 
         constexpr RefPtrImpl& operator=(RefPtrImpl&& other)
         {
-            VERIFY(other.m_control != nullptr);
+            VERIFY(other.m_data != nullptr);
 
             unref();
             new (this) RefPtrImpl(std::move(other));
@@ -298,24 +448,18 @@ namespace neo
 
         constexpr void unref()
         {
-            if (m_control != nullptr)
+            if constexpr (IntrusivelyRefCounted<T>)
             {
-                size_t refs = m_control->reference_count.sub_fetch(1, AcquireRelease);
-
-                if (refs == 0)
-                {
-                    delete m_data;
-                    m_data = nullptr;
-                    if (m_control->weak_reference_count == 0)
-                    {
-                        delete m_control;
-                        m_control = nullptr;
-                    }
-                }
-
-                m_data = nullptr;
-                m_control = nullptr;
+                if (m_data != nullptr)
+                    m_data->unref();
+            }
+            else if (m_control != nullptr)
+            {
+                detail::release_strong_reference(m_control);
             }
+
+            m_data = nullptr;
+            m_control = nullptr;
         }
 
         constexpr ~RefPtrImpl()
@@ -397,7 +541,10 @@ namespace neo
 
         [[nodiscard]] constexpr size_t ref_count() const
         {
-            return m_control->reference_count;
+            if constexpr (IntrusivelyRefCounted<T>)
+                return m_data->ref_count();
+            else
+                return m_control->reference_count;
         }
 
         [[nodiscard]] constexpr bool is_valid() const
@@ -408,6 +555,19 @@ namespace neo
     private:
         RefPtrImpl() = default;
 
+        constexpr RefPtrImpl(T* data, detail::RefPtrControlBlock* control) :
+            m_data(data), m_control(control)
+        {
+        }
+
+        constexpr void ref()
+        {
+            if constexpr (IntrusivelyRefCounted<T>)
+                m_data->ref();
+            else
+                m_control->reference_count.add_fetch(1, Relaxed);
+        }
+
         T* m_data { nullptr };
         detail::RefPtrControlBlock* m_control { nullptr };
     };
@@ -417,6 +577,18 @@ namespace neo
     template<typename T>
     using NullableRefPtr = RefPtrImpl<T, true>;
 
+    namespace detail
+    {
+        struct RefPtrAdopter
+        {
+            template<typename T, bool Nullable>
+            static constexpr RefPtrImpl<T, Nullable> adopt(T* data, RefPtrControlBlock* control)
+            {
+                return RefPtrImpl<T, Nullable>(data, control);
+            }
+        };
+    }
+
     template<typename T>
     class WeakPtr
     {
@@ -424,6 +596,7 @@ namespace neo
         constexpr WeakPtr(const RefPtr<T>& other) :
             m_data(other.m_data), m_control(other.m_control)
         {
+            static_assert(!IntrusivelyRefCounted<T>, "WeakPtr needs a control block");
             VERIFY(other.is_valid());
             m_control->weak_reference_count.add_fetch(1, Relaxed);
         }
@@ -441,9 +614,12 @@ namespace neo
             other.m_control = nullptr;
         }
 
+        // Expired references can be assigned, only moved-from ones can't.
         constexpr WeakPtr& operator=(const WeakPtr& other)
         {
-            VERIFY(other.is_valid());
+            VERIFY(other.m_control != nullptr);
+            if (this == &other)
+                return *this;
 
             this->~WeakPtr();
             new (this) WeakPtr(other);
@@ -453,7 +629,9 @@ namespace neo
 
         constexpr WeakPtr& operator=(WeakPtr&& other)
         {
-            VERIFY(other.is_valid());
+            VERIFY(other.m_control != nullptr);
+            if (this == &other)
+                return *this;
 
             this->~WeakPtr();
             new (this) WeakPtr(std::move(other));
@@ -466,14 +644,9 @@ namespace neo
             if (m_control == nullptr)
                 return;
 
-            size_t refs = m_control->weak_reference_count.sub_fetch(1, AcquireRelease);
-            if (m_control->reference_count.load(Acquire) == 0 && refs == 0)
-            {
-                delete m_data;
-                m_data = nullptr;
-                delete m_control;
-                m_control = nullptr;
-            }
+            detail::release_weak_reference(m_control);
+            m_data = nullptr;
+            m_control = nullptr;
         }
 
         [[nodiscard]] constexpr T* leak()
@@ -517,12 +690,12 @@ namespace neo
 
         [[nodiscard]] constexpr size_t weak_ref_count() const
         {
-            return m_control->reference_count;
+            return m_control->weak_reference_count - (m_control->reference_count != 0);
         }
 
         [[nodiscard]] constexpr bool is_valid() const
         {
-            return m_data != nullptr;
+            return m_control != nullptr && m_control->reference_count.load(Acquire) != 0;
         }
 
     private:
@@ -532,8 +705,11 @@ namespace neo
         detail::RefPtrControlBlock* m_control;
     };
 }
+using neo::IntrusivelyRefCounted;
+using neo::LocalRefCounted;
 using neo::NullableOwnPtr;
 using neo::NullableRefPtr;
 using neo::OwnPtr;
+using neo::RefCounted;
 using neo::RefPtr;
 using neo::WeakPtr;
@@ -24,6 +24,12 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <poll.h>
 #include <unistd.h>
 namespace neo
 {
@@ -72,7 +78,7 @@ namespace neo
             return m_port_network_order;
         }
 
-        constexpr Optional<String> to_string() const
+        Optional<String> to_string() const
         {
             char buf[INET_ADDRSTRLEN] {};
             if (::inet_ntop(AF_INET, &m_ip_network_order, buf, INET_ADDRSTRLEN) != buf)
@@ -134,10 +140,10 @@ namespace neo
             return m_port_network_order;
         }
 
-        constexpr Optional<String> to_string() const
+        Optional<String> to_string() const
         {
-            char buf[INET_ADDRSTRLEN] {};
-            if (::inet_ntop(AF_INET, &m_ip_network_order, buf, INET_ADDRSTRLEN) != buf)
+            char buf[INET6_ADDRSTRLEN] {};
+            if (::inet_ntop(AF_INET6, &m_ip_network_order, buf, INET6_ADDRSTRLEN) != buf)
                 return {};
             return { buf };
         }
@@ -147,9 +153,46 @@ namespace neo
         u16 m_port_network_order;
     };
 
+    enum class SocketMode
+    {
+        Blocking,
+        NonBlocking
+    };
+
+    namespace detail
+    {
+        inline ResultOrError<bool, SocketError> socket_data_available(int socketfd)
+        {
+            pollfd poll_info { socketfd, POLLIN, 0 };
+            auto result = ::poll(&poll_info, 1, 0);
+            if (result == -1)
+                return SocketError { errno };
+            return result == 1;
+        }
+
+        inline Optional<SocketError> set_socket_mode(int socketfd, SocketMode mode)
+        {
+            auto flags = ::fcntl(socketfd, F_GETFL);
+            if (flags == -1)
+                return SocketError(errno);
+
+            flags = mode == SocketMode::NonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+            if (::fcntl(socketfd, F_SETFL, flags) == -1)
+                return SocketError(errno);
+            return {};
+        }
+
+        constexpr int socket_type_flags(SocketMode mode)
+        {
+            return SOCK_CLOEXEC | (mode == SocketMode::NonBlocking ? SOCK_NONBLOCK : 0);
+        }
+    }
+
     class TCPSocket
     {
     private:
+        friend class TCPListener;
+
         explicit TCPSocket(int socketfd, Ipv4SocketAddress client_address, Ipv4SocketAddress remote_address) :
             m_socketfd(socketfd),
             m_is_ipv4(true),
@@ -170,9 +213,14 @@ namespace neo
         TCPSocket(TCPSocket const&) = delete;
 
         TCPSocket(TCPSocket&& other) :
-            m_socketfd(other.m_socketfd)
+            m_socketfd(other.m_socketfd),
+            m_is_ipv4(other.m_is_ipv4),
+            m_ipv6_client_address(other.m_ipv6_client_address),
+            m_ipv6_remote_address(other.m_ipv6_remote_address),
+            m_zero_copy_sent(other.m_zero_copy_sent),
+            m_zero_copy_completed(other.m_zero_copy_completed)
         {
-            other.m_socketfd = 0;
+            other.m_socketfd = -1;
         }
 
         TCPSocket& operator=(TCPSocket const&) = delete;
@@ -181,14 +229,23 @@ namespace neo
             if (this == &other)
                 return *this;
 
+            this->~TCPSocket();
             new (this) TCPSocket(std::move(other));
             return *this;
         }
 
+        ~TCPSocket()
+        {
+            if (is_open())
+                ::close(m_socketfd);
+        }
+
+        /// \param mode In non-blocking mode the connection may still be in progress when this returns, wait for the
+        /// socket to become writable and check pending_error()
         /// \return A connected socket if success, or SocketError containing an errno code if error
-        static ResultOrError<TCPSocket, SocketError> connect(Ipv4SocketAddress address)
+        static ResultOrError<TCPSocket, SocketError> connect(Ipv4SocketAddress address, SocketMode mode = SocketMode::Blocking)
         {
-            auto maybe_socket_fd = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            auto maybe_socket_fd = ::socket(AF_INET, SOCK_STREAM | detail::socket_type_flags(mode), IPPROTO_TCP);
             if (maybe_socket_fd == -1)
                 return SocketError(errno);
 
@@ -197,13 +254,21 @@ namespace neo
             socket_info.sin_port = address.port_in_network_order();
             socket_info.sin_family = AF_INET;
             auto result = ::connect(maybe_socket_fd, reinterpret_cast<sockaddr const*>(&socket_info), sizeof(socket_info));
-            if (result == -1)
-                return SocketError(errno);
+            if (result == -1 && !(mode == SocketMode::NonBlocking && errno == EINPROGRESS))
+            {
+                auto error = errno;
+                ::close(maybe_socket_fd);
+                return SocketError(error);
+            }
 
-            [[maybe_unused]] socklen_t client_info_length {};
+            socklen_t client_info_length = sizeof(sockaddr_in);
             sockaddr_in client_info {};
             if (getsockname(maybe_socket_fd, (sockaddr*)&client_info, &client_info_length) == -1)
-                return SocketError(errno);
+            {
+                auto error = errno;
+                ::close(maybe_socket_fd);
+                return SocketError(error);
+            }
 
             TCPSocket socket { maybe_socket_fd, { client_info.sin_addr.s_addr, client_info.sin_port }, address };
 
@@ -211,9 +276,9 @@ namespace neo
         }
 
         /// \return A connected socket if success, or SocketError containing an errno code if error
-        static ResultOrError<TCPSocket, SocketError> connect(Ipv6SocketAddress address)
+        static ResultOrError<TCPSocket, SocketError> connect(Ipv6SocketAddress address, SocketMode mode = SocketMode::Blocking)
         {
-            auto maybe_socket_fd = ::socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+            auto maybe_socket_fd = ::socket(AF_INET6, SOCK_STREAM | detail::socket_type_flags(mode), IPPROTO_TCP);
             if (maybe_socket_fd == -1)
                 return SocketError(errno);
 
@@ -222,24 +287,53 @@ namespace neo
             socket_info.sin6_port = address.port_in_network_order();
             socket_info.sin6_family = AF_INET6;
             auto result = ::connect(maybe_socket_fd, reinterpret_cast<sockaddr const*>(&socket_info), sizeof(socket_info));
-            if (result == -1)
-                return SocketError(errno);
+            if (result == -1 && !(mode == SocketMode::NonBlocking && errno == EINPROGRESS))
+            {
+                auto error = errno;
+                ::close(maybe_socket_fd);
+                return SocketError(error);
+            }
 
-            [[maybe_unused]] socklen_t client_info_length {};
+            socklen_t client_info_length = sizeof(sockaddr_in6);
             sockaddr_in6 client_info {};
             if (getsockname(maybe_socket_fd, (sockaddr*)&client_info, &client_info_length) == -1)
-                return SocketError(errno);
+            {
+                auto error = errno;
+                ::close(maybe_socket_fd);
+                return SocketError(error);
+            }
 
             TCPSocket socket { maybe_socket_fd, { *(u128*)&client_info.sin6_addr, client_info.sin6_port }, address };
 
             return socket;
         }
 
+        /// Takes ownership of an already connected socket, e.g. one accepted through IOEngine::accept()
+        /// \return The socket, on error the fd is left open and still owned by the caller
+        static ResultOrError<TCPSocket, SocketError> adopt(int socketfd)
+        {
+            sockaddr_in6 local_info {};
+            sockaddr_in6 remote_info {};
+            socklen_t local_info_length = sizeof(local_info);
+            socklen_t remote_info_length = sizeof(remote_info);
+            if (::getsockname(socketfd, (sockaddr*)&local_info, &local_info_length) == -1
+                || ::getpeername(socketfd, (sockaddr*)&remote_info, &remote_info_length) == -1)
+                return SocketError(errno);
+
+            if (local_info.sin6_family == AF_INET)
+            {
+                auto* local = (sockaddr_in*)&local_info;
+                auto* remote = (sockaddr_in*)&remote_info;
+                return TCPSocket { socketfd, Ipv4SocketAddress { local->sin_addr.s_addr, local->sin_port }, Ipv4SocketAddress { remote->sin_addr.s_addr, remote->sin_port } };
+            }
+            return TCPSocket { socketfd, Ipv6SocketAddress { *(u128*)&local_info.sin6_addr, local_info.sin6_port }, Ipv6SocketAddress { *(u128*)&remote_info.sin6_addr, remote_info.sin6_port } };
+        }
+
         /// \param data Data to send
         /// \return The error that occurred, if any
         Optional<SocketError> send(Span<u8> const& data)
         {
-            auto bytes_sent_or_error = ::send(m_socketfd, data.data(), data.size(), 0);
+            auto bytes_sent_or_error = ::send(m_socketfd, data.data(), data.size(), MSG_NOSIGNAL);
 
             if (bytes_sent_or_error == -1)
             {
@@ -249,6 +343,18 @@ namespace neo
             return {};
         }
 
+        /// Sends as much of data as the socket takes without blocking in non-blocking mode
+        /// \return The number of bytes sent, or EAGAIN if none could be
+        ResultOrError<size_t, SocketError> send_some(Span<u8> const& data)
+        {
+            auto bytes_sent = ::send(m_socketfd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (bytes_sent == -1)
+                return SocketError(errno);
+            return (size_t)bytes_sent;
+        }
+
+        /// \return The number of bytes read, 0 once the peer closed the connection. In non-blocking mode EAGAIN if
+        /// nothing is available
         ResultOr<size_t, SocketError> receive(Span<u8>& buffer)
         {
             VERIFY(buffer.size() != 0);
@@ -270,29 +376,121 @@ namespace neo
                 return SocketError(errno);
             }
 
-            m_socketfd = 0;
+            m_socketfd = -1;
             return {};
         }
 
         bool is_open() const
         {
-            return m_socketfd != 0;
+            return m_socketfd != -1;
         }
 
         ResultOrError<bool, SocketError> data_available() const
         {
-            fd_set readset;
-            timeval timeout { 0, 0 };
-            FD_ZERO(&readset);
-            FD_SET(m_socketfd, &readset);
+            return detail::socket_data_available(m_socketfd);
+        }
 
-            auto result = ::select(1, &readset, nullptr, nullptr, &timeout);
-            if (result == -1)
-                return SocketError { errno };
-            if (result == 1)
-                return true;
-            else
-                return false;
+        Optional<SocketError> set_mode(SocketMode mode)
+        {
+            return detail::set_socket_mode(m_socketfd, mode);
+        }
+
+        Optional<SocketError> set_no_delay(bool no_delay)
+        {
+            int value = no_delay ? 1 : 0;
+            if (::setsockopt(m_socketfd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) == -1)
+                return SocketError(errno);
+            return {};
+        }
+
+        /// Allows send_zero_copy() on this socket
+        Optional<SocketError> enable_zero_copy()
+        {
+            int value = 1;
+            if (::setsockopt(m_socketfd, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) == -1)
+                return SocketError(errno);
+            return {};
+        }
+
+        /// Sends all of data with MSG_ZEROCOPY: the kernel pins the pages instead of copying them and reports when it
+        /// is done with them. Pinning costs about as much as copying a few KiB, so this is for large sends only
+        /// \return A sequence number, data must stay untouched until zero_copy_done() returns true for it
+        ResultOrError<u32, SocketError> send_zero_copy(Span<u8> const& data)
+        {
+            size_t offset = 0;
+            while (offset < data.size())
+            {
+                auto bytes_sent = ::send(m_socketfd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL | MSG_ZEROCOPY);
+                if (bytes_sent == -1)
+                {
+                    // ENOBUFS: too many sends still hold pinned pages.
+                    if (errno == ENOBUFS || errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        pollfd poll_fd { m_socketfd, POLLOUT, 0 };
+                        auto error = errno;
+                        if (error == ENOBUFS)
+                            poll_fd.events = 0;
+                        if (::poll(&poll_fd, 1, -1) == -1 && errno != EINTR)
+                            return SocketError(errno);
+                        if (error == ENOBUFS)
+                        {
+                            auto reaped = reap_zero_copy();
+                            if (reaped.has_value())
+                                return reaped.value();
+                        }
+                        continue;
+                    }
+                    if (errno == EINTR)
+                        continue;
+                    return SocketError(errno);
+                }
+                offset += (size_t)bytes_sent;
+                m_zero_copy_sent++;
+            }
+            return m_zero_copy_sent;
+        }
+
+        /// \return True once the kernel released the buffers of the send_zero_copy() that returned sequence
+        ResultOrError<bool, SocketError> zero_copy_done(u32 sequence)
+        {
+            auto maybe_error = reap_zero_copy();
+            if (maybe_error.has_value())
+                return maybe_error.value();
+            return (i32)(m_zero_copy_completed - sequence) >= 0;
+        }
+
+        /// Blocks until zero_copy_done(sequence). Completions arrive as an error condition, so an EventLoop can watch
+        /// for EventLoop::Error instead
+        Optional<SocketError> wait_for_zero_copy(u32 sequence)
+        {
+            while (true)
+            {
+                auto done = zero_copy_done(sequence);
+                if (done.has_error())
+                    return done.error();
+                if (done.result())
+                    return {};
+
+                // Completions land on the error queue, which polls as POLLERR.
+                pollfd poll_fd { m_socketfd, 0, 0 };
+                if (::poll(&poll_fd, 1, -1) == -1 && errno != EINTR)
+                    return SocketError(errno);
+            }
+        }
+
+        /// \return The error a non-blocking connect finished with, 0 if it connected
+        SocketError pending_error() const
+        {
+            int error {};
+            socklen_t error_length = sizeof(error);
+            if (::getsockopt(m_socketfd, SOL_SOCKET, SO_ERROR, &error, &error_length) == -1)
+                return SocketError(errno);
+            return SocketError(error);
+        }
+
+        int fd() const
+        {
+            return m_socketfd;
         }
 
         bool ipv4() const
@@ -301,8 +499,42 @@ namespace neo
         }
 
     private:
+        // Drains the zero copy notifications from the error queue. Each covers a range of sends by sequence number.
+        Optional<SocketError> reap_zero_copy()
+        {
+            while (true)
+            {
+                alignas(cmsghdr) u8 control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+                msghdr message {};
+                message.msg_control = control;
+                message.msg_controllen = sizeof(control);
+                if (::recvmsg(m_socketfd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        return {};
+                    if (errno == EINTR)
+                        continue;
+                    return SocketError(errno);
+                }
+
+                for (auto* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+                {
+                    if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                        && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                        continue;
+
+                    sock_extended_err error;
+                    __builtin_memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+                    if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY || error.ee_errno != 0)
+                        continue;
+                    // ee_data is the last sequence of the range, sequences count from 0 and ours from 1.
+                    if ((i32)(error.ee_data + 1 - m_zero_copy_completed) > 0)
+                        m_zero_copy_completed = error.ee_data + 1;
+                }
+            }
+        }
 
-        int m_socketfd {};
+        int m_socketfd { -1 };
         bool m_is_ipv4;
         union
         {
@@ -314,49 +546,390 @@ namespace neo
             Ipv6SocketAddress m_ipv6_remote_address;
             Ipv4SocketAddress m_ipv4_remote_address;
         };
+        u32 m_zero_copy_sent { 0 };
+        u32 m_zero_copy_completed { 0 };
+    };
+
+    class TCPListener
+    {
+    public:
+        TCPListener(TCPListener const&) = delete;
+        TCPListener& operator=(TCPListener const&) = delete;
+
+        TCPListener(TCPListener&& other) :
+            m_socketfd(other.m_socketfd),
+            m_is_ipv4(other.m_is_ipv4),
+            m_mode(other.m_mode)
+        {
+            other.m_socketfd = -1;
+        }
+
+        TCPListener& operator=(TCPListener&& other)
+        {
+            if (this == &other)
+                return *this;
+
+            this->~TCPListener();
+            new (this) TCPListener(std::move(other));
+            return *this;
+        }
+
+        ~TCPListener()
+        {
+            if (is_open())
+                ::close(m_socketfd);
+        }
+
+        /// \param address Port 0 binds to any free port, see port()
+        /// \param mode Mode of the listener, accepted sockets inherit it
+        static ResultOrError<TCPListener, SocketError> listen(Ipv4SocketAddress address, SocketMode mode = SocketMode::NonBlocking, int backlog = SOMAXCONN)
+        {
+            sockaddr_in socket_info {};
+            socket_info.sin_addr.s_addr = address.ip_in_network_order();
+            socket_info.sin_port = address.port_in_network_order();
+            socket_info.sin_family = AF_INET;
+            return listen(AF_INET, (sockaddr const*)&socket_info, sizeof(socket_info), mode, backlog);
+        }
+
+        static ResultOrError<TCPListener, SocketError> listen(Ipv6SocketAddress address, SocketMode mode = SocketMode::NonBlocking, int backlog = SOMAXCONN)
+        {
+            sockaddr_in6 socket_info {};
+            *((u128*)&socket_info.sin6_addr) = address.ip_in_network_order();
+            socket_info.sin6_port = address.port_in_network_order();
+            socket_info.sin6_family = AF_INET6;
+            return listen(AF_INET6, (sockaddr const*)&socket_info, sizeof(socket_info), mode, backlog);
+        }
+
+        /// \return The next pending connection. In non-blocking mode EAGAIN if there is none
+        ResultOrError<TCPSocket, SocketError> accept()
+        {
+            sockaddr_in6 remote_info {};
+            socklen_t remote_info_length = sizeof(remote_info);
+            auto socketfd = ::accept4(m_socketfd, (sockaddr*)&remote_info, &remote_info_length, detail::socket_type_flags(m_mode));
+            if (socketfd == -1)
+                return SocketError(errno);
+
+            sockaddr_in6 local_info {};
+            socklen_t local_info_length = sizeof(local_info);
+            if (::getsockname(socketfd, (sockaddr*)&local_info, &local_info_length) == -1)
+            {
+                auto error = errno;
+                ::close(socketfd);
+                return SocketError(error);
+            }
+
+            if (m_is_ipv4)
+            {
+                auto* local = (sockaddr_in*)&local_info;
+                auto* remote = (sockaddr_in*)&remote_info;
+                return TCPSocket { socketfd, Ipv4SocketAddress { local->sin_addr.s_addr, local->sin_port }, Ipv4SocketAddress { remote->sin_addr.s_addr, remote->sin_port } };
+            }
+            return TCPSocket { socketfd, Ipv6SocketAddress { *(u128*)&local_info.sin6_addr, local_info.sin6_port }, Ipv6SocketAddress { *(u128*)&remote_info.sin6_addr, remote_info.sin6_port } };
+        }
+
+        /// \return The port the listener is bound to, in host order
+        ResultOrError<u16, SocketError> port() const
+        {
+            sockaddr_in6 local_info {};
+            socklen_t local_info_length = sizeof(local_info);
+            if (::getsockname(m_socketfd, (sockaddr*)&local_info, &local_info_length) == -1)
+                return SocketError(errno);
+            // sin_port and sin6_port sit at the same offset
+            return BigToHostEndian(local_info.sin6_port);
+        }
+
+        Optional<SocketError> close()
+        {
+            if (::close(m_socketfd) == -1)
+                return SocketError(errno);
+
+            m_socketfd = -1;
+            return {};
+        }
+
+        bool is_open() const
+        {
+            return m_socketfd != -1;
+        }
+
+        int fd() const
+        {
+            return m_socketfd;
+        }
+
+        bool ipv4() const
+        {
+            return m_is_ipv4;
+        }
+
+    private:
+        TCPListener(int socketfd, bool ipv4, SocketMode mode) :
+            m_socketfd(socketfd), m_is_ipv4(ipv4), m_mode(mode)
+        {
+        }
+
+        static ResultOrError<TCPListener, SocketError> listen(int domain, sockaddr const* address, socklen_t address_length, SocketMode mode, int backlog)
+        {
+            auto socketfd = ::socket(domain, SOCK_STREAM | detail::socket_type_flags(mode), IPPROTO_TCP);
+            if (socketfd == -1)
+                return SocketError(errno);
+
+            int reuse = 1;
+            if (::setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1
+                || ::bind(socketfd, address, address_length) == -1
+                || ::listen(socketfd, backlog) == -1)
+            {
+                auto error = errno;
+                ::close(socketfd);
+                return SocketError(error);
+            }
+
+            return TCPListener { socketfd, domain == AF_INET, mode };
+        }
+
+        int m_socketfd { -1 };
+        bool m_is_ipv4;
+        SocketMode m_mode;
     };
 
+    // Where receive_batch() put a datagram. With receive coalescing on, one buffer may carry several datagrams
+    // of segment_size bytes back to back, the last one possibly shorter.
+    struct ReceivedDatagram
+    {
+        size_t size;
+        size_t segment_size;
+    };
+
+    namespace detail
+    {
+        union UDPAddress
+        {
+            sockaddr_in ipv4;
+            sockaddr_in6 ipv6;
+        };
+
+        inline socklen_t to_sockaddr(Ipv4SocketAddress address, UDPAddress& out)
+        {
+            out.ipv4 = {};
+            out.ipv4.sin_family = AF_INET;
+            out.ipv4.sin_port = address.port_in_network_order();
+            out.ipv4.sin_addr.s_addr = address.ip_in_network_order();
+            return sizeof(sockaddr_in);
+        }
+
+        inline socklen_t to_sockaddr(Ipv6SocketAddress address, UDPAddress& out)
+        {
+            out.ipv6 = {};
+            out.ipv6.sin6_family = AF_INET6;
+            out.ipv6.sin6_port = address.port_in_network_order();
+            *(u128*)&out.ipv6.sin6_addr = address.ip_in_network_order();
+            return sizeof(sockaddr_in6);
+        }
+    }
+
     class UDPSocket
     {
     public:
+        // Datagrams moved per sendmmsg/recvmmsg call, larger batches are split.
+        static constexpr size_t max_batch_size = 64;
+
         explicit UDPSocket(int socketfd, bool ipv4) :
             m_socketfd(socketfd),
             m_is_ipv4(ipv4)
         {
         }
 
-        static ResultOrError<UDPSocket, SocketError> create(bool ipv4)
+        UDPSocket(UDPSocket const&) = delete;
+        UDPSocket& operator=(UDPSocket const&) = delete;
+
+        UDPSocket(UDPSocket&& other) :
+            m_socketfd(other.m_socketfd),
+            m_is_ipv4(other.m_is_ipv4),
+            m_gso_supported(other.m_gso_supported)
+        {
+            other.m_socketfd = -1;
+        }
+
+        UDPSocket& operator=(UDPSocket&& other)
+        {
+            if (this == &other)
+                return *this;
+
+            this->~UDPSocket();
+            new (this) UDPSocket(std::move(other));
+            return *this;
+        }
+
+        ~UDPSocket()
+        {
+            if (is_open())
+                ::close(m_socketfd);
+        }
+
+        static ResultOrError<UDPSocket, SocketError> create(bool ipv4, SocketMode mode = SocketMode::Blocking)
         {
             auto domain = ipv4 ? AF_INET : AF_INET6;
-            auto maybe_socket_fd = ::socket(domain, SOCK_DGRAM, IPPROTO_UDP);
+            auto maybe_socket_fd = ::socket(domain, SOCK_DGRAM | detail::socket_type_flags(mode), IPPROTO_UDP);
             if (maybe_socket_fd == -1)
                 return SocketError(errno);
 
             return UDPSocket { maybe_socket_fd, ipv4 };
         }
 
-        Optional<SocketError> send(Ipv4SocketAddress address, Span<u8> const& data)
+        /// \param address Port 0 binds to any free port, see port()
+        Optional<SocketError> bind(Ipv4SocketAddress address)
         {
-            sockaddr_in addr {};
-            addr.sin_port = address.port_in_network_order();
-            addr.sin_addr.s_addr = address.ip_in_network_order();
-            auto bytes_sent_or_error = ::sendto(m_socketfd, data.data(), data.size(), 0, (sockaddr const*)&address, sizeof(addr));
-            if (bytes_sent_or_error == -1)
-                return SocketError { errno };
+            detail::UDPAddress addr;
+            auto length = detail::to_sockaddr(address, addr);
+            if (::bind(m_socketfd, (sockaddr const*)&addr, length) == -1)
+                return SocketError(errno);
             return {};
         }
 
+        Optional<SocketError> bind(Ipv6SocketAddress address)
+        {
+            detail::UDPAddress addr;
+            auto length = detail::to_sockaddr(address, addr);
+            if (::bind(m_socketfd, (sockaddr const*)&addr, length) == -1)
+                return SocketError(errno);
+            return {};
+        }
+
+        /// \return The port the socket is bound to, in host order
+        ResultOrError<u16, SocketError> port() const
+        {
+            sockaddr_in6 local_info {};
+            socklen_t local_info_length = sizeof(local_info);
+            if (::getsockname(m_socketfd, (sockaddr*)&local_info, &local_info_length) == -1)
+                return SocketError(errno);
+            return BigToHostEndian(local_info.sin6_port);
+        }
+
+        Optional<SocketError> send(Ipv4SocketAddress address, Span<u8> const& data)
+        {
+            detail::UDPAddress addr;
+            auto length = detail::to_sockaddr(address, addr);
+            return send_to(addr, length, data);
+        }
+
         Optional<SocketError> send(Ipv6SocketAddress address, Span<u8> const& data)
         {
-            sockaddr_in6 addr {};
-            addr.sin6_port = address.port_in_network_order();
-            *(u128*)&addr.sin6_addr = address.ip_in_network_order();
-            auto bytes_sent_or_error = ::sendto(m_socketfd, data.data(), data.size(), 0, (sockaddr const*)&address, sizeof(addr));
-            if (bytes_sent_or_error == -1)
-                return SocketError { errno };
+            detail::UDPAddress addr;
+            auto length = detail::to_sockaddr(address, addr);
+            return send_to(addr, length, data);
+        }
+
+        /// \return The size of the datagram read into buffer, truncated to the buffer's size
+        ResultOrError<size_t, SocketError> receive(Span<u8>& buffer)
+        {
+            auto bytes_read = ::recv(m_socketfd, buffer.data(), buffer.size(), 0);
+            if (bytes_read == -1)
+                return SocketError(errno);
+            return (size_t)bytes_read;
+        }
+
+        /// Sends every span in datagrams as its own datagram, max_batch_size per syscall
+        /// \return The number of datagrams sent, fewer than given if the socket is non-blocking and its buffer filled
+        ResultOrError<size_t, SocketError> send_batch(Ipv4SocketAddress address, Span<Span<u8>> datagrams)
+        {
+            detail::UDPAddress addr;
+            auto length = detail::to_sockaddr(address, addr);
+            return send_batch_to(addr, length, datagrams);
+        }
+
+        ResultOrError<size_t, SocketError> send_batch(Ipv6SocketAddress address, Span<Span<u8>> datagrams)
+        {
+            detail::UDPAddress addr;
+            auto length = detail::to_sockaddr(address, addr);
+            return send_batch_to(addr, length, datagrams);
+        }
+
+        /// Receives into buffers, one datagram per buffer. Blocks for the first datagram in blocking mode, then only
+        /// takes what is already queued
+        /// \param received Must be at least as large as buffers, entry i describes what landed in buffers[i]
+        /// \return The number of buffers filled
+        ResultOrError<size_t, SocketError> receive_batch(Span<Span<u8>> buffers, Span<ReceivedDatagram> received)
+        {
+            VERIFY(received.size() >= buffers.size());
+            auto count = min(buffers.size(), max_batch_size);
+
+            mmsghdr messages[max_batch_size];
+            iovec iovecs[max_batch_size];
+            alignas(cmsghdr) u8 control[max_batch_size][CMSG_SPACE(sizeof(int))];
+            for (size_t i = 0; i < count; i++)
+            {
+                iovecs[i] = { buffers[i].data(), buffers[i].size() };
+                messages[i] = {};
+                messages[i].msg_hdr.msg_iov = &iovecs[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+                messages[i].msg_hdr.msg_control = control[i];
+                messages[i].msg_hdr.msg_controllen = sizeof(control[i]);
+            }
+
+            auto result = ::recvmmsg(m_socketfd, messages, (unsigned)count, MSG_WAITFORONE, nullptr);
+            if (result == -1)
+                return SocketError(errno);
+
+            for (int i = 0; i < result; i++)
+            {
+                auto size = (size_t)messages[i].msg_len;
+                received[i] = { size, size };
+                for (auto* cmsg = CMSG_FIRSTHDR(&messages[i].msg_hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&messages[i].msg_hdr, cmsg))
+                {
+                    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                    {
+                        int segment_size;
+                        __builtin_memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+                        received[i].segment_size = (size_t)segment_size;
+                    }
+                }
+            }
+            return (size_t)result;
+        }
+
+        /// Sends data as datagrams of segment_size bytes (the last one may be shorter) in one syscall, letting the
+        /// kernel or the NIC do the split (UDP GSO). Falls back to send_batch() where GSO is unsupported
+        Optional<SocketError> send_segmented(Ipv4SocketAddress address, Span<u8> const& data, u16 segment_size)
+        {
+            detail::UDPAddress addr;
+            auto length = detail::to_sockaddr(address, addr);
+            return send_segmented_to(addr, length, data, segment_size);
+        }
+
+        Optional<SocketError> send_segmented(Ipv6SocketAddress address, Span<u8> const& data, u16 segment_size)
+        {
+            detail::UDPAddress addr;
+            auto length = detail::to_sockaddr(address, addr);
+            return send_segmented_to(addr, length, data, segment_size);
+        }
+
+        /// Lets the kernel hand consecutive datagrams of one flow over as a single coalesced buffer (UDP GRO), see
+        /// ReceivedDatagram
+        Optional<SocketError> set_receive_coalescing(bool enabled)
+        {
+            int value = enabled ? 1 : 0;
+            if (::setsockopt(m_socketfd, SOL_UDP, UDP_GRO, &value, sizeof(value)) == -1)
+                return SocketError(errno);
             return {};
         }
 
+        Optional<SocketError> set_receive_buffer_size(int size)
+        {
+            if (::setsockopt(m_socketfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == -1)
+                return SocketError(errno);
+            return {};
+        }
+
+        Optional<SocketError> set_mode(SocketMode mode)
+        {
+            return detail::set_socket_mode(m_socketfd, mode);
+        }
+
+        int fd() const
+        {
+            return m_socketfd;
+        }
+
         bool ipv4() const
         {
             return m_is_ipv4;
@@ -369,40 +942,137 @@ namespace neo
                 return SocketError(errno);
             }
 
-            m_socketfd = 0;
+            m_socketfd = -1;
             return {};
         }
 
         bool is_open() const
         {
-            return m_socketfd != 0;
+            return m_socketfd != -1;
         }
 
         ResultOrError<bool, SocketError> data_available() const
         {
-            fd_set readset;
-            timeval timeout { 0, 0 };
-            FD_ZERO(&readset);
-            FD_SET(m_socketfd, &readset);
+            return detail::socket_data_available(m_socketfd);
+        }
 
-            auto result = ::select(1, &readset, nullptr, nullptr, &timeout);
-            if (result == -1)
+    private:
+        Optional<SocketError> send_to(detail::UDPAddress const& address, socklen_t address_length, Span<u8> const& data)
+        {
+            auto bytes_sent_or_error = ::sendto(m_socketfd, data.data(), data.size(), 0, (sockaddr const*)&address, address_length);
+            if (bytes_sent_or_error == -1)
                 return SocketError { errno };
-            if (result == 1)
-                return true;
-            else
-                return false;
+            return {};
         }
 
-    private:
-        int m_socketfd {};
-        bool m_is_ipv4;
-        union
+        ResultOrError<size_t, SocketError> send_batch_to(detail::UDPAddress const& address, socklen_t address_length, Span<Span<u8>> datagrams)
         {
-            Ipv6SocketAddress m_ipv6_client_address;
-            Ipv4SocketAddress m_ipv4_client_address;
-        };
+            iovec iovecs[max_batch_size];
+            size_t sent = 0;
+            while (sent < datagrams.size())
+            {
+                auto count = min(datagrams.size() - sent, max_batch_size);
+                for (size_t i = 0; i < count; i++)
+                    iovecs[i] = { datagrams[sent + i].data(), datagrams[sent + i].size() };
+
+                auto result = send_iovecs(address, address_length, iovecs, count);
+                if (result.has_error())
+                {
+                    if (sent != 0 && (result.error() == EAGAIN || result.error() == EWOULDBLOCK))
+                        return sent;
+                    return result.error();
+                }
+                sent += result.result();
+                if (result.result() < count)
+                    return sent;
+            }
+            return sent;
+        }
+
+        // One sendmmsg with a datagram per iovec.
+        ResultOrError<size_t, SocketError> send_iovecs(detail::UDPAddress const& address, socklen_t address_length, iovec* iovecs, size_t count)
+        {
+            mmsghdr messages[max_batch_size];
+            for (size_t i = 0; i < count; i++)
+            {
+                messages[i] = {};
+                messages[i].msg_hdr.msg_name = (void*)&address;
+                messages[i].msg_hdr.msg_namelen = address_length;
+                messages[i].msg_hdr.msg_iov = &iovecs[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            auto result = ::sendmmsg(m_socketfd, messages, (unsigned)count, 0);
+            if (result == -1)
+                return SocketError(errno);
+            return (size_t)result;
+        }
+
+        Optional<SocketError> send_segmented_to(detail::UDPAddress const& address, socklen_t address_length, Span<u8> const& data, u16 segment_size)
+        {
+            VERIFY(segment_size != 0);
+            if (m_gso_supported)
+            {
+                iovec iov { data.data(), data.size() };
+                alignas(cmsghdr) u8 control[CMSG_SPACE(sizeof(u16))] {};
+                msghdr message {};
+                message.msg_name = (void*)&address;
+                message.msg_namelen = address_length;
+                message.msg_iov = &iov;
+                message.msg_iovlen = 1;
+                message.msg_control = control;
+                message.msg_controllen = sizeof(control);
+                auto* cmsg = CMSG_FIRSTHDR(&message);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(u16));
+                __builtin_memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+
+                if (::sendmsg(m_socketfd, &message, 0) != -1)
+                    return {};
+                // EIO: the device can't segment, ENOPROTOOPT: the kernel predates UDP GSO. EINVAL only rules out
+                // this call (too many segments for one send), so GSO stays on for the next.
+                if (errno == EIO || errno == ENOPROTOOPT)
+                    m_gso_supported = false;
+                else if (errno != EINVAL)
+                    return SocketError(errno);
+            }
+
+            iovec segments[max_batch_size];
+            size_t offset = 0;
+            while (offset < data.size())
+            {
+                size_t count = 0;
+                while (count < max_batch_size && offset < data.size())
+                {
+                    auto size = min((size_t)segment_size, data.size() - offset);
+                    segments[count++] = { (u8*)data.data() + offset, size };
+                    offset += size;
+                }
+
+                size_t sent = 0;
+                while (sent < count)
+                {
+                    auto result = send_iovecs(address, address_length, segments + sent, count - sent);
+                    if (result.has_error())
+                        return result.error();
+                    sent += result.result();
+                }
+            }
+            return {};
+        }
+
+        int m_socketfd { -1 };
+        bool m_is_ipv4;
+        bool m_gso_supported { true };
     };
 
 }
+using neo::Ipv4SocketAddress;
+using neo::Ipv6SocketAddress;
+using neo::SocketError;
+using neo::SocketMode;
+using neo::TCPListener;
+using neo::ReceivedDatagram;
 using neo::TCPSocket;
+using neo::UDPSocket;
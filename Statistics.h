@@ -0,0 +1,335 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Aligned.h"
+#include "Assert.h"
+#include "Atomic.h"
+#include "Concepts.h"
+#include "NumericLimits.h"
+#include "Types.h"
+#include <sched.h>
+#include <unistd.h>
+
+namespace neo
+{
+    namespace detail
+    {
+        // A power of two covering every configured CPU, so each CPU gets a shard of its own.
+        inline size_t default_shard_count()
+        {
+            static size_t count = []()
+            {
+                auto cpus = sysconf(_SC_NPROCESSORS_CONF);
+                size_t shards = 1;
+                while (shards < (size_t)(cpus > 0 ? cpus : 1) && shards < 256)
+                    shards *= 2;
+                return shards;
+            }();
+            return count;
+        }
+
+        // The shard of the CPU the caller runs on. glibc reads it from the rseq area, so this costs about as
+        // much as a load, and threads move between CPUs rarely enough that a shard's line mostly stays put.
+        // Without a CPU number, threads are spread by a per thread index instead.
+        inline size_t current_shard(size_t mask)
+        {
+            auto cpu = sched_getcpu();
+            if (cpu >= 0) [[likely]]
+                return (size_t)cpu & mask;
+
+            static Atomic<size_t> s_next_index { 0 };
+            static thread_local size_t s_index = s_next_index.fetch_add(1, Relaxed);
+            return s_index & mask;
+        }
+
+        template<typename T>
+        struct alignas(hardware_destructive_interference_size) StatisticShard
+        {
+            Atomic<T> value;
+        };
+
+        template<Integral T, bool Maximum>
+        class ShardedExtremum
+        {
+        public:
+            static constexpr T identity = Maximum ? NumericLimits<T>::min() : NumericLimits<T>::max();
+
+            ShardedExtremum(ShardedExtremum const&) = delete;
+            ShardedExtremum& operator=(ShardedExtremum const&) = delete;
+
+            explicit ShardedExtremum(size_t shard_count = default_shard_count()) :
+                m_mask(shard_count - 1), m_shards(new StatisticShard<T>[shard_count])
+            {
+                VERIFY(shard_count > 0 && (shard_count & m_mask) == 0);
+                reset();
+            }
+
+            ~ShardedExtremum()
+            {
+                delete[] m_shards;
+                m_shards = nullptr;
+            }
+
+            // Only writes when value beats the shard's current one, so steady state updates are plain loads.
+            void record(T value)
+            {
+                auto& shard = m_shards[current_shard(m_mask)].value;
+                auto current = shard.load(Relaxed);
+                while (is_better(value, current) && !shard.compare_exchange_weak(current, value, Relaxed, Relaxed))
+                    ;
+            }
+
+            // identity if nothing was recorded.
+            [[nodiscard]] T value() const
+            {
+                T result = identity;
+                for (size_t i = 0; i <= m_mask; i++)
+                {
+                    auto shard = m_shards[i].value.load(Relaxed);
+                    if (is_better(shard, result))
+                        result = shard;
+                }
+                return result;
+            }
+
+            // Values recorded while this runs may or may not survive it.
+            void reset()
+            {
+                for (size_t i = 0; i <= m_mask; i++)
+                    m_shards[i].value.store(identity, Relaxed);
+            }
+
+        private:
+            static bool is_better(T candidate, T current)
+            {
+                if constexpr (Maximum)
+                    return candidate > current;
+                else
+                    return candidate < current;
+            }
+
+            size_t m_mask;
+            StatisticShard<T>* m_shards;
+        };
+    }
+
+    // A counter many threads update at once. Each CPU adds to a shard on a cache line of its own, so updates
+    // don't bounce a shared line between cores; value() sums the shards and is only exact once updates stop.
+    template<Integral T = u64>
+    class ShardedCounter
+    {
+    public:
+        ShardedCounter(ShardedCounter const&) = delete;
+        ShardedCounter& operator=(ShardedCounter const&) = delete;
+
+        explicit ShardedCounter(size_t shard_count = detail::default_shard_count()) :
+            m_mask(shard_count - 1), m_shards(new detail::StatisticShard<T>[shard_count])
+        {
+            VERIFY(shard_count > 0 && (shard_count & m_mask) == 0);
+        }
+
+        ~ShardedCounter()
+        {
+            delete[] m_shards;
+            m_shards = nullptr;
+        }
+
+        void add(T delta)
+        {
+            m_shards[detail::current_shard(m_mask)].value.fetch_add(delta, Relaxed);
+        }
+
+        void sub(T delta)
+        {
+            m_shards[detail::current_shard(m_mask)].value.fetch_sub(delta, Relaxed);
+        }
+
+        void increment()
+        {
+            add(1);
+        }
+
+        [[nodiscard]] T value() const
+        {
+            T sum = 0;
+            for (size_t i = 0; i <= m_mask; i++)
+                sum += m_shards[i].value.load(Relaxed);
+            return sum;
+        }
+
+        // Updates made while this runs may or may not survive it.
+        void reset()
+        {
+            for (size_t i = 0; i <= m_mask; i++)
+                m_shards[i].value.store(0, Relaxed);
+        }
+
+        [[nodiscard]] size_t shard_count() const
+        {
+            return m_mask + 1;
+        }
+
+    private:
+        size_t m_mask;
+        detail::StatisticShard<T>* m_shards;
+    };
+
+    // Largest value recorded by any thread, NumericLimits<T>::min() if none was.
+    template<Integral T>
+    using ShardedMax = detail::ShardedExtremum<T, true>;
+    // Smallest value recorded by any thread, NumericLimits<T>::max() if none was.
+    template<Integral T>
+    using ShardedMin = detail::ShardedExtremum<T, false>;
+
+    // Lock-free histogram of u64 samples such as latencies in nanoseconds. Buckets are log-linear: values below
+    // 16 get one each, and every power of two above is split into 16, so a bucket's bounds are within 1/16 of any
+    // value in it. record() is two relaxed increments in the caller's CPU shard; the queries merge the shards.
+    class Histogram
+    {
+    public:
+        static constexpr size_t sub_bucket_bits = 4;
+        static constexpr size_t sub_bucket_count = 1 << sub_bucket_bits;
+        static constexpr size_t bucket_count = (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+        Histogram(Histogram const&) = delete;
+        Histogram& operator=(Histogram const&) = delete;
+
+        explicit Histogram(size_t shard_count = detail::default_shard_count()) :
+            m_mask(shard_count - 1), m_shards(new Shard[shard_count])
+        {
+            VERIFY(shard_count > 0 && (shard_count & m_mask) == 0);
+        }
+
+        ~Histogram()
+        {
+            delete[] m_shards;
+            m_shards = nullptr;
+        }
+
+        [[nodiscard]] static constexpr size_t bucket_of(u64 value)
+        {
+            if (value < sub_bucket_count)
+                return value;
+            size_t shift = 63 - __builtin_clzll(value) - sub_bucket_bits;
+            return ((shift + 1) << sub_bucket_bits) + ((value >> shift) & (sub_bucket_count - 1));
+        }
+
+        [[nodiscard]] static constexpr u64 bucket_lower_bound(size_t bucket)
+        {
+            if (bucket < sub_bucket_count)
+                return bucket;
+            size_t shift = (bucket >> sub_bucket_bits) - 1;
+            return (sub_bucket_count + (bucket & (sub_bucket_count - 1))) << shift;
+        }
+
+        [[nodiscard]] static constexpr u64 bucket_upper_bound(size_t bucket)
+        {
+            if (bucket < sub_bucket_count)
+                return bucket;
+            size_t shift = (bucket >> sub_bucket_bits) - 1;
+            return bucket_lower_bound(bucket) + (((u64)1 << shift) - 1);
+        }
+
+        void record(u64 value, u64 count = 1)
+        {
+            auto& shard = m_shards[detail::current_shard(m_mask)];
+            shard.buckets[bucket_of(value)].fetch_add(count, Relaxed);
+            shard.sum.fetch_add(value * count, Relaxed);
+        }
+
+        [[nodiscard]] u64 count() const
+        {
+            u64 total = 0;
+            for (size_t bucket = 0; bucket < bucket_count; bucket++)
+                total += bucket_total(bucket);
+            return total;
+        }
+
+        [[nodiscard]] u64 sum() const
+        {
+            u64 total = 0;
+            for (size_t i = 0; i <= m_mask; i++)
+                total += m_shards[i].sum.load(Relaxed);
+            return total;
+        }
+
+        [[nodiscard]] double mean() const
+        {
+            auto samples = count();
+            return samples == 0 ? 0.0 : (double)sum() / (double)samples;
+        }
+
+        // Upper bound of the bucket holding the given percentile (0 to 100) of the samples, 0 if there are none.
+        [[nodiscard]] u64 percentile(double percent) const
+        {
+            u64 totals[bucket_count];
+            u64 samples = 0;
+            for (size_t bucket = 0; bucket < bucket_count; bucket++)
+            {
+                totals[bucket] = bucket_total(bucket);
+                samples += totals[bucket];
+            }
+            if (samples == 0)
+                return 0;
+
+            auto rank = (u64)(percent / 100.0 * (double)samples + 0.5);
+            if (rank == 0)
+                rank = 1;
+            u64 seen = 0;
+            for (size_t bucket = 0; bucket < bucket_count; bucket++)
+            {
+                seen += totals[bucket];
+                if (seen >= rank)
+                    return bucket_upper_bound(bucket);
+            }
+            return bucket_upper_bound(bucket_count - 1);
+        }
+
+        // Samples recorded while this runs may or may not survive it.
+        void reset()
+        {
+            for (size_t i = 0; i <= m_mask; i++)
+            {
+                for (auto& bucket : m_shards[i].buckets)
+                    bucket.store(0, Relaxed);
+                m_shards[i].sum.store(0, Relaxed);
+            }
+        }
+
+    private:
+        struct alignas(hardware_destructive_interference_size) Shard
+        {
+            Atomic<u64> sum;
+            Atomic<u64> buckets[bucket_count];
+        };
+
+        u64 bucket_total(size_t bucket) const
+        {
+            u64 total = 0;
+            for (size_t i = 0; i <= m_mask; i++)
+                total += m_shards[i].buckets[bucket].load(Relaxed);
+            return total;
+        }
+
+        size_t m_mask;
+        Shard* m_shards;
+    };
+}
+using neo::Histogram;
+using neo::ShardedCounter;
+using neo::ShardedMax;
+using neo::ShardedMin;
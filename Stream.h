@@ -15,23 +15,59 @@
  */
 
 #pragma once
+#include "NumericLimits.h"
+#include "OSError.h"
+#include "Optional.h"
+#include "ResultOrError.h"
+#include "ScopeExit.h"
 #include "Types.h"
 #include "Span.h"
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace neo
 {
+    // The kernel descriptor behind a stream. offset is the stream's position in a seekable descriptor, -1 for sockets
+    // and pipes.
+    struct NativeHandle
+    {
+        int fd;
+        i64 offset;
+    };
+
     class Stream
     {
     public:
         virtual void close() = 0;
         virtual bool has_error() const = 0;
+
+        // Lets transfer_to() move bytes between descriptors without copying them through user space. A stream
+        // handing out its descriptor has to flush whatever it buffered first.
+        virtual Optional<NativeHandle> native_handle()
+        {
+            return {};
+        }
+
+        // Called after a native transfer read or wrote bytes at the handle's offset.
+        virtual void native_advance(size_t)
+        {
+        }
     };
 
+    class OutputStream;
+
     class InputStream : public Stream
     {
     public:
         virtual size_t read(Span<u8>& to) = 0;
         virtual bool end() const = 0;
+
+        // Moves up to max_bytes into to, until the input runs out. Between two descriptors this is copy_file_range,
+        // sendfile or splice, otherwise read() and write() through a per thread buffer.
+        // Returns an error only when nothing was moved, a failure midway shows in the count and the streams' errors.
+        ResultOrError<size_t, OSError> transfer_to(OutputStream& to, size_t max_bytes = NumericLimits<size_t>::max());
     };
 
     class OutputStream : public Stream
@@ -40,7 +76,141 @@ namespace neo
         virtual void write(Span<u8> const& from) = 0;
         virtual void flush() = 0;
     };
+
+    namespace detail
+    {
+        // Errors that mean the kernel can't move bytes between this pair of descriptors, not that the move failed.
+        inline bool is_unsupported_transfer(int error)
+        {
+            return error == EINVAL || error == ENOSYS || error == EXDEV || error == EOPNOTSUPP;
+        }
+
+        // Neither end is a pipe, so splice goes through one: socket to socket, or file to file when copy_file_range
+        // can't. Takes what one receive gives rather than waiting for a full chunk.
+        inline ssize_t splice_through_pipe(int from, loff_t* from_offset, int to, loff_t* to_offset, int const (&pipe_fds)[2], size_t bytes)
+        {
+            auto received = ::splice(from, from_offset, pipe_fds[1], nullptr, bytes, SPLICE_F_MOVE);
+            if (received <= 0)
+                return received;
+
+            ssize_t moved = 0;
+            while (moved < received)
+            {
+                auto sent = ::splice(pipe_fds[0], nullptr, to, to_offset, (size_t)(received - moved), SPLICE_F_MOVE);
+                if (sent == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    // Whatever is still in the pipe is lost with it.
+                    return moved == 0 ? -1 : moved;
+                }
+                moved += sent;
+            }
+            return moved;
+        }
+
+        inline ResultOrError<size_t, OSError> native_transfer(NativeHandle from, NativeHandle to, size_t max_bytes)
+        {
+            struct stat from_stat;
+            struct stat to_stat;
+            if (::fstat(from.fd, &from_stat) == -1 || ::fstat(to.fd, &to_stat) == -1)
+                return (OSError)errno;
+
+            auto from_file = S_ISREG(from_stat.st_mode);
+            auto to_file = S_ISREG(to_stat.st_mode);
+            auto any_pipe = S_ISFIFO(from_stat.st_mode) || S_ISFIFO(to_stat.st_mode);
+            loff_t from_offset = from.offset;
+            loff_t to_offset = to.offset;
+            auto* from_position = from.offset >= 0 ? &from_offset : nullptr;
+            auto* to_position = to.offset >= 0 ? &to_offset : nullptr;
+            auto use_copy_file_range = from_file && to_file;
+            auto through_pipe = !from_file && !any_pipe;
+
+            int pipe_fds[2] { -1, -1 };
+            if (through_pipe && ::pipe2(pipe_fds, O_CLOEXEC) == -1)
+                return (OSError)errno;
+            ScopeExit close_pipe([&] {
+                if (pipe_fds[0] != -1)
+                {
+                    ::close(pipe_fds[0]);
+                    ::close(pipe_fds[1]);
+                }
+            });
+
+            size_t moved = 0;
+            while (moved < max_bytes)
+            {
+                auto chunk = min(max_bytes - moved, (size_t)1 << 30);
+                ssize_t result;
+                if (use_copy_file_range)
+                    result = ::copy_file_range(from.fd, from_position, to.fd, to_position, chunk, 0);
+                else if (through_pipe)
+                    result = splice_through_pipe(from.fd, from_position, to.fd, to_position, pipe_fds, min(chunk, 64 * KiB));
+                else if (from_file)
+                    result = ::sendfile(to.fd, from.fd, from_position, chunk);
+                else
+                    result = ::splice(from.fd, from_position, to.fd, to_position, chunk, SPLICE_F_MOVE);
+
+                if (result == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    // copy_file_range refuses some pairs of filesystems, splice through a pipe instead. Not sendfile:
+                    // it writes at the descriptor's own position and moves it, and the caller advances it again.
+                    if (use_copy_file_range && moved == 0 && is_unsupported_transfer(errno))
+                    {
+                        use_copy_file_range = false;
+                        through_pipe = true;
+                        if (::pipe2(pipe_fds, O_CLOEXEC) == -1)
+                            return (OSError)errno;
+                        continue;
+                    }
+                    if (moved == 0)
+                        return (OSError)errno;
+                    break;
+                }
+                if (result == 0)
+                    break;
+                moved += (size_t)result;
+            }
+            return moved;
+        }
+    }
+
+    inline ResultOrError<size_t, OSError> InputStream::transfer_to(OutputStream& to, size_t max_bytes)
+    {
+        auto from_handle = native_handle();
+        auto to_handle = from_handle.has_value() ? to.native_handle() : Optional<NativeHandle> {};
+        if (from_handle.has_value() && to_handle.has_value())
+        {
+            auto moved = detail::native_transfer(from_handle.value(), to_handle.value(), max_bytes);
+            if (moved.has_value())
+            {
+                native_advance(moved.result());
+                to.native_advance(moved.result());
+                return moved.result();
+            }
+            if (!detail::is_unsupported_transfer((int)moved.error()))
+                return moved.error();
+        }
+
+        alignas(64) static thread_local u8 s_buffer[64 * KiB];
+        size_t moved = 0;
+        while (moved < max_bytes)
+        {
+            Span<u8> chunk(s_buffer, min(max_bytes - moved, sizeof(s_buffer)));
+            auto bytes_read = read(chunk);
+            if (bytes_read == 0)
+                break;
+            to.write(Span<u8>(s_buffer, bytes_read));
+            if (to.has_error())
+                break;
+            moved += bytes_read;
+        }
+        return moved;
+    }
 }
 using neo::InputStream;
+using neo::NativeHandle;
 using neo::OutputStream;
 using neo::Stream;
@@ -0,0 +1,386 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Atomic.h"
+#include "Concepts.h"
+#include "Time.h"
+#include "Types.h"
+#include <time.h>
+
+namespace neo
+{
+    namespace detail
+    {
+        inline u64 deadline_after(Time const& timeout)
+        {
+            return Timer::now().to_nanoseconds() + timeout.to_nanoseconds();
+        }
+
+        // Sleeps on word while it holds expected, at most until deadline (Timer nanoseconds). false once the
+        // deadline has passed.
+        inline bool wait_until(Atomic<u32> const& word, u32 expected, u64 deadline)
+        {
+            auto now = Timer::now().to_nanoseconds();
+            if (now >= deadline)
+                return false;
+            auto remaining = deadline - now;
+            return word.wait(expected, timespec { (time_t)(remaining / 1000000000), (long)(remaining % 1000000000) });
+        }
+    }
+
+    // Condition variable for any lock with lock() and unlock(). Waiters sleep on a sequence number that every
+    // notify bumps, so a notify between unlocking and sleeping is never missed; notifies skip the syscall while
+    // nobody waits. Wake ups may be spurious, use the predicate overloads or recheck.
+    class ConditionVariable
+    {
+    public:
+        ConditionVariable() = default;
+        ConditionVariable(ConditionVariable const&) = delete;
+        ConditionVariable& operator=(ConditionVariable const&) = delete;
+
+        // mutex must be locked, once; it is unlocked while sleeping and locked again before returning.
+        template<MutexLike TMutex>
+        void wait(TMutex& mutex)
+        {
+            auto sequence = enter();
+            mutex.unlock();
+            m_sequence.wait(sequence);
+            m_waiters.sub_fetch(1, Relaxed);
+            mutex.lock();
+        }
+
+        template<MutexLike TMutex, typename TPredicate>
+        void wait(TMutex& mutex, TPredicate&& predicate)
+        {
+            while (!predicate())
+                wait(mutex);
+        }
+
+        // false if the timeout expired first.
+        template<MutexLike TMutex>
+        [[nodiscard]] bool wait_for(TMutex& mutex, Time const& timeout)
+        {
+            auto sequence = enter();
+            mutex.unlock();
+            auto in_time = detail::wait_until(m_sequence, sequence, detail::deadline_after(timeout));
+            m_waiters.sub_fetch(1, Relaxed);
+            mutex.lock();
+            return in_time;
+        }
+
+        // The predicate's last value: false if it still didn't hold when the timeout expired.
+        template<MutexLike TMutex, typename TPredicate>
+        [[nodiscard]] bool wait_for(TMutex& mutex, Time const& timeout, TPredicate&& predicate)
+        {
+            auto deadline = detail::deadline_after(timeout);
+            while (!predicate())
+            {
+                auto sequence = enter();
+                mutex.unlock();
+                auto in_time = detail::wait_until(m_sequence, sequence, deadline);
+                m_waiters.sub_fetch(1, Relaxed);
+                mutex.lock();
+                if (!in_time)
+                    return predicate();
+            }
+            return true;
+        }
+
+        void notify_one()
+        {
+            m_sequence.add_fetch(1, SequentiallyConsistent);
+            if (m_waiters.load(SequentiallyConsistent) != 0)
+                m_sequence.notify_one();
+        }
+
+        void notify_all()
+        {
+            m_sequence.add_fetch(1, SequentiallyConsistent);
+            if (m_waiters.load(SequentiallyConsistent) != 0)
+                m_sequence.notify_all();
+        }
+
+    private:
+        // Registering before reading the sequence means a notifier that sees no waiters bumped the sequence before
+        // we read it, while we still held the mutex.
+        u32 enter()
+        {
+            m_waiters.add_fetch(1, SequentiallyConsistent);
+            return m_sequence.load(SequentiallyConsistent);
+        }
+
+        Atomic<u32> m_sequence { 0 };
+        Atomic<u32> m_waiters { 0 };
+    };
+
+    // Counting semaphore. acquire() and release() are a single atomic operation while no thread has to sleep.
+    class Semaphore
+    {
+    public:
+        Semaphore(Semaphore const&) = delete;
+        Semaphore& operator=(Semaphore const&) = delete;
+
+        explicit Semaphore(u32 initial = 0) :
+            m_count(initial)
+        {
+        }
+
+        [[nodiscard]] bool try_acquire()
+        {
+            auto count = m_count.load(Relaxed);
+            while (count != 0)
+            {
+                if (m_count.compare_exchange_weak(count, count - 1, Acquire, Relaxed))
+                    return true;
+            }
+            return false;
+        }
+
+        void acquire()
+        {
+            if (try_acquire())
+                return;
+
+            m_waiters.add_fetch(1, SequentiallyConsistent);
+            while (!try_acquire())
+                m_count.wait(0);
+            m_waiters.sub_fetch(1, Relaxed);
+        }
+
+        // false if the timeout expired first.
+        [[nodiscard]] bool try_acquire_for(Time const& timeout)
+        {
+            if (try_acquire())
+                return true;
+
+            auto deadline = detail::deadline_after(timeout);
+            m_waiters.add_fetch(1, SequentiallyConsistent);
+            bool acquired = try_acquire();
+            while (!acquired && detail::wait_until(m_count, 0, deadline))
+                acquired = try_acquire();
+            m_waiters.sub_fetch(1, Relaxed);
+            return acquired;
+        }
+
+        void release(u32 count = 1)
+        {
+            m_count.add_fetch(count, SequentiallyConsistent);
+            if (m_waiters.load(SequentiallyConsistent) == 0)
+                return;
+            if (count == 1)
+                m_count.notify_one();
+            else
+                m_count.notify_all();
+        }
+
+        [[nodiscard]] u32 value() const
+        {
+            return m_count.load(Relaxed);
+        }
+
+    private:
+        Atomic<u32> m_count;
+        Atomic<u32> m_waiters { 0 };
+    };
+
+    // Single use countdown: wait() returns once count_down() brought the count to zero.
+    class Latch
+    {
+    public:
+        Latch(Latch const&) = delete;
+        Latch& operator=(Latch const&) = delete;
+
+        explicit Latch(u32 count) :
+            m_count(count)
+        {
+        }
+
+        void count_down(u32 count = 1)
+        {
+            auto remaining = m_count.sub_fetch(count, AcquireRelease);
+            if (remaining == 0)
+                m_count.notify_all();
+        }
+
+        [[nodiscard]] bool try_wait() const
+        {
+            return m_count.load(Acquire) == 0;
+        }
+
+        void wait() const
+        {
+            auto remaining = m_count.load(Acquire);
+            while (remaining != 0)
+            {
+                m_count.wait(remaining);
+                remaining = m_count.load(Acquire);
+            }
+        }
+
+        // false if the timeout expired first.
+        [[nodiscard]] bool wait_for(Time const& timeout) const
+        {
+            auto deadline = detail::deadline_after(timeout);
+            auto remaining = m_count.load(Acquire);
+            while (remaining != 0)
+            {
+                if (!detail::wait_until(m_count, remaining, deadline))
+                    return false;
+                remaining = m_count.load(Acquire);
+            }
+            return true;
+        }
+
+        void arrive_and_wait(u32 count = 1)
+        {
+            count_down(count);
+            wait();
+        }
+
+    private:
+        Atomic<u32> m_count;
+    };
+
+    // Event that stays set, releasing every waiter, until reset. set() only makes a syscall if someone waits.
+    class ManualResetEvent
+    {
+    public:
+        ManualResetEvent(ManualResetEvent const&) = delete;
+        ManualResetEvent& operator=(ManualResetEvent const&) = delete;
+
+        explicit ManualResetEvent(bool set = false) :
+            m_state(set ? Set : Unset)
+        {
+        }
+
+        void set()
+        {
+            if (m_state.exchange(Set, Release) == UnsetWithWaiters)
+                m_state.notify_all();
+        }
+
+        void reset()
+        {
+            u32 expected = Set;
+            m_state.compare_exchange_strong(expected, Unset, Relaxed, Relaxed);
+        }
+
+        [[nodiscard]] bool is_set() const
+        {
+            return m_state.load(Acquire) == Set;
+        }
+
+        void wait()
+        {
+            while (!prepare_to_sleep())
+                m_state.wait(UnsetWithWaiters);
+        }
+
+        // false if the timeout expired first.
+        [[nodiscard]] bool wait_for(Time const& timeout)
+        {
+            auto deadline = detail::deadline_after(timeout);
+            while (!prepare_to_sleep())
+            {
+                if (!detail::wait_until(m_state, UnsetWithWaiters, deadline))
+                    return is_set();
+            }
+            return true;
+        }
+
+    private:
+        enum : u32
+        {
+            Unset,
+            UnsetWithWaiters,
+            Set
+        };
+
+        // true if the event is set, otherwise marks it as having waiters.
+        bool prepare_to_sleep()
+        {
+            auto state = m_state.load(Acquire);
+            while (state == Unset && !m_state.compare_exchange_weak(state, UnsetWithWaiters, Acquire, Acquire))
+                ;
+            return state == Set;
+        }
+
+        Atomic<u32> m_state;
+    };
+
+    // Event that releases one waiter per set(), and stays set until a waiter takes it if nobody waits yet.
+    // Setting an already set event does nothing.
+    class AutoResetEvent
+    {
+    public:
+        AutoResetEvent(AutoResetEvent const&) = delete;
+        AutoResetEvent& operator=(AutoResetEvent const&) = delete;
+
+        explicit AutoResetEvent(bool set = false) :
+            m_set(set ? 1 : 0)
+        {
+        }
+
+        void set()
+        {
+            m_set.store(1, SequentiallyConsistent);
+            if (m_waiters.load(SequentiallyConsistent) != 0)
+                m_set.notify_one();
+        }
+
+        [[nodiscard]] bool try_wait()
+        {
+            u32 expected = 1;
+            return m_set.compare_exchange_strong(expected, 0, Acquire, Relaxed);
+        }
+
+        void wait()
+        {
+            if (try_wait())
+                return;
+
+            m_waiters.add_fetch(1, SequentiallyConsistent);
+            while (!try_wait())
+                m_set.wait(0);
+            m_waiters.sub_fetch(1, Relaxed);
+        }
+
+        // false if the timeout expired first.
+        [[nodiscard]] bool wait_for(Time const& timeout)
+        {
+            if (try_wait())
+                return true;
+
+            auto deadline = detail::deadline_after(timeout);
+            m_waiters.add_fetch(1, SequentiallyConsistent);
+            bool taken = try_wait();
+            while (!taken && detail::wait_until(m_set, 0, deadline))
+                taken = try_wait();
+            m_waiters.sub_fetch(1, Relaxed);
+            return taken;
+        }
+
+    private:
+        Atomic<u32> m_set;
+        Atomic<u32> m_waiters { 0 };
+    };
+}
+using neo::AutoResetEvent;
+using neo::ConditionVariable;
+using neo::Latch;
+using neo::ManualResetEvent;
+using neo::Semaphore;
@@ -15,39 +15,606 @@
  */
 
 #pragma once
+#include "NumericLimits.h"
+#include "Optional.h"
 #include "Types.h"
+#include "Util.h"
+#include "Vector.h"
 #include <fcntl.h>
 #include <sched.h>
-#include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
 namespace neo
 {
-    auto cpu_thread_count()
+    // Set of logical CPU indices, as taken by sched_setaffinity and friends.
+    class CpuSet
+    {
+    public:
+        static constexpr u32 max_cpus = CPU_SETSIZE;
+
+        CpuSet() = default;
+
+        static CpuSet single(u32 cpu)
+        {
+            CpuSet set;
+            set.add(cpu);
+            return set;
+        }
+
+        // The CPUs the calling process may run on.
+        static CpuSet allowed()
+        {
+            CpuSet set;
+            sched_getaffinity(0, sizeof(set.m_set), &set.m_set);
+            return set;
+        }
+
+        CpuSet& add(u32 cpu)
+        {
+            if (cpu < max_cpus)
+                CPU_SET(cpu, &m_set);
+            return *this;
+        }
+
+        CpuSet& remove(u32 cpu)
+        {
+            if (cpu < max_cpus)
+                CPU_CLR(cpu, &m_set);
+            return *this;
+        }
+
+        bool contains(u32 cpu) const
+        {
+            return cpu < max_cpus && CPU_ISSET(cpu, &m_set);
+        }
+
+        u32 count() const
+        {
+            return (u32)CPU_COUNT(&m_set);
+        }
+
+        bool is_empty() const
+        {
+            return count() == 0;
+        }
+
+        // Index of the n-th CPU in the set, in increasing order, or max_cpus if there are fewer.
+        u32 nth(u32 n) const
+        {
+            for (u32 cpu = 0; cpu < max_cpus; cpu++)
+            {
+                if (CPU_ISSET(cpu, &m_set) && n-- == 0)
+                    return cpu;
+            }
+            return max_cpus;
+        }
+
+        cpu_set_t const& native() const
+        {
+            return m_set;
+        }
+
+        cpu_set_t& native()
+        {
+            return m_set;
+        }
+
+    private:
+        cpu_set_t m_set {};
+    };
+
+    enum class CacheType
+    {
+        Data,
+        Instruction,
+        Unified
+    };
+
+    struct CacheInfo
+    {
+        u32 level { 0 };
+        CacheType type { CacheType::Unified };
+        u64 size { 0 };
+        u32 line_size { 0 };
+        u32 ways { 0 };
+        // Empty when only cpuid could be asked, which doesn't say which CPUs share it.
+        CpuSet shared_cpus;
+    };
+
+    struct CpuInfo
+    {
+        u32 id { 0 };
+        u32 socket { 0 };
+        // Only unique within its socket.
+        u32 core { 0 };
+        u32 numa_node { 0 };
+    };
+
+    enum class TransparentHugePages
+    {
+        Unavailable,
+        Never,
+        Madvise,
+        Always
+    };
+
+    struct HugePageInfo
+    {
+        TransparentHugePages transparent { TransparentHugePages::Unavailable };
+        // Of explicit (hugetlbfs) huge pages, 0 if the kernel has none.
+        u64 default_size { 0 };
+        u64 total { 0 };
+        u64 free { 0 };
+    };
+
+    namespace detail
+    {
+        // Reads a small sysfs or procfs file into buffer, null terminated. Returns false if it can't be read.
+        inline bool read_system_file(char const* path, char* buffer, size_t size)
+        {
+            auto fd = open(path, O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+                return false;
+            size_t total = 0;
+            while (total < size - 1)
+            {
+                auto bytes_read = read(fd, buffer + total, size - 1 - total);
+                if (bytes_read <= 0)
+                    break;
+                total += (size_t)bytes_read;
+            }
+            close(fd);
+            buffer[total] = 0;
+            return total > 0;
+        }
+
+        // "48K" style sizes as used by sysfs, and plain numbers.
+        inline Optional<u64> read_system_number(char const* path)
+        {
+            char buffer[32];
+            if (!read_system_file(path, buffer, sizeof(buffer)))
+                return {};
+            char* end = nullptr;
+            auto value = strtoull(buffer, &end, 10);
+            if (end == buffer)
+                return {};
+            if (*end == 'K')
+                value *= 1024;
+            else if (*end == 'M')
+                value *= 1024 * 1024;
+            else if (*end == 'G')
+                value *= 1024 * 1024 * 1024;
+            return (u64)value;
+        }
+
+        // Topology ids, which read as -1 when the kernel doesn't know them.
+        inline Optional<u32> read_topology_id(char const* path)
+        {
+            char buffer[32];
+            if (!read_system_file(path, buffer, sizeof(buffer)))
+                return {};
+            char* end = nullptr;
+            auto value = strtoll(buffer, &end, 10);
+            if (end == buffer || value < 0 || value > NumericLimits<u32>::max())
+                return {};
+            return (u32)value;
+        }
+
+        // Kernel cpu lists: "0-3,8,10-11".
+        inline CpuSet parse_cpu_list(char const* list)
+        {
+            CpuSet set;
+            while (*list != 0)
+            {
+                char* end = nullptr;
+                auto first = strtoul(list, &end, 10);
+                if (end == list)
+                    break;
+                auto last = first;
+                if (*end == '-')
+                {
+                    list = end + 1;
+                    last = strtoul(list, &end, 10);
+                }
+                for (auto cpu = first; cpu <= last && cpu < CpuSet::max_cpus; cpu++)
+                    set.add((u32)cpu);
+                list = *end == ',' ? end + 1 : end;
+            }
+            return set;
+        }
+
+        inline Optional<CpuSet> read_cpu_list(char const* path)
+        {
+            char buffer[4096];
+            if (!read_system_file(path, buffer, sizeof(buffer)))
+                return {};
+            return parse_cpu_list(buffer);
+        }
+
+        // Value of a "Name:   1234 kB" line of /proc/meminfo, in bytes if it has a unit.
+        inline Optional<u64> meminfo_value(char const* meminfo, char const* name)
+        {
+            auto name_length = strlen(name);
+            for (auto const* line = meminfo; line != nullptr && *line != 0;)
+            {
+                if (strncmp(line, name, name_length) == 0 && line[name_length] == ':')
+                {
+                    char* end = nullptr;
+                    auto value = strtoull(line + name_length + 1, &end, 10);
+                    while (*end == ' ')
+                        end++;
+                    return (u64)(*end == 'k' ? value * 1024 : value);
+                }
+                line = strchr(line, '\n');
+                if (line != nullptr)
+                    line++;
+            }
+            return {};
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        // Deterministic cache parameters: leaf 4 on Intel, 0x8000001D on AMD, both in the same format.
+        inline void cpuid_caches(Vector<CacheInfo>& caches)
+        {
+            u32 eax, ebx, ecx, edx;
+            u32 leaf = 4;
+            __cpuid(0, eax, ebx, ecx, edx);
+            // "AuthenticAMD" and "HygonGenuine".
+            if (ebx == 0x68747541 || ebx == 0x6f677948)
+                leaf = 0x8000001D;
+            if (__get_cpuid_max(leaf & 0x80000000, nullptr) < leaf)
+                return;
+
+            for (u32 index = 0; index < 16; index++)
+            {
+                __cpuid_count(leaf, index, eax, ebx, ecx, edx);
+                auto type = eax & 0x1F;
+                if (type == 0)
+                    break;
+                CacheInfo cache;
+                cache.level = (eax >> 5) & 0x7;
+                cache.type = type == 1 ? CacheType::Data : type == 2 ? CacheType::Instruction : CacheType::Unified;
+                cache.line_size = (ebx & 0xFFF) + 1;
+                cache.ways = ((ebx >> 22) & 0x3FF) + 1;
+                auto partitions = ((ebx >> 12) & 0x3FF) + 1;
+                cache.size = (u64)cache.ways * partitions * cache.line_size * ((u64)ecx + 1);
+                caches.append(move(cache));
+            }
+        }
+#endif
+    }
+
+    // What the machine looks like, as far as sysfs (and cpuid for caches, if sysfs has none) can tell:
+    // sockets, cores and their SMT threads, NUMA nodes, the cache hierarchy and huge page support. Read once,
+    // on first use, CPUs going on or offline later aren't noticed.
+    class CpuTopology
+    {
+    public:
+        CpuTopology(CpuTopology const&) = delete;
+        CpuTopology& operator=(CpuTopology const&) = delete;
+
+        static CpuTopology const& get()
+        {
+            static CpuTopology topology;
+            return topology;
+        }
+
+        // Online CPUs by increasing id.
+        Vector<CpuInfo> const& cpus() const
+        {
+            return m_cpus;
+        }
+
+        Optional<CpuInfo> cpu(u32 id) const
+        {
+            for (auto const& info : m_cpus)
+            {
+                if (info.id == id)
+                    return info;
+            }
+            return {};
+        }
+
+        u32 socket_count() const
+        {
+            return (u32)m_sockets.size();
+        }
+
+        // Physical cores, over all sockets.
+        u32 core_count() const
+        {
+            return m_core_count;
+        }
+
+        u32 numa_node_count() const
+        {
+            return m_numa_node_count;
+        }
+
+        // The hardware threads sharing cpu's core, cpu included.
+        CpuSet smt_siblings(u32 cpu) const
+        {
+            CpuSet siblings;
+            auto self = this->cpu(cpu);
+            if (!self.has_value())
+                return siblings;
+            for (auto const& info : m_cpus)
+            {
+                if (info.socket == self.value().socket && info.core == self.value().core)
+                    siblings.add(info.id);
+            }
+            return siblings;
+        }
+
+        CpuSet numa_node_cpus(u32 node) const
+        {
+            CpuSet set;
+            for (auto const& info : m_cpus)
+            {
+                if (info.numa_node == node)
+                    set.add(info.id);
+            }
+            return set;
+        }
+
+        // Every cache once, each with the CPUs sharing it.
+        Vector<CacheInfo> const& caches() const
+        {
+            return m_caches;
+        }
+
+        // The cache of the given level and type cpu uses.
+        Optional<CacheInfo> cache(u32 cpu, u32 level, CacheType type) const
+        {
+            for (auto const& cache : m_caches)
+            {
+                if (cache.level == level && cache.type == type && (cache.shared_cpus.is_empty() || cache.shared_cpus.contains(cpu)))
+                    return cache;
+            }
+            return {};
+        }
+
+        // Size of the first CPU's cache of that level and type, 0 if there is none or it is unknown.
+        u64 cache_size(u32 level, CacheType type) const
+        {
+            if (m_cpus.size() == 0)
+                return 0;
+            auto info = cache(m_cpus[0].id, level, type);
+            return info.has_value() ? info.value().size : 0;
+        }
+
+        HugePageInfo const& huge_pages() const
+        {
+            return m_huge_pages;
+        }
+
+        // The CPUs of allowed ordered to spread threads out: one hardware thread of every core first, going
+        // round the sockets, before any core gets a second one. The n-th thread goes on the n-th CPU.
+        Vector<u32> spread_order(CpuSet const& allowed = CpuSet::allowed()) const
+        {
+            Vector<CpuInfo> candidates;
+            // How many threads of the same core come before each candidate.
+            Vector<u32> ranks;
+            u32 max_rank = 0;
+            for (auto const& info : m_cpus)
+            {
+                if (!allowed.contains(info.id))
+                    continue;
+                u32 rank = 0;
+                for (auto const& other : candidates)
+                    rank += other.socket == info.socket && other.core == info.core;
+                candidates.append(info);
+                ranks.append(rank);
+                max_rank = max(max_rank, rank);
+            }
+
+            Vector<u32> order;
+            for (u32 rank = 0; rank <= max_rank; rank++)
+            {
+                // Round robin over the sockets, so two threads don't share a socket while another is idle.
+                for (u32 slot = 0; slot < candidates.size(); slot++)
+                {
+                    bool found = false;
+                    for (auto socket : m_sockets)
+                    {
+                        u32 seen = 0;
+                        for (u32 i = 0; i < candidates.size(); i++)
+                        {
+                            if (ranks[i] == rank && candidates[i].socket == socket && seen++ == slot)
+                            {
+                                order.append(candidates[i].id);
+                                found = true;
+                            }
+                        }
+                    }
+                    if (!found)
+                        break;
+                }
+            }
+            return order;
+        }
+
+    private:
+        CpuTopology()
+        {
+            auto online = detail::read_cpu_list("/sys/devices/system/cpu/online");
+            auto cpus = online.has_value() ? online.value() : CpuSet::allowed();
+
+            char path[128];
+            for (u32 id = 0; id < CpuSet::max_cpus; id++)
+            {
+                if (!cpus.contains(id))
+                    continue;
+                CpuInfo info;
+                info.id = id;
+                snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", id);
+                info.socket = detail::read_topology_id(path).value_or(0);
+                snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/core_id", id);
+                // Without topology every CPU is its own core.
+                info.core = detail::read_topology_id(path).value_or(id);
+                m_cpus.append(move(info));
+            }
+
+            for (u32 i = 0; i < m_cpus.size(); i++)
+            {
+                bool new_socket = true;
+                bool new_core = true;
+                for (u32 j = 0; j < i; j++)
+                {
+                    new_socket &= m_cpus[j].socket != m_cpus[i].socket;
+                    new_core &= m_cpus[j].socket != m_cpus[i].socket || m_cpus[j].core != m_cpus[i].core;
+                }
+                if (new_socket)
+                    m_sockets.append(m_cpus[i].socket);
+                m_core_count += new_core;
+            }
+
+            auto nodes = detail::read_cpu_list("/sys/devices/system/node/online");
+            m_numa_node_count = nodes.has_value() ? nodes.value().count() : 1;
+            if (nodes.has_value())
+            {
+                for (u32 node = 0; node < CpuSet::max_cpus; node++)
+                {
+                    if (!nodes.value().contains(node))
+                        continue;
+                    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+                    auto node_cpus = detail::read_cpu_list(path);
+                    if (!node_cpus.has_value())
+                        continue;
+                    for (auto& info : m_cpus)
+                    {
+                        if (node_cpus.value().contains(info.id))
+                            info.numa_node = node;
+                    }
+                }
+            }
+
+            discover_caches();
+            discover_huge_pages();
+        }
+
+        void discover_caches()
+        {
+            char path[128];
+            char type[32];
+            for (auto const& info : m_cpus)
+            {
+                for (u32 index = 0; index < 16; index++)
+                {
+                    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/level", info.id, index);
+                    auto level = detail::read_system_number(path);
+                    if (!level.has_value())
+                        break;
+
+                    CacheInfo cache;
+                    cache.level = (u32)level.value();
+                    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/type", info.id, index);
+                    if (detail::read_system_file(path, type, sizeof(type)))
+                        cache.type = type[0] == 'D' ? CacheType::Data : type[0] == 'I' ? CacheType::Instruction : CacheType::Unified;
+                    // Shared caches show up under every CPU sharing them, keep the first.
+                    if (this->cache(info.id, cache.level, cache.type).has_value())
+                        continue;
+
+                    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/size", info.id, index);
+                    cache.size = detail::read_system_number(path).value_or(0);
+                    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/coherency_line_size", info.id, index);
+                    cache.line_size = (u32)detail::read_system_number(path).value_or(0);
+                    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/ways_of_associativity", info.id, index);
+                    cache.ways = (u32)detail::read_system_number(path).value_or(0);
+                    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cache/index%u/shared_cpu_list", info.id, index);
+                    cache.shared_cpus = detail::read_cpu_list(path).value_or(CpuSet::single(info.id));
+                    m_caches.append(move(cache));
+                }
+            }
+
+#if defined(__x86_64__) || defined(__i386__)
+            if (m_caches.size() == 0)
+                detail::cpuid_caches(m_caches);
+#endif
+        }
+
+        void discover_huge_pages()
+        {
+            char buffer[8192];
+            if (detail::read_system_file("/sys/kernel/mm/transparent_hugepage/enabled", buffer, sizeof(buffer)))
+            {
+                if (strstr(buffer, "[always]") != nullptr)
+                    m_huge_pages.transparent = TransparentHugePages::Always;
+                else if (strstr(buffer, "[madvise]") != nullptr)
+                    m_huge_pages.transparent = TransparentHugePages::Madvise;
+                else if (strstr(buffer, "[never]") != nullptr)
+                    m_huge_pages.transparent = TransparentHugePages::Never;
+            }
+
+            if (detail::read_system_file("/proc/meminfo", buffer, sizeof(buffer)))
+            {
+                m_huge_pages.default_size = detail::meminfo_value(buffer, "Hugepagesize").value_or(0);
+                m_huge_pages.total = detail::meminfo_value(buffer, "HugePages_Total").value_or(0);
+                m_huge_pages.free = detail::meminfo_value(buffer, "HugePages_Free").value_or(0);
+            }
+        }
+
+        Vector<CpuInfo> m_cpus;
+        Vector<CacheInfo> m_caches;
+        HugePageInfo m_huge_pages;
+        // Distinct socket ids, in the order their first CPU shows up.
+        Vector<u32> m_sockets;
+        u32 m_core_count { 0 };
+        u32 m_numa_node_count { 1 };
+    };
+
+    inline auto cpu_thread_count()
     {
         static auto count = []()
         {
-            cpu_set_t set {};
-            sched_getaffinity(0, sizeof(set), &set);
-            return CPU_COUNT(&set);
+            return (int)CpuSet::allowed().count();
         }();
         return count;
     }
 
-    auto l1_cache_line_size()
+    inline auto l1_cache_line_size()
     {
-#ifndef __linux__
         static auto size = []()
         {
-            auto fd = open("/sys/devices/system/cpu/cpu0/cache/index0/coherency_line_size", O_RDONLY);
-            if (fd == -1)
-                return -1l;
-            char buffer[16] {};
-            auto bytes_read = read(fd, buffer, sizeof(buffer));
-            return strtol(buffer, nullptr, 10);
+            for (auto const& cache : CpuTopology::get().caches())
+            {
+                if (cache.level == 1 && cache.type != CacheType::Instruction && cache.line_size != 0)
+                    return (long)cache.line_size;
+            }
+            return -1l;
         }();
         return size;
-#else
-        static_assert(false, "l1_cache_line_size() is not supported in Windows yet.");
-#endif
+    }
+
+    // Per core data and unified caches, 0 if unknown.
+    inline u64 l1_data_cache_size()
+    {
+        static auto size = CpuTopology::get().cache_size(1, CacheType::Data);
+        return size;
+    }
+
+    inline u64 l2_cache_size()
+    {
+        static auto size = CpuTopology::get().cache_size(2, CacheType::Unified);
+        return size;
+    }
+
+    inline u64 l3_cache_size()
+    {
+        static auto size = CpuTopology::get().cache_size(3, CacheType::Unified);
+        return size;
     }
 }
+using neo::CacheInfo;
+using neo::CacheType;
+using neo::CpuInfo;
+using neo::CpuSet;
+using neo::CpuTopology;
+using neo::HugePageInfo;
+using neo::TransparentHugePages;
@@ -0,0 +1,381 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Assert.h"
+#include "Atomic.h"
+#include "Concepts.h"
+#include "Coroutine.h"
+#include "Future.h"
+#include "New.h"
+#include "Span.h"
+#include "Stream.h"
+#include "Synchronization.h"
+#include "TypeTraits.h"
+
+namespace neo
+{
+    template<typename T = void>
+    class Task;
+
+    namespace detail
+    {
+        struct TaskPromiseBase
+        {
+            // Hands control straight to whoever awaited the task instead of returning to the resumer, so long
+            // chains of co_await don't grow the stack.
+            struct FinalAwaiter
+            {
+                bool await_ready() const noexcept { return false; }
+
+                template<typename TPromise>
+                CoroutineHandle<> await_suspend(CoroutineHandle<TPromise> handle) noexcept
+                {
+                    auto continuation = handle.promise().continuation;
+                    if (continuation)
+                        return continuation;
+                    return std::noop_coroutine();
+                }
+
+                void await_resume() const noexcept { }
+            };
+
+            SuspendAlways initial_suspend() const noexcept { return {}; }
+            FinalAwaiter final_suspend() const noexcept { return {}; }
+            void unhandled_exception() { VERIFY_NOT_REACHED(); }
+
+            CoroutineHandle<> continuation {};
+        };
+
+        template<typename T>
+        struct TaskPromise : public TaskPromiseBase
+        {
+            ~TaskPromise()
+            {
+                if (has_value)
+                    value().~T();
+            }
+
+            Task<T> get_return_object();
+
+            void return_value(T result)
+            {
+                new (storage) T(std::move(result));
+                has_value = true;
+            }
+
+            T& value()
+            {
+                VERIFY(has_value);
+                return *reinterpret_cast<T*>(storage);
+            }
+
+            alignas(T) u8 storage[sizeof(T)];
+            bool has_value { false };
+        };
+
+        template<>
+        struct TaskPromise<void> : public TaskPromiseBase
+        {
+            Task<void> get_return_object();
+            void return_void() const { }
+            void value() const { }
+        };
+
+        // Eagerly started coroutine that owns its own frame and frees it when it finishes.
+        struct DetachedTask
+        {
+            struct promise_type
+            {
+                DetachedTask get_return_object() const noexcept { return {}; }
+                SuspendNever initial_suspend() const noexcept { return {}; }
+                SuspendNever final_suspend() const noexcept { return {}; }
+                void return_void() const noexcept { }
+                void unhandled_exception() { VERIFY_NOT_REACHED(); }
+            };
+        };
+    }
+
+    // Lazily started coroutine: nothing runs until it is awaited, and the awaiting coroutine is resumed
+    // through symmetric transfer once it finishes. The frame is owned by the Task and destroyed with it, which
+    // together with the lazy start is what lets the compiler elide the frame allocation when a task is
+    // awaited in the scope that created it.
+    template<typename T>
+    class [[nodiscard]] Task
+    {
+    public:
+        using promise_type = detail::TaskPromise<T>;
+        using type = T;
+
+        Task(Task const&) = delete;
+        Task& operator=(Task const&) = delete;
+
+        Task(Task&& other) :
+            m_handle(other.m_handle)
+        {
+            other.m_handle = nullptr;
+        }
+
+        Task& operator=(Task&& other)
+        {
+            if (this == &other)
+                return *this;
+
+            this->~Task();
+            new (this) Task(std::move(other));
+
+            return *this;
+        }
+
+        ~Task()
+        {
+            if (m_handle)
+                m_handle.destroy();
+        }
+
+        [[nodiscard]] bool is_valid() const
+        {
+            return (bool)m_handle;
+        }
+
+        [[nodiscard]] bool is_done() const
+        {
+            VERIFY(is_valid());
+            return m_handle.done();
+        }
+
+        // Awaits the task and produces its result.
+        auto operator co_await() noexcept
+        {
+            struct Awaiter
+            {
+                bool await_ready() const noexcept { return handle.done(); }
+
+                CoroutineHandle<> await_suspend(CoroutineHandle<> awaiting) noexcept
+                {
+                    handle.promise().continuation = awaiting;
+                    return handle;
+                }
+
+                T await_resume()
+                {
+                    if constexpr (IsSame<T, void>)
+                        return;
+                    else
+                        return std::move(handle.promise().value());
+                }
+
+                CoroutineHandle<promise_type> handle;
+            };
+
+            VERIFY(is_valid());
+            return Awaiter { m_handle };
+        }
+
+        // Awaits the task without taking its result, which stays available through release_value().
+        auto when_ready() noexcept
+        {
+            struct Awaiter
+            {
+                bool await_ready() const noexcept { return handle.done(); }
+
+                CoroutineHandle<> await_suspend(CoroutineHandle<> awaiting) noexcept
+                {
+                    handle.promise().continuation = awaiting;
+                    return handle;
+                }
+
+                void await_resume() const noexcept { }
+
+                CoroutineHandle<promise_type> handle;
+            };
+
+            VERIFY(is_valid());
+            return Awaiter { m_handle };
+        }
+
+        T release_value()
+        {
+            VERIFY(is_done());
+            if constexpr (IsSame<T, void>)
+                return;
+            else
+                return std::move(m_handle.promise().value());
+        }
+
+    private:
+        friend promise_type;
+
+        explicit Task(CoroutineHandle<promise_type> handle) :
+            m_handle(handle)
+        {
+        }
+
+        CoroutineHandle<promise_type> m_handle {};
+    };
+
+    namespace detail
+    {
+        template<typename T>
+        Task<T> TaskPromise<T>::get_return_object()
+        {
+            return Task<T>(CoroutineHandle<TaskPromise<T>>::from_promise(*this));
+        }
+
+        inline Task<void> TaskPromise<void>::get_return_object()
+        {
+            return Task<void>(CoroutineHandle<TaskPromise<void>>::from_promise(*this));
+        }
+    }
+
+    // Starts the task on the calling thread and lets it run to completion on its own, the frame is freed when
+    // it finishes.
+    template<typename T>
+    void spawn(Task<T> task)
+    {
+        [](Task<T> task) -> detail::DetachedTask
+        {
+            co_await task.when_ready();
+        }(std::move(task));
+    }
+
+    // Runs the task, blocking the calling thread until it finishes wherever it ends up being resumed.
+    template<typename T>
+    T sync_wait(Task<T> task)
+    {
+        ManualResetEvent done;
+        [](Task<T>& task, ManualResetEvent& done) -> detail::DetachedTask
+        {
+            co_await task.when_ready();
+            done.set();
+        }(task, done);
+
+        done.wait();
+        return task.release_value();
+    }
+
+    // Suspends until the future is ready, the coroutine is resumed on the thread that sets the value. Awaiting a
+    // broken future is a bug, just like reading its value.
+    template<typename T>
+    auto operator co_await(Future<T> future)
+    {
+        struct Awaiter
+        {
+            bool await_ready() const { return future.is_ready(); }
+
+            void await_suspend(CoroutineHandle<> handle)
+            {
+                future.on_completion([handle]
+                    { handle.resume(); });
+            }
+
+            T await_resume() { return future.release_value(); }
+
+            Future<T> future;
+        };
+
+        return Awaiter { std::move(future) };
+    }
+
+    template<typename TExecutor>
+    concept Executor = requires(TExecutor executor, void (*func)()) {
+        executor.execute(func);
+    };
+
+    // co_await schedule_on(pool) continues the coroutine on one of the executor's threads.
+    template<Executor TExecutor>
+    auto schedule_on(TExecutor& executor)
+    {
+        struct Awaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(CoroutineHandle<> handle)
+            {
+                executor.execute([handle]
+                    { handle.resume(); });
+            }
+
+            void await_resume() const noexcept { }
+
+            TExecutor& executor;
+        };
+
+        return Awaiter { executor };
+    }
+
+    // Runs the blocking read on the executor and resumes the coroutine there with the number of bytes read, so
+    // the awaiting side doesn't hold a thread while the stream blocks.
+    template<Executor TExecutor>
+    auto async_read(InputStream& stream, Span<u8>& to, TExecutor& executor)
+    {
+        struct Awaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(CoroutineHandle<> handle)
+            {
+                executor.execute([this, handle]
+                    {
+                        result = stream.read(to);
+                        handle.resume(); });
+            }
+
+            size_t await_resume() const noexcept { return result; }
+
+            InputStream& stream;
+            Span<u8>& to;
+            TExecutor& executor;
+            size_t result { 0 };
+        };
+
+        return Awaiter { stream, to, executor };
+    }
+
+    // Same as async_read() for OutputStream::write().
+    template<Executor TExecutor>
+    auto async_write(OutputStream& stream, Span<u8> const& from, TExecutor& executor)
+    {
+        struct Awaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(CoroutineHandle<> handle)
+            {
+                executor.execute([this, handle]
+                    {
+                        stream.write(from);
+                        handle.resume(); });
+            }
+
+            void await_resume() const noexcept { }
+
+            OutputStream& stream;
+            Span<u8> const& from;
+            TExecutor& executor;
+        };
+
+        return Awaiter { stream, from, executor };
+    }
+}
+
+using neo::async_read;
+using neo::async_write;
+using neo::Executor;
+using neo::schedule_on;
+using neo::spawn;
+using neo::sync_wait;
+using neo::Task;
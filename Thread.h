@@ -16,12 +16,16 @@
 
 #pragma once
 #include "Util.h"
+#include "Atomic.h"
 #include "SmartPtr.h"
 #include "Concepts.h"
+#include "Function.h"
+#include "NumericLimits.h"
+#include "Optional.h"
 #include "String.h"
 #include "ResultOrError.h"
 #include "OSError.h"
-#include "SmartPtr.h"
+#include "SystemInfo.h"
 #include <syscall.h>
 #include <linux/sched.h>
 #include <sched.h>
@@ -31,54 +35,283 @@
 #include <sys/prctl.h>
 #include <linux/prctl.h>
 #include <pthread.h>
+#include <sys/resource.h>
 
 namespace neo
 {
+    enum class SchedulingPolicy
+    {
+        Normal = SCHED_OTHER,
+        Batch = SCHED_BATCH,
+        Idle = SCHED_IDLE,
+        // Real time policies, with a priority between 1 and 99. Usually need CAP_SYS_NICE.
+        Fifo = SCHED_FIFO,
+        RoundRobin = SCHED_RR
+    };
 
     namespace detail
     {
-        struct generic_callable_view
+        // name can be 15 bytes at most
+        inline Optional<OSError> set_thread_name(pthread_t thread, char const* name)
         {
-            virtual ~generic_callable_view() = default;
-            virtual void* function_ptr() = 0;
-        };
+            auto result = pthread_setname_np(thread, name);
+            if (result != 0)
+                return OSError(result);
+            return {};
+        }
 
-        template<typename TCallable>
-        struct callable_storage : public generic_callable_view
+        inline Optional<OSError> set_thread_affinity(pthread_t thread, CpuSet const& cpus)
         {
-            explicit callable_storage(TCallable&& f) :
-                callable(std::move(f)) { }
-            explicit callable_storage(TCallable const& f) :
-                callable(f) { }
+            auto result = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus.native());
+            if (result != 0)
+                return OSError(result);
+            return {};
+        }
 
-            virtual ~callable_storage()
-            {
-            }
+        inline ResultOrError<CpuSet, OSError> thread_affinity(pthread_t thread)
+        {
+            CpuSet cpus;
+            auto result = pthread_getaffinity_np(thread, sizeof(cpu_set_t), &cpus.native());
+            if (result != 0)
+                return OSError(result);
+            return cpus;
+        }
+
+        inline Optional<OSError> set_thread_policy(pthread_t thread, SchedulingPolicy policy, int priority)
+        {
+            sched_param parameters {};
+            parameters.sched_priority = priority;
+            auto result = pthread_setschedparam(thread, (int)policy, &parameters);
+            if (result != 0)
+                return OSError(result);
+            return {};
+        }
+    }
+
+    // How Thread::create sets up a thread. Anything left unset is inherited from the creating thread, as
+    // pthread_create with no attributes would.
+    class ThreadOptions
+    {
+    public:
+        // name can be 15 bytes at most. The thread sets it before running its function.
+        ThreadOptions& name(String const& name)
+        {
+            VERIFY(name.byte_size() < sizeof(m_name));
+            __builtin_memset(m_name, 0, sizeof(m_name));
+            __builtin_memcpy(m_name, name.data(), name.byte_size());
+            return *this;
+        }
+
+        // At least PTHREAD_STACK_MIN.
+        ThreadOptions& stack_size(size_t bytes)
+        {
+            m_stack_size = bytes;
+            return *this;
+        }
+
+        // 0 leaves the stack without a guard page.
+        ThreadOptions& guard_size(size_t bytes)
+        {
+            m_guard_size = bytes;
+            return *this;
+        }
 
-            void* function_ptr() override
+        ThreadOptions& affinity(CpuSet const& cpus)
+        {
+            m_affinity = cpus;
+            return *this;
+        }
+
+        ThreadOptions& pin_to_cpu(u32 cpu)
+        {
+            return affinity(CpuSet::single(cpu));
+        }
+
+        // priority is 1 to 99 for the real time policies and 0 for the others.
+        ThreadOptions& policy(SchedulingPolicy policy, int priority = 0)
+        {
+            m_policy = policy;
+            m_priority = priority;
+            return *this;
+        }
+
+        // -20 (favoured) to 19, only meaningful for Normal and Batch. Applied by the new thread itself before
+        // it runs its function, so Thread::create waits for it to start.
+        ThreadOptions& nice(int nice)
+        {
+            m_nice = nice;
+            return *this;
+        }
+
+    private:
+        friend class Thread;
+
+        bool needs_attributes() const
+        {
+            return m_stack_size.has_value() || m_guard_size.has_value() || m_affinity.has_value() || m_policy.has_value();
+        }
+
+        bool needs_startup() const
+        {
+            return m_nice.has_value();
+        }
+
+        // attributes must be initialized, and are left for the caller to destroy.
+        Optional<OSError> fill(pthread_attr_t& attributes) const
+        {
+            int result = 0;
+            if (m_stack_size.has_value())
+                result = pthread_attr_setstacksize(&attributes, m_stack_size.value());
+            if (result == 0 && m_guard_size.has_value())
+                result = pthread_attr_setguardsize(&attributes, m_guard_size.value());
+            if (result == 0 && m_affinity.has_value())
+                result = pthread_attr_setaffinity_np(&attributes, sizeof(cpu_set_t), &m_affinity.value().native());
+            if (result == 0 && m_policy.has_value())
             {
-                return &callable;
+                sched_param parameters {};
+                parameters.sched_priority = m_priority;
+                result = pthread_attr_setinheritsched(&attributes, PTHREAD_EXPLICIT_SCHED);
+                if (result == 0)
+                    result = pthread_attr_setschedpolicy(&attributes, (int)m_policy.value());
+                if (result == 0)
+                    result = pthread_attr_setschedparam(&attributes, &parameters);
             }
+            if (result != 0)
+                return OSError(result);
+            return {};
+        }
 
-            TCallable callable;
-        };
-    }
+        // Runs on the new thread.
+        OSError start() const
+        {
+            if (m_nice.has_value() && setpriority(PRIO_PROCESS, (id_t)gettid(), m_nice.value()) != 0)
+                return OSError(errno);
+            return OSError::Success;
+        }
+
+        char m_name[16] {};
+        Optional<size_t> m_stack_size;
+        Optional<size_t> m_guard_size;
+        Optional<CpuSet> m_affinity;
+        Optional<SchedulingPolicy> m_policy;
+        int m_priority { 0 };
+        Optional<int> m_nice;
+    };
 
-    class Thread
+    // The calling thread, whether or not it was started by Thread::create.
+    class CurrentThread
     {
     public:
+        // Kernel thread id.
+        pid_t id() const
+        {
+            return gettid();
+        }
+
+        // CPU the thread was running on a moment ago.
+        int cpu() const
+        {
+            return sched_getcpu();
+        }
+
+        // name can be 15 bytes at most
+        Optional<OSError> set_name(String const& name) const
+        {
+            VERIFY(name.byte_size() < 16);
+            return detail::set_thread_name(pthread_self(), name.null_terminated_characters());
+        }
+
+        ResultOrError<String, OSError> name() const
+        {
+            char buf[16] {};
+            auto result = pthread_getname_np(pthread_self(), buf, sizeof(buf));
+            if (result != 0)
+                return OSError(result);
+            return String(buf);
+        }
+
+        Optional<OSError> set_affinity(CpuSet const& cpus) const
+        {
+            return detail::set_thread_affinity(pthread_self(), cpus);
+        }
+
+        Optional<OSError> pin_to_cpu(u32 cpu) const
+        {
+            return set_affinity(CpuSet::single(cpu));
+        }
+
+        ResultOrError<CpuSet, OSError> affinity() const
+        {
+            return detail::thread_affinity(pthread_self());
+        }
+
+        Optional<OSError> set_policy(SchedulingPolicy policy, int priority = 0) const
+        {
+            return detail::set_thread_policy(pthread_self(), policy, priority);
+        }
+
+        Optional<OSError> set_nice(int nice) const
+        {
+            if (setpriority(PRIO_PROCESS, (id_t)gettid(), nice) != 0)
+                return OSError(errno);
+            return {};
+        }
+
+        void yield() const
+        {
+            sched_yield();
+        }
+    };
+
+    class Thread : public RefCounted<Thread>
+    {
+    public:
+        static CurrentThread current()
+        {
+            return {};
+        }
+
         template<VoidCallable TFunc>
-        [[nodiscard]] static ResultOrError<RefPtr<Thread>, OSError> create(TFunc&& start_function)
+        [[nodiscard]] static ResultOrError<RefPtr<Thread>, OSError> create(TFunc&& start_function, ThreadOptions const& options = {})
         {
-            auto entry_point_storage = new detail::callable_storage<TFunc>(forward<TFunc>(start_function));
-            if (entry_point_storage == nullptr)
-                return OSError::OutOfMemory;
+            // The thread's exit code: what the function returns, or 0.
+            UniqueFunction<u64> entry_point = [start_function = forward<TFunc>(start_function)]() mutable -> u64
+            {
+                if constexpr (!CallableWithReturnType<TFunc, void>)
+                    return (u64)start_function();
+                else
+                {
+                    start_function();
+                    return 0;
+                }
+            };
 
-            RefPtr<Thread> thread(new Thread(entry_point_storage));
+            RefPtr<Thread> thread(new Thread(std::move(entry_point)));
             if (!thread.is_valid())
                 return OSError(OSError::OutOfMemory);
 
+            pthread_attr_t attributes;
+            pthread_attr_t* attributes_ptr = nullptr;
+            if (options.needs_attributes())
+            {
+                auto result = pthread_attr_init(&attributes);
+                if (result != 0)
+                    return OSError(result);
+                attributes_ptr = &attributes;
+                auto error = options.fill(attributes);
+                if (error.has_value())
+                {
+                    pthread_attr_destroy(&attributes);
+                    return error.release_value();
+                }
+            }
+            __builtin_memcpy(thread->m_initial_name, options.m_name, sizeof(options.m_name));
+            // The new thread reads the options before it reports back, while we wait for it.
+            if (options.needs_startup())
+                thread->m_startup_options = &options;
+
             RefPtr<Thread>* temp_storage = new RefPtr<Thread>(thread);
+            thread->m_is_alive.store(true, Release);
 
             asm volatile(""
                          :
@@ -86,25 +319,55 @@ namespace neo
                          : "memory");
 
             auto result = pthread_create(
-                &thread->m_tid, nullptr, [](void* thread_ptr) -> void*
+                &thread->m_tid, attributes_ptr, [](void* thread_ptr) -> void*
                 {
                     auto* this_thread = reinterpret_cast<RefPtr<Thread>*>(thread_ptr);
-                    u64 result;
-
-                    if constexpr(!CallableWithReturnType<TFunc, void>)
-                    result = (*this_thread->leak_ref().template get_start_function_ptr<TFunc>())();
-                    else
+                    auto& self = this_thread->leak_ref();
+                    if (self.m_startup_options != nullptr)
                     {
-                        (*this_thread->leak_ref().template get_start_function_ptr<TFunc>())();
-                        result = 0;
+                        auto status = self.m_startup_options->start();
+                        self.m_startup_options = nullptr;
+                        self.m_startup_status.store((u32)status, Release);
+                        self.m_startup_status.notify_one();
+                        if (status != OSError::Success)
+                        {
+                            self.m_is_alive.store(false, Release);
+                            delete this_thread;
+                            return nullptr;
+                        }
                     }
+                    if (self.m_initial_name[0] != 0)
+                        [[maybe_unused]] auto error = detail::set_thread_name(pthread_self(), self.m_initial_name);
+                    auto result = self.m_entry_point();
 
-                    this_thread->leak_ref().m_tid = 0;
+                    // The thread keeps its own reference until it finishes, so dropping the last one here
+                    // lets ~Thread detach it if nobody is going to join it.
+                    this_thread->leak_ref().m_is_alive.store(false, Release);
+                    delete this_thread;
                     return (void*)(ptr_t)result; },
                 temp_storage);
 
+            if (attributes_ptr != nullptr)
+                pthread_attr_destroy(attributes_ptr);
+
             if (result != 0)
+            {
+                thread->m_is_alive.store(false, Release);
+                delete temp_storage;
                 return OSError(result);
+            }
+
+            if (options.needs_startup())
+            {
+                u32 status;
+                while ((status = thread->m_startup_status.load(Acquire)) == startup_pending)
+                    thread->m_startup_status.wait(startup_pending);
+                if (status != (u32)OSError::Success)
+                {
+                    [[maybe_unused]] auto exit = thread->wait_for_thread_exit();
+                    return (OSError)status;
+                }
+            }
 
             return thread;
         }
@@ -113,11 +376,25 @@ namespace neo
         {
             VERIFY(name.byte_size() < 16);
             VERIFY(m_tid != 0);
-            auto result = pthread_setname_np(m_tid, name.null_terminated_characters());
-            if (result != 0)
-                return OSError(result);
+            return detail::set_thread_name(m_tid, name.null_terminated_characters());
+        }
 
-            return {};
+        Optional<OSError> set_affinity(CpuSet const& cpus)
+        {
+            VERIFY(m_tid != 0);
+            return detail::set_thread_affinity(m_tid, cpus);
+        }
+
+        ResultOrError<CpuSet, OSError> affinity() const
+        {
+            VERIFY(m_tid != 0);
+            return detail::thread_affinity(m_tid);
+        }
+
+        Optional<OSError> set_policy(SchedulingPolicy policy, int priority = 0)
+        {
+            VERIFY(m_tid != 0);
+            return detail::set_thread_policy(m_tid, policy, priority);
         }
 
         ~Thread()
@@ -125,8 +402,6 @@ namespace neo
             if (m_tid != 0)
                 pthread_detach(m_tid);
             m_tid = 0;
-            delete m_entry_point_storage;
-            m_entry_point_storage = nullptr;
         }
 
         Thread& operator=(Thread const&) = delete;
@@ -150,28 +425,32 @@ namespace neo
             auto result = pthread_join(m_tid, &end_code);
             if (result != 0)
                 return OSError(result);
+            m_tid = 0;
             return end_code;
         }
 
         bool is_valid_or_alive() const
         {
-            return m_tid != 0;
+            return m_tid != 0 && m_is_alive.load(Acquire);
         }
 
     private:
-        explicit Thread(detail::generic_callable_view* entry_point_storage) :
-            m_tid(0), m_entry_point_storage(entry_point_storage)
+        explicit Thread(UniqueFunction<u64>&& entry_point) :
+            m_entry_point(std::move(entry_point))
         {
         }
 
-        template<typename TFunc>
-        auto get_start_function_ptr()
-        {
-            return (TFunc*)m_entry_point_storage->function_ptr();
-        }
+        static constexpr u32 startup_pending = NumericLimits<u32>::max();
 
         pthread_t m_tid { 0 };
-        detail::generic_callable_view* m_entry_point_storage { nullptr };
+        Atomic<bool> m_is_alive { false };
+        UniqueFunction<u64> m_entry_point;
+        char m_initial_name[16] {};
+        ThreadOptions const* m_startup_options { nullptr };
+        Atomic<u32> m_startup_status { startup_pending };
     };
 }
+using neo::CurrentThread;
+using neo::SchedulingPolicy;
 using neo::Thread;
+using neo::ThreadOptions;
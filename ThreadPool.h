@@ -0,0 +1,448 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "Aligned.h"
+#include "Atomic.h"
+#include "Concepts.h"
+#include "Future.h"
+#include "Mutex.h"
+#include "NumericLimits.h"
+#include "OSError.h"
+#include "Optional.h"
+#include "ResultOrError.h"
+#include "SmartPtr.h"
+#include "SystemInfo.h"
+#include "Thread.h"
+#include "TypeTraits.h"
+#include "Vector.h"
+#include <stdio.h>
+
+namespace neo
+{
+    namespace detail
+    {
+        struct PoolTask
+        {
+            virtual ~PoolTask() = default;
+            virtual void run() = 0;
+
+            PoolTask* next { nullptr };
+        };
+
+        template<typename TFunc>
+        struct PoolTaskStorage final : public PoolTask
+        {
+            template<typename TArg>
+            explicit PoolTaskStorage(TArg&& f) :
+                func(forward<TArg>(f))
+            {
+            }
+
+            void run() override
+            {
+                func();
+            }
+
+            TFunc func;
+        };
+
+        // FIFO of tasks for submissions that can't go into a worker's own deque.
+        class TaskList
+        {
+        public:
+            void push(PoolTask* task)
+            {
+                ScopedLock lock(m_lock);
+                task->next = nullptr;
+                if (m_tail == nullptr)
+                    m_head = task;
+                else
+                    m_tail->next = task;
+                m_tail = task;
+                m_size.add_fetch(1, Release);
+            }
+
+            PoolTask* pop()
+            {
+                if (m_size.load(Acquire) == 0)
+                    return nullptr;
+
+                ScopedLock lock(m_lock);
+                auto* task = m_head;
+                if (task == nullptr)
+                    return nullptr;
+                m_head = task->next;
+                if (m_head == nullptr)
+                    m_tail = nullptr;
+                m_size.sub_fetch(1, Release);
+                return task;
+            }
+
+        private:
+            SpinlockMutex m_lock;
+            PoolTask* m_head { nullptr };
+            PoolTask* m_tail { nullptr };
+            Atomic<size_t> m_size { 0 };
+        };
+
+        // Chase-Lev deque, as in "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al.).
+        // Only the owner pushes and pops at the bottom, any thread may steal from the top.
+        class WorkStealingDeque
+        {
+        public:
+            static constexpr i64 capacity = 4096;
+
+            // false if the deque is full
+            bool push(PoolTask* task)
+            {
+                auto bottom = m_bottom.load(Relaxed);
+                auto top = m_top.load(Acquire);
+                if (bottom - top >= capacity)
+                    return false;
+                m_tasks[bottom & (capacity - 1)].store(task, Relaxed);
+                atomic_thread_fence(Release);
+                m_bottom.store(bottom + 1, Relaxed);
+                return true;
+            }
+
+            PoolTask* pop()
+            {
+                auto bottom = m_bottom.load(Relaxed) - 1;
+                m_bottom.store(bottom, Relaxed);
+                atomic_thread_fence(SequentiallyConsistent);
+                auto top = m_top.load(Relaxed);
+                if (top > bottom)
+                {
+                    m_bottom.store(bottom + 1, Relaxed);
+                    return nullptr;
+                }
+
+                auto* task = m_tasks[bottom & (capacity - 1)].load(Relaxed);
+                if (top == bottom)
+                {
+                    // Last task, race the thieves for it.
+                    if (!m_top.compare_exchange_strong(top, top + 1, SequentiallyConsistent, Relaxed))
+                        task = nullptr;
+                    m_bottom.store(bottom + 1, Relaxed);
+                }
+                return task;
+            }
+
+            PoolTask* steal()
+            {
+                auto top = m_top.load(Acquire);
+                atomic_thread_fence(SequentiallyConsistent);
+                auto bottom = m_bottom.load(Acquire);
+                if (top >= bottom)
+                    return nullptr;
+
+                auto* task = m_tasks[top & (capacity - 1)].load(Relaxed);
+                if (!m_top.compare_exchange_strong(top, top + 1, SequentiallyConsistent, Relaxed))
+                    return nullptr;
+                return task;
+            }
+
+        private:
+            alignas(hardware_destructive_interference_size) Atomic<i64> m_top { 0 };
+            alignas(hardware_destructive_interference_size) Atomic<i64> m_bottom { 0 };
+            alignas(hardware_destructive_interference_size) Atomic<PoolTask*> m_tasks[capacity] {};
+        };
+    }
+
+    struct ThreadPoolOptions
+    {
+        size_t worker_count = (size_t)cpu_thread_count();
+        // Pins each worker to one CPU the process may run on, spreading them over the cores and sockets before
+        // doubling up on SMT siblings (see CpuTopology::spread_order), and wrapping around if there are more.
+        bool pin_workers = false;
+        // 0 keeps the default stack size.
+        size_t stack_size = 0;
+    };
+
+    // Fixed set of workers, each with its own work stealing deque. Tasks submitted from a worker go to its own
+    // deque, tasks from other threads go to a shared queue, and idle workers steal from each other before
+    // parking on a futex.
+    class ThreadPool
+    {
+    public:
+        static constexpr size_t AnyWorker = NumericLimits<size_t>::max();
+
+        explicit ThreadPool(size_t worker_count = cpu_thread_count()) :
+            ThreadPool(ThreadPoolOptions { .worker_count = worker_count })
+        {
+        }
+
+        // Runs with whatever workers could be started, the running ones steal anything hinted at the others. If
+        // none could, tasks run inline on the submitting thread; use create() to get the error instead.
+        explicit ThreadPool(ThreadPoolOptions const& options)
+        {
+            [[maybe_unused]] auto error = start_workers(options);
+        }
+
+        // Fails with the error of the first worker that couldn't be started, e.g. EAGAIN, a stack_size below
+        // PTHREAD_STACK_MIN or a CPU to pin to that the process may not run on.
+        static ResultOrError<OwnPtr<ThreadPool>, OSError> create(ThreadPoolOptions const& options)
+        {
+            OwnPtr<ThreadPool> pool(new ThreadPool(Uninitialized));
+            if (auto error = pool->start_workers(options); error.has_value())
+                return error.release_value();
+            return pool;
+        }
+
+        ThreadPool(ThreadPool const&) = delete;
+        ThreadPool& operator=(ThreadPool const&) = delete;
+
+        ~ThreadPool()
+        {
+            shutdown();
+            delete[] m_workers;
+            m_workers = nullptr;
+        }
+
+        // Shared pool with one worker per hardware thread, torn down at exit. If no worker can be started it has
+        // none, and everything submitted to it runs inline.
+        static ThreadPool& global()
+        {
+            static ThreadPool pool;
+            return pool;
+        }
+
+        // Runs func on some worker. worker_hint asks for a specific worker (modulo worker_count()), e.g. to keep
+        // tasks touching the same data on the same core; other workers may still take it if it is idle.
+        template<VoidCallable TFunc>
+        void execute(TFunc&& func, size_t worker_hint = AnyWorker)
+        {
+            enqueue(new detail::PoolTaskStorage<RemoveCV<RemoveReference<TFunc>>>(forward<TFunc>(func)), worker_hint);
+        }
+
+        template<VoidCallable TFunc>
+        requires(!IsSame<ReturnType<TFunc>, void>)
+            [[nodiscard]] Future<ReturnType<TFunc>> submit(TFunc&& func, size_t worker_hint = AnyWorker)
+        {
+            Promise<ReturnType<TFunc>> promise;
+            auto future = promise.get_future();
+            execute([promise = move(promise), func = forward<TFunc>(func)]() mutable
+                { promise.set_value(func()); },
+                worker_hint);
+            return future;
+        }
+
+        // Blocks until every task submitted so far, and every task those spawn, has finished.
+        // Must not be called from one of this pool's workers.
+        void drain()
+        {
+            VERIFY(s_current_pool != this);
+            auto pending = m_pending.load(Acquire);
+            while (pending != 0)
+            {
+                m_pending.wait(pending);
+                pending = m_pending.load(Acquire);
+            }
+        }
+
+        // Drains the pool, stops every worker and joins it. No task can be submitted afterwards.
+        void shutdown()
+        {
+            if (m_stopping.exchange(true, AcquireRelease))
+                return;
+
+            drain();
+            m_wake_epoch.add_fetch(1, SequentiallyConsistent);
+            m_wake_epoch.notify_all();
+
+            for (size_t i = 0; i < m_worker_count; i++)
+            {
+                if (m_workers[i].thread.has_value())
+                    [[maybe_unused]] auto exit = m_workers[i].thread.value()->wait_for_thread_exit();
+            }
+        }
+
+        [[nodiscard]] size_t worker_count() const
+        {
+            return m_worker_count;
+        }
+
+        [[nodiscard]] bool is_shut_down() const
+        {
+            return m_stopping.load(Acquire);
+        }
+
+        // Index of the calling thread in this pool, AnyWorker if it isn't one of its workers.
+        [[nodiscard]] size_t current_worker_index() const
+        {
+            return s_current_pool == this ? s_current_worker_index : AnyWorker;
+        }
+
+    private:
+        struct Worker
+        {
+            detail::WorkStealingDeque deque;
+            // Pushed to by other threads, keep it off the line of the owner's random_state.
+            CacheLinePadded<detail::TaskList> mailbox;
+            u64 random_state { 0 };
+            Optional<RefPtr<Thread>> thread;
+        };
+
+        enum UninitializedTag
+        {
+            Uninitialized
+        };
+
+        explicit ThreadPool(UninitializedTag)
+        {
+        }
+
+        Optional<OSError> start_workers(ThreadPoolOptions const& options)
+        {
+            // Counted in u32 atomics.
+            auto worker_count = (u32)options.worker_count;
+            VERIFY(worker_count > 0 && worker_count == options.worker_count);
+            auto cpus = options.pin_workers ? CpuTopology::get().spread_order() : Vector<u32>();
+            m_workers = new Worker[worker_count];
+            m_worker_count = worker_count;
+            for (size_t i = 0; i < worker_count; i++)
+            {
+                char name[16] {};
+                snprintf(name, sizeof(name), "neo-pool-%u", (u16)i);
+                ThreadOptions thread_options;
+                thread_options.name(name);
+                if (cpus.size() != 0)
+                    thread_options.pin_to_cpu(cpus[i % cpus.size()]);
+                if (options.stack_size != 0)
+                    thread_options.stack_size(options.stack_size);
+
+                auto maybe_thread = Thread::create([this, i]()
+                    { worker_main(i); },
+                    thread_options);
+                if (maybe_thread.has_error())
+                {
+                    if (i == 0)
+                    {
+                        // Nothing will ever look at the workers, fall back to running tasks inline.
+                        delete[] m_workers;
+                        m_workers = nullptr;
+                        m_worker_count = 0;
+                    }
+                    return maybe_thread.error();
+                }
+                m_workers[i].thread = maybe_thread.result();
+            }
+            return {};
+        }
+
+        void enqueue(detail::PoolTask* task, size_t worker_hint)
+        {
+            VERIFY(!m_stopping.load(Relaxed) || s_current_pool == this);
+            m_pending.add_fetch(1, AcquireRelease);
+            if (m_worker_count == 0)
+            {
+                run_task(task);
+                return;
+            }
+
+            if (worker_hint != AnyWorker)
+                m_workers[worker_hint % m_worker_count].mailbox->push(task);
+            else if (s_current_pool != this || !m_workers[s_current_worker_index].deque.push(task))
+                m_global_queue->push(task);
+
+            m_wake_epoch.add_fetch(1, SequentiallyConsistent);
+            if (m_sleeping_workers.load(SequentiallyConsistent) > 0)
+                m_wake_epoch.notify_one();
+        }
+
+        detail::PoolTask* find_task(size_t index)
+        {
+            auto& self = m_workers[index];
+            if (auto* task = self.mailbox->pop())
+                return task;
+            if (auto* task = self.deque.pop())
+                return task;
+            if (auto* task = m_global_queue->pop())
+                return task;
+
+            // xorshift, to spread thieves over different victims
+            self.random_state ^= self.random_state << 13;
+            self.random_state ^= self.random_state >> 7;
+            self.random_state ^= self.random_state << 17;
+            auto start = self.random_state % m_worker_count;
+            for (size_t i = 0; i < m_worker_count; i++)
+            {
+                auto victim = (start + i) % m_worker_count;
+                if (victim == index)
+                    continue;
+                if (auto* task = m_workers[victim].deque.steal())
+                    return task;
+                if (auto* task = m_workers[victim].mailbox->pop())
+                    return task;
+            }
+            return nullptr;
+        }
+
+        void run_task(detail::PoolTask* task)
+        {
+            task->run();
+            delete task;
+            if (m_pending.sub_fetch(1, AcquireRelease) == 0)
+                m_pending.notify_all();
+        }
+
+        void worker_main(size_t index)
+        {
+            s_current_pool = this;
+            s_current_worker_index = index;
+            m_workers[index].random_state = index * 0x9E3779B97F4A7C15ull + 1;
+
+            while (true)
+            {
+                if (auto* task = find_task(index))
+                {
+                    run_task(task);
+                    continue;
+                }
+
+                // Anything enqueued after this load bumps the epoch, so the futex wait below won't sleep through it.
+                auto epoch = m_wake_epoch.load(SequentiallyConsistent);
+                if (auto* task = find_task(index))
+                {
+                    run_task(task);
+                    continue;
+                }
+                if (m_stopping.load(Acquire) && m_pending.load(Acquire) == 0)
+                    break;
+
+                m_sleeping_workers.add_fetch(1, SequentiallyConsistent);
+                m_wake_epoch.wait(epoch);
+                m_sleeping_workers.sub_fetch(1, SequentiallyConsistent);
+            }
+
+            s_current_pool = nullptr;
+        }
+
+        static inline thread_local ThreadPool* s_current_pool { nullptr };
+        static inline thread_local size_t s_current_worker_index { 0 };
+
+        Worker* m_workers { nullptr };
+        size_t m_worker_count { 0 };
+        CacheLinePadded<detail::TaskList> m_global_queue;
+        alignas(hardware_destructive_interference_size) Atomic<u32> m_pending { 0 };
+        alignas(hardware_destructive_interference_size) Atomic<u32> m_wake_epoch { 0 };
+        Atomic<u32> m_sleeping_workers { 0 };
+        Atomic<bool> m_stopping { false };
+    };
+}
+using neo::ThreadPool;
+using neo::ThreadPoolOptions;
@@ -60,6 +60,21 @@ namespace neo
             return Time { secs.value(), nanosecs.value() };
         }
 
+        constexpr u64 seconds() const
+        {
+            return m_seconds;
+        }
+
+        constexpr u64 nanoseconds() const
+        {
+            return m_nanoseconds;
+        }
+
+        constexpr u64 to_nanoseconds() const
+        {
+            return m_seconds * 1000000000 + m_nanoseconds;
+        }
+
         constexpr bool operator<(Time const& other) const
         {
             if (m_seconds < other.m_seconds || (m_seconds == other.m_seconds && m_nanoseconds < other.m_nanoseconds))
@@ -281,7 +281,7 @@ namespace neo
         void append(T const& item)
         {
             if (m_size == m_capacity)
-                ensure_capacity(m_capacity * 2);
+                ensure_capacity(m_capacity == 0 ? default_capacity : m_capacity * 2);
 
             new (&m_storage[m_size]) T { item };
 			
@@ -291,7 +291,7 @@ namespace neo
         void append(T&& item)
         {
             if (m_size == m_capacity)
-                ensure_capacity(m_capacity * 2);
+                ensure_capacity(m_capacity == 0 ? default_capacity : m_capacity * 2);
 
             new (&m_storage[m_size]) T { std::move(item) };
             m_size++;
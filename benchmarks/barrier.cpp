@@ -0,0 +1,66 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Barrier.h>
+#include <Optional.h>
+#include <Thread.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr u32 phase_count = 20000;
+
+// Average time for a phase, with every thread doing nothing but arriving.
+template<typename TArrive>
+static double phases(u32 thread_count, TArrive&& arrive_and_wait)
+{
+    Optional<RefPtr<Thread>> threads[16];
+    auto begin = Timer::now().to_nanoseconds();
+    for (u32 t = 1; t < thread_count; t++)
+    {
+        threads[t] = Thread::create([&arrive_and_wait, t]
+            {
+                for (u32 phase = 0; phase < phase_count; phase++)
+                    arrive_and_wait(t); })
+                         .result();
+    }
+    for (u32 phase = 0; phase < phase_count; phase++)
+        arrive_and_wait(0);
+    for (u32 t = 1; t < thread_count; t++)
+        [[maybe_unused]] auto exit = threads[t].value()->wait_for_thread_exit();
+    return (double)(Timer::now().to_nanoseconds() - begin) / (double)phase_count;
+}
+
+int main()
+{
+    for (u32 threads = 1; threads <= 16; threads *= 2)
+    {
+        Barrier central(threads);
+        Barrier sleeping(threads, 0);
+        TreeBarrier tree(threads);
+        DisseminationBarrier dissemination(threads);
+        printf("%2u threads: central %.0f ns, central without spinning %.0f ns, tree %.0f ns, dissemination %.0f ns per phase\n",
+            threads,
+            phases(threads, [&](u32)
+                { central.arrive_and_wait(); }),
+            phases(threads, [&](u32)
+                { sleeping.arrive_and_wait(); }),
+            phases(threads, [&](u32 t)
+                { tree.arrive_and_wait(t); }),
+            phases(threads, [&](u32 t)
+                { dissemination.arrive_and_wait(t); }));
+    }
+    return 0;
+}
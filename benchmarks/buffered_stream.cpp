@@ -0,0 +1,102 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <BinaryReader.h>
+#include <BufferedStream.h>
+#include <FileStream.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr size_t value_count = 1024 * 1024;
+static constexpr size_t line_count = 200000;
+static char const* const values_path = "/tmp/neo_buffered_values.bin";
+static char const* const lines_path = "/tmp/neo_buffered_lines.txt";
+
+template<typename TStream>
+static u64 sum_values(TStream& stream)
+{
+    BinaryReader reader(stream);
+    u64 sum = 0;
+    for (size_t i = 0; i < value_count; i++)
+        sum += reader.template read<u32>().value();
+    return sum;
+}
+
+int main()
+{
+    {
+        auto file = FileStream::create(values_path, "w");
+        BufferedOutputStream stream(file.result());
+        for (u32 i = 0; i < value_count; i++)
+            stream.write(Span<u8>((u8*)&i, sizeof(i)));
+    }
+    {
+        auto file = FileStream::create(lines_path, "w");
+        BufferedOutputStream stream(file.result());
+        char line[64];
+        for (size_t i = 0; i < line_count; i++)
+        {
+            auto length = snprintf(line, sizeof(line), "line %zu with some padding text\n", i);
+            stream.write(Span<u8>((u8*)line, (size_t)length));
+        }
+    }
+
+    // Four byte reads straight off the FileStream, one virtual call and one stdio call each.
+    {
+        auto file = FileStream::create(values_path, "r");
+        auto begin = Timer::now().to_nanoseconds();
+        auto sum = sum_values(file.result());
+        auto elapsed = Timer::now().to_nanoseconds() - begin;
+        printf("FileStream u32 reads: %.1f M/s (sum %llu)\n", value_count * 1e3 / elapsed, (unsigned long long)sum);
+    }
+
+    // The same reads through a BufferedInputStream, which the templated reader calls directly.
+    {
+        auto file = FileStream::create(values_path, "r");
+        BufferedInputStream stream(file.result());
+        auto begin = Timer::now().to_nanoseconds();
+        auto sum = sum_values(stream);
+        auto elapsed = Timer::now().to_nanoseconds() - begin;
+        printf("BufferedInputStream u32 reads: %.1f M/s (sum %llu)\n", value_count * 1e3 / elapsed, (unsigned long long)sum);
+    }
+
+    {
+        auto* handle = fopen(lines_path, "r");
+        auto begin = Timer::now().to_nanoseconds();
+        size_t lines = 0;
+        char line[64];
+        while (fgets(line, sizeof(line), handle))
+            lines++;
+        auto elapsed = Timer::now().to_nanoseconds() - begin;
+        fclose(handle);
+        printf("fgets: %.1f M lines/s (%zu lines)\n", lines * 1e3 / elapsed, lines);
+    }
+
+    {
+        auto file = FileStream::create(lines_path, "r");
+        BufferedInputStream stream(file.result());
+        auto begin = Timer::now().to_nanoseconds();
+        size_t lines = 0;
+        while (stream.read_line().has_value())
+            lines++;
+        auto elapsed = Timer::now().to_nanoseconds() - begin;
+        printf("read_line: %.1f M lines/s (%zu lines)\n", lines * 1e3 / elapsed, lines);
+    }
+
+    [[maybe_unused]] auto remove_values = File::remove(values_path);
+    [[maybe_unused]] auto remove_lines = File::remove(lines_path);
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <CircularBuffer.h>
+#include <ConcurrentQueue.h>
+#include <Mutex.h>
+#include <Thread.h>
+#include <Time.h>
+#include <Vector.h>
+#include <sched.h>
+#include <stdio.h>
+
+static constexpr u64 item_count = 10000000;
+
+// The queue these replace for thread to thread hand off: a CircularBuffer behind a lock.
+class LockedQueue
+{
+public:
+    bool try_push(u64 value)
+    {
+        ScopedLock lock(m_lock);
+        if (m_buffer.size() == 1024)
+            return false;
+        m_buffer.enqueue(value);
+        return true;
+    }
+
+    Optional<u64> try_pop()
+    {
+        ScopedLock lock(m_lock);
+        return m_buffer.dequeue();
+    }
+
+private:
+    SpinlockMutex m_lock;
+    CircularBuffer<u64> m_buffer { 1024 };
+};
+
+template<typename TProducer, typename TConsumer>
+static double run(size_t producers, size_t consumers, TProducer&& producer, TConsumer&& consumer)
+{
+    auto begin = Timer::now().to_nanoseconds();
+    Vector<RefPtr<Thread>> threads;
+    for (size_t i = 0; i < producers; i++)
+        threads.append(Thread::create([&producer, producers]
+            { producer(item_count / producers); })
+                           .result());
+    for (size_t i = 0; i < consumers; i++)
+        threads.append(Thread::create([&consumer, consumers]
+            { consumer(item_count / consumers); })
+                           .result());
+    for (auto& thread : threads)
+        [[maybe_unused]] auto exit = thread->wait_for_thread_exit();
+    return (double)item_count * 1e3 / (double)(Timer::now().to_nanoseconds() - begin);
+}
+
+template<typename TQueue>
+static double run_single(TQueue& queue, size_t producers, size_t consumers)
+{
+    return run(
+        producers, consumers, [&](u64 count)
+        {
+            for (u64 i = 0; i < count; i++)
+            {
+                while (!queue.try_push(i))
+                    sched_yield();
+            } },
+        [&](u64 count)
+        {
+            for (u64 i = 0; i < count;)
+            {
+                if (queue.try_pop().has_value())
+                    i++;
+                else
+                    sched_yield();
+            } });
+}
+
+int main()
+{
+    {
+        LockedQueue queue;
+        printf("1:1 locked CircularBuffer: %.1f M items/s\n", run_single(queue, 1, 1));
+    }
+    {
+        SPSCRingBuffer<u64> queue(1024);
+        printf("1:1 SPSCRingBuffer: %.1f M items/s\n", run_single(queue, 1, 1));
+    }
+    {
+        SPSCRingBuffer<u64> queue(1024);
+        auto rate = run(
+            1, 1, [&](u64 count)
+            {
+                u64 batch[64];
+                for (u64 i = 0; i < count;)
+                {
+                    auto size = min<u64>(64, count - i);
+                    for (u64 j = 0; j < size; j++)
+                        batch[j] = i + j;
+                    auto pushed = queue.push_batch(Span<u64>(batch, size));
+                    if (pushed == 0)
+                        sched_yield();
+                    i += pushed;
+                } },
+            [&](u64 count)
+            {
+                u64 batch[64];
+                Span<u64> batch_span(batch, 64);
+                for (u64 i = 0; i < count;)
+                {
+                    auto popped = queue.pop_batch(batch_span);
+                    if (popped == 0)
+                        sched_yield();
+                    i += popped;
+                } });
+        printf("1:1 SPSCRingBuffer batches of 64: %.1f M items/s\n", rate);
+    }
+    {
+        MPMCQueue<u64> queue(1024);
+        printf("1:1 MPMCQueue: %.1f M items/s\n", run_single(queue, 1, 1));
+    }
+    {
+        LockedQueue queue;
+        printf("4:4 locked CircularBuffer: %.1f M items/s\n", run_single(queue, 4, 4));
+    }
+    {
+        MPMCQueue<u64> queue(1024);
+        printf("4:4 MPMCQueue: %.1f M items/s\n", run_single(queue, 4, 4));
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Queue.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr u32 side = 4000;
+
+// What Queue used to be: a node and a separately allocated value per element.
+template<typename T>
+class NodeQueue
+{
+public:
+    ~NodeQueue()
+    {
+        while (m_first != nullptr)
+            pop_front();
+    }
+
+    void add_back(T const& value)
+    {
+        auto* node = new Node { new T(value), nullptr };
+        if (m_last == nullptr)
+            m_first = node;
+        else
+            m_last->next = node;
+        m_last = node;
+        m_size++;
+    }
+
+    T pop_front()
+    {
+        auto* node = m_first;
+        T value = *node->data;
+        m_first = node->next;
+        if (m_first == nullptr)
+            m_last = nullptr;
+        delete node->data;
+        delete node;
+        m_size--;
+        return value;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    struct Node
+    {
+        T* data;
+        Node* next;
+    };
+
+    Node* m_first { nullptr };
+    Node* m_last { nullptr };
+    size_t m_size { 0 };
+};
+
+// Breadth first search over a side x side grid from one corner, the shape of our tools' graph walks.
+template<typename TQueue>
+static double breadth_first_search(u8* visited)
+{
+    __builtin_memset(visited, 0, (size_t)side * side);
+    auto begin = Timer::now().to_nanoseconds();
+    TQueue queue;
+    queue.add_back(0);
+    visited[0] = 1;
+    u64 reached = 0;
+    while (queue.size() > 0)
+    {
+        auto cell = queue.pop_front();
+        reached++;
+        auto x = cell % side;
+        auto y = cell / side;
+        u32 neighbours[4] = { x > 0 ? cell - 1 : cell, x + 1 < side ? cell + 1 : cell, y > 0 ? cell - side : cell, y + 1 < side ? cell + side : cell };
+        for (auto neighbour : neighbours)
+        {
+            if (!visited[neighbour])
+            {
+                visited[neighbour] = 1;
+                queue.add_back(neighbour);
+            }
+        }
+    }
+    auto elapsed = Timer::now().to_nanoseconds() - begin;
+    return (double)reached * 1e3 / (double)elapsed;
+}
+
+int main()
+{
+    auto* visited = (u8*)__builtin_malloc((size_t)side * side);
+    printf("node per element queue: %.1f M cells/s\n", breadth_first_search<NodeQueue<u32>>(visited));
+    printf("Queue (Deque): %.1f M cells/s\n", breadth_first_search<Queue<u32>>(visited));
+    __builtin_free(visited);
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <EventLoop.h>
+#include <Parallel.h>
+#include <Thread.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr size_t connection_samples = 5000;
+static constexpr size_t round_trip_samples = 50000;
+static constexpr size_t message_size = 64;
+
+static Ipv4SocketAddress loopback(u16 port)
+{
+    return { HostToBigEndian((u32)0x7f000001), HostToBigEndian(port) };
+}
+
+Task<void> echo(EventLoop& loop, TCPSocket socket)
+{
+    socket.set_no_delay(true);
+    u8 buffer[4096];
+    Span<u8> span(buffer, sizeof(buffer));
+    while (true)
+    {
+        auto received = co_await loop.receive(socket, span);
+        if (received.has_error() || received.result() == 0)
+            break;
+        auto error = co_await loop.send(socket, Span<u8>(buffer, received.result()));
+        if (error.has_value())
+            break;
+    }
+    loop.close(socket);
+}
+
+Task<void> serve(EventLoop& loop, TCPListener& listener)
+{
+    while (true)
+    {
+        auto client = co_await loop.accept(listener);
+        if (client.has_error())
+            break;
+        spawn(echo(loop, move(client.result())));
+    }
+}
+
+static bool round_trip(TCPSocket& socket, u8* message)
+{
+    if (socket.send(Span<u8>(message, message_size)).has_value())
+        return false;
+    u8 reply[message_size];
+    size_t got = 0;
+    while (got < message_size)
+    {
+        Span<u8> rest(reply + got, message_size - got);
+        auto received = socket.receive(rest);
+        if (received.has_error() || received.result() == 0)
+            return false;
+        got += received.result();
+    }
+    return true;
+}
+
+static void print_latencies(char const* name, Vector<u64>& latencies)
+{
+    parallel_sort(latencies);
+    u64 total = 0;
+    for (size_t i = 0; i < latencies.size(); i++)
+        total += latencies[i];
+    printf("%s: avg %llu ns, p50 %llu ns, p99 %llu ns\n", name,
+        (unsigned long long)(total / latencies.size()),
+        (unsigned long long)latencies[latencies.size() / 2],
+        (unsigned long long)latencies[latencies.size() * 99 / 100]);
+}
+
+int main()
+{
+    auto maybe_loop = EventLoop::create();
+    auto maybe_listener = TCPListener::listen(loopback(0));
+    if (maybe_loop.has_error() || maybe_listener.has_error())
+    {
+        printf("failed to set up the server\n");
+        return 1;
+    }
+    auto& loop = *maybe_loop.result();
+    auto& listener = maybe_listener.result();
+    auto port = listener.port().result();
+
+    auto server = Thread::create([&]()
+        {
+            spawn(serve(loop, listener));
+            loop.run(); });
+
+    // New connection per request: connect, one echo, close.
+    u8 message[message_size] {};
+    Vector<u64> latencies;
+    auto begin = Timer::now().to_nanoseconds();
+    for (size_t i = 0; i < connection_samples; i++)
+    {
+        auto started = Timer::now().to_nanoseconds();
+        auto connection = TCPSocket::connect(loopback(port));
+        if (connection.has_error() || !round_trip(connection.result(), message))
+        {
+            printf("connection %zu failed: %d\n", i, connection.has_error() ? connection.error() : 0);
+            return 1;
+        }
+        latencies.append(Timer::now().to_nanoseconds() - started);
+    }
+    auto elapsed = Timer::now().to_nanoseconds() - begin;
+    printf("connections: %.0f connections/s\n", connection_samples * 1e9 / elapsed);
+    print_latencies("connect + echo latency", latencies);
+
+    // Echo round trips over one connection.
+    auto connection = TCPSocket::connect(loopback(port));
+    connection.result().set_no_delay(true);
+    Vector<u64> round_trips;
+    begin = Timer::now().to_nanoseconds();
+    for (size_t i = 0; i < round_trip_samples; i++)
+    {
+        auto started = Timer::now().to_nanoseconds();
+        if (!round_trip(connection.result(), message))
+        {
+            printf("round trip %zu failed\n", i);
+            return 1;
+        }
+        round_trips.append(Timer::now().to_nanoseconds() - started);
+    }
+    elapsed = Timer::now().to_nanoseconds() - begin;
+    printf("round trips: %.0f messages/s\n", round_trip_samples * 1e9 / elapsed);
+    print_latencies("echo latency", round_trips);
+
+    loop.stop();
+    [[maybe_unused]] auto exit_code = server.result()->wait_for_thread_exit();
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Aligned.h>
+#include <Atomic.h>
+#include <Optional.h>
+#include <PerThread.h>
+#include <Thread.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr u64 increments = 20000000;
+
+// Every thread bumps its own counter; only where the counters sit differs. Returns ns per increment.
+template<typename TCounter>
+static double run(u32 thread_count, TCounter&& counter_of)
+{
+    Optional<RefPtr<Thread>> threads[16];
+    auto begin = Timer::now().to_nanoseconds();
+    for (u32 t = 0; t < thread_count; t++)
+    {
+        threads[t] = Thread::create([&counter_of, t]
+            {
+                Atomic<u64>& counter = counter_of(t);
+                for (u64 i = 0; i < increments; i++)
+                    counter.store(counter.load(neo::Relaxed) + 1, neo::Relaxed); })
+                         .result();
+    }
+    for (u32 t = 0; t < thread_count; t++)
+        [[maybe_unused]] auto exit = threads[t].value()->wait_for_thread_exit();
+    return (double)(Timer::now().to_nanoseconds() - begin) / (double)(increments * thread_count);
+}
+
+int main()
+{
+    for (u32 threads = 1; threads <= 16; threads *= 2)
+    {
+        Atomic<u64> packed[16] {};
+        CacheLinePadded<Atomic<u64>> padded[16] {};
+        PerThread<Atomic<u64>> per_thread;
+        printf("%2u threads: packed %.2f ns, CacheLinePadded %.2f ns, PerThread %.2f ns per increment\n",
+            threads,
+            run(threads, [&](u32 t) -> Atomic<u64>&
+                { return packed[t]; }),
+            run(threads, [&](u32 t) -> Atomic<u64>&
+                { return *padded[t]; }),
+            run(threads, [&](u32) -> Atomic<u64>&
+                { return per_thread.local(); }));
+    }
+    return 0;
+}
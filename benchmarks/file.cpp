@@ -0,0 +1,120 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <File.h>
+#include <Thread.h>
+#include <Time.h>
+#include <Vector.h>
+#include <stdio.h>
+
+static constexpr size_t file_size = 64 * MiB;
+static constexpr size_t block_size = 4096;
+static constexpr size_t reads_per_thread = 50000;
+static constexpr size_t thread_count = 4;
+static char const* const path = "/tmp/neo_file_benchmark.bin";
+
+template<typename TWork>
+static u64 run_threads(TWork&& work)
+{
+    auto begin = Timer::now().to_nanoseconds();
+    Vector<RefPtr<Thread>> threads;
+    for (size_t t = 0; t < thread_count; t++)
+    {
+        auto thread = Thread::create([&work, t]
+            { work(t); });
+        threads.append(thread.result());
+    }
+    for (auto& thread : threads)
+        [[maybe_unused]] auto exit = thread->wait_for_thread_exit();
+    return Timer::now().to_nanoseconds() - begin;
+}
+
+static u64 block_offset(size_t t, size_t i)
+{
+    return ((t * reads_per_thread + i) * 2654435761u % (file_size / block_size)) * block_size;
+}
+
+int main()
+{
+    {
+        auto file = File::open(path, "w");
+        if (file.has_error())
+        {
+            printf("failed to create the test file\n");
+            return 1;
+        }
+        [[maybe_unused]] auto allocate_error = file.result().allocate(0, file_size);
+    }
+
+    auto total_reads = (double)(thread_count * reads_per_thread);
+
+    // Random block reads through one shared FILE*, the way File used to work: seek and read under stdio's lock.
+    {
+        auto* handle = fopen(path, "r");
+        auto elapsed = run_threads([&](size_t t)
+            {
+                u8 block[block_size];
+                for (size_t i = 0; i < reads_per_thread; i++)
+                {
+                    flockfile(handle);
+                    fseek(handle, (long)block_offset(t, i), SEEK_SET);
+                    [[maybe_unused]] auto read = fread(block, 1, block_size, handle);
+                    funlockfile(handle);
+                } });
+        fclose(handle);
+        printf("stdio seek + read: %.0f reads/s\n", total_reads * 1e9 / elapsed);
+    }
+
+    auto file = File::open(path, "r+");
+    {
+        auto elapsed = run_threads([&](size_t t)
+            {
+                u8 block[block_size];
+                for (size_t i = 0; i < reads_per_thread; i++)
+                    [[maybe_unused]] auto read = file.result().read_at(Span<u8>(block, block_size), block_offset(t, i));
+            });
+        printf("read_at: %.0f reads/s\n", total_reads * 1e9 / elapsed);
+    }
+
+    // Small appends that each have to be durable.
+    static constexpr size_t syncs_per_thread = 200;
+    {
+        auto elapsed = run_threads([&](size_t t)
+            {
+                u8 record[64] {};
+                for (size_t i = 0; i < syncs_per_thread; i++)
+                {
+                    [[maybe_unused]] auto written = file.result().write_at(Span<u8>(record, sizeof(record)), (t * syncs_per_thread + i) * sizeof(record));
+                    [[maybe_unused]] auto error = file.result().sync_data();
+                } });
+        printf("fdatasync per write: %.0f writes/s\n", thread_count * syncs_per_thread * 1e9 / elapsed);
+    }
+    {
+        DataSyncBatcher batcher(file.result());
+        auto elapsed = run_threads([&](size_t t)
+            {
+                u8 record[64] {};
+                for (size_t i = 0; i < syncs_per_thread; i++)
+                {
+                    [[maybe_unused]] auto written = file.result().write_at(Span<u8>(record, sizeof(record)), (t * syncs_per_thread + i) * sizeof(record));
+                    [[maybe_unused]] auto error = batcher.sync();
+                } });
+        printf("DataSyncBatcher: %.0f writes/s, %u syncs for %zu writes\n", thread_count * syncs_per_thread * 1e9 / elapsed, batcher.syncs(), thread_count * syncs_per_thread);
+    }
+
+    [[maybe_unused]] auto remove_error = File::remove(path);
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Function.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr u64 iterations = 20000000;
+
+// What Function used to do: a heap allocated storage object behind a virtual call, for every callable.
+template<typename TReturn, typename TArg>
+class HeapFunction
+{
+    struct View
+    {
+        virtual ~View() = default;
+        virtual TReturn call(TArg) = 0;
+    };
+
+    template<typename TCallable>
+    struct Storage final : View
+    {
+        explicit Storage(TCallable const& c) :
+            callable(c)
+        {
+        }
+
+        TReturn call(TArg arg) override
+        {
+            return callable(arg);
+        }
+
+        TCallable callable;
+    };
+
+public:
+    template<typename TCallable>
+    HeapFunction(TCallable const& callable) :
+        m_view(new Storage<TCallable>(callable))
+    {
+    }
+
+    ~HeapFunction()
+    {
+        delete m_view;
+    }
+
+    TReturn operator()(TArg arg) const
+    {
+        return m_view->call(arg);
+    }
+
+private:
+    View* m_view;
+};
+
+// An event path: wrap a small capture in a callback, hand it down, call it once.
+template<typename TCallback>
+[[gnu::noinline]] static u64 dispatch(TCallback const& callback, u64 value)
+{
+    return callback(value);
+}
+
+template<typename TCallback>
+static double run()
+{
+    u64 sum = 0;
+    auto begin = Timer::now().to_nanoseconds();
+    for (u64 i = 0; i < iterations; i++)
+    {
+        u64 a = i;
+        u64 b = i * 3;
+        TCallback callback = [a, b](u64 value)
+        { return value + a + b; };
+        sum += dispatch(callback, i);
+    }
+    auto elapsed = Timer::now().to_nanoseconds() - begin;
+    asm volatile(""
+                 :
+                 : "r"(sum));
+    return (double)elapsed / (double)iterations;
+}
+
+int main()
+{
+    printf("heap allocated callable: %.1f ns per callback\n", run<HeapFunction<u64, u64>>());
+    printf("Function: %.1f ns per callback\n", run<Function<u64, u64>>());
+    printf("FunctionRef: %.1f ns per callback\n", run<FunctionRef<u64, u64>>());
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <IOEngine.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr size_t file_size = 64 * 1024 * 1024;
+static constexpr size_t block_size = 4096;
+static constexpr u32 queue_depth = 64;
+
+static void print_rate(char const* name, u64 elapsed)
+{
+    printf("%s: %.0f MB/s, %.0f blocks/s\n", name, file_size * 1e3 / elapsed, (file_size / block_size) * 1e9 / elapsed);
+}
+
+// Reads the whole file keeping queue_depth block reads in flight.
+static u64 read_with_engine(IOEngine& engine, int fd, u8* buffer)
+{
+    auto begin = Timer::now().to_nanoseconds();
+    size_t next_offset = 0;
+    while (next_offset < file_size || engine.in_flight() != 0)
+    {
+        while (next_offset < file_size && engine.in_flight() < queue_depth)
+        {
+            auto slot = (next_offset / block_size) % queue_depth;
+            [[maybe_unused]] auto read = engine.read_at(fd, Span<u8>(buffer + slot * block_size, block_size), next_offset);
+            next_offset += block_size;
+        }
+        engine.wait(1);
+    }
+    return Timer::now().to_nanoseconds() - begin;
+}
+
+int main()
+{
+    auto file_or_error = File::open("/tmp/neo_io_engine_benchmark.bin", "w+");
+    if (file_or_error.has_error())
+    {
+        printf("failed to create the test file\n");
+        return 1;
+    }
+    auto& file = file_or_error.result();
+    auto fd = file.fd();
+
+    static u8 buffer[block_size * queue_depth];
+    for (size_t offset = 0; offset < file_size; offset += block_size)
+    {
+        if (::pwrite(fd, buffer, block_size, (off_t)offset) != (ssize_t)block_size)
+        {
+            printf("failed to fill the test file\n");
+            return 1;
+        }
+    }
+
+    // One pread per block.
+    auto begin = Timer::now().to_nanoseconds();
+    for (size_t offset = 0; offset < file_size; offset += block_size)
+        [[maybe_unused]] auto read = ::pread(fd, buffer, block_size, (off_t)offset);
+    print_rate("pread", Timer::now().to_nanoseconds() - begin);
+
+    auto uring = IOEngine::create(queue_depth, IOBackend::IoUring);
+    if (uring.has_value())
+        print_rate("io_uring", read_with_engine(*uring.result(), fd, buffer));
+    else
+        printf("io_uring: unavailable\n");
+
+    auto fallback = IOEngine::create(queue_depth, IOBackend::Fallback);
+    print_rate("fallback", read_with_engine(*fallback.result(), fd, buffer));
+
+    [[maybe_unused]] auto close_error = file.close();
+    [[maybe_unused]] auto remove_error = File::remove("/tmp/neo_io_engine_benchmark.bin");
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <MappedFile.h>
+#include <File.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr size_t file_size = 256 * MiB;
+static char const* const path = "/tmp/neo_mapped_file_benchmark.bin";
+
+static u64 checksum(u8 const* data, size_t size)
+{
+    u64 sum = 0;
+    for (size_t i = 0; i + 8 <= size; i += 8)
+        sum += *(u64 const*)(data + i);
+    return sum;
+}
+
+static void print_rate(char const* name, u64 elapsed, u64 sum)
+{
+    printf("%s: %.0f MB/s (checksum %llx)\n", name, file_size * 1e3 / elapsed, (unsigned long long)sum);
+}
+
+int main()
+{
+    {
+        auto file = File::open(path, "w");
+        if (file.has_error())
+        {
+            printf("failed to create the test file\n");
+            return 1;
+        }
+        static u8 block[1 * MiB];
+        for (size_t i = 0; i < sizeof(block); i++)
+            block[i] = (u8)i;
+        for (size_t offset = 0; offset < file_size; offset += sizeof(block))
+            [[maybe_unused]] auto written = file.result().write(Span<u8>(block, sizeof(block)), sizeof(block));
+    }
+
+    // Everything runs against a warm page cache, this measures the copies and faults rather than the disk.
+    {
+        auto begin = Timer::now().to_nanoseconds();
+        auto buffer = File::read_all(path);
+        auto sum = checksum(buffer.result().data(), buffer.result().size());
+        print_rate("read_all", Timer::now().to_nanoseconds() - begin, sum);
+    }
+
+    {
+        auto begin = Timer::now().to_nanoseconds();
+        auto file = MappedFile::map(path);
+        [[maybe_unused]] auto error = file.result().advise(MapAdvice::Sequential);
+        auto sum = checksum(file.result().span().data(), file.result().span().size());
+        print_rate("mapped", Timer::now().to_nanoseconds() - begin, sum);
+    }
+
+    {
+        auto begin = Timer::now().to_nanoseconds();
+        auto file = MappedFile::map(path, { .populate = true });
+        auto sum = checksum(file.result().span().data(), file.result().span().size());
+        print_rate("mapped, populated", Timer::now().to_nanoseconds() - begin, sum);
+    }
+
+    {
+        auto begin = Timer::now().to_nanoseconds();
+        auto file = MappedFile::map(path, { .window_size = 16 * MiB });
+        MappedFileStream stream(file.result());
+        u64 sum = 0;
+        while (!stream.end())
+        {
+            auto chunk = stream.next(file_size);
+            sum += checksum(chunk.data(), chunk.size());
+        }
+        print_rate("stream, 16 MiB windows", Timer::now().to_nanoseconds() - begin, sum);
+    }
+
+    [[maybe_unused]] auto remove_error = File::remove(path);
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ConcurrentStream.h>
+#include <FileStream.h>
+#include <Thread.h>
+#include <Time.h>
+#include <Vector.h>
+#include <stdio.h>
+
+static constexpr size_t thread_count = 8;
+static constexpr size_t lines_per_thread = 200000;
+
+// What ConcurrentOutputStream does, one lock around every write.
+class LockedOutputStream final : public OutputStream
+{
+public:
+    explicit LockedOutputStream(OutputStream& base) :
+        m_base(base)
+    {
+    }
+
+    void write(Span<u8> const& from) override
+    {
+        m_lock.lock();
+        m_base.write(from);
+        m_lock.unlock();
+    }
+
+    void flush() override
+    {
+        m_lock.lock();
+        m_base.flush();
+        m_lock.unlock();
+    }
+
+    bool has_error() const override
+    {
+        return m_base.has_error();
+    }
+
+    void close() override
+    {
+    }
+
+private:
+    OutputStream& m_base;
+    SpinlockMutex m_lock;
+};
+
+static double log_lines(OutputStream& stream)
+{
+    auto begin = Timer::now().to_nanoseconds();
+    Vector<RefPtr<Thread>> threads;
+    for (size_t t = 0; t < thread_count; t++)
+    {
+        auto thread = Thread::create([&stream, t]
+            {
+                char line[96];
+                for (size_t i = 0; i < lines_per_thread; i++)
+                {
+                    auto length = snprintf(line, sizeof(line), "[thread %zu] request %zu handled in %zu us\n", t, i, i % 977);
+                    stream.write(Span<u8>((u8*)line, (size_t)length));
+                } });
+        threads.append(thread.result());
+    }
+    for (auto& thread : threads)
+        [[maybe_unused]] auto exit = thread->wait_for_thread_exit();
+    stream.flush();
+    auto elapsed = Timer::now().to_nanoseconds() - begin;
+    return (double)(thread_count * lines_per_thread) * 1e3 / (double)elapsed;
+}
+
+int main()
+{
+    {
+        auto file = FileStream::create("/dev/null", "w");
+        LockedOutputStream stream(file.result());
+        printf("one lock per write: %.2f M lines/s\n", log_lines(stream));
+    }
+
+    {
+        auto file = FileStream::create("/dev/null", "w");
+        auto stream = MultiProducerOutputStream::create(file.result());
+        printf("MultiProducerOutputStream: %.2f M lines/s\n", log_lines(*stream.result()));
+    }
+
+    return 0;
+}
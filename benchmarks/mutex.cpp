@@ -0,0 +1,113 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Mutex.h>
+#include <Thread.h>
+#include <Time.h>
+#include <Vector.h>
+#include <stdio.h>
+
+static constexpr u64 operations = 4000000;
+static constexpr size_t thread_count = 4;
+
+template<typename TBody>
+static double run_threads(TBody&& body)
+{
+    auto begin = Timer::now().to_nanoseconds();
+    Vector<RefPtr<Thread>> threads;
+    for (size_t t = 0; t < thread_count; t++)
+        threads.append(Thread::create([&body, t]
+            { body(t, operations / thread_count); })
+                           .result());
+    for (auto& thread : threads)
+        [[maybe_unused]] auto exit = thread->wait_for_thread_exit();
+    return (double)operations * 1e3 / (double)(Timer::now().to_nanoseconds() - begin);
+}
+
+// An uncontended lock and unlock: no syscall either way.
+template<typename TMutex>
+static double uncontended()
+{
+    TMutex mutex;
+    auto begin = Timer::now().to_nanoseconds();
+    for (u64 i = 0; i < operations; i++)
+    {
+        mutex.lock();
+        asm volatile(""
+                     :
+                     :
+                     : "memory");
+        mutex.unlock();
+    }
+    return (double)(Timer::now().to_nanoseconds() - begin) / (double)operations;
+}
+
+template<typename TMutex>
+static double contended()
+{
+    TMutex mutex;
+    u64 counter = 0;
+    return run_threads([&](size_t, u64 count)
+        {
+            for (u64 i = 0; i < count; i++)
+            {
+                ScopedLock lock(mutex);
+                counter++;
+            } });
+}
+
+// A read mostly table: one write per 64 lookups.
+template<typename TLock, bool Shared>
+static double read_mostly()
+{
+    TLock lock;
+    u64 table[64] {};
+    return run_threads([&](size_t t, u64 count)
+        {
+            u64 sum = 0;
+            for (u64 i = 0; i < count; i++)
+            {
+                if (i % 64 == t)
+                {
+                    ScopedLock exclusive(lock);
+                    table[i % 64]++;
+                }
+                else if constexpr (Shared)
+                {
+                    ScopedSharedLock shared(lock);
+                    sum += table[i % 64];
+                }
+                else
+                {
+                    ScopedLock exclusive(lock);
+                    sum += table[i % 64];
+                }
+            }
+            asm volatile(""
+                         :
+                         : "r"(sum)); });
+}
+
+int main()
+{
+    printf("uncontended lock + unlock: SpinlockMutex %.1f ns, Mutex %.1f ns, TicketLock %.1f ns, RWLock %.1f ns\n",
+        uncontended<SpinlockMutex>(), uncontended<Mutex>(), uncontended<TicketLock>(), uncontended<RWLock>());
+    printf("%zu threads incrementing one counter: SpinlockMutex %.1f M/s, Mutex %.1f M/s, HybridMutex %.1f M/s, TicketLock %.1f M/s\n",
+        thread_count, contended<SpinlockMutex>(), contended<Mutex>(), contended<HybridMutex>(), contended<TicketLock>());
+    printf("%zu threads, read mostly table: Mutex %.1f M/s, RWLock %.1f M/s\n",
+        thread_count, read_mostly<Mutex, false>(), read_mostly<RWLock, true>());
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Mutex.h>
+#include <RcuCell.h>
+#include <Thread.h>
+#include <Time.h>
+#include <Vector.h>
+#include <stdio.h>
+
+static constexpr u64 lookups = 4000000;
+
+// A routing table: readers look up a route per packet, a writer swaps in a new table now and then.
+struct RoutingTable
+{
+    u32 next_hop[256];
+};
+
+template<typename TBody>
+static double run_readers(size_t thread_count, TBody&& body)
+{
+    auto begin = Timer::now().to_nanoseconds();
+    Vector<RefPtr<Thread>> threads;
+    for (size_t t = 0; t < thread_count; t++)
+        threads.append(Thread::create([&body, thread_count]
+            { body(lookups / thread_count); })
+                           .result());
+    for (auto& thread : threads)
+        [[maybe_unused]] auto exit = thread->wait_for_thread_exit();
+    return (double)lookups * 1e3 / (double)(Timer::now().to_nanoseconds() - begin);
+}
+
+static double with_mutex(size_t thread_count)
+{
+    Mutex mutex;
+    RoutingTable table {};
+    return run_readers(thread_count, [&](u64 count)
+        {
+            u64 sum = 0;
+            for (u64 i = 0; i < count; i++)
+            {
+                ScopedLock lock(mutex);
+                if (i % 4096 == 0)
+                    table.next_hop[i % 256] = (u32)i;
+                sum += table.next_hop[i % 256];
+            }
+            asm volatile(""
+                         :
+                         : "r"(sum)); });
+}
+
+template<bool UseSnapshots>
+static double with_rcu(size_t thread_count)
+{
+    RcuCell<RoutingTable> cell(RoutingTable {});
+    return run_readers(thread_count, [&](u64 count)
+        {
+            u64 sum = 0;
+            for (u64 i = 0; i < count; i++)
+            {
+                if (i % 4096 == 0)
+                    cell.update([i](RoutingTable& table)
+                        { table.next_hop[i % 256] = (u32)i; });
+                if constexpr (UseSnapshots)
+                    sum += cell.snapshot()->next_hop[i % 256];
+                else
+                    sum += cell.read([i](RoutingTable const& table)
+                        { return table.next_hop[i % 256]; });
+            }
+            asm volatile(""
+                         :
+                         : "r"(sum)); });
+}
+
+int main()
+{
+    for (size_t threads = 1; threads <= 4; threads *= 2)
+    {
+        printf("%zu threads: Mutex %.1f M lookups/s, RcuCell::read %.1f M lookups/s, RcuCell::snapshot %.1f M lookups/s\n",
+            threads, with_mutex(threads), with_rcu<false>(threads), with_rcu<true>(threads));
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Mutex.h>
+#include <Reclamation.h>
+#include <Thread.h>
+#include <Time.h>
+#include <Vector.h>
+#include <stdio.h>
+
+static constexpr u64 operations = 4000000;
+
+struct Table
+{
+    u64 entries[64];
+};
+
+template<typename TBody>
+static double run_threads(size_t thread_count, TBody&& body)
+{
+    auto begin = Timer::now().to_nanoseconds();
+    Vector<RefPtr<Thread>> threads;
+    for (size_t t = 0; t < thread_count; t++)
+        threads.append(Thread::create([&body, t, thread_count]
+            { body(t, operations / thread_count); })
+                           .result());
+    for (auto& thread : threads)
+        [[maybe_unused]] auto exit = thread->wait_for_thread_exit();
+    return (double)operations * 1e3 / (double)(Timer::now().to_nanoseconds() - begin);
+}
+
+// Lookups in a shared table that one thread in 1024 operations replaces with a copy.
+template<typename TRead, typename TReplace>
+static double read_mostly(size_t thread_count, TRead read, TReplace replace)
+{
+    return run_threads(thread_count, [&](size_t t, u64 count)
+        {
+            u64 sum = 0;
+            for (u64 i = 0; i < count; i++)
+            {
+                if (t == 0 && i % 1024 == 0)
+                    replace(i);
+                else
+                    sum += read(i % 64);
+            }
+            asm volatile(""
+                         :
+                         : "r"(sum)); });
+}
+
+static double with_rwlock(size_t thread_count)
+{
+    RWLock lock;
+    Table* table = new Table {};
+    auto result = read_mostly(
+        thread_count,
+        [&](u64 index)
+        {
+            ScopedSharedLock guard(lock);
+            return table->entries[index];
+        },
+        [&](u64 value)
+        {
+            auto* copy = new Table(*table);
+            copy->entries[value % 64] = value;
+            ScopedLock guard(lock);
+            delete table;
+            table = copy;
+        });
+    delete table;
+    return result;
+}
+
+static double with_epochs(size_t thread_count)
+{
+    EpochDomain domain;
+    Atomic<Table*> table { new Table {} };
+    auto result = read_mostly(
+        thread_count,
+        [&](u64 index)
+        {
+            auto guard = domain.pin();
+            return table.load(neo::Acquire)->entries[index];
+        },
+        [&](u64 value)
+        {
+            auto* copy = new Table(*table.load(neo::Acquire));
+            copy->entries[value % 64] = value;
+            domain.retire(table.exchange(copy, neo::AcquireRelease));
+        });
+    delete table.load(neo::Relaxed);
+    return result;
+}
+
+static double with_hazard_pointers(size_t thread_count)
+{
+    HazardDomain domain;
+    Atomic<Table*> table { new Table {} };
+    auto result = read_mostly(
+        thread_count,
+        [&](u64 index)
+        {
+            auto hazard = domain.make_hazard_pointer();
+            return hazard.protect(table)->entries[index];
+        },
+        [&](u64 value)
+        {
+            auto* copy = new Table(*table.load(neo::Acquire));
+            copy->entries[value % 64] = value;
+            domain.retire(table.exchange(copy, neo::AcquireRelease));
+        });
+    delete table.load(neo::Relaxed);
+    return result;
+}
+
+int main()
+{
+    for (size_t threads = 1; threads <= 4; threads *= 2)
+    {
+        printf("%zu threads: RWLock %.1f M lookups/s, EpochDomain %.1f M lookups/s, HazardDomain %.1f M lookups/s\n",
+            threads, with_rwlock(threads), with_epochs(threads), with_hazard_pointers(threads));
+    }
+    return 0;
+}
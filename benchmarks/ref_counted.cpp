@@ -0,0 +1,71 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Memory.h>
+#include <SmartPtr.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr u64 iterations = 5000000;
+
+struct Payload
+{
+    u64 value;
+};
+
+struct IntrusivePayload : public RefCounted<IntrusivePayload>
+{
+    u64 value;
+};
+
+struct LocalPayload : public LocalRefCounted<LocalPayload>
+{
+    u64 value;
+};
+
+// Allocate, hand out a couple of references, read through them and drop everything.
+template<typename T, typename TCreate>
+static double run(TCreate create)
+{
+    u64 sum = 0;
+    auto begin = Timer::now().to_nanoseconds();
+    for (u64 i = 0; i < iterations; i++)
+    {
+        RefPtr<T> ref = create();
+        ref->value = i;
+        auto a = ref;
+        auto b = a;
+        sum += b->value;
+        asm volatile(""
+                     :
+                     : "r"(&b)
+                     : "memory");
+    }
+    auto elapsed = Timer::now().to_nanoseconds() - begin;
+    asm volatile(""
+                 :
+                 : "r"(sum));
+    return (double)elapsed / (double)iterations;
+}
+
+int main()
+{
+    printf("RefPtr(new T): %.1f ns per object\n", run<Payload>([] { return RefPtr<Payload>(new Payload {}); }));
+    printf("create_refcounted: %.1f ns per object\n", run<Payload>([] { return create_refcounted<Payload>().release_nonnull(); }));
+    printf("RefCounted: %.1f ns per object\n", run<IntrusivePayload>([] { return create_refcounted<IntrusivePayload>().release_nonnull(); }));
+    printf("LocalRefCounted: %.1f ns per object\n", run<LocalPayload>([] { return create_refcounted<LocalPayload>().release_nonnull(); }));
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Statistics.h>
+#include <Thread.h>
+#include <Time.h>
+#include <Vector.h>
+#include <stdio.h>
+
+static constexpr u64 operations = 20000000;
+static constexpr size_t thread_count = 4;
+
+template<typename TBody>
+static double run_threads(TBody&& body)
+{
+    auto begin = Timer::now().to_nanoseconds();
+    Vector<RefPtr<Thread>> threads;
+    for (size_t t = 0; t < thread_count; t++)
+        threads.append(Thread::create([&body]
+            { body(operations / thread_count); })
+                           .result());
+    for (auto& thread : threads)
+        [[maybe_unused]] auto exit = thread->wait_for_thread_exit();
+    return (double)operations * 1e3 / (double)(Timer::now().to_nanoseconds() - begin);
+}
+
+int main()
+{
+    // Every thread counts events into the same metric.
+    Atomic<u64> shared { 0 };
+    printf("shared Atomic<u64>: %.1f M increments/s\n", run_threads([&](u64 count)
+        {
+            for (u64 i = 0; i < count; i++)
+                shared.fetch_add(1, neo::Relaxed); }));
+
+    ShardedCounter<u64> counter;
+    printf("ShardedCounter (%zu shards): %.1f M increments/s\n", counter.shard_count(), run_threads([&](u64 count)
+        {
+            for (u64 i = 0; i < count; i++)
+                counter.increment(); }));
+
+    ShardedMax<u64> maximum;
+    printf("ShardedMax: %.1f M records/s\n", run_threads([&](u64 count)
+        {
+            for (u64 i = 0; i < count; i++)
+                maximum.record(i & 1023); }));
+
+    Histogram histogram;
+    printf("Histogram: %.1f M records/s\n", run_threads([&](u64 count)
+        {
+            for (u64 i = 0; i < count; i++)
+                histogram.record(i * 2654435761u % 100000); }));
+    printf("p50 %llu, p99 %llu\n", (unsigned long long)histogram.percentile(50), (unsigned long long)histogram.percentile(99));
+    return 0;
+}
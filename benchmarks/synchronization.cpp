@@ -0,0 +1,92 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Mutex.h>
+#include <Synchronization.h>
+#include <Thread.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr u64 operations = 10000000;
+static constexpr u64 round_trips = 100000;
+
+// acquire and release with the count never reaching zero: no syscall.
+static double semaphore_uncontended()
+{
+    Semaphore semaphore(1);
+    auto begin = Timer::now().to_nanoseconds();
+    for (u64 i = 0; i < operations; i++)
+    {
+        semaphore.acquire();
+        semaphore.release();
+    }
+    return (double)(Timer::now().to_nanoseconds() - begin) / (double)operations;
+}
+
+// The same semaphore built from a mutex and a condition variable.
+static double condition_variable_semaphore()
+{
+    Mutex mutex;
+    ConditionVariable available;
+    u32 count = 1;
+    auto begin = Timer::now().to_nanoseconds();
+    for (u64 i = 0; i < operations; i++)
+    {
+        {
+            ScopedLock lock(mutex);
+            available.wait(mutex, [&] { return count > 0; });
+            count--;
+        }
+        {
+            ScopedLock lock(mutex);
+            count++;
+            available.notify_one();
+        }
+    }
+    return (double)(Timer::now().to_nanoseconds() - begin) / (double)operations;
+}
+
+// Two threads handing a turn back and forth, each hand off wakes the other one up.
+template<typename TEvent>
+static double ping_pong()
+{
+    TEvent ping;
+    TEvent pong;
+    auto begin = Timer::now().to_nanoseconds();
+    auto thread = Thread::create([&]
+        {
+            for (u64 i = 0; i < round_trips; i++)
+            {
+                ping.wait();
+                pong.set();
+            } })
+                      .result();
+    for (u64 i = 0; i < round_trips; i++)
+    {
+        ping.set();
+        pong.wait();
+    }
+    [[maybe_unused]] auto exit = thread->wait_for_thread_exit();
+    return (double)(Timer::now().to_nanoseconds() - begin) / (double)round_trips;
+}
+
+int main()
+{
+    printf("Semaphore acquire and release: %.1f ns\n", semaphore_uncontended());
+    printf("Mutex and ConditionVariable as a semaphore: %.1f ns\n", condition_variable_semaphore());
+    printf("AutoResetEvent ping pong: %.0f ns per round trip\n", ping_pong<AutoResetEvent>());
+    return 0;
+}
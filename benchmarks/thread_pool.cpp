@@ -0,0 +1,79 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ThreadPool.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr size_t latency_samples = 10000;
+static constexpr size_t throughput_tasks = 1000000;
+static constexpr size_t thread_per_task_samples = 1000;
+
+int main()
+{
+    ThreadPool pool;
+    printf("workers: %zu\n", pool.worker_count());
+
+    // Spawn latency: time from submit() until the task starts running on a worker.
+    u64 total_latency = 0;
+    u64 worst_latency = 0;
+    for (size_t i = 0; i < latency_samples; i++)
+    {
+        auto submitted = Timer::now().to_nanoseconds();
+        auto future = pool.submit([]()
+            { return Timer::now().to_nanoseconds(); });
+        auto started = future.value();
+        total_latency += started - submitted;
+        worst_latency = max(worst_latency, started - submitted);
+    }
+    printf("pool spawn latency: avg %llu ns, worst %llu ns\n", (unsigned long long)(total_latency / latency_samples), (unsigned long long)worst_latency);
+
+    // Same thing paying for a thread per task.
+    total_latency = 0;
+    for (size_t i = 0; i < thread_per_task_samples; i++)
+    {
+        Atomic<u64> started { 0 };
+        auto submitted = Timer::now().to_nanoseconds();
+        auto thread = Thread::create([&]()
+            { started.store(Timer::now().to_nanoseconds(), neo::Release); });
+        [[maybe_unused]] auto exit_code = thread.result()->wait_for_thread_exit();
+        total_latency += started.load(neo::Acquire) - submitted;
+    }
+    printf("thread per task spawn latency: avg %llu ns\n", (unsigned long long)(total_latency / thread_per_task_samples));
+
+    // Throughput of empty tasks, submitted from outside and from inside the pool.
+    Atomic<u64> counter { 0 };
+    auto begin = Timer::now().to_nanoseconds();
+    for (size_t i = 0; i < throughput_tasks; i++)
+        pool.execute([&]()
+            { counter.add_fetch(1, neo::Relaxed); });
+    pool.drain();
+    auto elapsed = Timer::now().to_nanoseconds() - begin;
+    printf("external submit throughput: %.0f tasks/s\n", throughput_tasks * 1e9 / elapsed);
+
+    auto per_worker = throughput_tasks / pool.worker_count();
+    begin = Timer::now().to_nanoseconds();
+    for (size_t i = 0; i < pool.worker_count(); i++)
+        pool.execute([&]()
+            {
+                for (size_t j = 0; j < per_worker; j++)
+                    pool.execute([&]()
+                        { counter.add_fetch(1, neo::Relaxed); }); });
+    pool.drain();
+    elapsed = Timer::now().to_nanoseconds() - begin;
+    printf("worker submit throughput: %.0f tasks/s\n", per_worker * pool.worker_count() * 1e9 / elapsed);
+    return 0;
+}
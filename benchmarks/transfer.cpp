@@ -0,0 +1,128 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <FileStream.h>
+#include <NetworkStream.h>
+#include <Thread.h>
+#include <Time.h>
+#include <stdio.h>
+
+static constexpr size_t file_size = 256 * MiB;
+
+static Ipv4SocketAddress loopback(u16 port)
+{
+    return { HostToBigEndian((u32)0x7f000001), HostToBigEndian(port) };
+}
+
+static void print_rate(char const* name, u64 elapsed)
+{
+    printf("%s: %.0f MB/s\n", name, file_size * 1e3 / elapsed);
+}
+
+// Times send() while a second thread drains the other end of a fresh loopback connection.
+template<typename TSend>
+static void run(char const* name, TCPListener& listener, TSend&& send)
+{
+    auto client = TCPSocket::connect(loopback(listener.port().result()));
+    auto server = listener.accept();
+    if (client.has_error() || server.has_error())
+    {
+        printf("%s: failed to connect\n", name);
+        return;
+    }
+
+    auto& receiver = client.result();
+    auto thread = Thread::create([&]
+        {
+            static u8 sink[256 * KiB];
+            while (true)
+            {
+                Span<u8> span(sink, sizeof(sink));
+                auto received = receiver.receive(span);
+                if (received.has_error() || received.result() == 0)
+                    return;
+            } });
+    if (thread.has_error())
+        return;
+
+    NetworkStream stream(std::move(server.result()));
+    auto begin = Timer::now().to_nanoseconds();
+    send(stream);
+    auto elapsed = Timer::now().to_nanoseconds() - begin;
+    stream.close();
+    [[maybe_unused]] auto exit = thread.result()->wait_for_thread_exit();
+    print_rate(name, elapsed);
+}
+
+int main()
+{
+    static u8 buffer[256 * KiB];
+    {
+        auto file = File::open("/tmp/neo_transfer_benchmark.bin", "w");
+        if (file.has_error())
+        {
+            printf("failed to create the test file\n");
+            return 1;
+        }
+        for (size_t offset = 0; offset < file_size; offset += sizeof(buffer))
+            [[maybe_unused]] auto written = file.result().write(Span<u8>(buffer, sizeof(buffer)), sizeof(buffer));
+    }
+
+    auto listener = TCPListener::listen(loopback(0), SocketMode::Blocking);
+    if (listener.has_error())
+    {
+        printf("failed to listen\n");
+        return 1;
+    }
+
+    run("read + write", listener.result(), [&](NetworkStream& stream)
+        {
+            auto from = FileStream::create("/tmp/neo_transfer_benchmark.bin", "r");
+            while (true)
+            {
+                Span<u8> span(buffer, sizeof(buffer));
+                auto bytes_read = from.result().read(span);
+                if (bytes_read == 0)
+                    break;
+                stream.write(Span<u8>(buffer, bytes_read));
+            } });
+
+    run("transfer_to", listener.result(), [&](NetworkStream& stream)
+        {
+            auto from = FileStream::create("/tmp/neo_transfer_benchmark.bin", "r");
+            [[maybe_unused]] auto moved = from.result().transfer_to(stream); });
+
+    run("send_file", listener.result(), [&](NetworkStream& stream)
+        {
+            auto file = File::open("/tmp/neo_transfer_benchmark.bin", "r");
+            stream.send_file(file.result(), 0, file_size); });
+
+    run("zero copy write", listener.result(), [&](NetworkStream& stream)
+        {
+            auto from = FileStream::create("/tmp/neo_transfer_benchmark.bin", "r");
+            [[maybe_unused]] auto error = stream.enable_zero_copy(64 * KiB);
+            while (true)
+            {
+                Span<u8> span(buffer, sizeof(buffer));
+                auto bytes_read = from.result().read(span);
+                if (bytes_read == 0)
+                    break;
+                stream.write(Span<u8>(buffer, bytes_read));
+            } });
+
+    [[maybe_unused]] auto remove_error = File::remove("/tmp/neo_transfer_benchmark.bin");
+    return 0;
+}
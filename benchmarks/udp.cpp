@@ -0,0 +1,105 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Socket.h>
+#include <Time.h>
+#include <Vector.h>
+#include <stdio.h>
+
+static constexpr size_t datagram_size = 1200;
+static constexpr size_t round_size = 40;
+static constexpr size_t rounds = 20000;
+
+static Ipv4SocketAddress loopback(u16 port)
+{
+    return { HostToBigEndian((u32)0x7f000001), HostToBigEndian(port) };
+}
+
+static u8 s_payload[round_size * datagram_size];
+static u8 s_receive_storage[UDPSocket::max_batch_size][64 * 1024];
+
+// Drains whatever arrived, counting datagrams rather than buffers so coalesced receives compare fairly.
+static size_t drain(UDPSocket& receiver, Span<Span<u8>> buffers, Span<ReceivedDatagram> received)
+{
+    size_t datagrams = 0;
+    while (true)
+    {
+        auto count = receiver.receive_batch(buffers, received);
+        if (count.has_error())
+            return datagrams;
+        for (size_t i = 0; i < count.result(); i++)
+            datagrams += (received[i].size + received[i].segment_size - 1) / received[i].segment_size;
+    }
+}
+
+template<typename TSend>
+static void run(char const* name, UDPSocket& receiver, TSend&& send_round)
+{
+    Vector<Span<u8>> buffers;
+    Vector<ReceivedDatagram> received;
+    for (size_t i = 0; i < UDPSocket::max_batch_size; i++)
+    {
+        buffers.append(Span<u8>(s_receive_storage[i], sizeof(s_receive_storage[i])));
+        received.append({ 0, 0 });
+    }
+
+    size_t delivered = 0;
+    auto begin = Timer::now().to_nanoseconds();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        send_round();
+        delivered += drain(receiver, buffers.span(), received.span());
+    }
+    auto elapsed = Timer::now().to_nanoseconds() - begin;
+    printf("%s: %.0f datagrams/s, %zu of %zu delivered\n", name, delivered * 1e9 / elapsed, delivered, rounds * round_size);
+}
+
+int main()
+{
+    auto receiver_or_error = UDPSocket::create(true, SocketMode::NonBlocking);
+    auto sender_or_error = UDPSocket::create(true);
+    if (receiver_or_error.has_error() || sender_or_error.has_error())
+    {
+        printf("failed to create the sockets\n");
+        return 1;
+    }
+    auto& receiver = receiver_or_error.result();
+    auto& sender = sender_or_error.result();
+    [[maybe_unused]] auto bind_error = receiver.bind(loopback(0));
+    [[maybe_unused]] auto buffer_error = receiver.set_receive_buffer_size(8 * 1024 * 1024);
+    auto address = loopback(receiver.port().result());
+
+    Vector<Span<u8>> datagrams;
+    for (size_t i = 0; i < round_size; i++)
+        datagrams.append(Span<u8>(s_payload + i * datagram_size, datagram_size));
+
+    run("send", receiver, [&] {
+        for (size_t i = 0; i < round_size; i++)
+            [[maybe_unused]] auto error = sender.send(address, datagrams[i]);
+    });
+    run("send_batch", receiver, [&] {
+        [[maybe_unused]] auto sent = sender.send_batch(address, datagrams.span());
+    });
+    run("send_segmented", receiver, [&] {
+        [[maybe_unused]] auto error = sender.send_segmented(address, Span<u8>(s_payload, sizeof(s_payload)), datagram_size);
+    });
+
+    [[maybe_unused]] auto coalescing_error = receiver.set_receive_coalescing(true);
+    run("send_segmented, coalesced receive", receiver, [&] {
+        [[maybe_unused]] auto error = sender.send_segmented(address, Span<u8>(s_payload, sizeof(s_payload)), datagram_size);
+    });
+    return 0;
+}
@@ -22,6 +22,8 @@
     #define VERBOSE_ASSERTS 1
 #endif
 #include <Assert.h>
+#include <Optional.h>
+#include <Thread.h>
 
 #define TEST(expr) VERIFY(expr)
 #define TEST_FALSE(expr) VERIFY(!(expr))
@@ -29,6 +31,23 @@
 #define TEST_NOT_EQUAL(expr1, expr2) VERIFY(expr1 != expr2)
 #define TEST_UNREACHABLE() VERIFY_NOT_REACHED()
 
+// Runs body(index) on count threads at once and waits for all of them.
+template<typename TBody>
+static void run_threads(size_t count, TBody&& body)
+{
+    Optional<RefPtr<Thread>> threads[8];
+    VERIFY(count <= 8);
+    for (size_t t = 0; t < count; t++)
+    {
+        auto thread = Thread::create([&body, t]
+            { body(t); });
+        TEST(thread.has_value());
+        threads[t] = thread.result();
+    }
+    for (size_t t = 0; t < count; t++)
+        [[maybe_unused]] auto exit = threads[t].value()->wait_for_thread_exit();
+}
+
 struct LifetimeLogger
 {
     LifetimeLogger(char const* msg = "") :
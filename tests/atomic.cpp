@@ -46,4 +46,37 @@ int main()
             break;
     };
     VERIFY(var.load(MemoryOrder::Relaxed) == 0x02FFFFFF);
+
+    // Each op_fetch returns the new value, each fetch_op the old one.
+    {
+        Atomic<u32> bits { 0b1100 };
+        TEST_EQUAL(bits.and_fetch(0b1010, neo::Relaxed), 0b1000u);
+        TEST_EQUAL(bits.or_fetch(0b0011, neo::Relaxed), 0b1011u);
+        TEST_EQUAL(bits.xor_fetch(0b1111, neo::Relaxed), 0b0100u);
+        TEST_EQUAL(bits.nand_fetch(0b0110, neo::Relaxed), ~0b0100u);
+        TEST_EQUAL(bits.fetch_and(0b0001, neo::Relaxed), ~0b0100u);
+        TEST_EQUAL(bits.load(neo::Relaxed), 0b0001u);
+    }
+
+    // wait() returns right away when the value already moved on, and sleepers wake up on notify.
+    {
+        static Atomic<u32> flag { 0 };
+        flag.wait(1);
+
+        timespec timeout { 0, 1000 * 1000 };
+        TEST_FALSE(flag.wait(0, timeout));
+
+        pthread_t waker;
+        pthread_create(
+            &waker, nullptr, [](void*) -> void*
+            {
+                flag.store(1, neo::Release);
+                flag.notify_all();
+                return nullptr; },
+            nullptr);
+        while (flag.load(neo::Acquire) == 0)
+            flag.wait(0);
+        pthread_join(waker, nullptr);
+        TEST_EQUAL(flag.load(neo::Relaxed), 1u);
+    }
 }
@@ -0,0 +1,127 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Atomic.h>
+#include <Barrier.h>
+
+// Every thread publishes the phase number, passes the barrier and checks it sees everybody's. The slots are
+// double buffered, so one barrier per phase is all that keeps a fast thread from overwriting what a slow one
+// still has to read: a barrier that lets anyone through early shows up as a stale or future phase number.
+template<typename TArrive>
+static void phases(u32 thread_count, TArrive&& arrive_and_wait)
+{
+    static constexpr u32 phase_count = 2000;
+    Atomic<u32> slots[2][8] {};
+    Atomic<u32> mismatches { 0 };
+
+    run_threads(thread_count, [&](u32 t)
+        {
+            for (u32 phase = 1; phase <= phase_count; phase++)
+            {
+                slots[phase % 2][t].store(phase, neo::Relaxed);
+                arrive_and_wait(t);
+                for (u32 other = 0; other < thread_count; other++)
+                {
+                    if (slots[phase % 2][other].load(neo::Relaxed) != phase)
+                        mismatches.add_fetch(1, neo::Relaxed);
+                }
+            } });
+    TEST_EQUAL(mismatches.load(neo::Relaxed), 0u);
+}
+
+static void barrier_phases()
+{
+    for (u32 threads = 1; threads <= 8; threads++)
+    {
+        Barrier barrier(threads);
+        phases(threads, [&](u32)
+            { barrier.arrive_and_wait(); });
+        TEST_EQUAL(barrier.size(), threads);
+        TEST_EQUAL(barrier.waiting(), 0u);
+    }
+}
+
+static void barrier_phases_without_spinning()
+{
+    Barrier barrier(4, 0);
+    phases(4, [&](u32)
+        { barrier.arrive_and_wait(); });
+}
+
+static void tree_barrier_phases()
+{
+    // 5, 7 and 8 give partial leaves and two levels with fan in 4.
+    for (u32 threads = 1; threads <= 8; threads++)
+    {
+        TreeBarrier barrier(threads);
+        phases(threads, [&](u32 t)
+            { barrier.arrive_and_wait(t); });
+    }
+}
+
+static void dissemination_barrier_phases()
+{
+    for (u32 threads = 1; threads <= 8; threads++)
+    {
+        DisseminationBarrier barrier(threads);
+        phases(threads, [&](u32 t)
+            { barrier.arrive_and_wait(t); });
+    }
+}
+
+static void arrive_then_wait()
+{
+    Barrier barrier(2);
+    Atomic<u32> value { 0 };
+    run_threads(2, [&](u32 t)
+        {
+            if (t == 0)
+                value.store(42, neo::Relaxed);
+            auto phase = barrier.arrive();
+            barrier.wait(phase);
+            TEST_EQUAL(value.load(neo::Relaxed), 42u); });
+}
+
+static void arrive_and_drop()
+{
+    Barrier barrier(3);
+    Atomic<u32> passed { 0 };
+    run_threads(3, [&](u32 t)
+        {
+            if (t == 0)
+            {
+                barrier.arrive_and_drop();
+                return;
+            }
+            // The first phase still counts the dropped thread, the later ones don't.
+            for (u32 phase = 0; phase < 100; phase++)
+                barrier.arrive_and_wait();
+            passed.add_fetch(1, neo::Relaxed); });
+    TEST_EQUAL(passed.load(neo::Relaxed), 2u);
+    TEST_EQUAL(barrier.size(), 2u);
+}
+
+int main()
+{
+    barrier_phases();
+    barrier_phases_without_spinning();
+    tree_barrier_phases();
+    dissemination_barrier_phases();
+    arrive_then_wait();
+    arrive_and_drop();
+    return 0;
+}
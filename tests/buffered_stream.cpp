@@ -0,0 +1,135 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <BinaryReader.h>
+#include <BufferedStream.h>
+#include <FileStream.h>
+#include <MemoryStream.h>
+
+static Span<u8> bytes(char const* text)
+{
+    return Span<u8>((u8*)text, __builtin_strlen(text));
+}
+
+static bool equals(Span<u8> const& span, char const* text)
+{
+    return span.size() == __builtin_strlen(text) && __builtin_memcmp(span.data(), text, span.size()) == 0;
+}
+
+static bool equals(StringView const& view, char const* text)
+{
+    return view.byte_size() == __builtin_strlen(text) && __builtin_memcmp(view.non_null_terminated_buffer(), text, view.byte_size()) == 0;
+}
+
+int main()
+{
+    // Small writes accumulate, a write that doesn't fit flushes first, one larger than the buffer goes straight
+    // through behind what was buffered.
+    {
+        MemoryStream base(0);
+        {
+            BufferedOutputStream stream(base, 16);
+            stream.write(bytes("hello"));
+            stream.write(bytes(" world"));
+            TEST_EQUAL(base.size(), 0u);
+            TEST_EQUAL(stream.buffered_size(), 11u);
+            stream.write(bytes(", again"));
+            TEST_EQUAL(base.size(), 11u);
+            TEST_EQUAL(stream.buffered_size(), 7u);
+            stream.write(bytes(" and a write longer than the buffer"));
+            TEST_EQUAL(base.size(), 53u);
+            TEST_EQUAL(stream.buffered_size(), 0u);
+            stream.write(bytes("!"));
+        }
+        // The destructor flushed the last byte.
+        auto buffer = base.release_buffer();
+        TEST(equals(buffer.span(), "hello world, again and a write longer than the buffer!"));
+    }
+
+    // Lines, peeking and reads across refills through a buffer smaller than some lines.
+    {
+        MemoryStream base(0);
+        base.write(bytes("first\r\nsecond line is longer than sixteen bytes\n\nthird,fourth\nlast"));
+        BufferedInputStream stream(base, 16);
+
+        TEST(equals(stream.peek(3), "fir"));
+        auto line = stream.read_line();
+        TEST(line.has_value());
+        TEST(equals(line.value(), "first"));
+        line = stream.read_line();
+        TEST(equals(line.value(), "second line is longer than sixteen bytes"));
+        line = stream.read_line();
+        TEST(equals(line.value(), ""));
+        auto field = stream.read_until(',');
+        TEST(equals(field.value(), "third,"));
+        stream.skip(7);
+        line = stream.read_line();
+        TEST(equals(line.value(), "last"));
+        TEST(stream.end());
+        TEST_FALSE(stream.read_line().has_value());
+        TEST_EQUAL(stream.peek(4).size(), 0u);
+    }
+
+    // Fixed size reads come back whole even when they straddle a refill, and large ones bypass the buffer.
+    {
+        static u32 values[1000];
+        MemoryStream base(0);
+        for (u32 i = 0; i < 1000; i++)
+        {
+            values[i] = i * 2654435761u;
+            base.write(Span<u8>((u8*)&values[i], sizeof(u32)));
+        }
+
+        BufferedInputStream stream(base, 10);
+        BinaryReader reader(stream);
+        for (u32 i = 0; i < 500; i++)
+            TEST_EQUAL(reader.read<u32>().value(), values[i]);
+
+        static u32 rest[500];
+        Span<u8> rest_span((u8*)rest, sizeof(rest));
+        TEST_EQUAL(stream.read(rest_span), sizeof(rest));
+        TEST_EQUAL(__builtin_memcmp(rest, values + 500, sizeof(rest)), 0);
+        TEST_FALSE(reader.read<u32>().has_value());
+        TEST(stream.end());
+    }
+
+    // A native transfer into a buffered file stream lands after what was buffered.
+    {
+        auto source = FileStream::create("/tmp/neo_buffered_source.txt", "w+");
+        TEST(source.has_value());
+        source.result().write(bytes(" from the kernel"));
+        TEST_FALSE(source.result().seek(0).has_value());
+
+        auto destination = FileStream::create("/tmp/neo_buffered_destination.txt", "w+");
+        TEST(destination.has_value());
+        {
+            BufferedOutputStream stream(destination.result(), 64);
+            stream.write(bytes("buffered"));
+            auto moved = source.result().transfer_to(stream);
+            TEST(moved.has_value());
+            TEST_EQUAL(moved.result(), 16u);
+        }
+
+        TEST_FALSE(destination.result().seek(0).has_value());
+        BufferedInputStream stream(destination.result());
+        TEST(equals(stream.read_line().value(), "buffered from the kernel"));
+    }
+
+    [[maybe_unused]] auto remove_source = File::remove("/tmp/neo_buffered_source.txt");
+    [[maybe_unused]] auto remove_destination = File::remove("/tmp/neo_buffered_destination.txt");
+    return 0;
+}
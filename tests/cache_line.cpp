@@ -0,0 +1,145 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Aligned.h>
+#include <Atomic.h>
+#include <PerThread.h>
+#include <SystemInfo.h>
+
+static void padding()
+{
+    static_assert(alignof(CacheLinePadded<u8>) == neo::hardware_destructive_interference_size);
+    static_assert(sizeof(CacheLinePadded<u8>) == neo::hardware_destructive_interference_size);
+    static_assert(sizeof(CacheLinePadded<u8[200]>) % neo::hardware_destructive_interference_size == 0);
+
+    CacheLinePadded<Atomic<u64>> counters[2];
+    auto distance = (ptr_t)&counters[1].get() - (ptr_t)&counters[0].get();
+    TEST(distance >= neo::hardware_destructive_interference_size);
+    counters[0]->store(1, neo::Relaxed);
+    TEST_EQUAL((*counters[0]).load(neo::Relaxed), 1u);
+
+    CacheLinePadded<int> value(42);
+    auto copy = value;
+    TEST_EQUAL(*copy, 42);
+
+    // The constants are compile time guesses, they must cover the line size this machine reports.
+    auto line_size = neo::l1_cache_line_size();
+    if (line_size > 0)
+        TEST((size_t)line_size <= neo::hardware_destructive_interference_size);
+}
+
+static void thread_slots()
+{
+    static constexpr size_t thread_count = 8;
+    Atomic<u32> slots[thread_count] {};
+    Atomic<u32> arrived { 0 };
+    run_threads(thread_count, [&](size_t t)
+        {
+            slots[t].store(thread_slot(), neo::Relaxed);
+            TEST_EQUAL(thread_slot(), slots[t].load(neo::Relaxed));
+            // Stay alive until everyone has a slot, so none of them can be reused yet.
+            arrived.add_fetch(1, neo::AcquireRelease);
+            while (arrived.load(neo::Acquire) != thread_count)
+                sched_yield(); });
+    for (size_t i = 0; i < thread_count; i++)
+    {
+        for (size_t j = i + 1; j < thread_count; j++)
+            TEST(slots[i].load(neo::Relaxed) != slots[j].load(neo::Relaxed));
+    }
+
+    // Slots of exited threads are handed out again, the lowest free one first.
+    auto main_slot = thread_slot();
+    Atomic<u32> reused { neo::detail::max_thread_slots };
+    run_threads(1, [&](size_t)
+        { reused.store(thread_slot(), neo::Relaxed); });
+    TEST(reused.load(neo::Relaxed) <= thread_count);
+    TEST(reused.load(neo::Relaxed) != main_slot);
+}
+
+// A record owned by a thread that exited goes to the next thread asking, even one reusing the same slot.
+static void thread_owned_records()
+{
+    struct Record
+    {
+        Atomic<u64> owner { 0 };
+    };
+    Record records[2];
+
+    auto* mine = neo::detail::claim_thread_owned(records, 2);
+    TEST(mine == &records[0]);
+    TEST_EQUAL(records[0].owner.load(neo::Relaxed), thread_token());
+    TEST(neo::detail::claim_thread_owned(records, 2) == mine);
+
+    u64 tokens[2] {};
+    for (size_t round = 0; round < 2; round++)
+    {
+        run_threads(1, [&](size_t)
+            {
+                tokens[round] = thread_token();
+                TEST(neo::detail::claim_thread_owned(records, 2) == &records[1]);
+                // Both records are taken by live threads.
+                TEST(neo::detail::claim_thread_owned(records, 1) == nullptr); });
+    }
+    TEST_EQUAL((u32)tokens[0], (u32)tokens[1]);
+    TEST(tokens[0] != tokens[1]);
+    TEST_EQUAL(records[1].owner.load(neo::Relaxed), tokens[1]);
+}
+
+static void per_thread_counters()
+{
+    static constexpr size_t thread_count = 8;
+    static constexpr u64 increments = 100000;
+    PerThread<Atomic<u64>> counters;
+    run_threads(thread_count, [&](size_t)
+        {
+            auto& counter = counters.local();
+            for (u64 i = 0; i < increments; i++)
+                counter.store(counter.load(neo::Relaxed) + 1, neo::Relaxed); });
+
+    u64 total = 0;
+    counters.for_each([&](Atomic<u64>& counter)
+        { total += counter.load(neo::Relaxed); });
+    TEST_EQUAL(total, thread_count * increments);
+}
+
+static void per_thread_chunks()
+{
+    PerThread<u64> values;
+    values.at(3) = 3;
+    values.at(PerThread<u64>::chunk_size + 5) = 5;
+    TEST_EQUAL(values.at(4), 0u);
+    TEST_EQUAL(&values.at(4) - &values.at(3), (long)(sizeof(CacheLinePadded<u64>) / sizeof(u64)));
+
+    size_t seen = 0;
+    u64 sum = 0;
+    values.for_each([&](u64& value)
+        {
+            seen++;
+            sum += value; });
+    TEST_EQUAL(seen, 2 * PerThread<u64>::chunk_size);
+    TEST_EQUAL(sum, 8u);
+}
+
+int main()
+{
+    padding();
+    thread_slots();
+    thread_owned_records();
+    per_thread_counters();
+    per_thread_chunks();
+    return 0;
+}
@@ -0,0 +1,215 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <CircularBuffer.h>
+#include <ConcurrentQueue.h>
+#include <Thread.h>
+#include <Vector.h>
+#include <sched.h>
+
+static int s_live = 0;
+
+struct Tracked
+{
+    explicit Tracked(u64 v) :
+        value(v)
+    {
+        s_live++;
+    }
+
+    Tracked(Tracked&& other) :
+        value(other.value)
+    {
+        s_live++;
+    }
+
+    Tracked& operator=(Tracked&& other)
+    {
+        value = other.value;
+        return *this;
+    }
+
+    ~Tracked()
+    {
+        s_live--;
+    }
+
+    u64 value;
+};
+
+int main()
+{
+    // CircularBuffer grows while wrapped and keeps FIFO order.
+    {
+        CircularBuffer<Tracked> buffer(3);
+        for (u64 i = 0; i < 3; i++)
+            buffer.enqueue(Tracked(i));
+        TEST_EQUAL(buffer.dequeue().value().value, 0u);
+        TEST_EQUAL(buffer.dequeue().value().value, 1u);
+        for (u64 i = 3; i < 10; i++)
+            buffer.enqueue(Tracked(i));
+        TEST_EQUAL(buffer.size(), 8u);
+        TEST(buffer.capacity() >= 8u);
+        for (u64 i = 2; i < 7; i++)
+            TEST_EQUAL(buffer.dequeue().value().value, i);
+        TEST_EQUAL(s_live, 3);
+    }
+    TEST_EQUAL(s_live, 0);
+
+    // SPSCRingBuffer: full at capacity, batches wrap around, leftovers are destroyed.
+    {
+        SPSCRingBuffer<Tracked> ring(5);
+        TEST_EQUAL(ring.capacity(), 8u);
+        for (u64 i = 0; i < 8; i++)
+            TEST(ring.try_push(Tracked(i)));
+        TEST_FALSE(ring.try_push(Tracked(8)));
+        TEST_EQUAL(ring.try_pop().value().value, 0u);
+
+        u64 batch[4] = { 100, 101, 102, 103 };
+        SPSCRingBuffer<u64> values(8);
+        TEST_EQUAL(values.push_batch(Span<u64>(batch, 4)), 4u);
+        TEST_EQUAL(values.push_batch(Span<u64>(batch, 4)), 4u);
+        TEST_EQUAL(values.push_batch(Span<u64>(batch, 4)), 0u);
+        u64 out[6] {};
+        Span<u64> out_span(out, 6);
+        TEST_EQUAL(values.pop_batch(out_span), 6u);
+        TEST_EQUAL(out[4], 100u);
+        TEST_EQUAL(values.push_batch(Span<u64>(batch, 4)), 4u);
+        TEST_EQUAL(values.pop_batch(out_span), 6u);
+        TEST_EQUAL(out[0], 102u);
+        TEST_EQUAL(out[5], 103u);
+        TEST_FALSE(values.try_pop().has_value());
+    }
+    TEST_EQUAL(s_live, 0);
+
+    // SPSCRingBuffer across two threads: everything arrives once, in order.
+    {
+        SPSCRingBuffer<u64> ring(1024);
+        constexpr u64 count = 1000000;
+        auto producer = Thread::create([&ring]
+            {
+                u64 batch[32];
+                u64 next = 0;
+                while (next < count)
+                {
+                    if (next % 3 == 0)
+                    {
+                        if (ring.try_push(next))
+                            next++;
+                        else
+                            sched_yield();
+                        continue;
+                    }
+                    size_t size = min<u64>(32, count - next);
+                    for (size_t i = 0; i < size; i++)
+                        batch[i] = next + i;
+                    auto pushed = ring.push_batch(Span<u64>(batch, size));
+                    if (pushed == 0)
+                        sched_yield();
+                    next += pushed;
+                } });
+        TEST(producer.has_value());
+
+        bool in_order = true;
+        u64 expected = 0;
+        u64 batch[16];
+        Span<u64> batch_span(batch, 16);
+        while (expected < count)
+        {
+            auto popped = ring.pop_batch(batch_span);
+            if (popped == 0)
+                sched_yield();
+            for (size_t i = 0; i < popped; i++)
+                in_order &= batch[i] == expected++;
+            if (auto value = ring.try_pop(); value.has_value())
+                in_order &= value.value() == expected++;
+        }
+        TEST(in_order);
+        [[maybe_unused]] auto exit = producer.result()->wait_for_thread_exit();
+    }
+
+    // MPMCQueue: bounded, and destroys what is left in it.
+    {
+        MPMCQueue<Tracked> queue(4);
+        for (u64 i = 0; i < 4; i++)
+            TEST(queue.try_push(Tracked(i)));
+        TEST_FALSE(queue.try_push(Tracked(4)));
+        TEST_EQUAL(queue.try_pop().value().value, 0u);
+        TEST(queue.try_push(Tracked(4)));
+        TEST_EQUAL(queue.size_approx(), 4u);
+    }
+    TEST_EQUAL(s_live, 0);
+
+    // MPMCQueue across threads: every value is popped exactly once and each producer's values stay in order.
+    {
+        constexpr u64 producers = 4;
+        constexpr u64 consumers = 4;
+        constexpr u64 per_producer = 50000;
+        MPMCQueue<u64> queue(256);
+        Atomic<u64> popped_sum { 0 };
+        Atomic<u64> popped_count { 0 };
+        Atomic<bool> ordered { true };
+
+        Vector<RefPtr<Thread>> threads;
+        for (u64 p = 0; p < producers; p++)
+        {
+            auto thread = Thread::create([&queue, p]
+                {
+                    for (u64 i = 0; i < per_producer; i++)
+                    {
+                        while (!queue.try_push((p << 32) | i))
+                            sched_yield();
+                    } });
+            threads.append(thread.result());
+        }
+        for (u64 c = 0; c < consumers; c++)
+        {
+            auto thread = Thread::create([&]
+                {
+                    u64 last[producers];
+                    for (auto& value : last)
+                        value = NumericLimits<u64>::max();
+                    u64 sum = 0;
+                    while (popped_count.load(neo::Relaxed) < producers * per_producer)
+                    {
+                        auto value = queue.try_pop();
+                        if (!value.has_value())
+                        {
+                            sched_yield();
+                            continue;
+                        }
+                        auto producer = value.value() >> 32;
+                        auto index = value.value() & 0xffffffff;
+                        if (last[producer] != NumericLimits<u64>::max() && index <= last[producer])
+                            ordered.store(false, neo::Relaxed);
+                        last[producer] = index;
+                        sum += index;
+                        popped_count.fetch_add(1, neo::Relaxed);
+                    }
+                    popped_sum.fetch_add(sum, neo::Relaxed); });
+            threads.append(thread.result());
+        }
+        for (auto& thread : threads)
+            [[maybe_unused]] auto exit = thread->wait_for_thread_exit();
+
+        TEST_EQUAL(popped_count.load(neo::Relaxed), producers * per_producer);
+        TEST_EQUAL(popped_sum.load(neo::Relaxed), producers * (per_producer * (per_producer - 1) / 2));
+        TEST(ordered.load(neo::Relaxed));
+    }
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Generator.h>
+#include <MemoryStream.h>
+#include <Task.h>
+#include <Thread.h>
+#include <ThreadPool.h>
+
+Generator<int> count_to(int limit)
+{
+    for (int i = 1; i <= limit; i++)
+        co_yield i;
+}
+
+Task<int> square(int value)
+{
+    co_return value * value;
+}
+
+Task<int> sum_of_squares(int count)
+{
+    int sum = 0;
+    for (int i = 1; i <= count; i++)
+        sum += co_await square(i);
+    co_return sum;
+}
+
+// Chain of synchronously completing tasks. Symmetric transfer only becomes a tail call with optimizations on,
+// so the depth stays within what an unoptimized build's stack can take.
+Task<int> countdown(int depth)
+{
+    if (depth == 0)
+        co_return 0;
+    co_return 1 + co_await countdown(depth - 1);
+}
+
+Task<int> await_future(Future<int> future)
+{
+    auto value = co_await future;
+    co_return value + 1;
+}
+
+Task<bool> hop_to_pool(ThreadPool& pool)
+{
+    co_await schedule_on(pool);
+    co_return pool.current_worker_index() != ThreadPool::AnyWorker;
+}
+
+Task<size_t> echo_through(MemoryStream& stream, ThreadPool& pool)
+{
+    u8 out[4] { 1, 2, 3, 4 };
+    Span<u8> from(out, 4);
+    co_await async_write(stream, from, pool);
+
+    u8 in[4] {};
+    Span<u8> to(in, 4);
+    auto read = co_await async_read(stream, to, pool);
+    for (size_t i = 0; i < 4; i++)
+        TEST_EQUAL(in[i], out[i]);
+    co_return read;
+}
+
+Task<void> bump(Atomic<int>& counter)
+{
+    counter.add_fetch(1, neo::Relaxed);
+    co_return;
+}
+
+int main()
+{
+    int expected = 1;
+    for (auto value : count_to(5))
+        TEST_EQUAL(value, expected++);
+    TEST_EQUAL(expected, 6);
+
+    for (auto value : count_to(0))
+    {
+        (void)value;
+        TEST_UNREACHABLE();
+    }
+
+    TEST_EQUAL(sync_wait(sum_of_squares(4)), 30);
+    TEST_EQUAL(sync_wait(countdown(10000)), 10000);
+
+    {
+        auto lazy = square(3);
+        TEST_FALSE(lazy.is_done());
+        TEST_EQUAL(sync_wait(move(lazy)), 9);
+    }
+
+    {
+        Promise<int> promise;
+        auto task = await_future(promise.get_future());
+        auto thread = Thread::create([p = move(promise)]() mutable
+            { p.set_value(41); });
+        TEST(thread.has_value());
+        TEST_EQUAL(sync_wait(move(task)), 42);
+    }
+
+    ThreadPool pool(2);
+    TEST(sync_wait(hop_to_pool(pool)));
+
+    MemoryStream stream(0);
+    TEST_EQUAL(sync_wait(echo_through(stream, pool)), 4u);
+
+    Atomic<int> counter { 0 };
+    spawn(bump(counter));
+    sync_wait(bump(counter));
+    TEST_EQUAL(counter.load(neo::Relaxed), 2);
+}
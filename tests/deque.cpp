@@ -0,0 +1,140 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Deque.h>
+#include <Queue.h>
+#include <Stack.h>
+
+static int s_live = 0;
+
+struct Tracked
+{
+    explicit Tracked(int v) :
+        value(v)
+    {
+        s_live++;
+    }
+
+    Tracked(Tracked const& other) :
+        value(other.value)
+    {
+        s_live++;
+    }
+
+    Tracked(Tracked&& other) :
+        value(other.value)
+    {
+        s_live++;
+    }
+
+    Tracked& operator=(Tracked&& other)
+    {
+        value = other.value;
+        return *this;
+    }
+
+    ~Tracked()
+    {
+        s_live--;
+    }
+
+    int value;
+};
+
+int main()
+{
+    // Both ends, wrapping around and growing while wrapped.
+    {
+        Deque<int> deque;
+        TEST(deque.is_empty());
+        for (int i = 0; i < 10; i++)
+            deque.add_back(i);
+        for (int i = 1; i <= 10; i++)
+            deque.add_front(-i);
+        TEST_EQUAL(deque.size(), 20u);
+        TEST_EQUAL(deque.capacity(), 32u);
+        TEST_EQUAL(deque.peek_front(), -10);
+        TEST_EQUAL(deque.peek_back(), 9);
+        for (size_t i = 0; i < deque.size(); i++)
+            TEST_EQUAL(deque[i], (int)i - 10);
+
+        for (int i = 10; i < 40; i++)
+            deque.add_back(i);
+        TEST_EQUAL(deque.size(), 50u);
+        TEST_EQUAL(deque.pop_front(), -10);
+        TEST_EQUAL(deque.pop_back(), 39);
+        int expected = -9;
+        bool ordered = true;
+        for (auto value : deque)
+            ordered &= value == expected++;
+        TEST(ordered);
+        TEST_EQUAL(expected, 39);
+    }
+
+    // Elements are constructed and destroyed exactly once, including what is left at the end.
+    {
+        Deque<Tracked> deque;
+        for (int i = 0; i < 100; i++)
+        {
+            if (i % 2 == 0)
+                deque.add_back(Tracked(i));
+            else
+                deque.add_front(Tracked(i));
+        }
+        TEST_EQUAL(s_live, 100);
+        for (int i = 0; i < 30; i++)
+            [[maybe_unused]] auto value = deque.pop_front();
+        TEST_EQUAL(s_live, 70);
+
+        Deque<Tracked> copy(deque);
+        TEST_EQUAL(s_live, 140);
+        TEST_EQUAL(copy.peek_front().value, deque.peek_front().value);
+        Deque<Tracked> moved(std::move(copy));
+        TEST_EQUAL(s_live, 140);
+        TEST_EQUAL(copy.size(), 0u);
+        moved.clear();
+        TEST_EQUAL(s_live, 70);
+    }
+    TEST_EQUAL(s_live, 0);
+
+    // Queue and Stack keep their old interface.
+    {
+        Queue<int> queue;
+        queue.add_back(1);
+        queue.add_back(2);
+        queue.add_front(0);
+        TEST_EQUAL(queue.pop_front(), 0);
+        TEST_EQUAL(queue.pop_front(), 1);
+        TEST_EQUAL(queue.size(), 1u);
+
+        Stack<int> stack;
+        stack.add_back(1);
+        stack.add_back(2);
+        TEST_EQUAL(stack.pop_back(), 2);
+        TEST_EQUAL(stack.peek_back(), 1);
+    }
+
+    // Long queues no longer recurse on destruction.
+    {
+        Queue<u64> queue;
+        for (u64 i = 0; i < 5000000; i++)
+            queue.add_back(i);
+        TEST_EQUAL(queue.peek_back(), 4999999u);
+    }
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <EventLoop.h>
+#include <Thread.h>
+
+static Ipv4SocketAddress loopback(u16 port)
+{
+    return { HostToBigEndian((u32)0x7f000001), HostToBigEndian(port) };
+}
+
+Task<void> echo_once(EventLoop& loop, TCPListener& listener)
+{
+    auto client = co_await loop.accept(listener);
+    TEST(client.has_value());
+    auto& socket = client.result();
+
+    u8 buffer[64];
+    Span<u8> span(buffer, sizeof(buffer));
+    while (true)
+    {
+        auto received = co_await loop.receive(socket, span);
+        TEST(received.has_value());
+        if (received.result() == 0)
+            break;
+        auto error = co_await loop.send(socket, Span<u8>(buffer, received.result()));
+        TEST_FALSE(error.has_value());
+    }
+    loop.close(socket);
+}
+
+Task<void> ping(EventLoop& loop, u16 port, int& replies)
+{
+    auto connection = co_await loop.connect(loopback(port));
+    TEST(connection.has_value());
+    auto& socket = connection.result();
+
+    for (u8 i = 0; i < 3; i++)
+    {
+        u8 message[4] { i, 1, 2, 3 };
+        auto error = co_await loop.send(socket, Span<u8>(message, 4));
+        TEST_FALSE(error.has_value());
+
+        u8 reply[4] {};
+        size_t got = 0;
+        while (got < 4)
+        {
+            Span<u8> rest(reply + got, 4 - got);
+            auto received = co_await loop.receive(socket, rest);
+            TEST(received.has_value());
+            TEST_NOT_EQUAL(received.result(), 0u);
+            got += received.result();
+        }
+        TEST_EQUAL(reply[0], i);
+        replies++;
+    }
+    loop.close(socket);
+    loop.stop();
+}
+
+Task<void> receive_until_closed(EventLoop& loop, u16 port, Optional<SocketError>& error)
+{
+    auto connection = co_await loop.connect(loopback(port));
+    TEST(connection.has_value());
+    auto& socket = connection.result();
+
+    // Nothing is ever sent, only closing the socket ends the receive.
+    loop.add_timer(Time { 0, 1000000 }, [&]
+        { loop.close(socket); });
+    u8 buffer[16];
+    Span<u8> span(buffer, sizeof(buffer));
+    auto received = co_await loop.receive(socket, span);
+    TEST(received.has_error());
+    error = received.error();
+    loop.stop();
+}
+
+int main()
+{
+    auto maybe_loop = EventLoop::create();
+    TEST(maybe_loop.has_value());
+    auto& loop = *maybe_loop.result();
+
+    // Timers fire in deadline order, cancelled ones never do.
+    {
+        int order[3] {};
+        int fired = 0;
+        loop.add_timer(Time { 0, 3000000 }, [&]
+            { order[fired++] = 3; loop.stop(); });
+        loop.add_timer(Time { 0, 1000000 }, [&]
+            { order[fired++] = 1; });
+        auto cancelled = loop.add_timer(Time { 0, 1500000 }, [&]
+            { TEST_UNREACHABLE(); });
+        loop.add_timer(Time { 0, 2000000 }, [&]
+            { order[fired++] = 2; });
+        TEST(loop.cancel_timer(cancelled));
+        TEST_FALSE(loop.cancel_timer(cancelled));
+        loop.run();
+        TEST_EQUAL(fired, 3);
+        TEST_EQUAL(order[0], 1);
+        TEST_EQUAL(order[1], 2);
+        TEST_EQUAL(order[2], 3);
+    }
+
+    // A repeating timer can cancel itself.
+    {
+        int runs = 0;
+        EventLoop::TimerId id = 0;
+        id = loop.add_repeating_timer(Time { 0, 500000 }, [&]
+            {
+                if (++runs == 3)
+                {
+                    TEST(loop.cancel_timer(id));
+                    loop.add_timer(Time { 0, 2000000 }, [&] { loop.stop(); });
+                } });
+        loop.run();
+        TEST_EQUAL(runs, 3);
+    }
+
+    // execute() and stop() from another thread.
+    {
+        Atomic<int> ran { 0 };
+        auto thread = Thread::create([&]
+            {
+                for (int i = 0; i < 100; i++)
+                    loop.execute([&] { ran.add_fetch(1, neo::Relaxed); });
+                loop.execute([&] { loop.stop(); }); });
+        TEST(thread.has_value());
+        loop.run();
+        TEST_EQUAL(ran.load(neo::Relaxed), 100);
+    }
+
+    auto maybe_listener = TCPListener::listen(loopback(0));
+    TEST(maybe_listener.has_value());
+    auto& listener = maybe_listener.result();
+    auto port = listener.port();
+    TEST(port.has_value());
+
+    // Callback interface: accept until EAGAIN on every edge.
+    {
+        int accepted = 0;
+        auto error = loop.watch(listener.fd(), [&](u32 events)
+            {
+                TEST(events & EventLoop::Readable);
+                while (true)
+                {
+                    auto client = listener.accept();
+                    if (client.has_error())
+                    {
+                        TEST_EQUAL(client.error(), EAGAIN);
+                        break;
+                    }
+                    if (++accepted == 2)
+                        loop.stop();
+                } });
+        TEST_FALSE(error.has_value());
+
+        auto first = TCPSocket::connect(loopback(port.result()));
+        auto second = TCPSocket::connect(loopback(port.result()));
+        TEST(first.has_value());
+        TEST(second.has_value());
+        loop.run();
+        TEST_EQUAL(accepted, 2);
+        loop.unwatch(listener.fd());
+    }
+
+    // Coroutine interface: echo server and client sharing the loop.
+    {
+        int replies = 0;
+        spawn(echo_once(loop, listener));
+        spawn(ping(loop, port.result(), replies));
+        loop.run();
+        TEST_EQUAL(replies, 3);
+    }
+
+    // Closing a socket cancels a pending receive, and a new fd reusing its number is watched from scratch.
+    {
+        Optional<SocketError> error;
+        spawn(receive_until_closed(loop, port.result(), error));
+        loop.run();
+        TEST(error.has_value());
+        TEST_EQUAL(error.value(), ECANCELED);
+
+        auto next = TCPSocket::connect(loopback(port.result()), SocketMode::NonBlocking);
+        TEST(next.has_value());
+        bool writable = false;
+        auto watch_error = loop.watch(next.result().fd(), [&](u32 events)
+            {
+                if (events & EventLoop::Writable)
+                {
+                    writable = true;
+                    loop.stop();
+                } });
+        TEST_FALSE(watch_error.has_value());
+        loop.run();
+        TEST(writable);
+        loop.close(next.result());
+    }
+}
@@ -17,6 +17,21 @@
 #include "Test.h"
 #include <File.h>
 
+static u8 pattern(u64 index)
+{
+    return (u8)(index * 13 + index / 257);
+}
+
+static bool matches_pattern(u8 const* data, size_t size, u64 first_index)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (data[i] != pattern(first_index + i))
+            return false;
+    }
+    return true;
+}
+
 int main(int, [[maybe_unused]] char** argv)
 {
 #ifndef DEBUG_ASSERTS
@@ -59,5 +74,143 @@ int main(int, [[maybe_unused]] char** argv)
     TEST(file_or_error2.has_error());
     TEST_EQUAL(file_or_error2.error(), neo::Error::NoSuchEntity);
 #endif
+
+    static constexpr size_t file_size = 64 * 1024;
+    static u8 contents[file_size];
+    for (size_t i = 0; i < file_size; i++)
+        contents[i] = pattern(i);
+
+    auto opened = File::open("/tmp/neo_file_test.bin", "w+");
+    TEST(opened.has_value());
+    auto& file = opened.result();
+    auto written = file.write_at(Span<u8>(contents, file_size), 0);
+    TEST(written.has_value());
+    TEST_EQUAL(written.result(), file_size);
+    TEST_EQUAL(file.size().result(), (long)file_size);
+    TEST_EQUAL(file.getpos().result(), 0);
+
+    // Positional reads don't move the file position, a short count marks the end.
+    u8 block[1000];
+    auto read = file.read_at(Span<u8>(block, sizeof(block)), 5000);
+    TEST(read.has_value());
+    TEST_EQUAL(read.result(), sizeof(block));
+    TEST(matches_pattern(block, sizeof(block), 5000));
+    read = file.read_at(Span<u8>(block, sizeof(block)), file_size - 10);
+    TEST_EQUAL(read.result(), 10u);
+    TEST_EQUAL(file.getpos().result(), 0);
+
+    // Sequential reads set eof() once they run into the end, a seek clears it.
+    TEST_FALSE(file.seek(SeekMode::End, -100).has_value());
+    read = file.read(Span<u8>(block, sizeof(block)), sizeof(block));
+    TEST_EQUAL(read.result(), 100u);
+    TEST(file.eof());
+    TEST_EQUAL(file.read(Span<u8>(block, sizeof(block)), sizeof(block)).error(), OSError::EndOfFile);
+    TEST_FALSE(file.seek(SeekMode::Start, 0).has_value());
+    TEST_FALSE(file.eof());
+    TEST_EQUAL(file.read_byte().result(), pattern(0));
+
+    // Byte reads come out of the read-ahead buffer; the position stays the logical one, and writes, seeks and
+    // flushes go from there.
+    for (size_t i = 1; i < 100; i++)
+        TEST_EQUAL(file.read_byte().result(), pattern(i));
+    TEST_EQUAL(file.getpos().result(), 100);
+    TEST(::lseek(file.fd(), 0, SEEK_CUR) > 100);
+    u8 marker[2] { 0xAB, 0xCD };
+    TEST_EQUAL(file.write(Span<u8>(marker, 2), 2).result(), 2u);
+    TEST_EQUAL(file.getpos().result(), 102);
+    TEST_EQUAL(file.read_at(Span<u8>(block, 2), 100).result(), 2u);
+    TEST_EQUAL(block[0], 0xAB);
+    TEST_EQUAL(block[1], 0xCD);
+    TEST_FALSE(file.seek(SeekMode::Current, 10).has_value());
+    TEST_EQUAL(file.read_byte().result(), pattern(112));
+    read = file.read(Span<u8>(block, 10), 10);
+    TEST_EQUAL(read.result(), 10u);
+    TEST(matches_pattern(block, 10, 113));
+    TEST_FALSE(file.flush().has_value());
+    TEST_EQUAL(::lseek(file.fd(), 0, SEEK_CUR), 123);
+    TEST_EQUAL(file.write_at(Span<u8>(contents + 100, 2), 100).result(), 2u);
+
+    // Scatter reads across uneven buffers, more of them than one preadv takes.
+    {
+        static u8 storage[150 * 7];
+        Vector<Span<u8>> buffers;
+        for (size_t i = 0; i < 150; i++)
+            buffers.append(Span<u8>(storage + i * 7, 7));
+        auto scattered = file.read_vectored_at(buffers.span(), 3);
+        TEST(scattered.has_value());
+        TEST_EQUAL(scattered.result(), sizeof(storage));
+        TEST(matches_pattern(storage, sizeof(storage), 3));
+
+        // Gather them back somewhere else and past the end, which grows the file.
+        auto gathered = file.write_vectored_at(buffers.span(), file_size);
+        TEST(gathered.has_value());
+        TEST_EQUAL(gathered.result(), sizeof(storage));
+        auto tail = file.read_at(Span<u8>(block, sizeof(block)), file_size);
+        TEST_EQUAL(tail.result(), sizeof(block));
+        TEST(matches_pattern(block, sizeof(block), 3));
+
+        // Reading past the end fills what it can.
+        scattered = file.read_vectored_at(buffers.span(), file_size + sizeof(storage) - 10);
+        TEST_EQUAL(scattered.result(), 10u);
+    }
+
+    // Preallocation grows the file unless asked not to.
+    TEST_FALSE(file.allocate(0, 1024 * 1024).has_value());
+    TEST_EQUAL(file.size().result(), 1024 * 1024);
+    auto keep_size_error = file.allocate(1024 * 1024, 1024 * 1024, true);
+    if (!keep_size_error.has_value())
+        TEST_EQUAL(file.size().result(), 1024 * 1024);
+
+    // Disjoint positional reads from several threads at once.
+    {
+        Atomic<u32> failures { 0 };
+        run_threads(4, [&](u64 t)
+            {
+                u8 chunk[4096];
+                for (u64 offset = t * 4096; offset < file_size; offset += 4 * 4096)
+                {
+                    auto result = file.read_at(Span<u8>(chunk, sizeof(chunk)), offset);
+                    if (result.has_error() || result.result() != sizeof(chunk) || !matches_pattern(chunk, sizeof(chunk), offset))
+                        failures.add_fetch(1, neo::Relaxed);
+                } });
+        TEST_EQUAL(failures.load(neo::Relaxed), 0u);
+    }
+
+    // Concurrent writers share fdatasync calls.
+    {
+        DataSyncBatcher batcher(file);
+        Atomic<u32> failures { 0 };
+        run_threads(4, [&](u64 t)
+            {
+                for (u64 i = 0; i < 20; i++)
+                {
+                    auto offset = (t * 20 + i) * 64;
+                    if (file.write_at(Span<u8>(contents + offset, 64), offset).has_error() || batcher.sync().has_value())
+                        failures.add_fetch(1, neo::Relaxed);
+                } });
+        TEST_EQUAL(failures.load(neo::Relaxed), 0u);
+        TEST(batcher.syncs() >= 1);
+        TEST(batcher.syncs() <= 80);
+    }
+    TEST_FALSE(file.close().has_value());
+    TEST_EQUAL(file.close().value(), OSError::BadFileNumber);
+
+    // O_DIRECT with an aligned buffer, where the filesystem supports it.
+    auto direct = File::open("/tmp/neo_file_test.bin", "r", { .direct = true });
+    if (direct.has_value())
+    {
+        auto alignment = direct.result().direct_io_alignment();
+        auto buffer = Buffer<u8>::create_uninitialized(4 * alignment, alignment);
+        TEST(buffer.has_value());
+        auto direct_read = direct.result().read_at(buffer.value().span(), alignment);
+        TEST(direct_read.has_value());
+        TEST_EQUAL(direct_read.result(), 4 * alignment);
+        TEST(matches_pattern(buffer.value().data(), 4 * alignment, alignment));
+    }
+
+    TEST_EQUAL(File::open("/tmp/neo_file_test.bin", "q").error(), OSError::InvalidArgument);
+    TEST_EQUAL(File::open("/tmp/neo_file_test.bin", "wx").error(), OSError::FileExists);
+    TEST_FALSE(File::remove("/tmp/neo_file_test.bin").has_value());
+    TEST_EQUAL(File::size("/tmp/neo_file_test.bin").error(), OSError::NoSuchEntity);
     return 0;
 }
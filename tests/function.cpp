@@ -0,0 +1,140 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Function.h>
+#include <Array.h>
+#include <SmartPtr.h>
+
+static int s_live = 0;
+static int s_copies = 0;
+
+struct Counted
+{
+    Counted()
+    {
+        s_live++;
+    }
+
+    Counted(Counted const&)
+    {
+        s_live++;
+        s_copies++;
+    }
+
+    Counted(Counted&&)
+    {
+        s_live++;
+    }
+
+    ~Counted()
+    {
+        s_live--;
+    }
+};
+
+static int call_twice(FunctionRef<int, int> callback, int value)
+{
+    return callback(callback(value));
+}
+
+int main()
+{
+    // Small captures live inside the object, large ones on the heap; both copy, move and destroy correctly.
+    {
+        int offset = 5;
+        auto small = [offset](int value)
+        { return value + offset; };
+        u8 padding[64] {};
+        padding[63] = 7;
+        auto large = [offset, padding](int value)
+        { return value + offset + padding[63]; };
+        static_assert(Function<int, int>::stores_inline<decltype(small)>);
+        static_assert(!Function<int, int>::stores_inline<decltype(large)>);
+        static_assert(InlineFunction<128, int, int>::stores_inline<decltype(large)>);
+
+        Function<int, int> f = small;
+        Function<int, int> g = large;
+        TEST_EQUAL(f(1), 6);
+        TEST_EQUAL(g(1), 13);
+
+        auto f_copy = f;
+        auto g_copy = g;
+        TEST_EQUAL(f_copy(2), 7);
+        TEST_EQUAL(g_copy(2), 14);
+
+        // A move empties the source instead of leaving two owners of one callable.
+        auto g_moved = std::move(g);
+        TEST_FALSE(g.is_valid());
+        TEST_EQUAL(g_moved(3), 15);
+
+        f = g_moved;
+        TEST_EQUAL(f(0), 12);
+        f = [](int value)
+        { return value * 2; };
+        TEST_EQUAL(f(21), 42);
+    }
+
+    // Captured objects are copied with the Function and destroyed with it, inline or not.
+    {
+        {
+            Counted counted;
+            Function<void, void> inline_function = [counted] {};
+            Function<void, void> heap_function = [counted, padding = Array<u64, 8> {}] {};
+            TEST_EQUAL(s_live, 3);
+            auto inline_copy = inline_function;
+            auto heap_copy = heap_function;
+            TEST_EQUAL(s_live, 5);
+            auto inline_moved = std::move(inline_function);
+            auto heap_moved = std::move(heap_function);
+            TEST_EQUAL(s_live, 5);
+            heap_copy.reset();
+            TEST_EQUAL(s_live, 4);
+        }
+        TEST_EQUAL(s_live, 0);
+    }
+
+    // UniqueFunction takes move only captures.
+    {
+        OwnPtr<int> owned(new int(41));
+        UniqueFunction<int> unique = [owned = std::move(owned)]
+        { return *owned + 1; };
+        auto moved = std::move(unique);
+        TEST_FALSE(unique.is_valid());
+        TEST_EQUAL(moved(), 42);
+    }
+
+    // FunctionRef calls the callable in place and never copies it.
+    {
+        Counted counted;
+        int calls = 0;
+        auto add = [&calls, counted](int value)
+        {
+            calls++;
+            return value + 1;
+        };
+        s_copies = 0;
+        TEST_EQUAL(call_twice(add, 1), 3);
+        TEST_EQUAL(calls, 2);
+        TEST_EQUAL(s_copies, 0);
+
+        Function<int, int> function = [](int value)
+        { return value * 3; };
+        TEST_EQUAL(call_twice(function, 1), 9);
+    }
+
+    return 0;
+}
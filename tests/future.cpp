@@ -18,6 +18,7 @@
 #include "ScopeExit.h"
 #include <Future.h>
 #include <Thread.h>
+#include <ThreadPool.h>
 #include <stdio.h>
 
 void lambda(Promise<int>& promise)
@@ -52,5 +53,57 @@ int main()
     }
     printf("The result is %d\n", willbe_result.value());
     TEST_EQUAL(willbe_result.value(), 42);
+
+    auto blocking_result = download();
+    blocking_result.wait();
+    TEST_EQUAL(blocking_result.release_value(), 42);
+
+    {
+        Promise<int> never_set;
+        auto never = never_set.get_future();
+        TEST_FALSE(never.wait_for(Time { 0, 10000000 }));
+        TEST_FALSE(never.is_ready());
+    }
+
+    Future<int> broken = []()
+    {
+        Promise<int> promise;
+        return promise.get_future();
+    }();
+    broken.wait();
+    TEST(broken.is_broken());
+
+    Promise<int> source;
+    auto doubled = source.get_future().then([](int& value)
+        { return value * 2; });
+    auto broken_chain = broken.then([](int& value)
+        { return value; });
+    TEST(broken_chain.is_broken());
+    source.set_value(21);
+    TEST_EQUAL(doubled.value(), 42);
+    TEST(doubled.wait_for(Time { 0, 0 }));
+
+    ThreadPool pool(2);
+    auto on_pool = doubled.then([](int& value)
+        { return value + 1; },
+        pool);
+    TEST_EQUAL(on_pool.value(), 43);
+
+    Promise<int> promises[4];
+    Future<int> futures[4] { promises[0].get_future(), promises[1].get_future(), promises[2].get_future(), promises[3].get_future() };
+    auto all = when_all(Span<Future<int>> { futures, 4 });
+    auto any = when_any(Span<Future<int>> { futures, 4 });
+    promises[2].set_value(2);
+    TEST_EQUAL(any.value(), 2);
+    TEST_FALSE(all.is_ready());
+    for (size_t i = 0; i < 4; i++)
+    {
+        if (i != 2)
+            pool.execute([&promises, i]()
+                { promises[i].set_value((int)i); });
+    }
+    TEST_EQUAL(all.value(), 4);
+    for (int i = 0; i < 4; i++)
+        TEST_EQUAL(futures[i].value(), i);
     return 0;
 }
@@ -0,0 +1,159 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <IOEngine.h>
+#include <Task.h>
+
+static Ipv4SocketAddress loopback(u16 port)
+{
+    return { HostToBigEndian((u32)0x7f000001), HostToBigEndian(port) };
+}
+
+static bool equal(u8 const* a, u8 const* b, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+Task<void> copy_block(IOEngine& engine, int fd, bool& done)
+{
+    u8 block[5] {};
+    auto read = co_await engine.read_at(fd, Span<u8>(block, 5), 0);
+    TEST(read.has_value());
+    TEST_EQUAL(read.result(), 5u);
+    auto written = co_await engine.write_at(fd, Span<u8>(block, 5), 5);
+    TEST(written.has_value());
+    done = true;
+}
+
+static void test_backend(IOBackend backend)
+{
+    auto maybe_engine = IOEngine::create(8, backend);
+    TEST(maybe_engine.has_value());
+    auto& engine = *maybe_engine.result();
+    TEST(engine.backend() == backend);
+
+    auto file_or_error = File::open("/tmp/neo_io_engine_test.bin", "w+");
+    TEST(file_or_error.has_value());
+    auto& file = file_or_error.result();
+
+    // A linked write then read of the same bytes.
+    u8 message[11] { 'h', 'e', 'l', 'l', 'o', ' ', 'w', 'o', 'r', 'l', 'd' };
+    u8 read_back[11] {};
+    auto write = engine.write_at(file, Span<u8>(message, 11), 0, IOFlags::Link);
+    auto read = engine.read_at(file, Span<u8>(read_back, 11), 0);
+    engine.wait(2);
+    TEST(write.is_ready() && read.is_ready());
+    TEST_EQUAL(write.value().result(), 11u);
+    TEST_EQUAL(read.value().result(), 11u);
+    TEST(equal(message, read_back, 11));
+
+    // A failed link cancels what follows it.
+    auto failed = engine.read_at(-1, Span<u8>(read_back, 11), 0, IOFlags::Link);
+    auto cancelled = engine.write_at(file, Span<u8>(message, 11), 0);
+    engine.wait(2);
+    TEST(failed.value().has_error());
+    TEST(cancelled.value().has_error());
+    TEST_EQUAL((int)cancelled.value().error(), ECANCELED);
+
+    // Registered buffers and files.
+    u8 pinned[64] {};
+    Span<u8> buffers[1] { Span<u8>(pinned, 64) };
+    TEST_FALSE(engine.register_buffers(Span<Span<u8>>(buffers, 1)).has_value());
+    int fds[1] { file.fd() };
+    TEST_FALSE(engine.register_files(Span<int>(fds, 1)).has_value());
+
+    auto fixed_read = engine.read_fixed_at(FixedFile { 0 }, 0, Span<u8>(pinned + 8, 11), 0);
+    engine.wait(1);
+    TEST_EQUAL(fixed_read.value().result(), 11u);
+    TEST(equal(message, pinned + 8, 11));
+
+    auto fixed_write = engine.write_fixed_at(file, 0, Span<u8>(pinned + 8, 5), 11);
+    auto end = engine.read_at(file, Span<u8>(read_back, 11), 100);
+    engine.wait(2);
+    TEST_EQUAL(fixed_write.value().result(), 5u);
+    TEST_EQUAL(end.value().result(), 0u);
+
+    // Awaiting operations from a coroutine, resumed while the engine is pumped.
+    bool done = false;
+    spawn(copy_block(engine, file.fd(), done));
+    while (!done)
+        engine.wait(1);
+    u8 copied[5] {};
+    auto copied_read = engine.read_at(file, Span<u8>(copied, 5), 5);
+    engine.wait(1);
+    TEST_EQUAL(copied_read.value().result(), 5u);
+    TEST(equal(message, copied, 5));
+
+    TEST_FALSE(file.close().has_value());
+    TEST_FALSE(File::remove("/tmp/neo_io_engine_test.bin").has_value());
+
+    // Sockets: accept, then a send and a receive over the accepted connection.
+    auto listener = TCPListener::listen(loopback(0), SocketMode::Blocking);
+    TEST(listener.has_value());
+    auto accepted = engine.accept(listener.result());
+    auto client = TCPSocket::connect(loopback(listener.result().port().result()));
+    TEST(client.has_value());
+    engine.wait(1);
+    TEST(accepted.value().has_value());
+    auto server = TCPSocket::adopt((int)accepted.value().result());
+    TEST(server.has_value());
+
+    u8 received[11] {};
+    auto receive = engine.receive(server.result(), Span<u8>(received, 11));
+    auto send = engine.send(client.result(), Span<u8>(message, 11));
+    engine.wait(2);
+    TEST_EQUAL(send.value().result(), 11u);
+    TEST(receive.value().result() > 0);
+    TEST(equal(message, received, receive.value().result()));
+    TEST_EQUAL(engine.in_flight(), 0u);
+
+    // An accept and a receive nobody answers, cancelled.
+    auto idle_listener = TCPListener::listen(loopback(0), SocketMode::Blocking);
+    TEST(idle_listener.has_value());
+    auto idle_accept = engine.accept(idle_listener.result());
+    auto idle_receive = engine.receive(server.result(), Span<u8>(received, 11));
+    TEST_FALSE(engine.submit().has_value());
+    engine.poll();
+    engine.cancel_all();
+    engine.wait(2);
+    TEST_EQUAL(engine.in_flight(), 0u);
+    TEST(idle_accept.value().has_error());
+    TEST_EQUAL((int)idle_accept.value().error(), ECANCELED);
+    TEST(idle_receive.value().has_error());
+    TEST_EQUAL((int)idle_receive.value().error(), ECANCELED);
+
+    // Destroying an engine cancels what is still pending instead of waiting for it forever.
+    {
+        auto other = IOEngine::create(8, backend);
+        TEST(other.has_value());
+        auto pending = other.result()->accept(idle_listener.result());
+        TEST_FALSE(other.result()->submit().has_value());
+    }
+}
+
+int main()
+{
+    auto probe = IOEngine::create(8, IOBackend::IoUring);
+    if (probe.has_value())
+        test_backend(IOBackend::IoUring);
+    test_backend(IOBackend::Fallback);
+}
@@ -0,0 +1,168 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <BinaryReader.h>
+#include <FileStream.h>
+#include <GenericLexer.h>
+#include <MappedFile.h>
+
+static constexpr size_t value_count = 5000;
+
+static void write_file(char const* path, u8 const* data, size_t size)
+{
+    auto file = File::open(path, "w");
+    TEST(file.has_value());
+    if (size != 0)
+        TEST(file.result().write(Span<u8>((u8*)data, size), size).has_value());
+}
+
+static bool is_identifier_char(Utf32Char c)
+{
+    return (c >= 'a' && c <= 'z') || c == '_';
+}
+
+int main()
+{
+    // value_count u32s spanning several pages, so a one page window has to slide.
+    static u32 values[value_count];
+    for (u32 i = 0; i < value_count; i++)
+        values[i] = i * 2654435761u;
+    write_file("/tmp/neo_mapped_file.bin", (u8*)values, sizeof(values));
+
+    // The whole file in one mapping.
+    {
+        auto file = MappedFile::map("/tmp/neo_mapped_file.bin", { .populate = true });
+        TEST(file.has_value());
+        auto& mapped = file.result();
+        TEST_EQUAL(mapped.file_size(), sizeof(values));
+        TEST_EQUAL(mapped.span().size(), sizeof(values));
+        TEST_FALSE(mapped.is_windowed());
+        TEST_EQUAL(__builtin_memcmp(mapped.span().data(), values, sizeof(values)), 0);
+        TEST_FALSE(mapped.advise(MapAdvice::WillNeed).has_value());
+        TEST_FALSE(mapped.advise(MapAdvice::Random, 10, 100).has_value());
+    }
+
+    // A window of one page. Sliding maps the page holding the offset.
+    {
+        auto file = MappedFile::map("/tmp/neo_mapped_file.bin", { .window_size = 100 });
+        TEST(file.has_value());
+        auto& mapped = file.result();
+        auto page = MappedFile::page_size();
+        TEST(mapped.is_windowed());
+        TEST_EQUAL(mapped.span().size(), page);
+        TEST_FALSE(mapped.slide_to(page + 5).has_value());
+        TEST_EQUAL(mapped.window_offset(), page);
+        TEST_EQUAL(*(u32*)mapped.span().data(), values[page / 4]);
+        TEST_FALSE(mapped.slide_to(sizeof(values) - 1).has_value());
+        TEST_EQUAL(mapped.window_offset() + mapped.span().size(), sizeof(values));
+        TEST_FALSE(mapped.slide_to(sizeof(values)).has_value());
+    }
+
+    // BinaryReader over a windowed stream crosses every window boundary, including values split across two.
+    {
+        auto file = MappedFile::map("/tmp/neo_mapped_file.bin", { .window_size = MappedFile::page_size() });
+        TEST(file.has_value());
+        MappedFileStream stream(file.result(), 8 * KiB);
+        BinaryReader reader(stream);
+        for (size_t i = 0; i < value_count; i++)
+        {
+            auto value = reader.read<u32>();
+            TEST(value.has_value());
+            TEST_EQUAL(value.value(), values[i]);
+        }
+        TEST(stream.end());
+        TEST_FALSE(stream.has_error());
+        TEST_FALSE(reader.read<u32>().has_value());
+
+        stream.seek(2);
+        u8 unaligned[4096 + 10];
+        Span<u8> span(unaligned, sizeof(unaligned));
+        TEST_EQUAL(stream.read(span), sizeof(unaligned));
+        TEST_EQUAL(__builtin_memcmp(unaligned, (u8*)values + 2, sizeof(unaligned)), 0);
+        TEST_EQUAL(stream.unread_bytes(), sizeof(values) - 2 - sizeof(unaligned));
+
+        // The rest goes out through copy_file_range from the stream's position.
+        auto to = FileStream::create("/tmp/neo_mapped_file_copy.bin", "w+");
+        TEST(to.has_value());
+        auto moved = stream.transfer_to(to.result());
+        TEST(moved.has_value());
+        TEST_EQUAL(moved.result(), sizeof(values) - 2 - sizeof(unaligned));
+        TEST(stream.end());
+        TEST_FALSE(to.result().seek(0).has_value());
+        static u8 copy[sizeof(values)];
+        Span<u8> copy_span(copy, sizeof(copy));
+        TEST_EQUAL(to.result().read(copy_span), moved.result());
+        TEST_EQUAL(__builtin_memcmp(copy, (u8*)values + 2 + sizeof(unaligned), moved.result()), 0);
+    }
+
+    // Writes through a shared mapping reach the file.
+    {
+        auto file = MappedFile::map("/tmp/neo_mapped_file.bin", { .access = MapAccess::ReadWrite });
+        TEST(file.has_value());
+        file.result().span()[5] = 0xab;
+        TEST_FALSE(file.result().sync().has_value());
+
+        auto read_back = File::open("/tmp/neo_mapped_file.bin", "r");
+        TEST(read_back.has_value());
+        u8 head[8] {};
+        TEST(read_back.result().read(Span<u8>(head, 8), 8).has_value());
+        TEST_EQUAL(head[5], 0xab);
+    }
+
+    // Lexing straight out of the mapping.
+    {
+        char const source[] = "let answer = forty_two";
+        write_file("/tmp/neo_mapped_file.txt", (u8 const*)source, sizeof(source) - 1);
+        auto file = MappedFile::map("/tmp/neo_mapped_file.txt");
+        TEST(file.has_value());
+        TEST_EQUAL(file.result().view().byte_size(), sizeof(source) - 1);
+
+        Vector<GenericLexer::LexingRule> rules;
+        rules.append({ 0, is_identifier_char, GenericLexer::LexingRuleAction::Read,
+            [](Utf32Char c, StringView const&)
+            { return is_identifier_char(c); },
+            [](String const&)
+            { return true; },
+            GenericLexerTokenType::Identifier });
+        GenericLexer lexer(rules);
+        auto tokens = lexer.tokenize(file.result().view());
+        size_t identifiers = 0;
+        for (auto& token : tokens)
+        {
+            if (token.type == GenericLexerTokenType::Identifier)
+                identifiers++;
+        }
+        TEST_EQUAL(identifiers, 3u);
+        TEST(tokens.last().value == "forty_two"_s);
+    }
+
+    // An empty file maps to an empty window.
+    {
+        write_file("/tmp/neo_mapped_file.txt", nullptr, 0);
+        auto file = MappedFile::map("/tmp/neo_mapped_file.txt");
+        TEST(file.has_value());
+        TEST_EQUAL(file.result().span().size(), 0u);
+        MappedFileStream stream(file.result());
+        TEST(stream.end());
+    }
+
+    TEST(MappedFile::map("/tmp/__idonotexist__").has_error());
+    [[maybe_unused]] auto remove_bin = File::remove("/tmp/neo_mapped_file.bin");
+    [[maybe_unused]] auto remove_copy = File::remove("/tmp/neo_mapped_file_copy.bin");
+    [[maybe_unused]] auto remove_text = File::remove("/tmp/neo_mapped_file.txt");
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <ConcurrentStream.h>
+#include <MemoryStream.h>
+#include <Thread.h>
+#include <Vector.h>
+
+// Holds writes back until opened, so producers can be made to run out of room.
+class GatedOutputStream final : public OutputStream
+{
+public:
+    void write(Span<u8> const& from) override
+    {
+        while (!m_open.load(neo::Acquire))
+            ;
+        m_base.write(from);
+    }
+
+    void flush() override
+    {
+        m_flushes.fetch_add(1, neo::Relaxed);
+    }
+
+    bool has_error() const override
+    {
+        return false;
+    }
+
+    void close() override
+    {
+        m_closed = true;
+    }
+
+    void open()
+    {
+        m_open.store(true, neo::Release);
+    }
+
+    MemoryStream m_base { 0 };
+    Atomic<bool> m_open { true };
+    Atomic<u32> m_flushes { 0 };
+    bool m_closed { false };
+};
+
+struct Record
+{
+    u32 thread;
+    u32 sequence;
+};
+
+// Every record arrives once and each thread's records arrive in the order it wrote them.
+static bool check_records(Span<u8> const& output, u32 thread_count, u32 per_thread)
+{
+    if (output.size() != sizeof(Record) * thread_count * per_thread)
+        return false;
+    u32 next[16] {};
+    auto* records = (Record const*)output.data();
+    for (size_t i = 0; i < output.size() / sizeof(Record); i++)
+    {
+        if (records[i].thread >= thread_count || records[i].sequence != next[records[i].thread]++)
+            return false;
+    }
+    return true;
+}
+
+static void run_producers(MultiProducerOutputStream& stream, u32 thread_count, u32 per_thread)
+{
+    Vector<RefPtr<Thread>> threads;
+    for (u32 t = 0; t < thread_count; t++)
+    {
+        auto thread = Thread::create([&stream, t, per_thread]
+            {
+                for (u32 i = 0; i < per_thread; i++)
+                {
+                    Record record { t, i };
+                    stream.write(Span<u8>((u8*)&record, sizeof(record)));
+                } });
+        threads.append(thread.result());
+    }
+    for (auto& thread : threads)
+        [[maybe_unused]] auto exit = thread->wait_for_thread_exit();
+}
+
+int main()
+{
+    // Several producers through small buffers, so they block on the writer often.
+    {
+        GatedOutputStream base;
+        auto stream = MultiProducerOutputStream::create(base, { .producer_buffer_size = 1024 });
+        TEST(stream.has_value());
+        run_producers(*stream.result(), 8, 20000);
+        stream.result()->flush();
+        TEST(base.m_flushes.load(neo::Relaxed) >= 1);
+        auto output = base.m_base.release_buffer();
+        TEST(check_records(output.span(), 8, 20000));
+        TEST_EQUAL(stream.result()->dropped_writes(), 0u);
+    }
+
+    // More threads than slots share the last one.
+    {
+        GatedOutputStream base;
+        {
+            auto stream = MultiProducerOutputStream::create(base, { .max_producers = 2 });
+            run_producers(*stream.result(), 6, 5000);
+        }
+        // Destruction drained and flushed without an explicit flush.
+        auto output = base.m_base.release_buffer();
+        TEST(check_records(output.span(), 6, 5000));
+        TEST_FALSE(base.m_closed);
+    }
+
+    // Writes too big for a producer's buffer go straight to base, after what that producer queued before.
+    {
+        GatedOutputStream base;
+        auto stream = MultiProducerOutputStream::create(base, { .producer_buffer_size = 1024 });
+        static u8 large[4096];
+        __builtin_memset(large, 'L', sizeof(large));
+        stream.result()->write(Span<u8>((u8*)"small", 5));
+        stream.result()->write(Span<u8>(large, sizeof(large)));
+        stream.result()->write(Span<u8>((u8*)"tail", 4));
+        stream.result()->close();
+        TEST(base.m_closed);
+
+        auto output = base.m_base.release_buffer();
+        TEST_EQUAL(output.size(), 5u + sizeof(large) + 4u);
+        TEST_EQUAL(__builtin_memcmp(output.data(), "small", 5), 0);
+        TEST_EQUAL(output[5], 'L');
+        TEST_EQUAL(__builtin_memcmp(output.data() + 5 + sizeof(large), "tail", 4), 0);
+
+        // Closed streams drop writes.
+        stream.result()->write(Span<u8>((u8*)"late", 4));
+        TEST_EQUAL(stream.result()->dropped_writes(), 1u);
+    }
+
+    // Under Drop a full buffer loses writes instead of waiting, and the count says how many.
+    {
+        GatedOutputStream base;
+        base.m_open.store(false, neo::Release);
+        auto stream = MultiProducerOutputStream::create(base, { .producer_buffer_size = 1024, .backpressure = BackpressurePolicy::Drop });
+        u32 const writes = 10000;
+        for (u32 i = 0; i < writes; i++)
+        {
+            Record record { 0, i };
+            stream.result()->write(Span<u8>((u8*)&record, sizeof(record)));
+        }
+        TEST(stream.result()->dropped_writes() > 0);
+        base.open();
+        stream.result()->flush();
+
+        auto output = base.m_base.release_buffer();
+        TEST_EQUAL(output.size() / sizeof(Record) + stream.result()->dropped_writes(), writes);
+        // What got through is still in order.
+        auto* records = (Record const*)output.data();
+        for (size_t i = 1; i < output.size() / sizeof(Record); i++)
+            TEST(records[i].sequence > records[i - 1].sequence);
+    }
+
+    return 0;
+}
@@ -16,9 +16,163 @@
 
 #include "Test.h"
 #include <Mutex.h>
+#include <Optional.h>
+#include <Thread.h>
+#include <Vector.h>
+#include <unistd.h>
+
+// Increments a plain counter under the lock from several threads; any lost update means two holders at once.
+template<typename TMutex>
+static bool excludes(TMutex& mutex)
+{
+    constexpr u64 per_thread = 100000;
+    u64 counter = 0;
+    run_threads(4, [&](size_t)
+        {
+            for (u64 i = 0; i < per_thread; i++)
+            {
+                ScopedLock lock(mutex);
+                counter++;
+            } });
+    return counter == 4 * per_thread && !mutex.is_locked();
+}
 
 int main()
 {
-    // TODO!
+    {
+        SpinlockMutex spinlock;
+        TEST(excludes(spinlock));
+        Mutex mutex;
+        TEST(excludes(mutex));
+        HybridMutex hybrid;
+        TEST(excludes(hybrid));
+        TicketLock ticket_lock;
+        TEST(excludes(ticket_lock));
+        RWLock rw_lock;
+        TEST(excludes(rw_lock));
+    }
+
+    // try_lock never waits, and contention is counted only when lock() had to wait.
+    {
+        Mutex mutex;
+        TEST(mutex.try_lock());
+        TEST_FALSE(mutex.try_lock());
+        auto waiter = Thread::create([&mutex]
+            {
+                mutex.lock();
+                mutex.unlock(); });
+        usleep(20000);
+        mutex.unlock();
+        [[maybe_unused]] auto exit = waiter.result()->wait_for_thread_exit();
+        TEST_EQUAL(mutex.contended_acquisitions(), 1u);
+        TEST_FALSE(mutex.is_locked());
+    }
+
+    // A ticket lock hands the lock over in arrival order.
+    {
+        TicketLock lock;
+        lock.lock();
+        Vector<size_t> order;
+        Optional<RefPtr<Thread>> threads[4];
+        for (size_t t = 0; t < 4; t++)
+        {
+            auto thread = Thread::create([&lock, &order, t]
+                {
+                    lock.lock();
+                    order.append(t);
+                    lock.unlock(); });
+            threads[t] = thread.result();
+            // Lets thread t take its ticket before the next one starts.
+            usleep(10000);
+        }
+        lock.unlock();
+        for (auto& thread : threads)
+            [[maybe_unused]] auto exit = thread.value()->wait_for_thread_exit();
+        TEST_EQUAL(order.size(), 4u);
+        for (size_t t = 0; t < order.size(); t++)
+            TEST_EQUAL(order[t], t);
+        TEST_EQUAL(lock.contended_acquisitions(), 4u);
+    }
+
+    // Readers share the lock; a waiting writer keeps new readers out until it has had its turn.
+    {
+        RWLock lock;
+        lock.lock_shared();
+        TEST(lock.try_lock_shared());
+        TEST_EQUAL(lock.readers(), 2u);
+        TEST_FALSE(lock.try_lock());
+
+        Atomic<bool> wrote { false };
+        auto writer = Thread::create([&]
+            {
+                lock.lock();
+                wrote.store(true, neo::Release);
+                lock.unlock(); });
+        usleep(20000);
+        TEST_FALSE(wrote.load(neo::Acquire));
+        TEST_FALSE(lock.try_lock_shared());
+
+        Atomic<bool> read_after_write { false };
+        auto reader = Thread::create([&]
+            {
+                ScopedSharedLock shared(lock);
+                read_after_write.store(wrote.load(neo::Acquire), neo::Release); });
+        usleep(20000);
+        lock.unlock_shared();
+        lock.unlock_shared();
+        [[maybe_unused]] auto writer_exit = writer.result()->wait_for_thread_exit();
+        [[maybe_unused]] auto reader_exit = reader.result()->wait_for_thread_exit();
+        TEST(wrote.load(neo::Acquire));
+        TEST(read_after_write.load(neo::Acquire));
+        TEST_EQUAL(lock.readers(), 0u);
+        TEST(lock.contended_writes() >= 1u);
+        TEST(lock.contended_reads() >= 1u);
+    }
+
+    // Readers and writers mixed: writers see no readers inside and readers never see a half done write.
+    {
+        RWLock lock;
+        u64 first = 0;
+        u64 second = 0;
+        Atomic<bool> torn { false };
+        run_threads(6, [&](size_t t)
+            {
+                for (u64 i = 0; i < 20000; i++)
+                {
+                    if (t < 2)
+                    {
+                        ScopedLock exclusive(lock);
+                        if (lock.readers() != 0)
+                            torn.store(true, neo::Relaxed);
+                        first++;
+                        second++;
+                    }
+                    else
+                    {
+                        ScopedSharedLock shared(lock);
+                        if (first != second)
+                            torn.store(true, neo::Relaxed);
+                    }
+                } });
+        TEST_FALSE(torn.load(neo::Relaxed));
+        TEST_EQUAL(first, 40000u);
+    }
+
+    {
+        RecursiveMutex mutex;
+        TEST_EQUAL(mutex.lock(), 1u);
+        TEST_EQUAL(mutex.lock(), 2u);
+        TEST_EQUAL(mutex.try_lock(), 3);
+        Atomic<ssize_t> other_try { -1 };
+        auto other = Thread::create([&]
+            { other_try.store(mutex.try_lock(), neo::Release); });
+        [[maybe_unused]] auto exit = other.result()->wait_for_thread_exit();
+        TEST_EQUAL(other_try.load(neo::Acquire), 0);
+        TEST_EQUAL(mutex.unlock(), 2u);
+        TEST_EQUAL(mutex.unlock(), 1u);
+        TEST_EQUAL(mutex.unlock(), 0u);
+        TEST_FALSE(mutex.is_locked());
+    }
+
     return 0;
 }
@@ -0,0 +1,70 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Parallel.h>
+
+int main()
+{
+    constexpr size_t size = 1000003;
+    auto* values = new u64[size];
+    Span<u64> span { values, size };
+
+    parallel_for(0, size, [&](size_t i)
+        { values[i] = (i * 2654435761u) % 1000; });
+    for (size_t i = 0; i < size; i++)
+        TEST_EQUAL(values[i], (i * 2654435761u) % 1000);
+
+    u64 expected_sum = 0;
+    for (size_t i = 0; i < size; i++)
+        expected_sum += values[i];
+    auto sum = parallel_reduce(
+        span, (u64)0, [](u64& total, u64& value)
+        { total += value; },
+        [](u64& total, u64 const& partial)
+        { total += partial; });
+    TEST_EQUAL(sum, expected_sum);
+
+    auto* doubled = new u64[size];
+    parallel_transform(span, Span<u64> { doubled, size }, [](u64& value) -> u64
+        { return value * 2; });
+    for (size_t i = 0; i < size; i++)
+        TEST_EQUAL(doubled[i], values[i] * 2);
+
+    parallel_for(Span<u64> { doubled, size }, [](u64& value)
+        { value = 1; });
+    parallel_scan(Span<u64> { doubled, size }, [](u64 const& a, u64 const& b) -> u64
+        { return a + b; });
+    for (size_t i = 0; i < size; i++)
+        TEST_EQUAL(doubled[i], i + 1);
+
+    parallel_sort(span);
+    for (size_t i = 1; i < size; i++)
+        TEST(values[i - 1] <= values[i]);
+
+    parallel_sort(span, [](u64 const& a, u64 const& b)
+        { return a > b; });
+    for (size_t i = 1; i < size; i++)
+        TEST(values[i - 1] >= values[i]);
+
+    u64 small[] { 5, 3, 9, 1 };
+    parallel_sort(Span<u64> { small, 4 });
+    TEST(small[0] == 1 && small[1] == 3 && small[2] == 5 && small[3] == 9);
+
+    delete[] doubled;
+    delete[] values;
+    return 0;
+}
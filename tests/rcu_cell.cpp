@@ -0,0 +1,161 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Optional.h>
+#include <RcuCell.h>
+#include <Thread.h>
+#include <sched.h>
+
+static neo::Atomic<int> s_live { 0 };
+
+// Two halves that every published version keeps equal, so a reader seeing a mix of versions would notice.
+struct Routes
+{
+    Routes() :
+        Routes(0)
+    {
+    }
+
+    explicit Routes(u64 v) :
+        first(v), second(v)
+    {
+        s_live.fetch_add(1, neo::Relaxed);
+    }
+
+    Routes(Routes const& other) :
+        first(other.first), second(other.second)
+    {
+        s_live.fetch_add(1, neo::Relaxed);
+    }
+
+    ~Routes()
+    {
+        s_live.fetch_sub(1, neo::Relaxed);
+    }
+
+    u64 first;
+    u64 second;
+};
+
+int main()
+{
+    {
+        EpochDomain domain;
+        {
+            RcuCell<Routes> cell(Routes(1), domain);
+            TEST_EQUAL(cell.read([](Routes const& routes)
+                           { return routes.first; }),
+                1u);
+
+            // A snapshot keeps its version after newer ones are published.
+            auto old = cell.snapshot();
+            cell.publish(Routes(2));
+            TEST_EQUAL(old->first, 1u);
+            TEST_EQUAL(cell.snapshot()->first, 2u);
+
+            cell.update([](Routes& routes)
+                { routes.first = routes.second = routes.first + 10; });
+            TEST_EQUAL(cell.snapshot()->second, 12u);
+            TEST_EQUAL(old->second, 1u);
+
+            // No reader is pinned, so every replaced version can go; the snapshot keeps its own value alive.
+            cell.synchronize();
+            TEST_EQUAL(domain.pending(), 0u);
+            TEST_EQUAL(old->first, 1u);
+        }
+
+        TEST_EQUAL(domain.pending(), 0u);
+        TEST_EQUAL(s_live.load(neo::Relaxed), 0);
+    }
+
+    // Replaced versions are reclaimed by the writes themselves, without anyone calling collect(): a writer keeps at
+    // most the last two it replaced, and synchronize() frees those once no reader can see them.
+    {
+        EpochDomain domain;
+        {
+            RcuCell<Routes> cell(Routes(0), domain);
+            for (u64 i = 1; i <= 200; i++)
+            {
+                cell.publish(Routes(i));
+                TEST(domain.pending() <= 2);
+                TEST(s_live.load(neo::Relaxed) <= 3);
+            }
+            cell.synchronize();
+            TEST_EQUAL(domain.pending(), 0u);
+            TEST_EQUAL(s_live.load(neo::Relaxed), 1);
+        }
+        TEST_EQUAL(s_live.load(neo::Relaxed), 0);
+    }
+
+    // Readers always see a whole version while writers keep publishing, and concurrent updates don't get lost.
+    {
+        EpochDomain domain;
+        {
+            RcuCell<Routes> cell(Routes(0), domain);
+            neo::Atomic<bool> stop { false };
+            neo::Atomic<u64> torn { 0 };
+            Optional<RefPtr<Thread>> readers[3];
+            for (auto& reader : readers)
+            {
+                reader = Thread::create(
+                    [&]()
+                    {
+                        u64 last = 0;
+                        while (!stop.load(neo::Acquire))
+                        {
+                            auto seen = cell.read([](Routes const& routes)
+                                { return routes.first == routes.second ? routes.first : ~(u64)0; });
+                            auto snapshot = cell.snapshot();
+                            if (seen == ~(u64)0 || snapshot->first != snapshot->second || seen < last)
+                                torn.fetch_add(1, neo::Relaxed);
+                            last = seen;
+                            sched_yield();
+                        }
+                    })
+                             .result();
+            }
+
+            Optional<RefPtr<Thread>> writers[2];
+            for (auto& writer : writers)
+            {
+                writer = Thread::create(
+                    [&]()
+                    {
+                        for (int i = 0; i < 2000; i++)
+                        {
+                            cell.update([](Routes& routes)
+                                { routes.first = routes.second = routes.first + 1; });
+                            if (i % 16 == 0)
+                                sched_yield();
+                        }
+                    })
+                             .result();
+            }
+            for (auto& writer : writers)
+                [[maybe_unused]] auto exit = writer.value()->wait_for_thread_exit();
+            stop.store(true, neo::Release);
+            for (auto& reader : readers)
+                [[maybe_unused]] auto exit = reader.value()->wait_for_thread_exit();
+
+            TEST_EQUAL(torn.load(neo::Relaxed), 0u);
+            TEST_EQUAL(cell.snapshot()->first, 4000u);
+        }
+    }
+    TEST_EQUAL(s_live.load(neo::Relaxed), 0);
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Optional.h>
+#include <Reclamation.h>
+#include <Thread.h>
+#include <sched.h>
+
+static neo::Atomic<int> s_live { 0 };
+
+struct Node
+{
+    explicit Node(u64 v) :
+        value(v)
+    {
+        s_live.fetch_add(1, neo::Relaxed);
+    }
+
+    ~Node()
+    {
+        s_live.fetch_sub(1, neo::Relaxed);
+    }
+
+    u64 value;
+    Node* next { nullptr };
+};
+
+// Treiber stack; popped nodes go to the domain instead of being deleted, since other poppers may still read them.
+template<typename TDomain>
+struct Stack
+{
+    void push(Node* node)
+    {
+        auto* head = top.load(neo::Relaxed);
+        do
+            node->next = head;
+        while (!top.compare_exchange_weak(head, node, neo::Release, neo::Relaxed));
+    }
+
+    Optional<u64> pop(TDomain& domain)
+    {
+        Node* head;
+        if constexpr (IsSame<TDomain, EpochDomain>)
+        {
+            auto guard = domain.pin();
+            head = top.load(neo::Acquire);
+            while (head != nullptr && !top.compare_exchange_weak(head, head->next, neo::Acquire, neo::Acquire))
+                ;
+        }
+        else
+        {
+            auto hazard = domain.make_hazard_pointer();
+            while (true)
+            {
+                head = hazard.protect(top);
+                if (head == nullptr || top.compare_exchange_weak(head, head->next, neo::Acquire, neo::Acquire))
+                    break;
+            }
+        }
+        if (head == nullptr)
+            return {};
+
+        auto value = head->value;
+        domain.retire(head);
+        return value;
+    }
+
+    neo::Atomic<Node*> top { nullptr };
+};
+
+template<typename TDomain>
+static void stress(TDomain& domain)
+{
+    static constexpr u64 per_thread = 20000;
+    Stack<TDomain> stack;
+    neo::Atomic<u64> popped_sum { 0 };
+    neo::Atomic<u64> popped_count { 0 };
+    {
+        Optional<RefPtr<Thread>> threads[4];
+        for (u64 t = 0; t < 4; t++)
+        {
+            auto thread = Thread::create(
+                [&, t]()
+                {
+                    for (u64 i = 0; i < per_thread; i++)
+                    {
+                        stack.push(new Node(t * per_thread + i));
+                        auto value = stack.pop(domain);
+                        if (value.has_value())
+                        {
+                            popped_sum.fetch_add(value.value(), neo::Relaxed);
+                            popped_count.fetch_add(1, neo::Relaxed);
+                        }
+                        if (i % 64 == 0)
+                            sched_yield();
+                    }
+                });
+            TEST(thread.has_value());
+            threads[t] = thread.result();
+        }
+        for (auto& thread : threads)
+            [[maybe_unused]] auto exit = thread.value()->wait_for_thread_exit();
+    }
+
+    while (true)
+    {
+        auto value = stack.pop(domain);
+        if (!value.has_value())
+            break;
+        popped_sum.fetch_add(value.value(), neo::Relaxed);
+        popped_count.fetch_add(1, neo::Relaxed);
+    }
+
+    u64 total = 4 * per_thread;
+    TEST_EQUAL(popped_count.load(neo::Relaxed), total);
+    TEST_EQUAL(popped_sum.load(neo::Relaxed), total * (total - 1) / 2);
+}
+
+int main()
+{
+    // A retired node outlives every guard that was pinned when it was retired.
+    {
+        EpochDomain domain;
+        {
+            auto guard = domain.pin();
+            domain.retire(new Node(1));
+            for (int i = 0; i < 4; i++)
+                domain.collect();
+            TEST_EQUAL(s_live.load(neo::Relaxed), 1);
+            TEST_EQUAL(domain.pending(), 1u);
+        }
+        size_t freed = 0;
+        for (int i = 0; i < 3; i++)
+            freed += domain.collect();
+        TEST_EQUAL(freed, 1u);
+        TEST_EQUAL(s_live.load(neo::Relaxed), 0);
+        TEST_EQUAL(domain.pending(), 0u);
+
+        // Guards nest; only the outermost one unpins.
+        {
+            auto outer = domain.pin();
+            {
+                auto inner = domain.pin();
+            }
+            auto epoch = domain.epoch();
+            domain.collect();
+            domain.collect();
+            TEST(domain.epoch() <= epoch + 1);
+        }
+    }
+
+    // A protected pointer is only freed once its hazard pointer lets go of it.
+    {
+        HazardDomain domain;
+        neo::Atomic<Node*> shared { new Node(2) };
+        {
+            auto hazard = domain.make_hazard_pointer();
+            auto* node = hazard.protect(shared);
+            TEST_EQUAL(node->value, 2u);
+            shared.store(nullptr, neo::Release);
+            domain.retire(node);
+            TEST_EQUAL(domain.collect(), 0u);
+            TEST_EQUAL(s_live.load(neo::Relaxed), 1);
+
+            hazard.reset();
+            TEST_EQUAL(domain.collect(), 1u);
+            TEST_EQUAL(s_live.load(neo::Relaxed), 0);
+        }
+
+        // Retiring past the scan threshold frees what is unprotected without an explicit collect.
+        HazardDomain small({ .max_threads = 4, .hazards_per_thread = 2, .scan_threshold = 8 });
+        for (int i = 0; i < 100; i++)
+            small.retire(new Node(i));
+        TEST(small.pending() < 8u);
+    }
+
+    // Destroying a domain frees whatever is still retired.
+    {
+        EpochDomain domain;
+        auto epoch = domain.epoch();
+        domain.retire(new Node(3));
+        TEST_EQUAL(domain.epoch(), epoch);
+    }
+    TEST_EQUAL(s_live.load(neo::Relaxed), 0);
+
+    {
+        EpochDomain domain;
+        stress(domain);
+    }
+    TEST_EQUAL(s_live.load(neo::Relaxed), 0);
+
+    {
+        HazardDomain domain;
+        stress(domain);
+    }
+    TEST_EQUAL(s_live.load(neo::Relaxed), 0);
+
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Memory.h>
+#include <SmartPtr.h>
+#include <Thread.h>
+
+static int s_live = 0;
+static int s_allocations = 0;
+
+struct CountingAllocator
+{
+    static void* allocate(size_t byte_count)
+    {
+        s_allocations++;
+        return neo::MallocAllocator::allocate(byte_count);
+    }
+
+    static void deallocate(void* ptr)
+    {
+        s_allocations--;
+        neo::MallocAllocator::deallocate(ptr);
+    }
+};
+
+struct Tracked
+{
+    Tracked(int v) :
+        value(v)
+    {
+        s_live++;
+    }
+
+    ~Tracked()
+    {
+        s_live--;
+    }
+
+    int value;
+};
+
+struct Node : public RefCounted<Node>
+{
+    Node(int v) :
+        value(v)
+    {
+        s_live++;
+    }
+
+    virtual ~Node()
+    {
+        s_live--;
+    }
+
+    int value;
+};
+
+struct DerivedNode final : public Node
+{
+    DerivedNode(int v) :
+        Node(v)
+    {
+    }
+};
+
+struct LocalNode : public LocalRefCounted<LocalNode>
+{
+    int value { 7 };
+};
+
+int main()
+{
+    // create_refcounted makes one allocation holding both the count and the object.
+    {
+        auto ref = create_refcounted<Tracked, CountingAllocator>(3).release_nonnull();
+        TEST_EQUAL(s_allocations, 1);
+        TEST_EQUAL(s_live, 1);
+        TEST_EQUAL(ref->value, 3);
+        TEST_EQUAL(ref.ref_count(), 1u);
+
+        {
+            auto copy = ref;
+            TEST_EQUAL(ref.ref_count(), 2u);
+            TEST_EQUAL(copy->value, 3);
+        }
+        TEST_EQUAL(ref.ref_count(), 1u);
+    }
+    TEST_EQUAL(s_live, 0);
+    TEST_EQUAL(s_allocations, 0);
+
+    // A weak reference keeps the block alive but not the object.
+    {
+        Optional<WeakPtr<Tracked>> weak;
+        {
+            auto ref = create_refcounted<Tracked, CountingAllocator>(5).release_nonnull();
+            weak = ref.make_weak();
+            TEST(weak.value().is_valid());
+            TEST_EQUAL(weak.value().weak_ref_count(), 1u);
+        }
+        TEST_EQUAL(s_live, 0);
+        TEST_FALSE(weak.value().is_valid());
+        TEST_EQUAL(s_allocations, 1);
+
+        // Expired references can still be copied and assigned around.
+        {
+            auto other_ref = create_refcounted<Tracked, CountingAllocator>(6).release_nonnull();
+            auto other = other_ref.make_weak();
+            TEST(other.is_valid());
+            other = weak.value();
+            TEST_FALSE(other.is_valid());
+            auto moved = weak.value();
+            other = std::move(moved);
+            TEST_FALSE(other.is_valid());
+        }
+        TEST_EQUAL(s_live, 0);
+        TEST_EQUAL(s_allocations, 1);
+        {
+            auto last = weak.release_value();
+        }
+        TEST_EQUAL(s_allocations, 0);
+    }
+
+    // RefPtr(new T) still works with a separate control block.
+    {
+        RefPtr<Tracked> ref(new Tracked(9));
+        auto copy = ref;
+        TEST_EQUAL(copy->value, 9);
+        TEST_EQUAL(ref.ref_count(), 2u);
+    }
+    TEST_EQUAL(s_live, 0);
+
+    // Intrusively counted objects carry their own count and need no control block.
+    {
+        RefPtr<Node> node(new Node(1));
+        TEST_EQUAL(node.ref_count(), 1u);
+        {
+            auto copy = node;
+            TEST_EQUAL(node->ref_count(), 2u);
+        }
+        TEST_EQUAL(node.ref_count(), 1u);
+
+        auto created = create_refcounted<Node>(2).release_nonnull();
+        TEST_EQUAL(created->value, 2);
+
+        RefPtr<DerivedNode> derived(new DerivedNode(4));
+        RefPtr<Node> base = derived;
+        TEST_EQUAL(base.ref_count(), 2u);
+        TEST_EQUAL(base->value, 4);
+    }
+    TEST_EQUAL(s_live, 0);
+
+    {
+        auto local = create_refcounted<LocalNode>().release_nonnull();
+        auto copy = local;
+        TEST_EQUAL(copy.ref_count(), 2u);
+        TEST_EQUAL(copy->value, 7);
+    }
+
+    // Counts stay exact when copies are made and dropped from several threads at once.
+    {
+        auto shared = create_refcounted<Tracked>(0).release_nonnull();
+        RefPtr<Node> node(new Node(0));
+        {
+            Optional<RefPtr<Thread>> threads[4];
+            for (auto& slot : threads)
+            {
+                auto thread = Thread::create(
+                    [shared, node]()
+                    {
+                        for (int i = 0; i < 20000; i++)
+                        {
+                            auto a = shared;
+                            auto b = node;
+                        }
+                    });
+                TEST(thread.has_value());
+                slot = thread.result();
+            }
+            for (auto& slot : threads)
+                [[maybe_unused]] auto exit = slot.value()->wait_for_thread_exit();
+        }
+
+        TEST_EQUAL(shared.ref_count(), 1u);
+        TEST_EQUAL(node.ref_count(), 1u);
+    }
+    TEST_EQUAL(s_live, 0);
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Statistics.h>
+#include <sched.h>
+
+int main()
+{
+    // No update is lost, whichever shards the threads land on.
+    {
+        ShardedCounter<u64> counter;
+        TEST(counter.shard_count() >= 1);
+        run_threads(4, [&](u64)
+            {
+                for (int i = 0; i < 100000; i++)
+                {
+                    counter.increment();
+                    if (i % 1024 == 0)
+                        sched_yield();
+                } });
+        TEST_EQUAL(counter.value(), 400000u);
+
+        counter.sub(1);
+        TEST_EQUAL(counter.value(), 399999u);
+        counter.reset();
+        TEST_EQUAL(counter.value(), 0u);
+
+        // More shards than CPUs, and a signed counter that goes below zero.
+        ShardedCounter<i64> balance(64);
+        balance.add(5);
+        balance.sub(12);
+        TEST_EQUAL(balance.value(), -7);
+    }
+
+    {
+        ShardedMax<i64> maximum;
+        ShardedMin<i64> minimum;
+        TEST_EQUAL(maximum.value(), NumericLimits<i64>::min());
+        TEST_EQUAL(minimum.value(), NumericLimits<i64>::max());
+        run_threads(4, [&](u64 t)
+            {
+                for (i64 i = 0; i < 10000; i++)
+                {
+                    maximum.record((i64)t * 10000 + i);
+                    minimum.record(-(i64)t * 10000 - i);
+                } });
+        TEST_EQUAL(maximum.value(), 39999);
+        TEST_EQUAL(minimum.value(), -39999);
+        maximum.reset();
+        TEST_EQUAL(maximum.value(), NumericLimits<i64>::min());
+    }
+
+    // Bucket bounds cover every value exactly once and stay within 1/16 of it.
+    {
+        TEST_EQUAL(Histogram::bucket_of(0), 0u);
+        TEST_EQUAL(Histogram::bucket_of(15), 15u);
+        TEST_EQUAL(Histogram::bucket_of(16), 16u);
+        TEST_EQUAL(Histogram::bucket_of(NumericLimits<u64>::max()), Histogram::bucket_count - 1);
+        TEST_EQUAL(Histogram::bucket_upper_bound(Histogram::bucket_count - 1), NumericLimits<u64>::max());
+        for (size_t bucket = 0; bucket + 1 < Histogram::bucket_count; bucket++)
+        {
+            auto lower = Histogram::bucket_lower_bound(bucket);
+            auto upper = Histogram::bucket_upper_bound(bucket);
+            TEST_EQUAL(Histogram::bucket_of(lower), bucket);
+            TEST_EQUAL(Histogram::bucket_of(upper), bucket);
+            TEST_EQUAL(Histogram::bucket_lower_bound(bucket + 1), upper + 1);
+            TEST(upper - lower <= lower / 16);
+        }
+    }
+
+    {
+        Histogram histogram;
+        TEST_EQUAL(histogram.percentile(50), 0u);
+        run_threads(4, [&](u64 t)
+            {
+                for (u64 value = 1 + t; value <= 10000; value += 4)
+                    histogram.record(value); });
+        TEST_EQUAL(histogram.count(), 10000u);
+        TEST_EQUAL(histogram.sum(), 10000u * 10001u / 2);
+        TEST(histogram.mean() > 5000.0 && histogram.mean() < 5001.0);
+
+        auto median = histogram.percentile(50);
+        TEST(median >= 5000 && median <= 5000 + 5000 / 16);
+        auto p99 = histogram.percentile(99);
+        TEST(p99 >= 9900 && p99 <= 9900 + 9900 / 16);
+        TEST_EQUAL(histogram.percentile(0), 1u);
+
+        histogram.record(7, 10);
+        TEST_EQUAL(histogram.count(), 10010u);
+        histogram.reset();
+        TEST_EQUAL(histogram.count(), 0u);
+        TEST_EQUAL(histogram.sum(), 0u);
+    }
+
+    return 0;
+}
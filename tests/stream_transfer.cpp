@@ -0,0 +1,248 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <FileStream.h>
+#include <MemoryStream.h>
+#include <NetworkStream.h>
+#include <Thread.h>
+
+static constexpr size_t source_size = 1 * MiB + 123;
+
+static Ipv4SocketAddress loopback(u16 port)
+{
+    return { HostToBigEndian((u32)0x7f000001), HostToBigEndian(port) };
+}
+
+static u8 pattern(size_t index)
+{
+    return (u8)(index * 7 + index / 251);
+}
+
+static bool matches_pattern(u8 const* data, size_t size, size_t first_index)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (data[i] != pattern(first_index + i))
+            return false;
+    }
+    return true;
+}
+
+struct Connection
+{
+    TCPSocket client;
+    TCPSocket server;
+};
+
+static Connection connect_pair(TCPListener& listener)
+{
+    auto client = TCPSocket::connect(loopback(listener.port().result()));
+    TEST(client.has_value());
+    auto server = listener.accept();
+    TEST(server.has_value());
+    return { std::move(client.result()), std::move(server.result()) };
+}
+
+// Reads size bytes from socket on another thread while the caller sends, loopback buffers can't hold them all.
+template<typename TSend>
+static void receive_while(TCPSocket& socket, u8* out, size_t size, TSend&& send)
+{
+    Atomic<size_t> received { 0 };
+    auto thread = Thread::create([&]
+        {
+            size_t got = 0;
+            while (got < size)
+            {
+                Span<u8> rest(out + got, size - got);
+                auto result = socket.receive(rest);
+                if (result.has_error() || result.result() == 0)
+                    break;
+                got += result.result();
+            }
+            received.store(got, neo::Release); });
+    TEST(thread.has_value());
+    send();
+    TEST_FALSE(thread.result()->wait_for_thread_exit().has_error());
+    TEST_EQUAL(received.load(neo::Acquire), size);
+}
+
+int main()
+{
+    static u8 source[source_size];
+    for (size_t i = 0; i < source_size; i++)
+        source[i] = pattern(i);
+    {
+        auto file = File::open("/tmp/neo_transfer_source.bin", "w");
+        TEST(file.has_value());
+        auto written = file.result().write(Span<u8>(source, source_size), source_size);
+        TEST(written.has_value());
+    }
+
+    static u8 received[source_size];
+
+    // File to file. The source was partly read through stdio and the destination partly written, the native copy
+    // has to start where each stream logically is.
+    {
+        auto from = FileStream::create("/tmp/neo_transfer_source.bin", "r");
+        TEST(from.has_value());
+        u8 head[100] {};
+        Span<u8> head_span(head, sizeof(head));
+        TEST_EQUAL(from.result().read(head_span), 100u);
+
+        auto to = FileStream::create("/tmp/neo_transfer_copy.bin", "w+");
+        TEST(to.has_value());
+        to.result().write(Span<u8>(head, 10));
+
+        auto moved = from.result().transfer_to(to.result());
+        TEST(moved.has_value());
+        TEST_EQUAL(moved.result(), source_size - 100);
+
+        to.result().write(Span<u8>(head, 10));
+        TEST_FALSE(to.result().seek(0).has_value());
+        Span<u8> copy(received, source_size);
+        TEST_EQUAL(to.result().read(copy), source_size - 80);
+        TEST(matches_pattern(received, 10, 0));
+        TEST(matches_pattern(received + 10, source_size - 100, 100));
+        TEST(matches_pattern(received + source_size - 90, 10, 0));
+
+        Span<u8> rest(head, sizeof(head));
+        TEST_EQUAL(from.result().read(rest), 0u);
+    }
+
+    // tmpfs to the disk: copy_file_range refuses to cross filesystems, and whatever replaces it must leave the
+    // destination's position exactly after the copied bytes, not advanced twice.
+    {
+        {
+            auto file = File::open("/dev/shm/neo_transfer_source.bin", "w");
+            TEST(file.has_value());
+            TEST(file.result().write(Span<u8>(source, 1000), 1000).has_value());
+        }
+        auto from = FileStream::create("/dev/shm/neo_transfer_source.bin", "r");
+        TEST(from.has_value());
+        auto to = FileStream::create("/tmp/neo_transfer_copy.bin", "w+");
+        TEST(to.has_value());
+        u8 tail[3] { 1, 2, 3 };
+        to.result().write(Span<u8>(tail, 3));
+
+        auto moved = from.result().transfer_to(to.result());
+        TEST(moved.has_value());
+        TEST_EQUAL(moved.result(), 1000u);
+        TEST_EQUAL(to.result().pos().result(), 1003);
+        to.result().write(Span<u8>(tail, 3));
+        TEST_EQUAL(to.result().pos().result(), 1006);
+
+        TEST_FALSE(to.result().seek(0).has_value());
+        Span<u8> copy(received, source_size);
+        TEST_EQUAL(to.result().read(copy), 1006u);
+        TEST(matches_pattern(received + 3, 1000, 0));
+        TEST_EQUAL(received[1003], 1);
+        TEST_EQUAL(received[1005], 3);
+        unlink("/dev/shm/neo_transfer_source.bin");
+    }
+
+    auto maybe_listener = TCPListener::listen(loopback(0), SocketMode::Blocking);
+    TEST(maybe_listener.has_value());
+    auto& listener = maybe_listener.result();
+
+    // send_file() of a slice, leaving the file's position alone.
+    {
+        auto connection = connect_pair(listener);
+        NetworkStream stream(std::move(connection.server));
+        auto file = File::open("/tmp/neo_transfer_source.bin", "r");
+        TEST(file.has_value());
+        receive_while(connection.client, received, 200000, [&]
+            { TEST_EQUAL(stream.send_file(file.result(), 1000, 200000), 200000u); });
+        TEST_FALSE(stream.has_error());
+        TEST(matches_pattern(received, 200000, 1000));
+        TEST_EQUAL(file.result().getpos().result(), 0);
+
+        // Past the end only sends what is there.
+        receive_while(connection.client, received, 23, [&]
+            { TEST_EQUAL(stream.send_file(file.result(), source_size - 23, 1000), 23u); });
+        TEST(matches_pattern(received, 23, source_size - 23));
+    }
+
+    // File to socket goes through sendfile.
+    {
+        auto connection = connect_pair(listener);
+        NetworkStream stream(std::move(connection.server));
+        auto from = FileStream::create("/tmp/neo_transfer_source.bin", "r");
+        TEST(from.has_value());
+        receive_while(connection.client, received, source_size, [&]
+            {
+                auto moved = from.result().transfer_to(stream);
+                TEST(moved.has_value());
+                TEST_EQUAL(moved.result(), source_size); });
+        TEST(matches_pattern(received, source_size, 0));
+    }
+
+    // Socket to file splices through a pipe until the peer closes.
+    {
+        auto connection = connect_pair(listener);
+        NetworkStream stream(std::move(connection.server));
+        auto to = FileStream::create("/tmp/neo_transfer_copy.bin", "w+");
+        TEST(to.has_value());
+
+        auto thread = Thread::create([&]
+            {
+                TEST_FALSE(connection.client.send(Span<u8>(source, 300000)).has_value());
+                TEST_FALSE(connection.client.close().has_value()); });
+        TEST(thread.has_value());
+        auto moved = stream.transfer_to(to.result());
+        TEST_FALSE(thread.result()->wait_for_thread_exit().has_error());
+        TEST(moved.has_value());
+        TEST_EQUAL(moved.result(), 300000u);
+
+        TEST_FALSE(to.result().seek(0).has_value());
+        Span<u8> copy(received, source_size);
+        TEST_EQUAL(to.result().read(copy), 300000u);
+        TEST(matches_pattern(received, 300000, 0));
+    }
+
+    // Large writes with MSG_ZEROCOPY, the buffer is reusable once write() returns.
+    {
+        auto connection = connect_pair(listener);
+        NetworkStream stream(std::move(connection.server));
+        auto error = stream.enable_zero_copy(64 * KiB);
+        if (!error.has_value())
+        {
+            receive_while(connection.client, received, source_size, [&]
+                { stream.write(Span<u8>(source, source_size)); });
+            TEST_FALSE(stream.has_error());
+            TEST(matches_pattern(received, source_size, 0));
+        }
+    }
+
+    // Streams without a descriptor fall back to read() and write(), in chunks smaller than the data.
+    {
+        MemoryStream from(0);
+        from.write(Span<u8>(source, 200000));
+        MemoryStream to(0);
+        auto moved = from.transfer_to(to, 150000);
+        TEST(moved.has_value());
+        TEST_EQUAL(moved.result(), 150000u);
+        TEST_EQUAL(to.size(), 150000u);
+        Span<u8> copy(received, 150000);
+        to.copy_to(copy);
+        TEST(matches_pattern(received, 150000, 0));
+        TEST_EQUAL(from.unread_bytes(), 50000u);
+    }
+
+    [[maybe_unused]] auto remove_source = File::remove("/tmp/neo_transfer_source.bin");
+    [[maybe_unused]] auto remove_copy = File::remove("/tmp/neo_transfer_copy.bin");
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Mutex.h>
+#include <Synchronization.h>
+
+// A bounded queue of ints between producers and consumers, guarded by any lock type.
+template<typename TMutex>
+static void condition_variable_queue()
+{
+    static constexpr int capacity = 4;
+    static constexpr int per_producer = 5000;
+    TMutex mutex;
+    ConditionVariable not_empty;
+    ConditionVariable not_full;
+    int items[capacity];
+    int head = 0;
+    int size = 0;
+    long total = 0;
+
+    run_threads(4, [&](size_t t)
+        {
+            for (int i = 1; i <= per_producer; i++)
+            {
+                ScopedLock lock(mutex);
+                if (t < 2)
+                {
+                    not_full.wait(mutex, [&] { return size < capacity; });
+                    items[(head + size++) % capacity] = i;
+                    not_empty.notify_one();
+                }
+                else
+                {
+                    not_empty.wait(mutex, [&] { return size > 0; });
+                    total += items[head];
+                    head = (head + 1) % capacity;
+                    size--;
+                    not_full.notify_one();
+                }
+            } });
+    TEST_EQUAL(size, 0);
+    TEST_EQUAL(total, 2L * per_producer * (per_producer + 1) / 2);
+}
+
+int main()
+{
+    condition_variable_queue<Mutex>();
+    condition_variable_queue<SpinlockMutex>();
+    condition_variable_queue<TicketLock>();
+
+    {
+        Mutex mutex;
+        ConditionVariable condition;
+        ScopedLock lock(mutex);
+        TEST_FALSE(condition.wait_for(mutex, Time(0, 1000 * 1000)));
+        TEST_FALSE(condition.wait_for(mutex, Time(0, 1000 * 1000), [] { return false; }));
+        TEST(condition.wait_for(mutex, Time(0, 1000 * 1000), [] { return true; }));
+    }
+
+    // A semaphore bounds how many threads are inside at once.
+    {
+        Semaphore slots(2);
+        Atomic<u32> inside { 0 };
+        Atomic<u32> most { 0 };
+        run_threads(6, [&](size_t)
+            {
+                for (int i = 0; i < 2000; i++)
+                {
+                    slots.acquire();
+                    auto now = inside.add_fetch(1, neo::AcquireRelease);
+                    auto seen = most.load(neo::Relaxed);
+                    while (now > seen && !most.compare_exchange_weak(seen, now, neo::Relaxed, neo::Relaxed))
+                        ;
+                    if (i % 64 == 0)
+                        sched_yield();
+                    inside.sub_fetch(1, neo::AcquireRelease);
+                    slots.release();
+                } });
+        TEST(most.load(neo::Relaxed) <= 2u);
+        TEST_EQUAL(slots.value(), 2u);
+
+        Semaphore empty;
+        TEST_FALSE(empty.try_acquire());
+        TEST_FALSE(empty.try_acquire_for(Time(0, 1000 * 1000)));
+        empty.release(3);
+        TEST(empty.try_acquire_for(Time(0, 1000 * 1000)));
+        TEST_EQUAL(empty.value(), 2u);
+    }
+
+    {
+        Latch latch(3);
+        TEST_FALSE(latch.try_wait());
+        TEST_FALSE(latch.wait_for(Time(0, 1000 * 1000)));
+        Atomic<u32> arrived { 0 };
+        run_threads(3, [&](size_t)
+            {
+                arrived.add_fetch(1, neo::AcquireRelease);
+                latch.arrive_and_wait();
+                // Nobody gets past the latch before everyone reached it.
+                TEST_EQUAL(arrived.load(neo::Acquire), 3u); });
+        TEST(latch.try_wait());
+        TEST(latch.wait_for(Time(0, 0)));
+    }
+
+    // A manual reset event releases every waiter and stays set.
+    {
+        ManualResetEvent event;
+        TEST_FALSE(event.is_set());
+        TEST_FALSE(event.wait_for(Time(0, 1000 * 1000)));
+        Atomic<u32> released { 0 };
+        run_threads(5, [&](size_t t)
+            {
+                if (t == 0)
+                {
+                    sched_yield();
+                    event.set();
+                    return;
+                }
+                event.wait();
+                released.add_fetch(1, neo::Relaxed); });
+        TEST_EQUAL(released.load(neo::Relaxed), 4u);
+        TEST(event.is_set());
+        event.wait();
+        event.reset();
+        TEST_FALSE(event.is_set());
+    }
+
+    // An auto reset event lets exactly one waiter through per set.
+    {
+        AutoResetEvent event;
+        TEST_FALSE(event.try_wait());
+        event.set();
+        event.set();
+        TEST(event.try_wait());
+        TEST_FALSE(event.try_wait());
+        TEST_FALSE(event.wait_for(Time(0, 1000 * 1000)));
+
+        AutoResetEvent done;
+        Atomic<u32> passed { 0 };
+        run_threads(4, [&](size_t t)
+            {
+                if (t == 0)
+                {
+                    for (int i = 0; i < 3; i++)
+                    {
+                        event.set();
+                        done.wait();
+                    }
+                    return;
+                }
+                event.wait();
+                passed.add_fetch(1, neo::Relaxed);
+                done.set(); });
+        TEST_EQUAL(passed.load(neo::Relaxed), 3u);
+        TEST_FALSE(event.try_wait());
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <SystemInfo.h>
+
+static void cpu_lists()
+{
+    auto set = neo::detail::parse_cpu_list("0-3,8,10-11\n");
+    TEST_EQUAL(set.count(), 7u);
+    TEST(set.contains(0));
+    TEST(set.contains(3));
+    TEST(!set.contains(4));
+    TEST(set.contains(8));
+    TEST(!set.contains(9));
+    TEST(set.contains(11));
+    TEST_EQUAL(set.nth(4), 8u);
+    TEST_EQUAL(set.nth(7), CpuSet::max_cpus);
+    TEST(neo::detail::parse_cpu_list("").is_empty());
+}
+
+static void meminfo()
+{
+    char const* text = "MemTotal:       16000000 kB\nHugePages_Total:       4\nHugepagesize:       2048 kB\n";
+    TEST_EQUAL(neo::detail::meminfo_value(text, "HugePages_Total").value(), 4u);
+    TEST_EQUAL(neo::detail::meminfo_value(text, "Hugepagesize").value(), 2048u * 1024);
+    TEST(!neo::detail::meminfo_value(text, "Hugepages").has_value());
+}
+
+// Unknown packages and cores read as -1 in sysfs.
+static void topology_ids()
+{
+    auto write = [](char const* text)
+    {
+        auto* file = fopen("/tmp/neo_topology_id", "w");
+        TEST(file != nullptr);
+        fputs(text, file);
+        fclose(file);
+    };
+    write("-1\n");
+    TEST(!neo::detail::read_topology_id("/tmp/neo_topology_id").has_value());
+    write("3\n");
+    TEST_EQUAL(neo::detail::read_topology_id("/tmp/neo_topology_id").value(), 3u);
+    remove("/tmp/neo_topology_id");
+    TEST(!neo::detail::read_topology_id("/tmp/neo_topology_id").has_value());
+}
+
+static void topology()
+{
+    auto const& topology = CpuTopology::get();
+    TEST(topology.cpus().size() > 0);
+    TEST(topology.socket_count() >= 1);
+    TEST(topology.core_count() >= topology.socket_count());
+    TEST(topology.core_count() <= topology.cpus().size());
+    TEST(topology.numa_node_count() >= 1);
+
+    u32 in_nodes = 0;
+    for (u32 node = 0; node < CpuSet::max_cpus; node++)
+        in_nodes += topology.numa_node_cpus(node).count();
+    TEST_EQUAL(in_nodes, (u32)topology.cpus().size());
+
+    for (auto const& cpu : topology.cpus())
+    {
+        auto siblings = topology.smt_siblings(cpu.id);
+        TEST(siblings.contains(cpu.id));
+        TEST(topology.cpu(cpu.id).has_value());
+    }
+
+    // The spread order is a permutation of the allowed CPUs with every core before any second sibling.
+    auto allowed = CpuSet::allowed();
+    auto order = topology.spread_order(allowed);
+    CpuSet seen;
+    for (auto cpu : order)
+    {
+        TEST(allowed.contains(cpu));
+        TEST(!seen.contains(cpu));
+        seen.add(cpu);
+    }
+    TEST_EQUAL(seen.count(), allowed.count());
+    if (topology.core_count() == topology.cpus().size())
+        TEST_EQUAL((u32)order.size(), allowed.count());
+
+    for (auto const& cache : topology.caches())
+    {
+        TEST(cache.level >= 1);
+        TEST(cache.size > 0);
+    }
+    if (topology.caches().size() > 0)
+    {
+        TEST(neo::l1_cache_line_size() > 0);
+        TEST(neo::l1_data_cache_size() > 0);
+        auto l1 = topology.cache(topology.cpus()[0].id, 1, CacheType::Data);
+        TEST(l1.has_value());
+        TEST_EQUAL(l1.value().size, neo::l1_data_cache_size());
+    }
+
+    auto const& huge_pages = topology.huge_pages();
+    TEST(huge_pages.free <= huge_pages.total);
+}
+
+int main()
+{
+    cpu_lists();
+    meminfo();
+    topology_ids();
+    topology();
+    return 0;
+}
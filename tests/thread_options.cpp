@@ -0,0 +1,150 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Atomic.h>
+#include <Thread.h>
+#include <ThreadPool.h>
+#include <sys/resource.h>
+
+template<typename TFunc>
+static void run(ThreadOptions const& options, TFunc&& body)
+{
+    auto thread = Thread::create(forward<TFunc>(body), options);
+    TEST(thread.has_value());
+    [[maybe_unused]] auto exit = thread.result()->wait_for_thread_exit();
+}
+
+static void name_is_set_before_the_function_runs()
+{
+    Atomic<bool> named { false };
+    run(ThreadOptions().name("neo-named"), [&]
+        {
+            auto name = Thread::current().name();
+            named.store(name.has_value() && name.result() == "neo-named", neo::Relaxed); });
+    TEST(named.load(neo::Relaxed));
+}
+
+static void stack_and_guard_size()
+{
+    static constexpr size_t stack_size = 4 * 1024 * 1024;
+    Atomic<size_t> actual_stack { 0 };
+    Atomic<size_t> actual_guard { 1 };
+    run(ThreadOptions().stack_size(stack_size).guard_size(0), [&]
+        {
+            pthread_attr_t attributes;
+            ENSURE(pthread_getattr_np(pthread_self(), &attributes) == 0);
+            size_t size = 0;
+            pthread_attr_getstacksize(&attributes, &size);
+            actual_stack.store(size, neo::Relaxed);
+            pthread_attr_getguardsize(&attributes, &size);
+            actual_guard.store(size, neo::Relaxed);
+            pthread_attr_destroy(&attributes); });
+    TEST(actual_stack.load(neo::Relaxed) >= stack_size);
+    TEST_EQUAL(actual_guard.load(neo::Relaxed), 0u);
+
+    auto too_small = Thread::create([] {}, ThreadOptions().stack_size(1));
+    TEST(too_small.has_error());
+    TEST(too_small.error() == OSError::InvalidArgument);
+}
+
+static void affinity()
+{
+    auto cpu = CpuSet::allowed().nth(0);
+    Atomic<u32> allowed_count { 0 };
+    Atomic<int> running_on { -1 };
+    run(ThreadOptions().pin_to_cpu(cpu), [&]
+        {
+            auto cpus = Thread::current().affinity();
+            ENSURE(cpus.has_value());
+            allowed_count.store(cpus.result().count(), neo::Relaxed);
+            running_on.store(Thread::current().cpu(), neo::Relaxed); });
+    TEST_EQUAL(allowed_count.load(neo::Relaxed), 1u);
+    TEST_EQUAL(running_on.load(neo::Relaxed), (int)cpu);
+}
+
+static void nice()
+{
+    Atomic<int> nice { 0 };
+    run(ThreadOptions().nice(5), [&]
+        { nice.store(getpriority(PRIO_PROCESS, (id_t)gettid()), neo::Relaxed); });
+    TEST_EQUAL(nice.load(neo::Relaxed), 5);
+}
+
+static void real_time_policy()
+{
+    Atomic<int> policy { -1 };
+    auto thread = Thread::create([&]
+        { policy.store(sched_getscheduler(0), neo::Relaxed); },
+        ThreadOptions().policy(SchedulingPolicy::Fifo, 1));
+    // Without CAP_SYS_NICE the thread is refused rather than started with the wrong policy.
+    if (thread.has_error())
+    {
+        TEST(thread.error() == OSError::OperationNotPermitted);
+        return;
+    }
+    [[maybe_unused]] auto exit = thread.result()->wait_for_thread_exit();
+    TEST_EQUAL(policy.load(neo::Relaxed), SCHED_FIFO);
+}
+
+static void current_thread()
+{
+    auto current = Thread::current();
+    TEST_EQUAL(current.id(), gettid());
+    TEST(!current.set_name("neo-main").has_value());
+    auto name = current.name();
+    TEST(name.has_value());
+    TEST(name.result() == "neo-main");
+
+    auto original = current.affinity();
+    TEST(original.has_value());
+    auto cpu = original.result().nth(0);
+    TEST(!current.pin_to_cpu(cpu).has_value());
+    TEST_EQUAL(current.cpu(), (int)cpu);
+    TEST(!current.set_affinity(original.result()).has_value());
+    TEST_EQUAL(current.affinity().result().count(), original.result().count());
+}
+
+static void pinned_pool()
+{
+    auto cpus = CpuTopology::get().spread_order();
+    ThreadPool pool(ThreadPoolOptions { .worker_count = 2, .pin_workers = true });
+    Atomic<u32> wrong { 0 };
+    for (size_t worker = 0; worker < 2; worker++)
+    {
+        pool.execute([&]
+            {
+                auto index = pool.current_worker_index();
+                auto affinity = Thread::current().affinity().result();
+                if (affinity.count() != 1 || !affinity.contains(cpus[index % cpus.size()]))
+                    wrong.add_fetch(1, neo::Relaxed); },
+            worker);
+    }
+    pool.drain();
+    TEST_EQUAL(wrong.load(neo::Relaxed), 0u);
+}
+
+int main()
+{
+    name_is_set_before_the_function_runs();
+    stack_and_guard_size();
+    affinity();
+    nice();
+    real_time_policy();
+    current_thread();
+    pinned_pool();
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <ThreadPool.h>
+
+int main()
+{
+    ThreadPool pool(4);
+    TEST_EQUAL(pool.worker_count(), 4);
+    TEST_EQUAL(pool.current_worker_index(), ThreadPool::AnyWorker);
+
+    auto answer = pool.submit([]()
+        { return 42; });
+    TEST_EQUAL(answer.value(), 42);
+
+    Atomic<u32> counter { 0 };
+    for (size_t i = 0; i < 10000; i++)
+        pool.execute([&]()
+            { counter.add_fetch(1, neo::Relaxed); });
+    pool.drain();
+    TEST_EQUAL(counter.load(neo::Acquire), 10000);
+
+    // Tasks spawned from workers land in their own deque and are stolen by the rest.
+    counter.store(0, neo::Release);
+    for (size_t i = 0; i < 16; i++)
+        pool.execute([&]()
+            {
+                for (size_t j = 0; j < 1000; j++)
+                    pool.execute([&]()
+                        { counter.add_fetch(1, neo::Relaxed); }); });
+    pool.drain();
+    TEST_EQUAL(counter.load(neo::Acquire), 16000);
+
+    Atomic<u32> wrong_worker { 0 };
+    for (size_t i = 0; i < 100; i++)
+        pool.execute([&]()
+            {
+                if (pool.current_worker_index() >= pool.worker_count())
+                    wrong_worker.add_fetch(1, neo::Relaxed); },
+            i);
+    pool.drain();
+    TEST_EQUAL(wrong_worker.load(neo::Acquire), 0);
+
+    counter.store(0, neo::Release);
+    for (size_t i = 0; i < 100; i++)
+        pool.execute([&]()
+            { counter.add_fetch(1, neo::Relaxed); });
+    pool.shutdown();
+    TEST(pool.is_shut_down());
+    TEST_EQUAL(counter.load(neo::Acquire), 100);
+
+    // A worker that can't start is reported by create(), and the plain constructor runs tasks inline instead.
+    TEST(ThreadPool::create({ .worker_count = 2, .stack_size = 1 }).has_error());
+    auto created = ThreadPool::create({ .worker_count = 2 });
+    TEST_FALSE(created.has_error());
+    TEST_EQUAL(created.result()->submit([]()
+                                  { return 7; })
+                   .value(),
+        7);
+
+    ThreadPool inline_pool({ .worker_count = 2, .stack_size = 1 });
+    TEST_EQUAL(inline_pool.worker_count(), 0);
+    counter.store(0, neo::Release);
+    for (size_t i = 0; i < 10; i++)
+        inline_pool.execute([&]()
+            { counter.add_fetch(1, neo::Relaxed); },
+            i);
+    TEST_EQUAL(counter.load(neo::Acquire), 10);
+    TEST_EQUAL(inline_pool.submit([]()
+                              { return 42; })
+                   .value(),
+        42);
+    inline_pool.drain();
+    return 0;
+}
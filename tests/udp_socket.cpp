@@ -0,0 +1,140 @@
+/*
+    Copyright (C) 2022  Iori Torres (shortanemoia@protonmail.com)
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+#include <Socket.h>
+#include <Vector.h>
+
+static constexpr size_t datagram_count = 100;
+static constexpr size_t datagram_size = 100;
+
+static Ipv4SocketAddress loopback(u16 port)
+{
+    return { HostToBigEndian((u32)0x7f000001), HostToBigEndian(port) };
+}
+
+static UDPSocket bound_socket()
+{
+    auto socket_or_error = UDPSocket::create(true);
+    TEST(socket_or_error.has_value());
+    auto socket = std::move(socket_or_error.result());
+    TEST_FALSE(socket.bind(loopback(0)).has_value());
+    return socket;
+}
+
+static u16 port_of(UDPSocket const& socket)
+{
+    auto port = socket.port();
+    TEST(port.has_value());
+    return port.result();
+}
+
+// Datagram i is datagram_size bytes of the value i.
+static void fill_datagrams(u8* storage, Vector<Span<u8>>& datagrams)
+{
+    for (size_t i = 0; i < datagram_count; i++)
+    {
+        __builtin_memset(storage + i * datagram_size, (int)i, datagram_size);
+        datagrams.append(Span<u8>(storage + i * datagram_size, datagram_size));
+    }
+}
+
+// Receives until total_bytes arrived, checking every datagram against fill_datagrams(). Accepts coalesced buffers.
+static void receive_all(UDPSocket& receiver, size_t total_bytes)
+{
+    static u8 storage[16][64 * 1024];
+    Vector<Span<u8>> buffers;
+    for (size_t i = 0; i < 16; i++)
+        buffers.append(Span<u8>(storage[i], sizeof(storage[i])));
+    Vector<ReceivedDatagram> received;
+    for (size_t i = 0; i < 16; i++)
+        received.append({ 0, 0 });
+
+    size_t next_datagram = 0;
+    size_t received_bytes = 0;
+    while (received_bytes < total_bytes)
+    {
+        auto count = receiver.receive_batch(buffers.span(), received.span());
+        TEST(count.has_value());
+        TEST(count.result() > 0);
+        for (size_t i = 0; i < count.result(); i++)
+        {
+            TEST(received[i].segment_size > 0);
+            for (size_t offset = 0; offset < received[i].size; offset += received[i].segment_size)
+            {
+                auto size = min(received[i].segment_size, received[i].size - offset);
+                TEST_EQUAL(size, datagram_size);
+                TEST_EQUAL(storage[i][offset], (u8)next_datagram);
+                TEST_EQUAL(storage[i][offset + size - 1], (u8)next_datagram);
+                next_datagram++;
+            }
+            received_bytes += received[i].size;
+        }
+    }
+    TEST_EQUAL(received_bytes, total_bytes);
+    TEST_EQUAL(next_datagram, total_bytes / datagram_size);
+}
+
+int main()
+{
+    auto receiver = bound_socket();
+    auto sender = bound_socket();
+    auto address = loopback(port_of(receiver));
+    TEST_FALSE(receiver.set_receive_buffer_size(4 * 1024 * 1024).has_value());
+
+    static u8 storage[datagram_count * datagram_size];
+    Vector<Span<u8>> datagrams;
+    fill_datagrams(storage, datagrams);
+
+    // One datagram per send, which also checks sendto gets a well formed address.
+    TEST_FALSE(sender.send(address, datagrams[0]).has_value());
+    u8 single[datagram_size] {};
+    Span<u8> single_span(single, sizeof(single));
+    auto size = receiver.receive(single_span);
+    TEST(size.has_value());
+    TEST_EQUAL(size.result(), datagram_size);
+    TEST_EQUAL(single[0], 0);
+
+    // More datagrams than fit in one sendmmsg.
+    auto sent = sender.send_batch(address, datagrams.span());
+    TEST(sent.has_value());
+    TEST_EQUAL(sent.result(), datagram_count);
+    receive_all(receiver, datagram_count * datagram_size);
+
+    // The receiver sees separate datagrams whether or not the kernel segmented them for the sender.
+    TEST_FALSE(sender.send_segmented(address, Span<u8>(storage, 40 * datagram_size), datagram_size).has_value());
+    receive_all(receiver, 40 * datagram_size);
+
+    // With coalescing on the same datagrams may arrive merged, each buffer reporting its segment size.
+    if (!receiver.set_receive_coalescing(true).has_value())
+    {
+        TEST_FALSE(sender.send_segmented(address, Span<u8>(storage, 40 * datagram_size), datagram_size).has_value());
+        receive_all(receiver, 40 * datagram_size);
+        TEST_FALSE(sender.send_batch(address, datagrams.span()).has_error());
+        receive_all(receiver, datagram_count * datagram_size);
+    }
+
+    // Non-blocking receive on an empty socket.
+    TEST_FALSE(receiver.set_mode(SocketMode::NonBlocking).has_value());
+    auto nothing = receiver.receive(single_span);
+    TEST(nothing.has_error());
+    TEST(nothing.error() == EAGAIN || nothing.error() == EWOULDBLOCK);
+
+    auto closed = sender.close();
+    TEST_FALSE(closed.has_value());
+    TEST_FALSE(sender.is_open());
+    return 0;
+}